@@ -73,6 +73,7 @@ EDITIONS=(
   YANEURAOU_ENGINE_NNUE_KP256
   YANEURAOU_ENGINE_DEEP_ORT_CPU
   YANEURAOU_ENGINE_DEEP_TENSOR_RT
+  YANEURAOU_ENGINE_DEEP_CPU
   YANEURAOU_ENGINE_KPPT
   YANEURAOU_ENGINE_KPP_KKPT
   YANEURAOU_ENGINE_MATERIAL
@@ -104,6 +105,7 @@ EDITIONSTR=(
   ["YANEURAOU_ENGINE_NNUE_KP256"]="YANEURAOU_ENGINE_NNUE_KP256"
   ["YANEURAOU_ENGINE_DEEP_ORT_CPU"]="YANEURAOU_ENGINE_DEEP_ORT_CPU"
   ["YANEURAOU_ENGINE_DEEP_TENSOR_RT"]="YANEURAOU_ENGINE_DEEP_TENSOR_RT"
+  ["YANEURAOU_ENGINE_DEEP_CPU"]="YANEURAOU_ENGINE_DEEP_CPU"
   ["YANEURAOU_ENGINE_KPPT"]="YANEURAOU_ENGINE_KPPT"
   ["YANEURAOU_ENGINE_KPP_KKPT"]="YANEURAOU_ENGINE_KPP_KKPT"
   ["YANEURAOU_ENGINE_MATERIAL"]="YANEURAOU_ENGINE_MATERIAL"
@@ -129,6 +131,7 @@ DIRSTR=(
   ["YANEURAOU_ENGINE_NNUE_KP256"]="NNUE_KP256"
   ["YANEURAOU_ENGINE_DEEP_ORT_CPU"]="DEEP_ORT_CPU"
   ["YANEURAOU_ENGINE_DEEP_TENSOR_RT"]="DEEP_TRT"
+  ["YANEURAOU_ENGINE_DEEP_CPU"]="DEEP_CPU"
   ["YANEURAOU_ENGINE_KPPT"]="KPPT"
   ["YANEURAOU_ENGINE_KPP_KKPT"]="KPP_KKPT"
   ["YANEURAOU_ENGINE_MATERIAL"]="MaterialLv1"
@@ -154,6 +157,7 @@ FILESTR=(
   ["YANEURAOU_ENGINE_NNUE_KP256"]="YaneuraOu_NNUE_KP256"
   ["YANEURAOU_ENGINE_DEEP_ORT_CPU"]="YaneuraOu_Deep_ORT_CPU"
   ["YANEURAOU_ENGINE_DEEP_TENSOR_RT"]="YaneuraOu_Deep_TRT"
+  ["YANEURAOU_ENGINE_DEEP_CPU"]="YaneuraOu_Deep_CPU"
   ["YANEURAOU_ENGINE_KPPT"]="YaneuraOu_KPPT"
   ["YANEURAOU_ENGINE_KPP_KKPT"]="YaneuraOu_KPP_KKPT"
   ["YANEURAOU_ENGINE_MATERIAL"]="YaneuraOu_MaterialLv1"
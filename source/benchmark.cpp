@@ -1,6 +1,8 @@
 ﻿#include "benchmark.h"
 #include "numa.h"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 
@@ -65,6 +67,27 @@ namespace YaneuraOu::Benchmark {
 			bench 64 1 15 default depth
 
 		のように指定する必要がある。
+
+	📓 制限の種類に"tt_latency"を指定すると、局面の探索は行わず、置換表について
+		NUMAノード間のアクセスのlatencyを計測する。制限値は各計測でのアクセス回数。
+
+			bench 4096 64 10000000 default tt_latency
+
+	📓 制限の種類に"mcts"を指定すると、ふかうら王(deep)で、制限値をnodesとして各局面を探索し、
+		探索部(木の降下、展開、backup)のplayouts/s、batchの充填率、SelectMaxUcbChild()の時間、
+		mutexの競合などを集計して出力する。スレッド数はUCT_Threadsとして設定される。
+		DNN_Modelに"mock:1000"のように指定すると、推論に1000[us]かかる擬似的なNNを用いるので、
+		GPUなしで探索部だけの性能を計測できる。
+
+			setoption name DNN_Model value mock:1000
+			bench 0 4 20000 default mcts
+
+	📓 "bench json"とすると、"bench"と同じ引数の後ろに繰り返し回数(省略時5回)を指定でき、
+		全局面の探索をその回数だけ繰り返して、局面ごとのnodes、NPS、深さごとの到達時間、
+		hashfull、seldepth、各段階の時間と、繰り返しを通したNPSの平均と95%信頼区間をJSONで出力する。
+		CIでbinary間のNPSを比較する用途を想定しているので、depthかnodesで制限するのが良い。
+
+			bench json 1024 1 16 default depth 10
 */
 
 std::vector<std::string> setup_bench(const std::string& currentFen, std::istream& is) {
@@ -88,7 +111,9 @@ std::vector<std::string> setup_bench(const std::string& currentFen, std::istream
     std::string limitType = (is >> token) ? token : "movetime";
 #endif
 
-	go = limitType == "eval" ? "eval" : "go " + limitType + " " + limit;
+	go = limitType == "eval" ? "eval"
+	   : limitType == "mcts" ? "go nodes " + limit
+	                         : "go " + limitType + " " + limit;
 
 	if (fenFile == "default")
 		fens = Defaults;
@@ -123,6 +148,22 @@ std::vector<std::string> setup_bench(const std::string& currentFen, std::istream
 	// 🤔 どうせ内部的にしか使わない符号みたいなものなので"usinewgame"に変更しないことにする。
     list.emplace_back("ucinewgame");
 
+#if !STOCKFISH
+	// 置換表のlatencyの計測は局面に依存しないので1回だけ行う。
+	if (limitType == "tt_latency")
+	{
+		list.emplace_back("tt_latency " + limit);
+		return list;
+	}
+
+	// 探索部の計測は全局面を通して集計する。
+	if (limitType == "mcts")
+	{
+		list.emplace_back("setoption name UCT_Threads value " + threads);
+		list.emplace_back("mcts_bench start");
+	}
+#endif
+
 	for (const std::string& fen : fens)
 		if (fen.find("setoption") != std::string::npos)
 			list.emplace_back(fen);
@@ -136,6 +177,11 @@ std::vector<std::string> setup_bench(const std::string& currentFen, std::istream
 			list.emplace_back(go);
 		}
 
+#if !STOCKFISH
+	if (limitType == "mcts")
+		list.emplace_back("mcts_bench stop");
+#endif
+
 	return list;
 }
 
@@ -218,4 +264,74 @@ BenchmarkSetup setup_benchmark(std::istream& is) {
 	return setup;
 }
 
+// bench_scaling [maxThreads] [depth] [ttSize]
+// 例) bench_scaling 64 16 4096 : 1,2,4,...,64スレッドで、各局面を深さ16まで探索する。(TT = 4096MB)
+
+ScalingSetup setup_scaling(std::istream& is) {
+
+	ScalingSetup setup{};
+	size_t       maxThreads;
+
+	if (!(is >> maxThreads) || maxThreads == 0)
+		maxThreads = get_hardware_concurrency();
+
+	if (!(is >> setup.depth) || setup.depth <= 0)
+		setup.depth = 14;
+
+	if (!(is >> setup.ttSize) || setup.ttSize == 0)
+		setup.ttSize = 1024;
+
+	for (size_t t = 1; t < maxThreads; t *= 2)
+		setup.threads.push_back(t);
+	setup.threads.push_back(maxThreads);
+
+	// 💡 前の局面の探索結果が置換表に残っていると、スレッド数ごとに条件が変わってしまうので、
+	//     局面ごとに置換表をクリアする。
+	for (const auto& game : BenchmarkPositions)
+		for (const std::string& fen : game)
+		{
+			setup.commands.emplace_back("ucinewgame");
+			setup.commands.emplace_back("position sfen " + fen);
+			setup.commands.emplace_back("go depth " + std::to_string(setup.depth));
+		}
+
+	return setup;
+}
+
+SampleStats sample_stats(const std::vector<double>& samples) {
+
+	SampleStats st;
+	st.n = samples.size();
+	if (st.n == 0)
+		return st;
+
+	st.min = *std::min_element(samples.begin(), samples.end());
+	st.max = *std::max_element(samples.begin(), samples.end());
+
+	double sum = 0;
+	for (auto x : samples)
+		sum += x;
+	st.mean = sum / double(st.n);
+
+	if (st.n < 2)
+		return st;
+
+	double sq = 0;
+	for (auto x : samples)
+		sq += (x - st.mean) * (x - st.mean);
+	st.stddev = std::sqrt(sq / double(st.n - 1));
+
+	// 両側95%のt分布の値(自由度1～30)。それより大きい自由度では正規分布で近似する。
+	static constexpr double T95[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+	};
+	const size_t df = st.n - 1;
+	const double t  = df <= std::size(T95) ? T95[df - 1] : 1.960;
+	st.ci95 = t * st.stddev / std::sqrt(double(st.n));
+
+	return st;
+}
+
 } // namespace YaneuraOu
@@ -35,6 +35,39 @@ namespace YaneuraOu::Benchmark {
 	// benchコマンドのコマンドラインからBenchmarkSetupの構造体に情報を詰め込んで返す。
 	BenchmarkSetup setup_benchmark(std::istream& is);
 
+	// "bench_scaling"コマンドのセットアップの構造体
+	struct ScalingSetup {
+		// 置換表サイズ[MB]
+		size_t                   ttSize;
+
+		// 各局面を探索する深さ
+		int                      depth;
+
+		// 計測するスレッド数。1,2,4,...と2倍ずつ増やして、最後は指定された最大スレッド数。
+		std::vector<size_t>      threads;
+
+		// 1つのスレッド数で実行するコマンド列。局面ごとに置換表をクリアしてから固定深さで探索する。
+		std::vector<std::string> commands;
+	};
+
+	// "bench_scaling"コマンドのコマンドラインからScalingSetupの構造体に情報を詰め込んで返す。
+	// 局面はsetup_benchmark()と同じものを用いる。
+	ScalingSetup setup_scaling(std::istream& is);
+
+	// 繰り返し計測した値の統計量
+	// 📝 "bench json"で、2つのbinaryのNPSなどを信頼区間付きで比較するのに用いる。
+	struct SampleStats {
+		size_t n      = 0;
+		double mean   = 0;
+		double stddev = 0; // 標本標準偏差(不偏分散の平方根)
+		double ci95   = 0; // 平均の95%信頼区間の半幅(t分布による)
+		double min    = 0;
+		double max    = 0;
+	};
+
+	// samplesの統計量を求める。
+	SampleStats sample_stats(const std::vector<double>& samples);
+
 }  // namespace YaneuraOu
 
 #endif  // #ifndef BENCHMARK_H_INCLUDED
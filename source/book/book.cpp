@@ -15,6 +15,7 @@
 #include "../thread.h"
 #include "../usi.h"
 #include "../movegen.h"
+#include "../memory.h"
 
 namespace YaneuraOu {
 namespace Book
@@ -284,7 +285,21 @@ namespace Book
 		return bool(file) || data.empty();
 	}
 
-	static bool read_u16_le_from_memory(const std::vector<unsigned char>& data, uint64_t offset, uint16_t& value)
+	// メモリ上にある.ybbの内容。
+	// 💡 丸読みしたstd::vectorと、mmapしたファイルの両方をこれで扱う。
+	struct YbbBytes
+	{
+		const unsigned char* ptr = nullptr;
+		uint64_t             len = 0;
+
+		const unsigned char* data() const { return ptr; }
+		uint64_t             size() const { return len; }
+		unsigned char operator[](size_t i) const { return ptr[i]; }
+	};
+
+	static YbbBytes ybb_bytes(const std::vector<unsigned char>& data) { return YbbBytes{ data.data(), data.size() }; }
+
+	static bool read_u16_le_from_memory(const YbbBytes& data, uint64_t offset, uint16_t& value)
 	{
 		if (offset > data.size() || data.size() - offset < 2)
 			return false;
@@ -292,7 +307,7 @@ namespace Book
 		return true;
 	}
 
-	static bool read_u64_le_from_memory(const std::vector<unsigned char>& data, uint64_t offset, uint64_t& value)
+	static bool read_u64_le_from_memory(const YbbBytes& data, uint64_t offset, uint64_t& value)
 	{
 		if (offset > data.size() || data.size() - offset < 8)
 			return false;
@@ -354,7 +369,7 @@ namespace Book
 		return true;
 	}
 
-	static bool read_ybb_header_from_memory(const std::vector<unsigned char>& data, uint64_t& record_count, uint64_t& flags)
+	static bool read_ybb_header_from_memory(const YbbBytes& data, uint64_t& record_count, uint64_t& flags)
 	{
 		if (data.size() < YbbHeaderSize)
 			return false;
@@ -374,7 +389,7 @@ namespace Book
 		return true;
 	}
 
-	static bool read_ybb_index_entry_from_memory(const std::vector<unsigned char>& data, uint64_t record_index, YbbIndexEntry& entry)
+	static bool read_ybb_index_entry_from_memory(const YbbBytes& data, uint64_t record_index, YbbIndexEntry& entry)
 	{
 		if (record_index > (std::numeric_limits<uint64_t>::max() - YbbHeaderSize) / YbbIndexRecordSize)
 			return false;
@@ -431,7 +446,7 @@ namespace Book
 		return book_moves;
 	}
 
-	static BookMovesPtr read_ybb_moves_from_memory(const std::vector<unsigned char>& moves_data, const YbbIndexEntry& entry, uint64_t flags, uint64_t moves_base)
+	static BookMovesPtr read_ybb_moves_from_memory(const YbbBytes& moves_data, const YbbIndexEntry& entry, uint64_t flags, uint64_t moves_base)
 	{
 		if (moves_base > moves_data.size() || entry.moves_offset > moves_data.size() - moves_base)
 			return BookMovesPtr();
@@ -460,6 +475,13 @@ namespace Book
 		book_moves->sort_moves();
 		return book_moves;
 	}
+	void MemoryBook::unmap_ybb()
+	{
+		unmap_file(ybb_mapped_data, ybb_mapped_size);
+		ybb_mapped_data = nullptr;
+		ybb_mapped_size = 0;
+	}
+
 	void MemoryBook::set_options(OptionsMap& options)
 	{
 		this->options.set_ref(options);
@@ -505,6 +527,7 @@ namespace Book
 			ybb_index_fs.close();
 		if (ybb_moves_fs.is_open())
 			ybb_moves_fs.close();
+		unmap_ybb();
 		this->ignoreBookPly = ignore_book_ply_;
 
 		// フォルダ名を取り去ったものが"no_book"(定跡なし)もしくは"book.bin"(Aperyの定跡ファイル)であるかを判定する。
@@ -538,6 +561,35 @@ namespace Book
 			// ファイルだけオープンして読み込んだことにする。
 			if (on_the_fly_)
 			{
+				// .ybbはファイルをmmapできるなら、mapしたページ上で直接二分探索する。
+				// 📝 ページはアクセスされた時に読み込まれるので、巨大な定跡でもすぐに使い始められる。
+				//     また、同じ定跡を使う他のエンジンのプロセスとOSのpage cacheを共有できる。
+				//     mapに失敗した時は、従来通りfstreamでseekしながら読む。
+				if (ybb_book_file)
+				{
+					size_t size = 0;
+					if (const void* mem = map_file_read_only(actual_filename, size))
+					{
+						const YbbBytes data{ static_cast<const unsigned char*>(mem), size };
+						if (!read_ybb_header_from_memory(data, ybb_record_count, ybb_flags)
+							|| !ybb_index_size(ybb_record_count, ybb_moves_base))
+						{
+							unmap_file(mem, size);
+							sync_cout << "info string Error! : invalid ybb file : " << actual_filename << sync_endl;
+							return Tools::Result(Tools::ResultCode::FileReadError);
+						}
+
+						this->ybb_mapped_data = mem;
+						this->ybb_mapped_size = size;
+						this->ybb_book = true;
+						this->ybb_moves_name = actual_filename;
+						this->on_the_fly = true;
+						this->book_name = filename;
+						this->pure_book_name = actual_pure_filename;
+						return Tools::Result::Ok();
+					}
+				}
+
 				if (ybb_book_file)
 				{
 					ybb_index_fs.open(actual_filename, std::ios::in | std::ios::binary);
@@ -602,7 +654,7 @@ namespace Book
 
 				uint64_t record_count = 0;
 				uint64_t flags = 0;
-				if (!read_ybb_header_from_memory(ybb_index_data, record_count, flags))
+				if (!read_ybb_header_from_memory(ybb_bytes(ybb_index_data), record_count, flags))
 				{
 					sync_cout << "info string Error! : invalid ybb file : " << actual_filename << sync_endl;
 					return Tools::Result(Tools::ResultCode::FileReadError);
@@ -1043,6 +1095,9 @@ namespace Book
 
 	BookMovesPtr MemoryBook::find_ybb_bookmoves_on_the_fly(const PackedSfen& target, uint16_t game_ply)
 	{
+		if (ybb_book && ybb_mapped_data)
+			return find_ybb_bookmoves_in_memory(target, game_ply);
+
 		if (!ybb_book || !ybb_index_fs.is_open() || !ybb_moves_fs.is_open())
 			return BookMovesPtr();
 
@@ -1073,7 +1128,13 @@ namespace Book
 
 	BookMovesPtr MemoryBook::find_ybb_bookmoves_in_memory(const PackedSfen& target, uint16_t game_ply)
 	{
-		if (!ybb_memory_book)
+		// 丸読みしたbufferか、mmapしたファイル。
+		YbbBytes data;
+		if (ybb_memory_book)
+			data = ybb_bytes(ybb_index_data);
+		else if (ybb_book && ybb_mapped_data)
+			data = YbbBytes{ static_cast<const unsigned char*>(ybb_mapped_data), ybb_mapped_size };
+		else
 			return BookMovesPtr();
 
 		uint64_t left  = 0;
@@ -1082,7 +1143,7 @@ namespace Book
 		{
 			const uint64_t middle = left + (right - left) / 2;
 			YbbIndexEntry entry;
-			if (!read_ybb_index_entry_from_memory(ybb_index_data, middle, entry))
+			if (!read_ybb_index_entry_from_memory(data, middle, entry))
 				return BookMovesPtr();
 
 			const int compare = compare_packed_sfen(target, entry.packed_sfen);
@@ -1094,7 +1155,7 @@ namespace Book
 			{
 				if (!ignoreBookPly && entry.ply != game_ply)
 					return BookMovesPtr();
-				return read_ybb_moves_from_memory(ybb_index_data, entry, ybb_flags, ybb_moves_base);
+				return read_ybb_moves_from_memory(data, entry, ybb_flags, ybb_moves_base);
 			}
 		}
 
@@ -169,6 +169,8 @@ typedef std::unordered_map<std::string /* sfen */, BookMovesPtr > BookType;
 // ・on the flyが指定されているときは実際はメモリ上にはないがこれを透過的に扱う。
 struct MemoryBook
 {
+	~MemoryBook() { unmap_ybb(); }
+
     // このclassの初期化としてOptionsMapを渡してやる必要がある。
     void set_options(OptionsMap& o);
 
@@ -243,6 +245,7 @@ protected:
 	BookMovesPtr find_bookmoves_on_the_fly(std::string sfen);
 	BookMovesPtr find_ybb_bookmoves_on_the_fly(const Position& pos);
 	BookMovesPtr find_ybb_bookmoves_on_the_fly(const PackedSfen& target, uint16_t game_ply);
+	// 丸読みした.ybb(ybb_memory_book == true)か、mmapした.ybb(ybb_mapped_data != nullptr)から探す。
 	BookMovesPtr find_ybb_bookmoves_in_memory(const PackedSfen& target, uint16_t game_ply);
 
 	// メモリに丸読みせずにfind()のごとにファイルを調べにいくのか。
@@ -269,6 +272,14 @@ protected:
 	// ybb_memory_book == trueのときに、.ybb 全体を丸読みして保持するバッファ。
 	std::vector<unsigned char> ybb_index_data;
 
+	// ybb_book == trueのときに、.ybb 全体をmmapしているなら、そのメモリとサイズ。
+	// このときybb_index_fs, ybb_moves_fsは開かずに、mapしたメモリ上で直接二分探索する。
+	const void* ybb_mapped_data = nullptr;
+	size_t      ybb_mapped_size = 0;
+
+	// ybb_mapped_dataをunmapする。
+	void unmap_ybb();
+
 	// moves record の先頭位置。
 	// .ybb の index 領域の直後。
 	uint64_t ybb_moves_base = 0;
@@ -19,7 +19,7 @@ namespace Book
 	// 定跡生成用の関数はplug-inのようになっていて、その関数は、自分の知っているコマンドを処理した場合、1を返す。
 
 	// 定跡生成コマンド2025年度版。ペタショック化コマンド。
-    int makebook2025(istringstream& is, const string& token, const OptionsMap& options);
+    int makebook2025(istringstream& is, const string& token, const OptionsMap& options, ThreadPool& threads);
 
 	// ---------------------------------------------------------------------------------------------
 
@@ -36,7 +36,7 @@ namespace Book
 		is >> token;
 
 		// 2025年に作ったmakebook拡張コマンド
-        if (makebook2025(is, token, engine.get_options()))
+        if (makebook2025(is, token, engine.get_options(), engine.get_threads()))
 		{
 			Tools::ProgressBar::enable(false);
 			return;
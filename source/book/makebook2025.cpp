@@ -39,6 +39,7 @@
 #include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <vector>
 #include <unordered_map>
@@ -48,16 +49,266 @@
 #include <random>
 #include <utility> // For std::forward
 #include <new>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <queue>
 
 #include "book.h"
 #include "../thread.h"
 #include "../position.h"
 #include "../movegen.h"
+#include "../memory.h"
 #include "../misc.h"
 
 using namespace std;
 namespace YaneuraOu {
 
+namespace MakeBook2025
+{
+	// ---------------------------------
+	//   external memoryモード用のarena
+	// ---------------------------------
+
+	// ファイルにmapしたメモリから切り出して割り当てるarena。
+	// 📝 peta_shockコマンドの"external"オプション指定時に、BookNodeの配列、各局面の指し手、
+	//     局面のhash keyからのindexをここに確保する。
+	//     ファイルにmapしたメモリは、OSが必要に応じてファイルに書き出して物理メモリから追い出せるので、
+	//     物理メモリより大きな定跡も処理できる。
+	//     割り当てたメモリはarenaの解体時にまとめて解放する。
+	//     小さなものは、deallocate()で返却すると、同じサイズの確保に再利用される。(SmallVectorの再確保など)
+	//     大きなもの(BookNodesなど)は再利用しないので、最終的なサイズがわかっているなら予めreserveしておくこと。
+	class MappedArena
+	{
+	public:
+		// 確保するメモリのalignment
+		static constexpr size_t ALIGNMENT = 32;
+
+		// path_prefix + ".番号" というファイルを(最低)chunk_sizeずつ作ってmapする。
+		MappedArena(const string& path_prefix, size_t chunk_size)
+			: path_prefix(path_prefix), chunk_size(chunk_size), id(++arena_counter) {}
+
+		MappedArena(const MappedArena&)            = delete;
+		MappedArena& operator=(const MappedArena&) = delete;
+
+		// unmapして、ファイルも削除する。
+		~MappedArena()
+		{
+			for (auto& chunk : chunks)
+			{
+				unmap_file(chunk.mem, chunk.size);
+				std::remove(chunk.path.c_str());
+			}
+		}
+
+		// sizeバイトを確保する。失敗した時はnullptrを返す。
+		// 💡 複数のスレッドから同時に呼び出して良い。
+		//     小さなものは、スレッドごとに切り出したslabから確保するのでlockしない。
+		void* allocate(size_t size)
+		{
+			size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+			if (size > SLAB_SIZE / 4)
+			{
+				std::lock_guard<std::mutex> lk(mutex);
+				return allocate_locked(size);
+			}
+
+			Slab& slab = local_slab();
+
+			// 同じサイズの返却された領域があれば、それを再利用する。
+			if (size <= FREE_LIST_MAX)
+				if (FreeBlock* block = slab.free_lists[size / ALIGNMENT - 1])
+				{
+					slab.free_lists[size / ALIGNMENT - 1] = block->next;
+					return block;
+				}
+
+			if (size_t(slab.end - slab.cur) < size)
+			{
+				std::lock_guard<std::mutex> lk(mutex);
+				char* mem = static_cast<char*>(allocate_locked(SLAB_SIZE));
+				if (!mem)
+					return nullptr;
+				slab.cur = mem;
+				slab.end = mem + SLAB_SIZE;
+			}
+
+			void* mem = slab.cur;
+			slab.cur += size;
+			return mem;
+		}
+
+		// allocate()でsizeバイト確保したmemを返却する。
+		// 💡 FREE_LIST_MAX以下のものは、このスレッドのfree listにつないでおき、同じサイズの確保に再利用する。
+		//     それより大きなものは何もしない。(arenaの解体時に解放される)
+		void deallocate(void* mem, size_t size)
+		{
+			size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+			if (!mem || size > FREE_LIST_MAX)
+				return;
+
+			Slab& slab  = local_slab();
+			auto* block = static_cast<FreeBlock*>(mem);
+			block->next = slab.free_lists[size / ALIGNMENT - 1];
+			slab.free_lists[size / ALIGNMENT - 1] = block;
+		}
+
+		// mapしているファイルの合計サイズ
+		size_t mapped_size() const
+		{
+			size_t total = 0;
+			for (auto& chunk : chunks)
+				total += chunk.size;
+			return total;
+		}
+
+	private:
+		// mutexを獲得してから呼び出すこと。
+		void* allocate_locked(size_t size)
+		{
+			if (chunks.empty() || chunks.back().size - chunks.back().used < size)
+			{
+				// 📝 最後のchunkの残りは捨てて、新しいchunkを作る。
+				Chunk chunk;
+				chunk.size = std::max(chunk_size, size);
+				chunk.path = path_prefix + "." + std::to_string(chunks.size());
+				chunk.mem  = static_cast<char*>(map_file_read_write(chunk.path, chunk.size));
+				if (!chunk.mem)
+				{
+					std::remove(chunk.path.c_str());
+					return nullptr;
+				}
+				chunks.push_back(chunk);
+			}
+
+			auto& chunk = chunks.back();
+			void* mem   = chunk.mem + chunk.used;
+			chunk.used += size;
+			return mem;
+		}
+
+		// ファイル1つ分のmapしたメモリ
+		struct Chunk
+		{
+			char*  mem  = nullptr;
+			size_t size = 0;
+			size_t used = 0;
+			string path;
+		};
+
+		// 返却された領域。先頭に次の領域へのポインタを書いて、サイズごとのlistにする。
+		struct FreeBlock
+		{
+			FreeBlock* next;
+		};
+
+		// free listで再利用する最大のサイズ
+		static constexpr size_t FREE_LIST_MAX = 4096;
+
+		// スレッドごとに切り出した領域と、そのスレッドで返却された領域のfree list
+		struct Slab
+		{
+			u64   arena_id = 0;
+			char* cur      = nullptr;
+			char* end      = nullptr;
+
+			// free_lists[i] : (i + 1) * ALIGNMENTバイトの領域のlist
+			std::array<FreeBlock*, FREE_LIST_MAX / ALIGNMENT> free_lists{};
+		};
+		static constexpr size_t SLAB_SIZE = 1024 * 1024;
+
+		// このスレッドのSlab。別のarenaのものであれば捨てて作り直す。
+		Slab& local_slab()
+		{
+			thread_local Slab slab;
+			if (slab.arena_id != id)
+				slab = Slab{ id };
+			return slab;
+		}
+
+		// thread_localなSlabが、どのarenaから切り出したものかを識別するための通し番号
+		static inline std::atomic<u64> arena_counter{0};
+
+		string        path_prefix;
+		size_t        chunk_size;
+		u64           id;
+		vector<Chunk> chunks;
+		std::mutex    mutex;
+	};
+
+	// arenaから確保する。確保できなければ終了する。
+	static void* arena_allocate_or_exit(MappedArena* arena, size_t size)
+	{
+		void* mem = arena->allocate(size);
+		if (!mem)
+		{
+			std::cout << "Error! : failed to map an arena file. size = " << size << std::endl;
+			Tools::exit();
+		}
+		return mem;
+	}
+
+	// SmallVectorのメモリをここから確保するarena。nullptrなら通常のheapから確保する。
+	static MappedArena* active_arena = nullptr;
+
+	// SmallVectorのメモリ確保。
+	// in_arena : active_arenaから確保した時はtrueが返る。
+	static void* allocate_small_vector(size_t size, bool& in_arena)
+	{
+		in_arena = active_arena != nullptr;
+		return in_arena ? arena_allocate_or_exit(active_arena, size) : new char[size];
+	}
+
+	// SmallVectorのメモリ解放。
+	// in_arena : allocate_small_vector()でactive_arenaから確保したか。
+	// 💡 arenaから確保したものは、active_arenaがあればそこに返却して再利用させる。
+	//     なければ何もしない。(arenaの解体時にまとめて解放される)
+	//     arenaは同時に1つしか作らないので、active_arenaは確保した時のarenaと同じである。
+	static void deallocate_small_vector(void* mem, size_t size, bool in_arena)
+	{
+		if (!in_arena)
+			delete[] static_cast<char*>(mem);
+		else if (active_arena)
+			active_arena->deallocate(mem, size);
+	}
+
+	// arenaが指定されていればそこから、されていなければheapから確保するallocator。
+	// std::vectorの要素をarenaに置くために用いる。
+	template <typename T>
+	struct NodeAllocator
+	{
+		using value_type                             = T;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_swap            = std::true_type;
+
+		NodeAllocator(MappedArena* arena = nullptr) noexcept : arena(arena) {}
+		template <typename U>
+		NodeAllocator(const NodeAllocator<U>& other) noexcept : arena(other.arena) {}
+
+		T* allocate(size_t n)
+		{
+			static_assert(alignof(T) <= MappedArena::ALIGNMENT);
+			return arena ? static_cast<T*>(arena_allocate_or_exit(arena, n * sizeof(T))) : std::allocator<T>().allocate(n);
+		}
+
+		void deallocate(T* p, size_t n) noexcept
+		{
+			if (!arena)
+				std::allocator<T>().deallocate(p, n);
+			else
+				arena->deallocate(p, n * sizeof(T));
+		}
+
+		bool operator==(const NodeAllocator& other) const { return arena == other.arena; }
+		bool operator!=(const NodeAllocator& other) const { return arena != other.arena; }
+
+		MappedArena* arena;
+	};
+
+} // namespace MakeBook2025
+
 // ある局面の指し手の配列、std::vector<Move>だとsize_t(64bit環境で8バイト)でcapacityとかsizeとか格納するので
 // 非常にもったいない。定跡のある局面の指し手が255手を超えることはないだろうから1byteでも十分。
 // そこで、size_tではなくint16_tでサイズなどを保持しているvectorのsubsetを用意する。
@@ -66,7 +317,7 @@ namespace YaneuraOu {
 template <typename T>
 class SmallVector {
 public:
-	SmallVector() noexcept : data(nullptr), count(0), capacity(0) {
+	SmallVector() noexcept : data(nullptr), count(0), capacity(0), in_arena(false) {
 
 		// 定跡の指し手、MultiPVで探索していて、
 		// 4の倍数なのでcapacityは4を初期値にしておく。
@@ -75,7 +326,7 @@ public:
 
 	// コピーコンストラクタ
 	SmallVector(const SmallVector& other)
-		: data(nullptr), count(0), capacity(0) {
+		: data(nullptr), count(0), capacity(0), in_arena(false) {
 		if (other.count > 0) {
 			reserve(other.count);
 			for (uint16_t i = 0; i < other.count; ++i) {
@@ -103,7 +354,7 @@ public:
 
 	// ムーブコンストラクタ
 	SmallVector(SmallVector&& other) noexcept
-		: data(nullptr), count(0), capacity(0) {
+		: data(nullptr), count(0), capacity(0), in_arena(false) {
 		swap(other);
 	}
 
@@ -173,6 +424,7 @@ public:
 		swap(data, other.data);
 		swap(count, other.count);
 		swap(capacity, other.capacity);
+		swap(in_arena, other.in_arena);
 	}
 
 private:
@@ -186,7 +438,8 @@ private:
 	}
 
 	void reserve(uint16_t new_capacity) {
-		T* new_data = reinterpret_cast<T*>(new char[new_capacity * sizeof(T)]);
+		bool new_in_arena;
+		T* new_data = reinterpret_cast<T*>(MakeBook2025::allocate_small_vector(new_capacity * sizeof(T), new_in_arena));
 		for (uint16_t i = 0; i < count; ++i) {
 			new (&new_data[i]) T(std::move(data[i]));
 			data[i].~T();
@@ -194,17 +447,24 @@ private:
 		release();
 		data = new_data;
 		capacity = new_capacity;
+		in_arena = new_in_arena;
 	}
 
 	void release() noexcept {
-		delete[] reinterpret_cast<char*>(data);
+		// arenaから確保したメモリは、arenaに返却して再利用させる。
+		MakeBook2025::deallocate_small_vector(data, capacity * sizeof(T), in_arena);
 		data = nullptr;
 		capacity = 0;
+		in_arena = false;
 	}
 
 	T* data;
 	uint16_t count;
 	uint16_t capacity;
+
+	// dataをMakeBook2025::active_arenaから確保したか。
+	// 💡 paddingに収まるので、sizeof(SmallVector)は増えない。
+	bool in_arena;
 };
 
 // ADLを利用したswapの非メンバ関数バージョン
@@ -219,6 +479,13 @@ namespace MakeBook2025
 	// peta_shockコマンド実行時にsfen文字列を一時保存するファイル名
 	string SFEN_TEMP_FILENAME = "sfen_tmp.txt";
 
+	// peta_shockコマンドをexternalオプション付きで実行した時に、arenaとして用いる一時ファイル名
+	// 実際には、末尾に".0", ".1", ...が付与される。
+	string ARENA_TEMP_FILENAME = "arena_tmp";
+
+	// arenaのファイル1つあたりの(最小)サイズ
+	constexpr size_t ARENA_CHUNK_SIZE = size_t(1) << 30;
+
 	// BookMoveのポインターみたいなやつ。これで局面の行き来を行う。
 	// しばらくは42億を超えることはないと思うので32bitでいいや。
 	typedef u32 BookNodeIndex;
@@ -526,40 +793,225 @@ namespace MakeBook2025
 		// 16(moves) + 4(vd) + 1(color) + 1*3(flags) = 24 bytes
 	};
 
+	// 局面のHASH_KEYからBookNodeIndexへのmapper。
+	// hash keyでSHARD_NUM個のunordered_mapに振り分けてある。
+	// 📝 登録は、shardごとに担当するスレッドを決めて並列に行う。(同じshardに複数のスレッドが書き込むことはない)
+	//     検索は、登録がすべて終わってからであれば、どのスレッドからでも並列に行える。
+	class ShardedHashKey2Index
+	{
+	public:
+		static constexpr int    SHARD_BITS = 8;
+		static constexpr size_t SHARD_NUM  = size_t(1) << SHARD_BITS;
+
+		// keyを格納するshard番号
+		// 💡 unordered_mapのbucketはhash値の下位bitで決まるので、hash値をかき混ぜた上位bitを用いる。
+		static size_t shard_of(const Key& key)
+		{
+			return size_t((u64(std::hash<Key>()(key)) * 0x9E3779B97F4A7C15ULL) >> (64 - SHARD_BITS));
+		}
+
+		// 全部でn個登録する予定であることを事前に伝えておく。
+		void reserve(size_t n)
+		{
+			for (auto& shard : shards)
+				shard.reserve(n / SHARD_NUM + 1);
+		}
+
+		// keyをindexとして登録する。同じkeyがすでに登録されていれば上書きする。
+		// ⚠ shard_of(key)のshardを担当しているスレッドからしか呼び出してはならない。
+		void insert(size_t shard, const Key& key, BookNodeIndex index) { shards[shard][key] = index; }
+
+		// keyに対応するindexを返す。登録されていなければBookNodeIndexNullを返す。
+		BookNodeIndex find(const Key& key) const
+		{
+			const auto& shard = shards[shard_of(key)];
+			auto it = shard.find(key);
+			return it != shard.end() ? it->second : BookNodeIndexNull;
+		}
+
+		// メモリを解放する。
+		// (clear()では解放されないので、swap trickを用いる。)
+		void release()
+		{
+			for (auto& shard : shards)
+				unordered_map<Key, BookNodeIndex>().swap(shard);
+		}
+
+	private:
+		std::array<unordered_map<Key, BookNodeIndex>, SHARD_NUM> shards;
+	};
+
+	// external memoryモード用の、局面のHASH_KEYからBookNodeIndexへのmapper。
+	// read_book()の途中でsortしたrunを作っておき、最後にそれらをmergeして1本のsorted arrayにする。
+	// 検索はこのsorted arrayを二分探索する。
+	// 💡 arenaに確保するので、物理メモリより大きくても構わない。
+	class SortedHashKey2Index
+	{
+	public:
+		struct Entry
+		{
+			Key           key;
+			BookNodeIndex index;
+		};
+
+		// run, sorted arrayをarenaに確保するようにする。
+		void set_arena(MappedArena* arena)
+		{
+			runs    = Entries(NodeAllocator<Entry>(arena));
+			entries = Entries(NodeAllocator<Entry>(arena));
+			run_ends.clear();
+		}
+
+		// 追加するrunの要素数の合計がわかっている時に、runsを予め確保しておく。
+		// 💡 arenaでは、再確保で捨てた領域は再利用されないので。
+		void reserve(size_t n) { runs.reserve(n); }
+
+		// runを1つ追加する。runはここでsortされる。
+		void add_run(vector<Entry>& run)
+		{
+			std::sort(run.begin(), run.end(), entry_less);
+			runs.insert(runs.end(), run.begin(), run.end());
+			run_ends.push_back(runs.size());
+		}
+
+		// 追加したrunをすべてmergeしてsorted arrayを作る。
+		// ⚠ この呼び出しのあとでないとfind()は使えない。
+		void merge_runs()
+		{
+			// (runs[i]の先頭のEntry, run番号)のmin-heap
+			auto greater = [&](size_t a, size_t b) { return entry_less(runs[cursors[b]], runs[cursors[a]]); };
+			std::priority_queue<size_t, vector<size_t>, decltype(greater)> heap(greater);
+
+			cursors.resize(run_ends.size());
+			for (size_t i = 0; i < run_ends.size(); ++i)
+			{
+				cursors[i] = i == 0 ? 0 : run_ends[i - 1];
+				if (cursors[i] < run_ends[i])
+					heap.push(i);
+			}
+
+			entries.reserve(runs.size());
+			while (!heap.empty())
+			{
+				size_t i = heap.top();
+				heap.pop();
+				entries.push_back(runs[cursors[i]]);
+				if (++cursors[i] < run_ends[i])
+					heap.push(i);
+			}
+
+			// runsはもう不要。(arenaのメモリは解放されないが、ページはファイルに追い出される)
+			Entries(runs.get_allocator()).swap(runs);
+			vector<size_t>().swap(cursors);
+		}
+
+		// keyに対応するindexを返す。登録されていなければBookNodeIndexNullを返す。
+		// 同じkeyが複数登録されていれば、indexが最大のもの(あとから出現した局面)を返す。
+		BookNodeIndex find(const Key& key) const
+		{
+			auto it = std::upper_bound(entries.begin(), entries.end(), key,
+				[](const Key& k, const Entry& e) { return key_compare(k, e.key) < 0; });
+			if (it == entries.begin() || key_compare((it - 1)->key, key) != 0)
+				return BookNodeIndexNull;
+			return (it - 1)->index;
+		}
+
+		void release()
+		{
+			Entries(entries.get_allocator()).swap(entries);
+			vector<size_t>().swap(run_ends);
+		}
+
+	private:
+		// Keyの全順序。(大小関係自体に意味はない)
+		static int key_compare(const Key& a, const Key& b) { return std::memcmp(&a, &b, sizeof(Key)); }
+
+		static bool entry_less(const Entry& a, const Entry& b)
+		{
+			int c = key_compare(a.key, b.key);
+			return c != 0 ? c < 0 : a.index < b.index;
+		}
+
+		using Entries = vector<Entry, NodeAllocator<Entry>>;
+
+		Entries        runs;
+		vector<size_t> run_ends;
+		vector<size_t> cursors;
+		Entries        entries;
+	};
+
+	// BookNodeの配列
+	using BookNodes = vector<BookNode, NodeAllocator<BookNode>>;
+
+	// SmallVectorをactive_arenaから確保させる区間を表すRAII。
+	struct ActiveArenaScope
+	{
+		ActiveArenaScope(MappedArena* arena) { active_arena = arena; }
+		~ActiveArenaScope() { active_arena = nullptr; }
+	};
+
 	// ペタショック化
 	class PetaShock
 	{
 	public:
+		// 📝 各処理はthreadsのスレッドで並列化して行う。
+		PetaShock(ThreadPool& threads) : threads(threads) {}
+
 		// 定跡をペタショック化する。
 		void make_book(istringstream& is, string book_dir)
 		{
+			// 各処理の所要時間の計測用
+			phase_times.clear();
+			ElapsedTimer timer;
+			auto lap = [&](const char* phase) {
+				phase_times.emplace_back(phase, timer.elapsed());
+				cout << "Elapsed Time        : " << timer.elapsed() << " [ms]" << endl;
+				timer.reset();
+			};
+
 			// 初期化等
 			if (initialize(is, book_dir).is_not_ok())
 				return;
 
-			// ペタショック化する定跡ファイルの読み込み
-			if (read_book().is_not_ok())
-				return;
-
-			// 局面の合流チェック
-			if (convergence_check().is_not_ok())
-				return;
-
-			// 後退解析その1 : 出次数0の局面を定跡ツリーから削除
-			remove_const_nodes();
-
-			// 後退解析その2 : 連続王手の千日手のループを抽出
-			extract_check_loop();
-
-			// 千日手スコアで各ノードを初期化する。
-			init_cycle_nodes();
-
-			// 後退解析その3 : 評価値の親ノードへの伝播
-			propagate_all_nodes();
+			{
+				// externalモードなら、各局面の指し手をarenaに確保する。
+				ActiveArenaScope arena_scope(arena.get());
+
+				// ペタショック化する定跡ファイルの読み込み
+				if (read_book().is_not_ok())
+					return;
+
+				// externalモードなら、sortしておいたrunをmergeしてindexを完成させる。
+				if (external)
+					hashkey_sorted_index.merge_runs();
+				lap("read_book");
+
+				// 局面の合流チェック
+				if (convergence_check().is_not_ok())
+					return;
+				lap("convergence_check");
+
+				// 後退解析その1 : 出次数0の局面を定跡ツリーから削除
+				remove_const_nodes();
+				lap("remove_const_nodes");
+
+				// 後退解析その2 : 連続王手の千日手のループを抽出
+				extract_check_loop();
+				lap("extract_check_loop");
+
+				// 千日手スコアで各ノードを初期化する。
+				init_cycle_nodes();
+				lap("init_cycle_nodes");
+
+				// 後退解析その3 : 評価値の親ノードへの伝播
+				propagate_all_nodes();
+				lap("propagate_all_nodes");
+			}
 
 			// ペタショック化した定跡の書き出し
 			if (write_peta_shock_book(writebook_path, book_nodes).is_not_ok())
 				return;
+			lap("write_book");
 
 			// 結果出力
 			output_result();
@@ -572,6 +1024,31 @@ namespace MakeBook2025
 
 		// === helper function ===
 
+		// 並列化に用いるスレッド数
+		size_t thread_num() const { return std::max(size_t(1), threads.num_threads()); }
+
+		// [0, n)をthread_num()個に分割して、各スレッドでf(thread_id, begin, end)を呼び出す。
+		// すべてのスレッドの処理が終わるまで待機する。
+		template <typename F>
+		void parallel_for(size_t n, const F& f)
+		{
+			const size_t num = threads.num_threads();
+			if (num == 0)
+			{
+				f(size_t(0), size_t(0), n);
+				return;
+			}
+
+			for (size_t i = 0; i < num; ++i)
+			{
+				const size_t begin = n * i / num;
+				const size_t end   = n * (i + 1) / num;
+				threads.run_on_thread(i, [&f, i, begin, end]() { f(i, begin, end); });
+			}
+			for (size_t i = 0; i < num; ++i)
+				threads.wait_on_thread(i);
+		}
+
 		// 初期化
 		Tools::Result initialize(istringstream& is, string book_dir)
 		{
@@ -594,7 +1071,7 @@ namespace MakeBook2025
 
 			// コマンドラインオプションの読み込み
 			string token;
-			shrink = fast = false;
+			shrink = fast = external = false;
 			while (is >> token)
 			{
 				if (token == "shrink")
@@ -602,6 +1079,16 @@ namespace MakeBook2025
 
 				else if (token == "fast")
 					fast = true;
+
+				else if (token == "external")
+					external = true;
+			}
+
+			// externalとfastは両立しない。(fastはsfen文字列をメモリ上に溜めるので)
+			if (external && fast)
+			{
+				cout << "WARNING : 'fast' is ignored in the external mode." << endl;
+				fast = false;
 			}
 
 			string BOOK_DIR = book_dir;
@@ -610,6 +1097,22 @@ namespace MakeBook2025
 			writebook_path = Path::Combine(BOOK_DIR, writebook_path);
 			sfen_temp_path = writebook_path + "." + SFEN_TEMP_FILENAME;
 
+			// 前回のarenaから確保したものは、arenaを作り直す前に手放しておく。
+			// (これらはNodeAllocatorで、確保した時のarenaに返却するので)
+			book_nodes = BookNodes();
+			prev_vds   = vector<ValueDepth, NodeAllocator<ValueDepth>>();
+			hashkey_sorted_index.set_arena(nullptr);
+
+			// externalモードでは、BookNodeの配列などを書き出すファイルにmapしたarenaに確保する。
+			if (external)
+				arena = std::make_unique<MappedArena>(writebook_path + "." + ARENA_TEMP_FILENAME, ARENA_CHUNK_SIZE);
+			else
+				arena.reset();
+
+			book_nodes = BookNodes(NodeAllocator<BookNode>(arena.get()));
+			prev_vds   = vector<ValueDepth, NodeAllocator<ValueDepth>>(NodeAllocator<ValueDepth>(arena.get()));
+			hashkey_sorted_index.set_arena(arena.get());
+
 			const auto actual_readbook_path = resolve_book_filename_with_ybb_fallback(readbook_path);
 			if (actual_readbook_path != readbook_path)
 			{
@@ -636,6 +1139,8 @@ namespace MakeBook2025
 
 			cout << "shrink             : " << shrink << endl;
 			cout << "fast               : " << fast << endl;
+			cout << "external           : " << external << endl;
+			cout << "threads            : " << thread_num() << endl;
 
 			/*
 				note: DrawValueの変更について。
@@ -658,6 +1163,7 @@ namespace MakeBook2025
 
 			original_sfens.clear();
 			check_loop_nodes.clear();
+			pending_sfens.clear();
 
 			return Tools::Result::Ok();
 		}
@@ -704,7 +1210,11 @@ namespace MakeBook2025
 
 				cout << "Number Of Elements : " << noe << endl;
 				book_nodes.reserve(size_t(noe));
-				hashkey_to_index.reserve(size_t(noe));
+				if (external)
+					hashkey_sorted_index.reserve(size_t(noe));
+				else
+					hashkey_to_index.reserve(size_t(noe));
+				pending_sfens.reserve(std::min(size_t(noe), READ_BATCH_SIZE));
 				if (fast)
 					original_sfens.reserve(size_t(noe));
 
@@ -719,7 +1229,6 @@ namespace MakeBook2025
 				}
 
 				progress.reset(noe == 0 ? 0 : noe - 1);
-				Position pos;
 
 				for (u64 i = 0; i < noe; ++i)
 				{
@@ -744,23 +1253,12 @@ namespace MakeBook2025
 
 					StringExtension::trim_number_inplace(sfen);
 					Color stm = (sfen.find('w') != std::string::npos) ? WHITE : BLACK;
-					string white_sfen = stm == WHITE ? sfen : Position::sfen_to_flipped_sfen(sfen);
-
-					StateInfo si;
-					pos.set(white_sfen, &si);
-					Key white_hash_key = pos.key();
-
-					auto book_node_index = BookNodeIndex(book_nodes.size());
-					hashkey_to_index[white_hash_key] = book_node_index;
 
-					bool checked = pos.checkers();
 					book_nodes.emplace_back(BookNode());
 					auto& book_node = book_nodes.back();
 
 					book_node.color       = stm;
-					book_node.checked     = checked;
-					book_node.check_loop  = checked;
-					in_check_counter     += checked;
+					add_pending_sfen(std::move(sfen));
 
 					moves_reader.clear();
 					moves_reader.seekg(std::streamoff(moves_base + entry.moves_offset), ios::beg);
@@ -808,6 +1306,7 @@ namespace MakeBook2025
 				if (!fast)
 					sfen_writer.Close();
 
+				flush_pending_sfens();
 				return Tools::Result::Ok();
 			}
 
@@ -858,8 +1357,13 @@ namespace MakeBook2025
 									cout << "Number Of Elements : " << noe << endl;
 
 									// エントリー数が事前にわかったので、その分だけそれぞれの構造体配列を確保する。
+									// 💡 externalモードでは、arenaは再確保で捨てた領域を再利用しないので、ここで確保しておくことが重要。
 									book_nodes.reserve(noe);
-									hashkey_to_index.reserve(noe);
+									if (external)
+										hashkey_sorted_index.reserve(noe);
+									else
+										hashkey_to_index.reserve(noe);
+									pending_sfens.reserve(std::min(noe, READ_BATCH_SIZE));
 									if (fast)
 										original_sfens.reserve(noe);
 								}
@@ -886,8 +1390,6 @@ namespace MakeBook2025
 				}
 			}
 
-			Position pos;
-
 			while (reader.ReadLine(line).is_ok())
 			{
 				progress.check(reader.GetFilePos());
@@ -919,30 +1421,13 @@ namespace MakeBook2025
 					// ⇨ "w"の文字は駒には使わないので"w"があれば後手番であることが確定する。
 					Color stm = (sfen.find('w') != std::string::npos) ? WHITE : BLACK;
 
-					// 後手番化したsfen。
-					// hashkeyは、すべて後手番の局面で考えるから、hashkeyを求めるときに後手番の局面にしておく。
-					string white_sfen = stm == WHITE ? sfen : Position::sfen_to_flipped_sfen(sfen);
-
-					// hashkey_to_indexには後手番の局面のhash keyからのindexを登録する。
-					StateInfo si;
-					pos.set(white_sfen, &si);
-					Key white_hash_key = pos.key();
-					// 元の定跡ファイルにflipした局面は登録されていないものとする。
-					// ⇨  登録されていたら、あとから出現した局面を優先する。
-
-					auto book_node_index = BookNodeIndex(book_nodes.size()); // emplace_back()する前のsize()が今回追加されるindex
-					hashkey_to_index[white_hash_key] = book_node_index;
-
-					// この局面は王手されているのか？
-					bool checked = pos.checkers();
-
 					book_nodes.emplace_back(BookNode());
 					auto& book_node = book_nodes.back();
 
 					book_node.color        = stm; // 元の手番。これを維持してファイルに書き出さないと、sfen文字列でsortされていたのが狂う。
-					book_node.checked      = checked;
-					book_node.check_loop   = checked;
-					in_check_counter      += checked;
+
+					// hash keyと王手されているかは、あとでまとめてスレッド並列で求める。
+					add_pending_sfen(std::move(sfen));
 
 					// この直後にやってくる指し手をこの局面の指し手として取り込む。
 					continue;
@@ -973,9 +1458,86 @@ namespace MakeBook2025
 			if (!fast)
 				sfen_writer.Close();
 
+			flush_pending_sfens();
 			return Tools::Result::Ok();
 		}
 
+		// read_book()で読み込んだ局面のsfen(末尾の手数は除去済み)を追加する。
+		// この局面はbook_nodes.back()に対応する。
+		void add_pending_sfen(string&& sfen)
+		{
+			pending_sfens.emplace_back(std::move(sfen));
+			if (pending_sfens.size() >= READ_BATCH_SIZE)
+				flush_pending_sfens();
+		}
+
+		// pending_sfensの局面について、hash keyと王手されているかをスレッド並列で求めて、
+		// hashkey_to_indexに登録する。
+		void flush_pending_sfens()
+		{
+			const size_t n = pending_sfens.size();
+			if (n == 0)
+				return;
+
+			// pending_sfens[0]に対応するBookNodeIndex
+			const BookNodeIndex first = BookNodeIndex(book_nodes.size() - n);
+
+			vector<Key> keys(n);
+			vector<u8>  shards(n);
+			vector<u64> in_check(thread_num());
+
+			parallel_for(n, [&](size_t thread_id, size_t begin, size_t end) {
+				Position pos;
+				for (size_t i = begin; i < end; ++i)
+				{
+					auto& book_node = book_nodes[first + i];
+					const auto& sfen = pending_sfens[i];
+
+					// 後手番化したsfen。
+					// hashkeyは、すべて後手番の局面で考えるから、hashkeyを求めるときに後手番の局面にしておく。
+					string white_sfen = book_node.color == WHITE ? sfen : Position::sfen_to_flipped_sfen(sfen);
+
+					StateInfo si;
+					pos.set(white_sfen, &si);
+					keys[i]   = pos.key();
+					shards[i] = u8(ShardedHashKey2Index::shard_of(keys[i]));
+
+					// この局面は王手されているのか？
+					bool checked = pos.checkers();
+
+					book_node.checked    = checked;
+					book_node.check_loop = checked;
+					in_check[thread_id] += checked;
+				}
+			});
+
+			// hashkey_to_indexには後手番の局面のhash keyからのindexを登録する。
+			// 元の定跡ファイルにflipした局面は登録されていないものとする。
+			// ⇨  登録されていたら、あとから出現した局面を優先する。
+			if (external)
+			{
+				// externalモードでは、sortしたrunとしてarenaに書き出しておく。
+				vector<SortedHashKey2Index::Entry> run(n);
+				for (size_t i = 0; i < n; ++i)
+					run[i] = SortedHashKey2Index::Entry{ keys[i], BookNodeIndex(first + i) };
+				hashkey_sorted_index.add_run(run);
+			}
+			else
+			{
+				// 💡 各スレッドは担当のshardだけを、局面の出現順に登録する。
+				parallel_for(ShardedHashKey2Index::SHARD_NUM, [&](size_t, size_t shard_begin, size_t shard_end) {
+					for (size_t i = 0; i < n; ++i)
+						if (shard_begin <= shards[i] && shards[i] < shard_end)
+							hashkey_to_index.insert(shards[i], keys[i], BookNodeIndex(first + i));
+				});
+			}
+
+			for (auto c : in_check)
+				in_check_counter += c;
+
+			pending_sfens.clear();
+		}
+
 		// 局面の合流チェック
 		Tools::Result convergence_check()
 		{
@@ -996,91 +1558,111 @@ namespace MakeBook2025
 			Tools::ProgressBar progress;
 			progress.reset(book_nodes.size() - 1);
 
-			Position pos;
+			// 📝 各局面の合流チェックは独立しているのでスレッド並列で行う。
+			//     テンポラリファイルにsfen文字列を書き出している時は、READ_BATCH_SIZE局面ずつ読み込んでから並列化する。
 
-			// note : ここ、スレッド並列にして高速化すべきだが、
-			//  テンポラリファイルにsfen文字列を書き出してしまっているのでそれができない。
-			//  ⇨  fastオプションが指定されている時はその限りではないか..
+			vector<u64>    converged(thread_num());
+			vector<string> sfens;
 
-			for (BookNodeIndex i = 0; i < BookNodeIndex(book_nodes.size()); ++i)
+			for (size_t base = 0; base < book_nodes.size(); base += READ_BATCH_SIZE)
 			{
-				auto& book_node = book_nodes[i];
+				const size_t n = std::min(READ_BATCH_SIZE, book_nodes.size() - base);
 
-				StateInfo si, si2;
-				string sfen;
-				if (fast)
-					sfen = original_sfens[i];
-				else
+				if (!fast)
 				{
-					if (sfen_reader.ReadLine(sfen).is_not_ok())
+					sfens.resize(n);
+					for (size_t i = 0; i < n; ++i)
 					{
-						sync_cout << "info string Error! : can't read sfen temp file : " + sfen_temp_path << sync_endl;
-						return Tools::ResultCode::FileReadError;
+						if (sfen_reader.ReadLine(sfens[i]).is_not_ok())
+						{
+							sync_cout << "info string Error! : can't read sfen temp file : " + sfen_temp_path << sync_endl;
+							return Tools::ResultCode::FileReadError;
+						}
 					}
 				}
 
-				// この局面が後手番なら、sfenを先手の局面化する。
-				// 💡: BookNodeは先手の局面で考えている。hashkeyは後手の局面で考えている。
-				if (book_node.color == WHITE)
-					sfen = Position::sfen_to_flipped_sfen(sfen);
+				parallel_for(n, [&](size_t thread_id, size_t begin, size_t end) {
+					Position pos;
+					for (size_t i = begin; i < end; ++i)
+						converged[thread_id] += convergence_check_node(pos, book_nodes[base + i], fast ? original_sfens[base + i] : sfens[i]);
+				});
 
-				pos.set(sfen, &si);
-				ASSERT_LV3(pos.side_to_move() == BLACK);
+				progress.check(base + n - 1);
+			}
+			if (!fast)
+				sfen_reader.Close();
 
-				// 元ファイルの定跡DBに登録されていた指し手
-				SmallVector<BookMove> book_moves;
-				std::swap(book_node.moves, book_moves); // swapしていったんbook_node.movesはクリアしてしまう。
+			for (auto c : converged)
+				converged_moves += c;
 
-				// ここから全合法手で一手進めて既知の(定跡ツリー上の他の)局面に行くかを調べる。
-				for (auto move : MoveList<LEGAL_ALL>(pos))
-				{
-					// moveで進めた局面が存在する時のhash値。
-					Key next_hash = pos.key_after(move);
+			//cout << "converged_moves : " << converged_moves << endl;
+			return Tools::Result::Ok();
+		}
 
-					auto it = hashkey_to_index.find(next_hash);
-					if (it != hashkey_to_index.end())
-					{
-						// 定跡局面が存在した。
+		// 1つの局面の合流チェック
+		// 返し値 : 合流させた指し手の数
+		// 💡 book_node以外は書き換えないので、異なる局面であれば並列に呼び出せる。
+		u64 convergence_check_node(Position& pos, BookNode& book_node, string sfen)
+		{
+			u64 converged_count = 0;
 
-						BookNodeIndex next_book_node_index = it->second;
-						Move16        move16               = move.to_move16();
-						BookMove      book_move(move16, next_book_node_index);
+			StateInfo si;
 
-						// これが定跡DBのこの局面の指し手に登録されていないなら、
-						// これは(定跡DBにはなかった指し手で進めたら既知の局面に)合流したということだから
-						// 合流カウンターをインクリメントしておく。
-						if (std::find_if(book_moves.begin(), book_moves.end(), [&](const auto& bm) { return bm.move == move16; }) == book_moves.end())
-							converged_moves++;
+			// この局面が後手番なら、sfenを先手の局面化する。
+			// 💡: BookNodeは先手の局面で考えている。hashkeyは後手の局面で考えている。
+			if (book_node.color == WHITE)
+				sfen = Position::sfen_to_flipped_sfen(sfen);
 
-						book_node.moves.emplace_back(book_move);
-					}
-				}
+			pos.set(sfen, &si);
+			ASSERT_LV3(pos.side_to_move() == BLACK);
+
+			// 元ファイルの定跡DBに登録されていた指し手
+			SmallVector<BookMove> book_moves;
+			std::swap(book_node.moves, book_moves); // swapしていったんbook_node.movesはクリアしてしまう。
 
-				// どこにも合流していなければ、これは定跡ツリー上で、leaf nodeしか存在しないnodeである。
-				book_node.const_node = book_node.moves.size() == 0;
+			// ここから全合法手で一手進めて既知の(定跡ツリー上の他の)局面に行くかを調べる。
+			for (auto move : MoveList<LEGAL_ALL>(pos))
+			{
+				// moveで進めた局面が存在する時のhash値。
+				Key next_hash = pos.key_after(move);
 
-				// 元ファイルの定跡DB上のこの局面の指し手も登録しておく。
-				for (auto& book_move : book_moves)
+				BookNodeIndex next_book_node_index = external ? hashkey_sorted_index.find(next_hash) : hashkey_to_index.find(next_hash);
+				if (next_book_node_index != BookNodeIndexNull)
 				{
-					Move16 move = book_move.move;
-					if (move == Move16::none())
-						continue;
+					// 定跡局面が存在した。
+
+					Move16        move16               = move.to_move16();
+					BookMove      book_move(move16, next_book_node_index);
 
-					// これがbook_nodeにすでに登録されているか？
-					// 登録されているということは合流する( = 子局面がある)ということだから、評価値は子局面のものを使うので
-					// ここで評価値を反映させる必要はない。
-					if (std::find_if(book_node.moves.begin(), book_node.moves.end(), [&](auto& book_move) { return book_move.move == move; }) == book_node.moves.end())
-						// 登録されてなかったので登録する。(登録されていればどうせmin-max探索によって値が上書きされるので元の定跡ファイルの評価値は反映させなくて良い。)
-						book_node.moves.emplace_back(book_move);
+					// これが定跡DBのこの局面の指し手に登録されていないなら、
+					// これは(定跡DBにはなかった指し手で進めたら既知の局面に)合流したということだから
+					// 合流カウンターをインクリメントしておく。
+					if (std::find_if(book_moves.begin(), book_moves.end(), [&](const auto& bm) { return bm.move == move16; }) == book_moves.end())
+						converged_count++;
+
+					book_node.moves.emplace_back(book_move);
 				}
+			}
 
-				progress.check(i);
+			// どこにも合流していなければ、これは定跡ツリー上で、leaf nodeしか存在しないnodeである。
+			book_node.const_node = book_node.moves.size() == 0;
+
+			// 元ファイルの定跡DB上のこの局面の指し手も登録しておく。
+			for (auto& book_move : book_moves)
+			{
+				Move16 move = book_move.move;
+				if (move == Move16::none())
+					continue;
+
+				// これがbook_nodeにすでに登録されているか？
+				// 登録されているということは合流する( = 子局面がある)ということだから、評価値は子局面のものを使うので
+				// ここで評価値を反映させる必要はない。
+				if (std::find_if(book_node.moves.begin(), book_node.moves.end(), [&](auto& book_move) { return book_move.move == move; }) == book_node.moves.end())
+					// 登録されてなかったので登録する。(登録されていればどうせmin-max探索によって値が上書きされるので元の定跡ファイルの評価値は反映させなくて良い。)
+					book_node.moves.emplace_back(book_move);
 			}
-			if (!fast)
-				sfen_reader.Close();
 
-			//cout << "converged_moves : " << converged_moves << endl;
-			return Tools::Result::Ok();
+			return converged_count;
 		}
 
 		// 親に伝播するためのVDを作る。(評価値を反転させて、depthを1加算)
@@ -1092,6 +1674,13 @@ namespace MakeBook2025
 
 		// あるnodeについて、leaf nodeと子nodeを調べ、そのnodeの親に伝播すべきValueDepthを得るヘルパー関数。
 		ValueDepth bestvd_for_parent(const BookNode& node)
+		{
+			return bestvd_for_parent(node, [&](BookNodeIndex next) -> const ValueDepth& { return book_nodes[next].vd; });
+		}
+
+		// 子nodeのvdをchild_vd(BookNodeIndex)で得る版。
+		template <typename F>
+		ValueDepth bestvd_for_parent(const BookNode& node, const F& child_vd)
 		{
 			ValueDepth best(-BOOK_VALUE_INF, BOOK_DEPTH_MAX);
 
@@ -1100,7 +1689,7 @@ namespace MakeBook2025
 				// leaf nodeであるなら、このbook_moveのvdが有効。
 				// leaf nodeでないなら、子のvdを見る。
 				// 💡 右辺はtemporary objectではないので、左辺はauto&で問題ない。
-				const auto& vd = book_move.leaf ? book_move.vd : book_nodes[book_move.next].vd;
+				const auto& vd = book_move.leaf ? book_move.vd : child_vd(book_move.next);
 				if (vd > best)
 					best = vd;
 			}
@@ -1139,30 +1728,45 @@ namespace MakeBook2025
 
 			// 子がすべてleafもしくはconst nodeであるなら、それはconst nodeにできる。
 
-			// TODO : ここの処理は並列化できる。ここの速度はさほど問題ではないので、まあいいか…。
-			u64 node_count = 0;
-			for (BookNodeIndex book_node_index = 0; book_node_index < BookNodeIndex(book_nodes.size()); ++book_node_index)
-			{
-				auto& node = book_nodes[book_node_index];
+			// 📝 スレッド並列で処理する。
+			//     const_nodeのフラグは、全nodeを調べ終わってからまとめて立てる。
+			//     (調べている途中で他のスレッドのnodeのフラグが変化しないように)
+			//     1回の呼び出しで1段ずつしか進まないが、最終的にconst nodeになるnodeの集合とそのvdは変わらない。
 
-				// const node以外を処理対象とする。
-				if (node.const_node)
-					continue;
+			vector<vector<BookNodeIndex>> new_const_nodes(thread_num());
 
-				// このnodeのすべての指し手がleafもしくはconst nodeか？
-				// ⇨ 子nodeがあって、そこがconst nodeでなければ、このnodeは処理対象ではない。
-				for (auto& move : node.moves)
-					if (!move.leaf && !book_nodes[move.next].const_node)
-						goto Next;
+			parallel_for(book_nodes.size(), [&](size_t thread_id, size_t begin, size_t end) {
+				for (size_t book_node_index = begin; book_node_index < end; ++book_node_index)
+				{
+					auto& node = book_nodes[book_node_index];
 
-				// すべてがconst nodeだったので、このnodeをconst node化できる。
+					// const node以外を処理対象とする。
+					if (node.const_node)
+						continue;
 
-				// 子のbestをnode.vdに反映。これは次回以降にこのnodeの親が用いる。
-				node.vd = bestvd_for_parent(node);
-				node.const_node = true;
-				node_count ++;
+					// このnodeのすべての指し手がleafもしくはconst nodeか？
+					// ⇨ 子nodeがあって、そこがconst nodeでなければ、このnodeは処理対象ではない。
+					for (auto& move : node.moves)
+						if (!move.leaf && !book_nodes[move.next].const_node)
+							goto Next;
 
-			Next: ;
+					// すべてがconst nodeだったので、このnodeをconst node化できる。
+
+					// 子のbestをnode.vdに反映。これは次回以降にこのnodeの親が用いる。
+					// 💡 このnodeはまだconst nodeではないので、このvdを他のスレッドが参照することはない。
+					node.vd = bestvd_for_parent(node);
+					new_const_nodes[thread_id].push_back(BookNodeIndex(book_node_index));
+
+				Next: ;
+				}
+			});
+
+			u64 node_count = 0;
+			for (auto& nodes : new_const_nodes)
+			{
+				for (auto book_node_index : nodes)
+					book_nodes[book_node_index].const_node = true;
+				node_count += nodes.size();
 			}
 			return node_count;
 		}
@@ -1257,40 +1861,55 @@ namespace MakeBook2025
 
 			unordered_set<BookNodeIndex> check_loop_nodes_set;
 
+			// 📝 スレッド並列で処理する。check_loopのフラグは全nodeを調べ終わってからまとめて降ろす。
+			vector<vector<BookNodeIndex>> removed_nodes(thread_num());
+
 			for(int i = 0; i < BOOK_MAX_PLY ; ++i)
 			{
-				// 今回更新されたnodeの個数
-				u64 updated = 0;
-				for (auto& node : book_nodes)
-				{
-					if (!node.check_loop)
-						continue;
+				parallel_for(book_nodes.size(), [&](size_t thread_id, size_t begin, size_t end) {
+					auto& removed = removed_nodes[thread_id];
+					removed.clear();
 
-					// 2手先がcheck_loopか調べる
-					for (auto& move : node.moves)
+					for (size_t node_index = begin; node_index < end; ++node_index)
 					{
-						if (move.leaf)
+						auto& node = book_nodes[node_index];
+						if (!node.check_loop)
 							continue;
 
-						auto& next_node = book_nodes[move.next];
-						for (auto& move2 : next_node.moves)
+						// 2手先がcheck_loopか調べる
+						for (auto& move : node.moves)
 						{
-							if (move2.leaf)
+							if (move.leaf)
 								continue;
 
-							auto& next_next_node = book_nodes[move2.next];
-							if (next_next_node.check_loop)
-								goto Next;
+							auto& next_node = book_nodes[move.next];
+							for (auto& move2 : next_node.moves)
+							{
+								if (move2.leaf)
+									continue;
+
+								auto& next_next_node = book_nodes[move2.next];
+								if (next_next_node.check_loop)
+									goto Next;
+							}
 						}
+						// 2手先にcheck loop上の局面が見つからなかった。
+						// ゆえに、元のnodeはcheck loop上の局面ではない。
+						removed.push_back(BookNodeIndex(node_index));
+
+					Next:;
 					}
-					// 2手先にcheck loop上の局面が見つからなかった。
-					// ゆえに、元のnodeはcheck loop上の局面ではない。
-					node.check_loop = false;
-					updated++;
-					continue;
+				});
 
-				Next:;
+				// 今回更新されたnodeの個数
+				u64 updated = 0;
+				for (auto& removed : removed_nodes)
+				{
+					for (auto node_index : removed)
+						book_nodes[node_index].check_loop = false;
+					updated += removed.size();
 				}
+
 				progress.check(i);
 				if (updated == 0)
 					break;
@@ -1358,20 +1977,22 @@ namespace MakeBook2025
 
 			// サイクルになっているノードのみを千日手スコアで初期化する。
 			// サイクルになっていなければ、remove_const_nodes()でconst node化されているはず。
-			for (size_t i = 0 ; i < book_nodes.size() ; ++i)
-			{
-				auto& node = book_nodes[i];
-				if (!node.const_node)
+			parallel_for(book_nodes.size(), [&](size_t, size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i)
 				{
-					if (!node.check_loop)
-						// 通常の(連続王手の千日手ではない)千日手なら0で初期化。
-						node.vd = ValueDepth(0, BOOK_DEPTH_MAX);
-					else
-						// 連続王手の千日手であるなら、王手されているなら(parent用のvdは)-INF,王手されてないなら+INFで初期化。
-						node.vd = ValueDepth(node.checked ? BOOK_VALUE_MIN : BOOK_VALUE_MAX, BOOK_DEPTH_MAX);
+					auto& node = book_nodes[i];
+					if (!node.const_node)
+					{
+						if (!node.check_loop)
+							// 通常の(連続王手の千日手ではない)千日手なら0で初期化。
+							node.vd = ValueDepth(0, BOOK_DEPTH_MAX);
+						else
+							// 連続王手の千日手であるなら、王手されているなら(parent用のvdは)-INF,王手されてないなら+INFで初期化。
+							node.vd = ValueDepth(node.checked ? BOOK_VALUE_MIN : BOOK_VALUE_MAX, BOOK_DEPTH_MAX);
+					}
 				}
-				progress.check(i);
-			}
+			});
+			progress.check(book_nodes.size() - 1);
 		}
 
 		// このnodeの内容を出力する。(debug用)
@@ -1403,30 +2024,63 @@ namespace MakeBook2025
 		//   今回更新されたノード数。
 		u64 propagate_all_nodes_once()
 		{
-			// 今回更新されたnode数
-			u64 nodes_count = 0;
-			for (BookNodeIndex i = 0 ; i < BookNodeIndex(book_nodes.size()) ; ++i)
+			// 📝 1スレッドの時は、従来通り更新中のvdを参照しながら先頭から順番に更新する。(Gauss-Seidel法)
+			//     今回の呼び出しで更新された子nodeのvdがすぐに親nodeに伝播するので、収束が速い。
+			//
+			//     複数スレッドの時は、子nodeのvdは、すべて今回の呼び出しの開始時点のもの(prev_vds)を参照する。(Jacobi法)
+			//     ⇨ 更新中のvdを参照すると、スレッドの担当範囲の区切り方によって伝播の順番が変わり、
+			//       千日手サイクル絡みの局面の結果がスレッド数に依存してしまう。
+			//       こうしておけば、スレッド数(2以上)によらず同じ定跡が書き出される。
+			//     ⚠ 1回の呼び出しで1手分しか伝播しないので、1スレッドの時より、収束に要する回数は増える。
+
+			const bool jacobi = thread_num() > 1;
+			if (jacobi)
 			{
-				auto& node = book_nodes[i];
+				prev_vds.resize(book_nodes.size());
+				parallel_for(book_nodes.size(), [&](size_t, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i)
+						prev_vds[i] = book_nodes[i].vd;
+				});
+			}
 
-				// const node　⇨　vdの値が変わらないので更新は無駄
-				// check loop  ⇨  このあとdfsで更新するのでここで更新するとおかしくなる
-				if (node.const_node || node.check_loop)
-					continue;
+			vector<u64> updated(thread_num());
 
-				auto best = bestvd_for_parent(node);
+			parallel_for(book_nodes.size(), [&](size_t thread_id, size_t begin, size_t end) {
 
-				// これは循環ではないものが絡んだためにBOOK_DEPTH_MAXになっていないだけで、
-				// 実際は循環であると思う。
-				if (best.depth > BOOK_MAX_PLY)
-					best.depth = BOOK_DEPTH_MAX;
+				auto child_vd = [&](BookNodeIndex next) -> const ValueDepth& {
+					return jacobi ? prev_vds[next] : book_nodes[next].vd;
+				};
 
-				// 前回からvdが変化した箇所のカウント。
-				nodes_count += node.vd != best;
+				// 今回更新されたnode数
+				u64 nodes_count = 0;
+				for (size_t i = begin ; i < end ; ++i)
+				{
+					auto& node = book_nodes[i];
 
-				// vdを更新する。
-				node.vd = best;
-			}
+					// const node　⇨　vdの値が変わらないので更新は無駄
+					// check loop  ⇨  このあとdfsで更新するのでここで更新するとおかしくなる
+					if (node.const_node || node.check_loop)
+						continue;
+
+					auto best = bestvd_for_parent(node, child_vd);
+
+					// これは循環ではないものが絡んだためにBOOK_DEPTH_MAXになっていないだけで、
+					// 実際は循環であると思う。
+					if (best.depth > BOOK_MAX_PLY)
+						best.depth = BOOK_DEPTH_MAX;
+
+					// 前回からvdが変化した箇所のカウント。
+					nodes_count += node.vd != best;
+
+					// vdを更新する。
+					node.vd = best;
+				}
+				updated[thread_id] = nodes_count;
+			});
+
+			u64 nodes_count = 0;
+			for (auto c : updated)
+				nodes_count += c;
 
 			//cout << nodes_count << endl;
 
@@ -1514,6 +2168,8 @@ namespace MakeBook2025
 					break;
 			}
 			progress.check(BOOK_MAX_PLY + 100);
+
+			decltype(prev_vds)(prev_vds.get_allocator()).swap(prev_vds);
 		}
 
 		SmallVector<BookMove> make_output_moves(BookNode& book_node)
@@ -1576,14 +2232,14 @@ namespace MakeBook2025
 
 		// ペタショック化した定跡ファイルを書き出す。
 		//	shrink : bestvalueの指し手のみを書き出す。
-		Tools::Result write_peta_shock_book(std::string writebook_path, std::vector<BookNode>& book_nodes)
+		Tools::Result write_peta_shock_book(std::string writebook_path, BookNodes& book_nodes)
 		{
 			// 通常のpeta_shockコマンド時の処理。(peta_shock_nextコマンドではなく)
 
 			// メモリ上の定跡DBを再構成。
 			// この時点でもうhash_key_to_index不要なので解放する。
-			// (clear()では解放されないので、swap trickを用いる。)
-			HashKey2Index().swap(this->hashkey_to_index);
+			hashkey_to_index.release();
+			hashkey_sorted_index.release();
 
 			if (is_ybb_book(writebook_path))
 				return write_peta_shock_ybb_book(writebook_path, book_nodes);
@@ -1591,7 +2247,7 @@ namespace MakeBook2025
 			return write_peta_shock_db_book(writebook_path, book_nodes);
 		}
 
-		Tools::Result write_peta_shock_db_book(std::string writebook_path, std::vector<BookNode>& book_nodes)
+		Tools::Result write_peta_shock_db_book(std::string writebook_path, BookNodes& book_nodes)
 		{
 			// progress表示用
 			Tools::ProgressBar progress;
@@ -1660,7 +2316,7 @@ namespace MakeBook2025
 			return Tools::Result::Ok();
 		}
 
-		Tools::Result write_peta_shock_ybb_book(std::string writebook_path, std::vector<BookNode>& book_nodes)
+		Tools::Result write_peta_shock_ybb_book(std::string writebook_path, BookNodes& book_nodes)
 		{
 			cout << "Write to a book DB  : " << endl;
 
@@ -1777,6 +2433,20 @@ namespace MakeBook2025
 			// 合流チェックによって合流させた指し手の数。
 			cout << "converged_moves    : " << converged_moves << endl;
 
+			// externalモードで用いたarenaのファイルサイズ
+			if (arena)
+				cout << "arena file size    : " << arena->mapped_size() / (1024 * 1024) << " [MB]" << endl;
+
+			// 各処理の所要時間
+			cout << "[ PetaShock Timing ] threads = " << thread_num() << endl;
+			TimePoint total = 0;
+			for (const auto& [phase, elapsed] : phase_times)
+			{
+				cout << std::left << std::setw(19) << phase << ": " << elapsed << " [ms]" << endl;
+				total += elapsed;
+			}
+			cout << std::left << std::setw(19) << "total" << ": " << total << " [ms]" << endl;
+
 			cout << endl << "Making a peta-shock book has been completed." << endl;
 		}
 
@@ -1784,19 +2454,41 @@ namespace MakeBook2025
 
 		// -- 定跡データ
 
+		// externalモードの時に、book_nodesなどを確保するarena。
+		// ⚠ book_nodesなどより先に解体されてはならないので、それらより前に宣言しておく。
+		std::unique_ptr<MappedArena> arena;
+
 		// 定跡本体
-		vector<BookNode> book_nodes;
+		BookNodes book_nodes;
 
 		// 局面のHASH_KEYからBookMoveIndexへのmapper
 		// ただし、flipして後手番にしたhashkeyを登録してある。
 		// ⇨　後手の局面はflipして先手の局面として格納している。ゆえに、格納されているのはすべて先手の局面であり、
 		// 　そこから1手進めると後手の局面となる。この時に、hash keyから既存の局面かどうかを調べたいので…。
-		using HashKey2Index = unordered_map<Key, BookNodeIndex>;
-		HashKey2Index hashkey_to_index;
+		ShardedHashKey2Index hashkey_to_index;
+
+		// externalモードの時は、hashkey_to_indexの代わりにこちらを用いる。
+		SortedHashKey2Index hashkey_sorted_index;
 
 		// fast == trueのときは、テンポラリファイルではなくここに元の定跡ファイル上のSFEN文字列を溜めておく。
 		vector<string> original_sfens;
 
+		// read_book()で読み込んだsfenのうち、まだhash keyを求めていないもの。
+		// 💡 pos.set()が重いので、READ_BATCH_SIZE個溜まるごとにスレッド並列で処理する。
+		vector<string> pending_sfens;
+		static constexpr size_t READ_BATCH_SIZE = 1 << 18;
+
+		// propagate_all_nodes_once()の開始時点の各nodeのvd。複数スレッドの時は子nodeのvdはここから参照する。
+		vector<ValueDepth, NodeAllocator<ValueDepth>> prev_vds;
+
+		// -- 並列化
+
+		// 並列化に用いるスレッド
+		ThreadPool& threads;
+
+		// 各処理の名前と所要時間[ms]
+		vector<std::pair<string, TimePoint>> phase_times;
+
 		// check loop上の局面のBookNodeIndex
 		vector<BookNodeIndex> check_loop_nodes;
 
@@ -1834,6 +2526,10 @@ namespace MakeBook2025
 		// テンポラリファイルを書き出さない。
 		bool fast;
 
+		// BookNodeの配列などを、ファイルにmapしたarenaに確保する。
+		// 物理メモリに収まらない定跡を処理する時に用いる。
+		bool external;
+
 	};
 
 } // namespace MakeBook2025
@@ -1842,7 +2538,7 @@ namespace Book
 {
 	// 2025年以降に作ったmakebook拡張コマンド。
 	// この拡張コマンドを処理したら、この関数は非0を返す。
-	int makebook2025(std::istringstream& is, const std::string& token, const OptionsMap& options)
+	int makebook2025(std::istringstream& is, const std::string& token, const OptionsMap& options, ThreadPool& threads)
     {
 		if (token == "peta_shock") {
 
@@ -1854,9 +2550,11 @@ namespace Book
 			//   オプション指定
 			//		shrink : 最善手しか書き出さない
 			//      fast   : テンポラリファイルを書き出さない。(メモリ上に格納するのでその分だけメモリを消費する。)
-			//     ⇨  fastの時は、思考エンジンオプションのThreadsで指定したスレッド数で並列化して合流チェックなどを行う。
-			//		事前に "Threads 32"などとしてスレッド数を指定しておいてください。
-			MakeBook2025::PetaShock ps;
+			//      external : 局面と指し手、局面のhash keyのindexを、書き出す定跡ファイルと同じフォルダの一時ファイルにmapして保持する。
+			//                 物理メモリより大きな定跡を処理する時に用いる。(fastとは併用できない)
+			//   局面のhash keyの計算、合流チェック、後退解析は、思考エンジンオプションのThreadsで指定したスレッド数で並列化して行う。
+			//   事前に "setoption name Threads value 32"などとしてスレッド数を指定しておいてください。
+			MakeBook2025::PetaShock ps(threads);
 			auto book_dir = options["BookDir"];
 			ps.make_book(is, book_dir);
 			return 1;
@@ -243,6 +243,10 @@
 // ※　Mac専用。
 //#define COREML
 
+// ふかうら王で外部ライブラリを使わずにCPUだけで推論する時はこちら。
+// ※　ONNX形式のモデルファイルを自前で読み込む。
+//#define NN_CPU
+
 // ---------------------
 // 探索パラメーターの自動調整用
 // ---------------------
@@ -283,6 +287,16 @@
 //#define ENABLE_TEST_CMD
 
 
+// 探索部(yaneuraou-search.cpp)の統計情報を集計する。
+// TT hit率、null moveの枝刈りの成功率、LMRの再探索率、qsearch()のnodeの割合、
+// evaluate()の呼び出し回数とaccumulatorのrefresh回数、1手詰め判定のhit率などをスレッドごとに数える。
+// 集計結果は"stats"コマンドで出力される。(オプションのSearchStatsInfoをtrueにすると反復深化の1回ごとにも出力される)
+// 💡 定義しない時は集計のコードは一切生成されないので、探索速度には影響しない。
+//     Makefileで SEARCH_STATS = ON にしても良い。
+
+//#define USE_SEARCH_STATS
+
+
 // ---------------------
 // その他、オプション機能
 // ---------------------
@@ -459,6 +473,18 @@ constexpr int MAX_PLY_NUM = 246;
 	// 勝率の集計を行う型としてdouble型を用いる。
 	#define WIN_TYPE_DOUBLE
 
+	// 探索木のNodeを省メモリなlayoutにする。
+	// ChildNode::nnrateを16bit浮動小数点数で持ち、子ノードへのポインタを32bitのhandle(NodePtr)にして
+	// ChildNodeに埋め込む。(子ノードへのポインタ配列を別途確保しない)
+	// 1 edgeあたり32 bytes → 24 bytesになるが、handleで辿る分だけ少し遅くなる。
+	//#define DLSHOGI_COMPACT_NODE
+
+	// 探索木を、同一局面のNodeを共有するDAGにする。
+	// 手順前後で同じ局面に合流した時に、既存のNodeを子ノードとして共有するので、NNの推論回数と探索木のメモリが減る。
+	// 統計(move_count,win)はedge(ChildNode)ごとに持っているので、UCB値の計算はそのままで良い。
+	// Nodeに参照カウントと局面のkeyを持たせるので、1 Nodeあたり8 bytes増える。
+	//#define DLSHOGI_DAG
+
 	 //#define ASSERT_LV 3
 #endif
 
@@ -731,6 +757,8 @@ constexpr bool pretty_jp = false;
 		#define EVAL_TYPE_NAME "TRT-" EVAL_DEEP
 	#elif defined(COREML)
 		#define EVAL_TYPE_NAME "CoreML-" EVAL_DEEP
+	#elif defined(NN_CPU)
+		#define EVAL_TYPE_NAME "CPU-" EVAL_DEEP
 	#endif
 
 #else
@@ -273,7 +273,10 @@ void Engine::isready()
 std::uint64_t Engine::perft(const std::string& fen, Depth depth /*, bool isChess960 */) {
 	verify_networks();
 
-	return Benchmark::perft(fen, depth /*, isChess960 */);
+	// perft用の置換表は"USI_Hash"の値だけ確保する。
+	const size_t hash_mb = options.count("USI_Hash") ? size_t(int64_t(options["USI_Hash"])) : Benchmark::PERFT_HASH_MB;
+
+	return Benchmark::perft(fen, depth, threads, hash_mb /*, isChess960 */);
 }
 
 
@@ -268,6 +268,44 @@ public:
         message = "qsearch_psv is not supported by this engine.";
         return false;
     }
+
+    // USI拡張コマンド "tt_save", "tt_load" 用のhook。
+    // 置換表の内容をfilenameに保存する/filenameから読み込む。
+    // 置換表を持たないEngine派生classではfalseを返す。
+    virtual bool tt_save(const std::string& filename, std::string& message) {
+        message = "tt_save is not supported by this engine.";
+        return false;
+    }
+    virtual bool tt_load(const std::string& filename, std::string& message) {
+        message = "tt_load is not supported by this engine.";
+        return false;
+    }
+
+    // "bench"コマンドの制限の種類に"tt_latency"を指定した時に呼び出されるhook。
+    // 置換表のNUMAノード間のアクセスのlatencyを計測して、結果をmessageに返す。
+    virtual bool tt_latency_bench(uint64_t probes, std::string& message) {
+        message = "tt_latency is not supported by this engine.";
+        return false;
+    }
+
+    // "bench"コマンドの制限の種類に"mcts"を指定した時に呼び出されるhook。
+    // start == trueで探索部の計測を開始し、start == falseで計測を終了して、その結果をmessageに返す。
+    virtual bool mcts_bench(bool start, std::string& message) {
+        message = "mcts bench is not supported by this engine.";
+        return false;
+    }
+
+    // "gc_stats"コマンド。探索木のGCの状況(開放待ちのNode数、開放速度など)をmessageに返す。
+    virtual bool gc_stats(std::string& message) {
+        message = "gc_stats is not supported by this engine.";
+        return false;
+    }
+
+    // "stats"コマンド。直前の探索の統計情報(USE_SEARCH_STATS)をmessageに返す。
+    virtual bool search_stats(std::string& message) {
+        message = "stats is not supported by this engine.";
+        return false;
+    }
 #endif
 
 #if STOCKFISH
@@ -591,6 +629,20 @@ class EngineWrapper: public IEngine {
                              std::string&       message) override {
         return engine->qsearch_psv(inputPath, outputPath, workerCount, message);
     }
+    virtual bool tt_save(const std::string& filename, std::string& message) override {
+        return engine->tt_save(filename, message);
+    }
+    virtual bool tt_load(const std::string& filename, std::string& message) override {
+        return engine->tt_load(filename, message);
+    }
+    virtual bool tt_latency_bench(uint64_t probes, std::string& message) override {
+        return engine->tt_latency_bench(probes, message);
+    }
+    virtual bool mcts_bench(bool start, std::string& message) override {
+        return engine->mcts_bench(start, message);
+    }
+    virtual bool gc_stats(std::string& message) override { return engine->gc_stats(message); }
+    virtual bool search_stats(std::string& message) override { return engine->search_stats(message); }
 #endif
 
     virtual void              add_options() override { return engine->add_options(); }
@@ -2,6 +2,8 @@
 
 #if defined(YANEURAOU_ENGINE_DEEP)
 
+#include <numeric>
+
 #include "FukauraOuEngine.h"
 
 #include "../../position.h"
@@ -14,6 +16,7 @@
 
 #include "../../eval/deep/nn.h"
 #include "../../eval/deep/nn_types.h"
+#include "../../eval/deep/nn_mock.h"
 
 using namespace YaneuraOu;
 
@@ -61,7 +64,28 @@ void FukauraOuEngine::add_nn_options()
 #elif defined(COREML)
     // M1チップで8程度でスループットが飽和する。
     options.add("DNN_Batch_Size", Option(8, 1, 1024));
+#elif defined(NN_CPU)
+    // 各探索スレッドが1コアずつ使って推論するので、batchは小さめで良い。
+    options.add("DNN_Batch_Size", Option(8, 1, 1024));
+#endif
+
+    // 各探索スレッドが持つbatchのバッファの数。
+    // 2以上にすると、あるbatchを推論している間に次のbatchの探索を行う。(推論と探索が重なる)
+    // 💡 TensorRTでは推論slot(optimization profile)を(スレッド数×この値)だけ確保する。
+#if defined(ONNXRUNTIME)
+    // CPUで推論している時は、探索側のCPU処理を推論の裏に隠したいので2にしておく。
+    options.add("DNN_Pipeline", Option(2, 1, 4));
+#else
+    options.add("DNN_Pipeline", Option(1, 1, 4));
 #endif
+
+    // 推論サーバーを用いるか。
+    // trueにすると、各探索スレッドのbatchをGPUごとに一つのサーバースレッドがまとめてDNN_Batch_Size局面にして推論する。
+    // このとき、各探索スレッドが1つのbatchに積む局面数は DNN_Batch_Size / UCT_Threads になる。
+    options.add("DNN_Server", Option(false));
+
+    // 推論サーバーが最初のbatchを受け取ってから、他のスレッドのbatchを待つ最大時間[us]
+    options.add("DNN_Server_Latency", Option(1000, 0, 100000));
 }
 
 // ふかうら王のエンジンオプションを生やす
@@ -131,11 +155,20 @@ void FukauraOuEngine::init_gpu() {
     // DNNのbatch sizeの設定。
     int dnn_batch_size = int(options["DNN_Batch_Size"]);
 
+    // 各探索スレッドが持つbatchのバッファの数。
+    int dnn_pipeline_depth = int(options["DNN_Pipeline"]);
+
+    // 推論サーバーのbatchを待つ最大時間。推論サーバーを用いないなら-1。
+    int dnn_server_latency = options["DNN_Server"] ? int(options["DNN_Server_Latency"]) : -1;
+
     // 評価関数モデルのPATH。
     auto eval_dir      = options["EvalDir"];
     auto abs_eval_path = Path::Combine(Directory::GetBinaryFolder(), eval_dir);
     auto model_name    = options["DNN_Model"];
-    auto model_path    = Path::Combine(abs_eval_path, model_name);
+    // 💡 "mock"で始まるモデル名は擬似的なNN(NNMock)なのでファイルは存在しない。そのまま渡す。
+    auto model_path    = Eval::dlshogi::NNMock::is_mock_model(model_name)
+                         ? std::string(model_name)
+                         : Path::Combine(abs_eval_path, model_name);
     std::string model_architecture = options["ModelArchitecture"];
 
     if (!Eval::dlshogi::set_model_architecture(model_architecture))
@@ -151,13 +184,14 @@ void FukauraOuEngine::init_gpu() {
               << sync_endl;
 
     // modelファイルが存在することは事前に確認しておく。
-    if (!Path::Exists(model_path))
+    if (!Eval::dlshogi::NNMock::is_mock_model(model_path) && !Path::Exists(model_path))
     {
         sync_cout << "Error! : " << model_path << " file not found" << sync_endl;
         Tools::exit();
     }
 
-    searcher.InitGPU(model_path, model_architecture, thread_settings, dnn_batch_size);
+    searcher.InitGPU(model_path, model_architecture, thread_settings, dnn_batch_size, dnn_pipeline_depth,
+                     dnn_server_latency);
 }
 
 
@@ -176,14 +210,22 @@ void FukauraOuEngine::isready() {
     searcher.book.read_book();
 
     // -----------------------
-    //   GPUの初期化
+    //   GPUと探索部の初期化
     // -----------------------
 
-	init_gpu();
+	init_searcher();
 
-    // -----------------------
-    //   探索部の初期化
-    // -----------------------
+	// 🤔 "isready"に対してnode limit = 1 , batch_size = 128 で探索したほうがいいかも。(dlshogiはそうなっている)
+
+	// 基底classのisready()の呼び出し。
+	Engine::isready();
+}
+
+// "isready"タイミングで行うGPUと探索部の初期化。
+void FukauraOuEngine::init_searcher() {
+
+	// GPUの初期化
+	init_gpu();
 
 	// 探索部の初期化
 	searcher.InitializeUctSearch();
@@ -191,10 +233,8 @@ void FukauraOuEngine::isready() {
 	// PV lineの詰み探索の設定
 	searcher.SetPvMateSearch(int(options["PV_Mate_Search_Threads"]), int(options["PV_Mate_Search_Nodes"]));
 
-	// 🤔 "isready"に対してnode limit = 1 , batch_size = 128 で探索したほうがいいかも。(dlshogiはそうなっている)
-
-	// 基底classのisready()の呼び出し。
-	Engine::isready();
+	// GCのスレッド数の設定
+	searcher.SetGarbageCollector(int(options["GC_Threads"]));
 }
 
 // 🌈 "ponderhit"に対する処理。
@@ -215,6 +255,47 @@ std::string FukauraOuEngine::get_engine_name() const { return "FukauraOu"; }
 // エンジン作者名の変更
 std::string FukauraOuEngine::get_engine_author() const { return "Tadao Yamaoka , yaneurao"; }
 
+// "gc_stats"コマンド。GCの状況を返す。
+bool FukauraOuEngine::gc_stats(std::string& message) {
+    message = searcher.GarbageCollectorStats();
+    return true;
+}
+
+// "bench"コマンドで"mcts"を指定した時の探索部の計測の開始と終了。
+bool FukauraOuEngine::mcts_bench(bool start, std::string& message) {
+
+    // 探索中に計測結果を書き換えるわけにはいかないので、探索の終了を待つ。
+    wait_for_search_finished();
+
+    if (start)
+    {
+        // 📝 "bench"コマンドは"isready"を済ませてから"setoption name UCT_Threads"を送ってくるので、
+        //     UctSearcherの数がUCT_Threadsの設定と異なっていたら、ここで初期化しなおして反映させる。
+        if (get_thread_settings() != searcher.ThreadSettings())
+            init_searcher();
+
+        searcher.ResetSearchProfile();
+        searcher.search_profiling = true;
+        message.clear();
+    }
+    else
+    {
+        searcher.search_profiling = false;
+        message = "MCTS search profile\n" + searcher.SearchProfileReport();
+
+        // 要求したスレッド数で計測できたかを確認する。
+        const auto   settings  = get_thread_settings();
+        const size_t requested = size_t(std::accumulate(settings.begin(), settings.end(), 0));
+        if (searcher.UctSearcherCount() != requested)
+        {
+            message += "\nError! : searchers = " + std::to_string(searcher.UctSearcherCount())
+                     + " , but UCT_Threads requests " + std::to_string(requested) + " searchers.";
+            return false;
+        }
+    }
+    return true;
+}
+
 
 // 🌈 やねうら王フレームワークと、dlshogiの橋渡しを行うコード 🌈
 
@@ -453,8 +534,8 @@ void dfs_for_sfen(Node* node, TopVisited& tv , int ply , bool same_color, SfenNo
 
 		// n番目以上なのでこの訪問回数を追加する。
 		if (   move_count >= tv.nth_nodes()
-			&& node->child_nodes          != nullptr
-			&& node->child_nodes[i].get() != nullptr)
+			&& node->child_nodes
+			&& node->child_nodes[i])
 		{
 			// このnodeを再帰的に辿る必要がある。
 			// move_count以下のものは辿らない、すなわち枝刈りする。
@@ -70,6 +70,12 @@ class FukauraOuEngine: public YaneuraOu::Engine {
     // エンジン作者名の変更。
     virtual std::string get_engine_author() const override;
 
+	// "bench"コマンドで"mcts"を指定した時の探索部の計測の開始と終了。
+	virtual bool mcts_bench(bool start, std::string& message) override;
+
+	// "gc_stats"コマンド。GC(NodeGarbageCollector)の状況を返す。
+	virtual bool gc_stats(std::string& message) override;
+
 	// dlshogiの探索部本体
     DlshogiSearcher searcher;
 
@@ -80,6 +86,10 @@ class FukauraOuEngine: public YaneuraOu::Engine {
 	// "isready"タイミングで行うGPUの初期化。
 	void init_gpu();
 
+	// "isready"タイミングで行うGPUと探索部の初期化。
+	// 💡 "mcts_bench start"でUCT_Threadsの変更を反映させる時にも呼び出す。
+	void init_searcher();
+
 	// "Max_GPU","Disabled_GPU"と"UCT_Threads"の設定値から、各GPUのスレッド数の設定を返す。
     std::vector<int> get_thread_settings();
 
@@ -0,0 +1,111 @@
+﻿#include "NNCache.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "../../misc.h"
+#include "../../usi.h"
+#include "Node.h"
+
+namespace dlshogi {
+
+void NNCache::resize(size_t mb)
+{
+	if (mb == size_mb)
+		return;
+
+	entries.reset();
+	entry_count = 0;
+	size_mb     = mb;
+
+	if (mb == 0)
+		return;
+
+	const size_t count = mb * 1024 * 1024 / sizeof(Entry);
+	entries = make_unique_large_page<Entry[]>(count);
+	if (!entries)
+	{
+		sync_cout << "info string Error! : Failed to allocate " << mb << "MB for DNN_Cache." << sync_endl;
+		size_mb = 0;
+		return;
+	}
+	entry_count = count;
+	clear();
+}
+
+void NNCache::clear()
+{
+	if (entry_count)
+		std::memset(static_cast<void*>(entries.get()), 0, entry_count * sizeof(Entry));
+	reset_stats();
+}
+
+u16 NNCache::moves_hash_of(const ChildNode* uct_child, ChildNumType child_num)
+{
+	u32 h = child_num;
+	for (ChildNumType i = 0; i < child_num; ++i)
+		h = h * 0x9E3779B1u + uct_child[i].move.to_u32();
+	return u16(h ^ (h >> 16));
+}
+
+bool NNCache::probe(Key64 key, const ChildNode* uct_child, ChildNumType child_num, float& value, float* policy)
+{
+	if (!entry_count || child_num > MAX_CHILDREN)
+		return false;
+
+	probes.fetch_add(1, std::memory_order_relaxed);
+
+	const u16 moves_hash = moves_hash_of(uct_child, child_num);
+	const size_t index = index_of(key);
+	Entry& e = entries[index];
+	{
+		std::lock_guard<std::mutex> lock(mutex_of(index));
+		if (e.key != key || e.child_num != child_num || e.moves_hash != moves_hash)
+			return false;
+
+		value = e.value;
+		for (ChildNumType i = 0; i < child_num; ++i)
+			policy[i] = e.policy[i];
+	}
+
+	// 量子化したものを戻して、合計が1になるように正規化しなおす。
+	float sum = 0;
+	for (ChildNumType i = 0; i < child_num; ++i)
+		sum += policy[i];
+	if (sum > 0)
+	{
+		const float inv = 1.0f / sum;
+		for (ChildNumType i = 0; i < child_num; ++i)
+			policy[i] *= inv;
+	}
+
+	hits.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void NNCache::store(Key64 key, const ChildNode* uct_child, ChildNumType child_num, float value, const float* policy)
+{
+	if (!entry_count || child_num == 0 || child_num > MAX_CHILDREN)
+		return;
+
+	u16 q[MAX_CHILDREN];
+	for (ChildNumType i = 0; i < child_num; ++i)
+		q[i] = u16(std::lround(std::clamp(policy[i], 0.0f, 1.0f) * 65535.0f));
+	const u16 moves_hash = moves_hash_of(uct_child, child_num);
+
+	const size_t index = index_of(key);
+	Entry& e = entries[index];
+	std::lock_guard<std::mutex> lock(mutex_of(index));
+	e.key        = key;
+	e.value      = value;
+	e.child_num  = child_num;
+	e.moves_hash = moves_hash;
+	std::memcpy(e.policy, q, sizeof(u16) * child_num);
+}
+
+} // namespace dlshogi
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
@@ -0,0 +1,98 @@
+﻿#ifndef __NN_CACHE_H_INCLUDED__
+#define __NN_CACHE_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <atomic>
+#include <mutex>
+
+#include "../../extra/key128.h"
+#include "../../memory.h"
+#include "../../misc.h"
+#include "dlshogi_types.h"
+
+namespace dlshogi {
+
+	using namespace YaneuraOu;
+
+	struct ChildNode;
+
+	// NNの推論結果のcache
+	//
+	// 📝 同じ局面に合流(transposition)した時や、ReleaseChildrenExceptOne()で木の一部を捨てたあとに
+	//     同じ局面を再度展開した時に、nn_forward()を呼び出さずに済むように、
+	//     局面のhash key(Position::key()の下位64bit)に対して、valueと各合法手のpolicy(softmax後)を記録しておく。
+	//
+	// 💡 policyはu16に量子化して持つ。(65535 = 100%)
+	//     child_numがMAX_CHILDRENを超える局面はcacheしない。(そのような局面は稀である)
+	//     ExpandNode()で生成される指し手の順番は、同じ局面・同じ生成条件なら一意に決まるが、
+	//     GenerateAllLegalMovesの変更などで変わりうるので、指し手列のhashも照合する。
+	class NNCache
+	{
+	public:
+		// 1局面あたりに記録できる子ノードの最大数
+		// 💡 Entryがちょうど256 bytesになるように調整してある。
+		static constexpr ChildNumType MAX_CHILDREN = 120;
+
+		// cacheのサイズを[MB]単位で設定する。0ならcacheを使わない。
+		// サイズが前回と同じなら何もしない。(clearもしない)
+		void resize(size_t mb);
+
+		// cacheの内容をすべて消去する。
+		void clear();
+
+		// cacheが有効であるか。
+		bool enabled() const { return entry_count != 0; }
+
+		// cacheを調べる。
+		//   key       : 局面のhash key
+		//   uct_child : 展開済みの子ノード(指し手の照合に用いる)
+		//   child_num : 子ノードの数
+		//   value     : [Out] hitした時にNNのvalueが返る。
+		//   policy    : [Out] hitした時に各子ノードのpolicy(softmax後)が返る。child_num個の要素が必要。
+		// 返し値 : hitしたならtrue
+		bool probe(Key64 key, const ChildNode* uct_child, ChildNumType child_num, float& value, float* policy);
+
+		// cacheに書き込む。引数の意味はprobe()と同じ。
+		void store(Key64 key, const ChildNode* uct_child, ChildNumType child_num, float value, const float* policy);
+
+		// 統計情報
+		u64 get_probes() const { return probes.load(std::memory_order_relaxed); }
+		u64 get_hits()   const { return hits  .load(std::memory_order_relaxed); }
+		void reset_stats() { probes = 0; hits = 0; }
+
+	private:
+		struct Entry
+		{
+			Key64        key;
+			float        value;
+			ChildNumType child_num;
+			u16          moves_hash;
+			u16          policy[MAX_CHILDREN];
+		};
+		static_assert(sizeof(Entry) == 256);
+
+		// 子ノードの指し手列から照合用のhashを求める。
+		static u16 moves_hash_of(const ChildNode* uct_child, ChildNumType child_num);
+
+		size_t index_of(Key64 key) const { return size_t(mul_hi64(key, entry_count)); }
+		std::mutex& mutex_of(size_t index) { return mutexes[index & (MUTEX_NUM - 1)]; }
+
+		LargePagePtr<Entry[]> entries;
+		size_t entry_count = 0;
+		size_t size_mb     = 0;
+
+		// entryの読み書き用のmutex
+		// 💡 entryごとにmutexを持たせると大きくなりすぎるので、entryのindexから求めたmutexを使う。
+		static constexpr u64 MUTEX_NUM = 4096; // must be 2^n
+		std::mutex mutexes[MUTEX_NUM];
+
+		std::atomic<u64> probes = 0;
+		std::atomic<u64> hits   = 0;
+	};
+
+} // namespace dlshogi
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
+#endif // ndef __NN_CACHE_H_INCLUDED__
@@ -2,6 +2,13 @@
 #if defined(YANEURAOU_ENGINE_DEEP)
 #include "../../misc.h"
 
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#if defined(DLSHOGI_DAG)
+#include <unordered_set>
+#endif
+
 namespace dlshogi {
 
 	// --- struct Node
@@ -26,13 +33,14 @@ namespace dlshogi {
 					// 子ノードへのedgeは見つかっているけど実体がまだ。
 					if (!child_node)
 	                    // 新しいノードを作成する
-	                    child_node = std::make_unique<Node>();
+	                    child_node = MakeNode();
 
 					// 0番目の要素に移動させる。
 					if (i != 0) {
 						child[0]       = std::move(uct_child);
 						child_nodes[0] = std::move(child_node);
 					}
+					child[0].SetExpanded();
 				}
 				else {
 					// 子ノードを削除（ガベージコレクタに追加）
@@ -50,7 +58,8 @@ namespace dlshogi {
 				// 子ノードが見つからなかった場合、新しいノードを作成する
 				CreateSingleChildNode(move);
 				InitChildNodes();
-				return (child_nodes[0] = std::make_unique<Node>()).get();
+				child[0].SetExpanded();
+				return (child_nodes[0] = MakeNode()).get();
 			}
 		}
 		else {
@@ -58,8 +67,169 @@ namespace dlshogi {
 			CreateSingleChildNode(move);
 			// 子ノードへのポインタ配列を初期化する
 			InitChildNodes();
-			return (child_nodes[0] = std::make_unique<Node>()).get();
+			child[0].SetExpanded();
+			return (child_nodes[0] = MakeNode()).get();
+		}
+	}
+
+	// 子ノードへのポインタ配列が初期化されていなければ初期化する。
+	bool Node::EnsureChildNodes()
+	{
+		u8 state = expand_state.load(std::memory_order_acquire);
+		if (state == EXPANDED)
+			return true;
+
+		// UNEXPANDED → EXPANDINGにできたスレッドが初期化する。
+		if (state == UNEXPANDED
+			&& expand_state.compare_exchange_strong(state, EXPANDING, std::memory_order_acquire))
+		{
+			InitChildNodes(); // ここでEXPANDEDになる。
+			return true;
+		}
+
+		// 他のスレッドが初期化中。
+		return false;
+	}
+
+	// i番目の子ノードを作成する。
+	Node* Node::ExpandChildNode(int i, ExpandProfile& profile, Key dag_key)
+	{
+		ASSERT_LV3(child[i].expand_state.load(std::memory_order_relaxed) == EXPANDING && !child_nodes[i]);
+
+		Node* node = nullptr;
+
+#if defined(DLSHOGI_DAG)
+		// 同一局面のNodeがあれば、それを共有する。
+		if (Node* shared = dag_key ? NodeTable::Acquire(dag_key) : nullptr)
+		{
+			child_nodes[i] = NodePtr(shared);
+			profile.transpositions++;
+		}
+		else
+#endif
+		{
+			node = CreateChildNode(i);
+			profile.expansions++;
+
+#if defined(DLSHOGI_DAG)
+			if (dag_key)
+			{
+				node->dag_key = dag_key;
+				NodeTable::Insert(dag_key, node);
+			}
+#endif
+		}
+
+		child[i].SetExpanded();
+		return node;
+	}
+
+#if defined(DLSHOGI_DAG)
+	// --- class NodeTable
+
+	NodeTable::Shard NodeTable::shards[NodeTable::SHARD_NUM];
+
+	// keyのNodeを探す。見つかれば参照カウントを1増やして返す。
+	Node* NodeTable::Acquire(Key key)
+	{
+		// 📝 参照カウントが0になったNodeは、Erase()でここから取り除かれるまでは開放されないので、
+		//     shardのmutexをlockしている間は、見つかったNodeにアクセスして良い。
+		Shard&                      shard = shard_of(key);
+		std::lock_guard<std::mutex> lk(shard.mutex);
+
+		auto it = shard.map.find(key);
+		if (it == shard.map.end() || !it->second->TryAddRef())
+			return nullptr;
+		return it->second;
+	}
+
+	// keyのNodeとしてnodeを登録する。
+	void NodeTable::Insert(Key key, Node* node)
+	{
+		Shard&                      shard = shard_of(key);
+		std::lock_guard<std::mutex> lk(shard.mutex);
+		shard.map[key] = node;
+	}
+
+	// keyのNodeとしてnodeが登録されていれば取り除く。
+	void NodeTable::Erase(Key key, const Node* node)
+	{
+		Shard&                      shard = shard_of(key);
+		std::lock_guard<std::mutex> lk(shard.mutex);
+
+		auto it = shard.map.find(key);
+		if (it != shard.map.end() && it->second == node)
+			shard.map.erase(it);
+	}
+
+	// 登録されているNodeの数
+	size_t NodeTable::Size()
+	{
+		size_t size = 0;
+		for (auto& shard : shards)
+		{
+			std::lock_guard<std::mutex> lk(shard.mutex);
+			size += shard.map.size();
 		}
+		return size;
+	}
+#endif
+
+	// --- struct TreeFootprint
+
+	// rootから辿れるすべてのNodeのメモリ使用量を集計する。
+	TreeFootprint MeasureTree(const Node* root)
+	{
+		TreeFootprint fp;
+		if (!root)
+			return fp;
+
+		// 木が深いことがあるので、再帰ではなく自前のstackで辿る。
+		std::vector<const Node*> stack = { root };
+#if defined(DLSHOGI_DAG)
+		std::unordered_set<const Node*> visited;
+#endif
+		while (!stack.empty())
+		{
+			const Node* node = stack.back();
+			stack.pop_back();
+
+#if defined(DLSHOGI_DAG)
+			if (!visited.insert(node).second)
+				continue;
+#endif
+
+			fp.nodes++;
+			fp.edges += NodeArenaArraySize(node->child.get());
+			fp.bytes += node->MemoryBytes();
+
+			if (node->child_nodes)
+				for (int i = 0; i < node->child_num; ++i)
+					if (node->child_nodes[i])
+						stack.push_back(node->child_nodes[i].get());
+		}
+		return fp;
+	}
+
+	// 集計結果を文字列化する。
+	std::string TreeFootprint::to_string() const
+	{
+		std::ostringstream os;
+		os << std::fixed << std::setprecision(2)
+		   << "tree               : nodes = " << nodes << " , edges = " << edges
+		   << " , memory = " << double(bytes) / (1024 * 1024) << "[MB]"
+		   << " (" << (nodes ? double(bytes) / nodes : 0.0) << "[bytes/node])"
+		   << " , arena reserved = " << double(NodeArena::ReservedBytes()) / (1024 * 1024) << "[MB]" << std::endl
+#if defined(DLSHOGI_DAG)
+		   << "DAG                : shared nodes in table = " << NodeTable::Size() << std::endl
+#endif
+#if defined(DLSHOGI_COMPACT_NODE)
+		   << "node layout        : compact"
+#else
+		   << "node layout        : default"
+#endif
+		   << " , Node = " << sizeof(Node) << "[bytes] , ChildNode = " << sizeof(ChildNode) << "[bytes]";
+		return os.str();
 	}
 
 	// --- class NodeTree
@@ -83,7 +253,7 @@ namespace dlshogi {
 		}
 
 		if (!game_root_node) {
-			game_root_node = std::make_unique<Node>();
+			game_root_node = MakeNode();
 			current_head   = game_root_node.get();
 		}
 
@@ -123,7 +293,7 @@ namespace dlshogi {
 				ASSERT_LV3(prev_head->child_num == 1);
 				auto& prev_uct_child_node = prev_head->child_nodes[0];
 				gc->AddToGcQueue(std::move(prev_uct_child_node));
-				prev_uct_child_node = std::make_unique<Node>();
+				prev_uct_child_node = MakeNode();
 				current_head = prev_uct_child_node.get();
 			}
 			else {
@@ -142,10 +312,217 @@ namespace dlshogi {
 		// ※　AddToGcQueue()はnullptrを渡しても良いことになっている。
 		gc->AddToGcQueue(std::move(game_root_node));
 
-		game_root_node = std::make_unique<Node>();
+		game_root_node = MakeNode();
 		current_head = game_root_node.get();
 	}
 
+	// --- class NodeGarbageCollector
+
+	namespace {
+		// 部分木のNode数の見積もり。そのNodeを訪問した回数とする。
+		s64 estimated_subtree_nodes(const Node* node) {
+			const NodeCountType move_count = node->move_count.load(std::memory_order_relaxed);
+			return move_count == NOT_EXPANDED ? 1 : std::max(s64(1), s64(move_count));
+		}
+
+		u64 gc_now_ns() {
+			return u64(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+	}
+
+	// GC対象に追加する。
+	void NodeGarbageCollector::AddToGcQueue(NodePtr node)
+	{
+		if (!node)
+			return;
+
+		pending_nodes += estimated_subtree_nodes(node.get());
+		{
+			std::lock_guard<std::mutex> lock(gc_mutex);
+			subtrees_to_gc.emplace_back(std::move(node));
+		}
+		gc_cv.notify_one();
+	}
+
+	// GCのworkerの数を設定する。
+	void NodeGarbageCollector::SetWorkerCount(size_t worker_count)
+	{
+		worker_count = std::max(size_t(1), worker_count);
+		if (worker_count == workers.size())
+			return;
+
+		StopWorkers();
+
+		stop        = false;
+		num_workers = worker_count;
+		workers.reserve(worker_count);
+		for (size_t i = 0; i < worker_count; ++i)
+			workers.emplace_back([this, i]() { Worker(i); });
+	}
+
+	// 全workerを停止させる。
+	void NodeGarbageCollector::StopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(gc_mutex);
+			stop = true;
+		}
+		gc_cv.notify_all();
+
+		for (auto& th : workers)
+			th.join();
+		workers.clear();
+		num_workers = 0;
+	}
+
+	// 探索中であるかを設定する。
+	void NodeGarbageCollector::SetSearching(bool b)
+	{
+		{
+			std::lock_guard<std::mutex> lock(gc_mutex);
+			searching = b;
+		}
+		// 探索が終わったなら、待機していたworkerを起こす。
+		if (!b)
+			gc_cv.notify_all();
+	}
+
+	// stackに積まれているNodeをkSliceNodes個まで開放する。
+	void NodeGarbageCollector::FreeSlice(std::vector<NodePtr>& stack)
+	{
+		s64    pending_delta = 0;
+		u64    bytes         = 0;
+		size_t count         = 0;
+		size_t freed         = 0;
+
+		for (; count < kSliceNodes && !stack.empty(); ++count)
+		{
+			NodePtr ptr = std::move(stack.back());
+			stack.pop_back();
+			pending_delta -= estimated_subtree_nodes(ptr.get());
+
+#if defined(DLSHOGI_DAG)
+			// 他の親からも参照されているNodeなら、参照を1つ手放すだけで良い。
+			const bool last = ptr->ReleaseRef();
+			Node*      node = ptr.release();
+			if (!last)
+				continue;
+#else
+			Node* node = ptr.release();
+#endif
+			bytes += node->MemoryBytes();
+
+			// 子ノードは切り離してstackに積む。(このNodeのデストラクタで数珠つなぎに開放されないように)
+			const ChildNumType child_num = node->child_num;
+			if (node->child_nodes)
+			{
+				for (int i = 0; i < child_num; ++i)
+					if (node->child_nodes[i])
+					{
+						pending_delta += estimated_subtree_nodes(node->child_nodes[i].get());
+						stack.emplace_back(std::move(node->child_nodes[i]));
+					}
+			}
+
+			delete node;
+			++freed;
+		}
+
+		pending_nodes += pending_delta;
+		freed_nodes   += freed;
+		freed_bytes   += bytes;
+	}
+
+	// ガーベジ用のスレッドが実行するworker
+	void NodeGarbageCollector::Worker(size_t worker_id)
+	{
+		// 開放中の部分木のうち、まだ辿っていないNode
+		std::vector<NodePtr> stack;
+
+		while (true)
+		{
+			// --- やねうら王独自拡張
+
+			// bindThisThreadして欲しいなら、それを行う。
+			if (worker_id == 0 && current_thread_id != next_thread_id)
+			{
+				current_thread_id = next_thread_id.load();
+
+				//WinProcGroup::bindThisThread(current_thread_id);
+				// TODO : あとで binderどうにかする。
+			}
+
+			{
+				// 探索中は、worker 0以外はqueueに積まれていても待機する。
+				auto can_run = [&]() { return !subtrees_to_gc.empty() && (worker_id == 0 || !searching); };
+
+				std::unique_lock<std::mutex> lock(gc_mutex);
+				gc_cv.wait_for(lock, std::chrono::milliseconds(kGCIntervalMs), [&]() { return stop || can_run(); });
+				if (stop)
+					break;
+				if (!can_run())
+					continue;
+
+				stack.emplace_back(std::move(subtrees_to_gc.back()));
+				subtrees_to_gc.pop_back();
+			}
+
+			const u64 start_ns = gc_now_ns();
+			FreeSlice(stack);
+
+			// 開放したNodeのメモリは、確保した探索スレッドのNodeArenaにまとめて返却する。
+			NodeArena::FlushRemoteFrees();
+			busy_ns += gc_now_ns() - start_ns;
+
+			// まだ辿っていないNodeはqueueに戻して、他のworkerも開放できるようにする。
+			if (!stack.empty())
+			{
+				{
+					std::lock_guard<std::mutex> lock(gc_mutex);
+					for (auto& node : stack)
+						subtrees_to_gc.emplace_back(std::move(node));
+				}
+				stack.clear();
+				if (num_workers > 1 && !searching)
+					gc_cv.notify_all();
+			}
+
+			// 探索中は、探索スレッドに譲る。
+			if (searching)
+				std::this_thread::sleep_for(std::chrono::milliseconds(kYieldMs));
+		}
+	}
+
+	// GCの状況を文字列化して返す。
+	std::string NodeGarbageCollector::Stats()
+	{
+		size_t pending_subtrees;
+		{
+			std::lock_guard<std::mutex> lock(gc_mutex);
+			pending_subtrees = subtrees_to_gc.size();
+		}
+
+		const TimePoint t     = now();
+		const u64       bytes = freed_bytes;
+		const u64       busy  = busy_ns;
+
+		// 前回のStats()からの開放速度[MB/s]
+		const double recent_mbps = (last_stats_time && t > last_stats_time)
+		                         ? double(bytes - last_stats_bytes) / (1024 * 1024) * 1000 / double(t - last_stats_time)
+		                         : 0.0;
+		last_stats_time  = t;
+		last_stats_bytes = bytes;
+
+		std::ostringstream os;
+		os << std::fixed << std::setprecision(2)
+		   << "gc_stats : workers = " << num_workers << " , searching = " << (searching ? "yes" : "no") << std::endl
+		   << "pending  : subtrees = " << pending_subtrees << " , nodes = " << std::max(s64(0), pending_nodes.load()) << " (estimated)" << std::endl
+		   << "freed    : nodes = " << freed_nodes.load() << " , " << double(bytes) / (1024 * 1024) << "[MB]" << std::endl
+		   << "rate     : " << (busy ? double(bytes) / (1024 * 1024) * 1e9 / double(busy) : 0.0) << "[MB/s] while busy (busy " << busy / 1000000 << "[ms]) , "
+		   << recent_mbps << "[MB/s] since last gc_stats";
+		return os.str();
+	}
+
 } // namespace dlshogi
 
 #endif // defined(YANEURAOU_ENGINE_DEEP)
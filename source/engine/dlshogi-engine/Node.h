@@ -4,10 +4,19 @@
 
 #if defined(YANEURAOU_ENGINE_DEEP)
 
+#include <condition_variable>
+#include <cstring>
 #include <thread>
+#if defined(DLSHOGI_DAG)
+#include <unordered_map>
+#endif
+#if defined(DLSHOGI_COMPACT_NODE) && defined(__F16C__)
+#include <immintrin.h>
+#endif
 #include "../../position.h"
 #include "../../movegen.h"
 #include "dlshogi_types.h"
+#include "NodeArena.h"
 
 namespace dlshogi {
 
@@ -16,11 +25,202 @@ using namespace YaneuraOu;
 struct Node;
 class NodeGarbageCollector;
 
+#if defined(DLSHOGI_COMPACT_NODE)
+
+// 16bit浮動小数点数(IEEE 754 binary16)
+// ChildNode::nnrateをこれで持つ。nnrateは[0,1]の確率なので、有効桁数が3桁程度あれば十分。
+struct Float16 {
+    Float16() = default;
+    explicit Float16(float f) :
+        bits(from_float(f)) {}
+
+    Float16& operator=(float f) {
+        bits = from_float(f);
+        return *this;
+    }
+    Float16& operator+=(float f) { return *this = float(*this) + f; }
+    operator float() const { return to_float(bits); }
+
+    static u16 from_float(float f) {
+  #if defined(__F16C__)
+        return (u16) _cvtss_sh(f, 0);
+  #else
+        u32 x;
+        std::memcpy(&x, &f, sizeof(x));
+        const u32 sign = (x >> 16) & 0x8000;
+        x &= 0x7fffffff;
+        if (x >= 0x47800000)  // 65520以上(とNaN)は∞にする。
+            return u16(sign | 0x7c00);
+        if (x < 0x38800000)  // 2^-14未満は非正規化数。
+        {
+            // 2^24倍して、2^23を足すことで仮数部の下位bitに最近接偶数丸めした整数を得る。
+            float a;
+            std::memcpy(&a, &x, sizeof(a));
+            a = a * 16777216.0f + 8388608.0f;
+            std::memcpy(&x, &a, sizeof(x));
+            return u16(sign | (x - 0x4b000000));
+        }
+        // 指数部のbiasを127 → 15にして、仮数部を最近接偶数丸めで10bitにする。
+        return u16(sign | ((x + 0xc8000fff + ((x >> 13) & 1)) >> 13));
+  #endif
+    }
+
+    static float to_float(u16 h) {
+  #if defined(__F16C__)
+        return _cvtsh_ss(h);
+  #else
+        const u32 sign = u32(h & 0x8000) << 16;
+        const u32 exp  = (h >> 10) & 0x1f;
+        const u32 mant = h & 0x3ff;
+        if (exp == 0)  // 非正規化数
+            return sign ? -float(mant) / 16777216.0f : float(mant) / 16777216.0f;
+        const u32 x = exp == 31 ? (sign | 0x7f800000 | (mant << 13))
+                                : (sign | ((exp + 112) << 23) | (mant << 13));
+        float f;
+        std::memcpy(&f, &x, sizeof(f));
+        return f;
+  #endif
+    }
+
+    u16 bits = 0;
+};
+
+// Nodeを指す32bitのhandle。
+// std::unique_ptr<Node>と同じく、指しているNodeを所有していて、デストラクタでNodeを開放する。
+// 📝 Nodeは NodeArena::AllocateNode() でNode専用のchunkから確保されるので、
+//     上位bitにchunk id、下位bitにchunk内の何番目のNodeであるかを格納する。0はnullptr。
+class NodePtr {
+   public:
+    NodePtr() = default;
+    NodePtr(std::nullptr_t) {}
+    explicit NodePtr(Node* node);
+
+    NodePtr(NodePtr&& o) noexcept :
+        handle(o.handle) {
+        o.handle = 0;
+    }
+    NodePtr& operator=(NodePtr&& o) noexcept {
+        if (this != &o)
+        {
+            reset();
+            handle   = o.handle;
+            o.handle = 0;
+        }
+        return *this;
+    }
+    NodePtr(const NodePtr&)            = delete;
+    NodePtr& operator=(const NodePtr&) = delete;
+
+    ~NodePtr() { reset(); }
+
+    Node* get() const;
+    Node* operator->() const { return get(); }
+    Node& operator*() const { return *get(); }
+    explicit operator bool() const { return handle != 0; }
+
+    // 指しているNodeを開放してnullptrにする。
+    void reset();
+
+    // Nodeを開放せずにnullptrにする。指していたNodeを返す。
+    Node* release();
+
+    // handleのうち、chunk内の番号を表すbit数
+    static constexpr int SLOT_BITS = 32 - NodeArena::NODE_CHUNK_ID_BITS;
+
+   private:
+    u32 handle = 0;
+};
+
+#elif defined(DLSHOGI_DAG)
+
+// DAGモードでは、Nodeは複数の親から参照されるので、参照カウントが0になった時に開放する。
+struct NodeDeleter {
+    void operator()(Node* node) const noexcept;
+};
+typedef std::unique_ptr<Node, NodeDeleter> NodePtr;
+
+#else
+
+typedef std::unique_ptr<Node> NodePtr;
+
+#endif
+
+#if defined(DLSHOGI_DAG)
+// DAGモードで、同一局面のNodeを共有するための表。
+// 局面のkeyからNodeを引く。Nodeは所有しない。(参照カウントが0になったNodeはここから取り除かれる)
+//
+// 📝 keyには手数も含める。(KeyOf()) 子ノードは必ず手数が1つ多いので、これで循環しないことが保証される。
+//     (同じ局面でも手数が異なると共有されないが、手順前後による合流は同じ手数なので、それで十分である)
+//
+// 📝 千日手の判定は、その局面に至る経路に依存するので、部分木のなかで千日手が見つかったNodeは共有してはならない。
+//     keyに経路を含めると手順前後の合流がほとんど共有されなくなるので、keyには含めずに、
+//     千日手が見つかった時に、同一局面の間(千日手の手順の途中)にあるNodeをここから取り除いて、以降は共有しないことにする。(Node::SetPathDependent())
+//     ⚠ 千日手が見つかる前にすでに共有していた親は、そのまま共有し続ける。(その親からは、別の経路での千日手の結果が見える)
+//        これは、千日手が見つかるまで共有を遅らせないと防げないので、許容する。
+class NodeTable {
+   public:
+    // 局面posに対応するkey
+    static Key KeyOf(const Position& pos) { return pos.key() ^ (u64(pos.game_ply()) * 0x9e3779b97f4a7c15ULL); }
+
+    // keyのNodeを探す。見つかれば参照カウントを1増やして返す。なければnullptr。
+    static Node* Acquire(Key key);
+
+    // keyのNodeとしてnodeを登録する。すでに登録されていれば置き換える。
+    static void Insert(Key key, Node* node);
+
+    // keyのNodeとしてnodeが登録されていれば取り除く。
+    static void Erase(Key key, const Node* node);
+
+    // 登録されているNodeの数
+    static size_t Size();
+
+   private:
+    // 表は、keyの上位bitで分割して、それぞれをmutexで保護する。
+    static constexpr size_t SHARD_NUM = 1024;  // must be 2^n
+
+    struct alignas(64) Shard {
+        std::mutex                      mutex;
+        std::unordered_map<Key, Node*> map;
+    };
+    static Shard& shard_of(Key key) { return shards[(key >> 40) & (SHARD_NUM - 1)]; }
+
+    static Shard shards[SHARD_NUM];
+};
+#endif
+
+// Nodeの展開の計測結果。("bench"コマンドで"mcts"を指定した時に出力する)
+struct ExpandProfile {
+    u64 expansions     = 0;  // 子ノードを作成した回数
+    u64 transpositions = 0;  // DAGモードで、同一局面の既存のNodeを子ノードとして共有した回数
+    u64 path_dependent = 0;  // DAGモードで、部分木で千日手が見つかったので共有をやめたNodeの数
+    u64 lost           = 0;  // 他のスレッドが展開中(EXPANDING)であったので、DISCARDEDにした回数
+
+    void add(const ExpandProfile& o) {
+        expansions += o.expansions;
+        transpositions += o.transpositions;
+        path_dependent += o.path_dependent;
+        lost += o.lost;
+    }
+};
+
+// 展開の状態。Node::expand_state(child_nodesの状態)とChildNode::expand_state(子ノードの状態)で用いる。
+// 📝 UNEXPANDED → EXPANDING のCASに成功したスレッドだけが展開して、終わったらEXPANDEDをreleaseでstoreする。
+//     CASに失敗したスレッドは、待たずにDISCARDEDとして探索をやり直す。(spinしない)
+//     EXPANDEDをacquireでloadしたスレッドだけが、展開されたもの(child_nodes、child_nodes[i])を読んで良い。
+enum ExpandState : u8 {
+    UNEXPANDED,  // 未展開
+    EXPANDING,   // あるスレッドが展開中
+    EXPANDED,    // 展開済み
+};
+
 // 子ノード(に至るEdge(辺))を表現する。
 // あるノードから実際に子ノードにアクセスするとランダムアクセスになってしまうので
 // それが許容できないから、ある程度の情報をedgeがcacheするという考え。
 // Nodeが親ノードを表現していて、基本的には合法手の数だけ、このChildNodeを持つ。
 // ※　dlshogiのchild_node_t
+//
+// 📝 DLSHOGI_COMPACT_NODEの時は、nnrateを16bitで持ち、子ノードへのhandle(node)もここに持つ。
+//     (Node::child_nodesはこれを配列のように見せるview)
 struct ChildNode {
     ChildNode() :
         move_count(0),
@@ -34,6 +234,7 @@ struct ChildNode {
         nnrate(0.0f) {}
 
     // ムーブコンストラクタ
+    // ⚠ 子ノード(node)は移動させない。(子ノードを作る前のChildNodeにしか用いない)
     ChildNode(ChildNode&& o) noexcept :
         move(o.move),
         move_count(0),
@@ -41,6 +242,7 @@ struct ChildNode {
         nnrate(o.nnrate) {}
 
     // ムーブ代入演算子
+    // ⚠ 子ノード(node)とexpand_stateは移動させない。子ノードを移動させた時は、呼び出し元でSetExpanded()すること。
     ChildNode& operator=(ChildNode&& o) noexcept {
         move       = o.move;
         move_count = (NodeCountType) o.move_count;
@@ -69,6 +271,18 @@ struct ChildNode {
     void SetDraw() { move = Move(move.to_u32() | VALUE_DRAW); }
     // →　SetDraw()したときに、win = DRAW_VALUEにしたほうが良くないかな…。
 
+    // 子ノードが作成済みであるか。trueの時だけ、親のNode::child_nodes[i]を読んで良い。
+    bool IsExpanded() const { return expand_state.load(std::memory_order_acquire) == EXPANDED; }
+
+    // UNEXPANDED → EXPANDINGにする。成功したスレッドが子ノードを作成して、SetExpanded()する。
+    bool TryBeginExpand() {
+        u8 state = UNEXPANDED;
+        return expand_state.compare_exchange_strong(state, EXPANDING, std::memory_order_acquire);
+    }
+
+    // 子ノードを作成したことを、他のスレッドに公開する。
+    void SetExpanded() { expand_state.store(EXPANDED, std::memory_order_release); }
+
     // 親局面(Node)で、このedgeに至るための指し手
     /*
 		上位8bitをWin/Loseのフラグに使っているので、値比較するときには注意すること。
@@ -86,37 +300,91 @@ struct ChildNode {
 	// moveの上位bitにあるフラグをクリアして返す。
     Move getMove() const { return Move(move.to_u32() & 0xffffff); }
 
+#if !defined(DLSHOGI_COMPACT_NODE)
     // Policy Networkが返してきた、moveが選ばれる確率を正規化したもの。
     float nnrate;
+#endif
 
     // このedgeの訪問回数。
     // Node::move_countと同じ意味。
     std::atomic<NodeCountType> move_count;
 
+#if !defined(DLSHOGI_COMPACT_NODE)
+    // 子ノードの状態(ExpandState)
+    // 💡 winの手前のpaddingに収まるので、sizeof(ChildNode)は増えない。
+    std::atomic<u8> expand_state{UNEXPANDED};
+#endif
+
     // このedgeの勝った回数。Node::winと同じ意味。
     // ※　このChildNodeの着手moveによる期待勝率 = win / move_count の計算式で算出する。
     std::atomic<WinType> win;
+
+#if defined(DLSHOGI_COMPACT_NODE)
+    // Policy Networkが返してきた、moveが選ばれる確率を正規化したもの。
+    Float16 nnrate;
+
+    // 子ノードの状態(ExpandState)
+    // 💡 nnrateとnodeの間のpaddingに収まるので、sizeof(ChildNode)は増えない。
+    std::atomic<u8> expand_state{UNEXPANDED};
+
+    // 子ノード。展開していなければnullptr。
+    NodePtr node;
+#endif
 };
 
+#if defined(DLSHOGI_COMPACT_NODE)
+// ChildNode::nodeを、子ノードへのポインタ配列のように見せるview。
+// Node::child_nodes[i]は、Node::child[i].nodeを指す。
+class ChildNodePtrs {
+   public:
+    ChildNodePtrs() = default;
+    explicit ChildNodePtrs(ChildNode* child) :
+        child(child) {}
+
+    NodePtr& operator[](size_t i) const { return child[i].node; }
+    explicit operator bool() const { return child != nullptr; }
+
+   private:
+    ChildNode* child = nullptr;
+};
+#endif
+
 // 局面一つを表現する構造体
 // dlshogiのuct_node_t
 struct Node {
     Node() :
         move_count(NOT_EXPANDED),
-        win(0),
         visited_nnrate(0.0f),
+        win(0),
         child_num(0),
+        expand_state(UNEXPANDED),
+#if defined(DLSHOGI_DAG)
+        path_dependent(false),
+        ref_count(1),
+#endif
         dfpn_checked(0),
         dfpn_proven_unsolvable(0) /*, dfpn_mate_ply(0)*/ {}
 
+    // Nodeは探索スレッドごとのNodeArenaから確保する。
+#if defined(DLSHOGI_COMPACT_NODE)
+    static void* operator new(size_t size) { return NodeArena::AllocateNode(size); }
+#else
+    static void* operator new(size_t size) { return NodeArena::Allocate(size); }
+#endif
+    static void operator delete(void* ptr) noexcept { NodeArena::Deallocate(ptr); }
+
     // 子ノード作成
-    Node* CreateChildNode(int i) { return (child_nodes[i] = std::make_unique<Node>()).get(); }
+    Node* CreateChildNode(int i);
 
     // 子ノード1つのみで初期化する。
     void CreateSingleChildNode(const Move move) {
         child_num = 1;
-        child     = std::make_unique<ChildNode[]>(1);
+        child     = MakeNodeArenaArray<ChildNode>(1);
         child[0]  = move;
+#if defined(DLSHOGI_COMPACT_NODE)
+        child_nodes = ChildNodePtrs();
+#endif
+        expand_state = UNEXPANDED;
     }
 
     // 候補手の展開
@@ -134,7 +402,49 @@ struct Node {
     }
 
     // 子ノードへのポインタ配列の初期化
-    void InitChildNodes() { child_nodes = std::make_unique<std::unique_ptr<Node>[]>(child_num); }
+    void InitChildNodes() {
+#if defined(DLSHOGI_COMPACT_NODE)
+        child_nodes = ChildNodePtrs(child.get());
+#else
+        child_nodes = MakeNodeArenaArray<NodePtr>(child_num);
+#endif
+        expand_state.store(EXPANDED, std::memory_order_release);
+    }
+
+    // --- 探索スレッドから同時に呼び出す版
+    // 📝 lockはしない。子ノードの選択とVirtual Lossの加算はatomicな変数に対して行い、
+    //     child_nodesの初期化と子ノードの作成だけを、ExpandStateのCASで1スレッドに限る。(ExpandStateのコメントを参照)
+
+    // 子ノードへのポインタ配列が初期化されていなければ初期化する。
+    // 他のスレッドが初期化中であった時は、待たずにfalseを返す。
+    bool EnsureChildNodes();
+
+    // i番目の子ノードを作成する。child[i].TryBeginExpand()に成功したスレッドが呼び出すこと。
+    // 作成した子ノードは、child[i].SetExpanded()で公開される。
+    // DAGモードで dag_key != 0 の時は、NodeTableにdag_keyのNodeがあれば、それを子ノードとして共有してnullptrを返す。
+    Node* ExpandChildNode(int i, ExpandProfile& profile, Key dag_key = 0);
+
+#if defined(DLSHOGI_DAG)
+    // 参照カウントが0でなければ1増やしてtrueを返す。(NodeTable::Acquire()の下請け)
+    bool TryAddRef();
+
+    // 参照を1つ手放す。最後の参照であったならNodeTableから取り除いてtrueを返す。
+    // その時、このNodeを開放するのは呼び出し元の責任である。
+    bool ReleaseRef();
+
+    // このNodeの部分木の値が、このNodeに至る経路に依存する(部分木で千日手が見つかった)ので、以降は共有しない。
+    // NodeTableから取り除いた時にtrueを返す。
+    bool SetPathDependent();
+#endif
+
+    // このNodeが直接確保しているメモリ[byte]。(子ノードは含まない)
+    size_t MemoryBytes() const {
+        size_t bytes = sizeof(Node) + NodeArenaArraySize(child.get()) * sizeof(ChildNode);
+#if !defined(DLSHOGI_COMPACT_NODE)
+        bytes += NodeArenaArraySize(child_nodes.get()) * sizeof(NodePtr);
+#endif
+        return bytes;
+    }
 
     // 引数のmoveで指定した子ノード以外の子ノードをすべて開放する。
     // 前回探索した局面からmoveの指し手を選んだ局面の以外の情報を開放するのに用いる。
@@ -161,9 +471,17 @@ struct Node {
 
     // --- public members..
 
+    // 📝 paddingが入らないように、メンバの並び順を決めてある。
+
     // このノードの訪問回数
     std::atomic<NodeCountType> move_count;
 
+    // 訪問した子ノードのnnrateを累積(加算)したもの。
+    // 訪問ごとに加算している。
+    // fpu reductionで用いる。
+    // ※　visited_nnrateはfpu_reductionが1を超えると意味のない値なのでfloatでも精度的に問題ないらしい。
+    std::atomic<float> visited_nnrate;
+
     // このノードを訪れて勝った回数
     // 実際にはplayoutまで行わずにValue Networkの返し値から期待勝率を求めるので
     // 端数が発生するから浮動小数点数になっている。
@@ -171,23 +489,42 @@ struct Node {
     // これは累積されるので、このノードの期待勝率は、 win / move_count で求める。
     std::atomic<WinType> win;
 
-    // 訪問した子ノードのnnrateを累積(加算)したもの。
-    // 訪問ごとに加算している。
-    // fpu reductionで用いる。
-    // ※　visited_nnrateはfpu_reductionが1を超えると意味のない値なのでfloatでも精度的に問題ないらしい。
-    std::atomic<float> visited_nnrate;
+    // 子ノード(に至るedge)
+    // child_numの数だけ、ChildNodeをNodeArenaから確保して保持している。
+    NodeArenaArray<ChildNode> child;
+
+    // 子ノードへのポインタ配列
+    // もったいないので必要になってから確保する。
+    // 展開した子ノード以外はnullptrのまま。
+#if defined(DLSHOGI_COMPACT_NODE)
+    // ※　DLSHOGI_COMPACT_NODEの時は、childの各要素のnodeを指すview。
+    ChildNodePtrs child_nodes;
+#else
+    NodeArenaArray<NodePtr> child_nodes;
+#endif
+
+#if defined(DLSHOGI_DAG)
+    // NodeTableに登録した時のkey。登録していなければ0。
+    Key dag_key = 0;
+#endif
 
     // 子ノードの数
     ChildNumType child_num;
 
-    // 子ノード(に至るedge)
-    // child_numの数だけ、ChildNodeをnewして保持している。
-    std::unique_ptr<ChildNode[]> child;
+    // 子ノードへのポインタ配列(child_nodes)の状態(ExpandState)
+    std::atomic<u8> expand_state;
 
-    // 子ノードへのポインタ配列
-    // もったいないので必要になってからnewする。
-    // 展開した子ノード以外はnullptrのまま。
-    std::unique_ptr<std::unique_ptr<Node>[]> child_nodes;
+#if defined(DLSHOGI_DAG)
+    // SetPathDependent()済みであるか。
+    // 💡 expand_stateとref_countの間のpaddingに収まるので、sizeof(Node)は増えない。
+    std::atomic<bool> path_dependent;
+#endif
+
+#if defined(DLSHOGI_DAG)
+    // 参照カウント。このNodeを子ノードとして持つ親の数。
+    // 💡 1つの局面に至る直前の局面の数は高々数百なので、16bitで足りる。
+    std::atomic<u16> ref_count;
+#endif
 
 #if defined(USE_POLICY_BOOK)
     // PolicyBookから与えられたvalue
@@ -209,16 +546,113 @@ struct Node {
     void expand_node(const Position* pos) {
         MoveList<T> ml(*pos);
 
-        child            = std::make_unique<ChildNode[]>(ml.size());
+        child            = MakeNodeArenaArray<ChildNode>(ml.size());
         auto* child_node = child.get();
         for (auto m : ml)
             (child_node++)->move = m;
 
         // 子ノードの数 = 生成された指し手の数
         child_num = (ChildNumType) ml.size();
+#if defined(DLSHOGI_COMPACT_NODE)
+        child_nodes = ChildNodePtrs();
+#endif
+        expand_state = UNEXPANDED;
     }
 };
 
+#if defined(DLSHOGI_COMPACT_NODE)
+static_assert((NodeArena::CHUNK_SIZE - NodeArena::CHUNK_HEADER_SIZE) / sizeof(Node) < (size_t(1) << NodePtr::SLOT_BITS),
+              "Node slots in a chunk must fit in NodePtr::SLOT_BITS.");
+
+inline NodePtr::NodePtr(Node* node) {
+    if (node)
+    {
+        const u32 chunk_id = NodeArena::NodeChunkId(node);
+        const u32 slot =
+          u32((reinterpret_cast<char*>(node) - NodeArena::NodeChunk(chunk_id) - NodeArena::CHUNK_HEADER_SIZE) / sizeof(Node));
+        handle = (chunk_id << SLOT_BITS) | slot;
+    }
+}
+
+inline Node* NodePtr::get() const {
+    if (!handle)
+        return nullptr;
+    return reinterpret_cast<Node*>(NodeArena::NodeChunk(handle >> SLOT_BITS) + NodeArena::CHUNK_HEADER_SIZE
+                                   + (handle & ((u32(1) << SLOT_BITS) - 1)) * sizeof(Node));
+}
+
+inline void NodePtr::reset() {
+    if (handle)
+    {
+        Node* node = get();
+        handle     = 0;
+  #if defined(DLSHOGI_DAG)
+        if (node->ReleaseRef())
+  #endif
+            delete node;
+    }
+}
+
+inline Node* NodePtr::release() {
+    Node* node = get();
+    handle     = 0;
+    return node;
+}
+#endif
+
+// Nodeを1つ生成する。
+inline NodePtr MakeNode() { return NodePtr(new Node()); }
+
+#if defined(DLSHOGI_DAG)
+inline bool Node::TryAddRef() {
+    u16 n = ref_count.load(std::memory_order_relaxed);
+    // 0なら開放中。最大値なら、これ以上共有しない。
+    while (n != 0 && n != u16(-1))
+        if (ref_count.compare_exchange_weak(n, u16(n + 1), std::memory_order_relaxed))
+            return true;
+    return false;
+}
+
+inline bool Node::ReleaseRef() {
+    if (ref_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return false;
+    if (dag_key)
+        NodeTable::Erase(dag_key, this);
+    return true;
+}
+
+inline bool Node::SetPathDependent() {
+    if (!dag_key || path_dependent.exchange(true, std::memory_order_relaxed))
+        return false;
+    NodeTable::Erase(dag_key, this);
+    return true;
+}
+
+  #if !defined(DLSHOGI_COMPACT_NODE)
+inline void NodeDeleter::operator()(Node* node) const noexcept {
+    if (node->ReleaseRef())
+        delete node;
+}
+  #endif
+#endif
+
+inline Node* Node::CreateChildNode(int i) { return (child_nodes[i] = MakeNode()).get(); }
+
+// 探索木のメモリ使用量
+// 📝 DLSHOGI_COMPACT_NODEの効果を確認するために、探索木を辿って集計する。
+struct TreeFootprint {
+    u64 nodes = 0;  // Nodeの数
+    u64 edges = 0;  // ChildNodeの数
+    u64 bytes = 0;  // Node,ChildNode,子ノードへのポインタ配列のメモリ[byte]
+
+    // 集計結果を文字列化する。
+    std::string to_string() const;
+};
+
+// rootから辿れるすべてのNodeのメモリ使用量を集計する。(DAGモードでは、共有されているNodeは1回だけ数える)
+// 探索中に呼び出してはならない。
+TreeFootprint MeasureTree(const Node* root);
+
 // 前回探索した局面から2手進んだ局面かを判定するための情報を保持しておくためのNodeTree。
 // 1つのゲームに対して1つのインスタンス。
 class NodeTree {
@@ -240,6 +674,9 @@ class NodeTree {
     // 現在の探索開始局面の取得
     Node* GetCurrentHead() const { return current_head; }
 
+    // ゲーム木のroot nodeの取得
+    Node* GetGameRoot() const { return game_root_node.get(); }
+
    private:
     // game_root_nodeをrootとするゲーム木を開放する。
     void DeallocateTree();
@@ -249,7 +686,7 @@ class NodeTree {
 
     // ゲーム木のroot node = ゲームの開始局面
     // ※　dlshogiでは、gamebegin_node_という変数名
-    std::unique_ptr<Node> game_root_node;
+    NodePtr game_root_node;
 
     // ゲーム開始局面
     // ※　dlshogiではhistory_starting_pos_key_というKey型の変数
@@ -265,35 +702,52 @@ class NodeTree {
 // ※　探索スレッドからスレッドを割り当てるとシンプルなコードになるのだが、
 //    GCに時間がかかることがあり、bestmoveを返すときに全スレッドの終了を待機するので
 //    それは良くないアイデアであった。
+//
+// 📝 やねうら王独自拡張
+//     長時間のponderのあとなどでは、開放する部分木が数千万Nodeになることがある。
+//     unique_ptrのデストラクタで数珠つなぎに開放すると、1つの部分木を開放し終わるまで止まらない上に
+//     1スレッドでしか開放できないので、部分木を自前のstackで辿って、kSliceNodes個ずつ開放する。
+//     1回分(slice)を開放するごとに、まだ辿っていない子ノードを共有のqueueに戻すので、
+//     複数のworkerで手分けして開放できる。
+//
+//     探索中(SetSearching(true)の間)は、worker 0だけがsliceごとにkYieldMs[ms]休みながら開放する。
+//     (探索スレッドとCPUを取り合わないように)
+//     探索していない時は、全workerで休まずに開放する。
 class NodeGarbageCollector {
    public:
     // コンストラクタでGCスレッドを開始する。
     NodeGarbageCollector() :
-        current_thread_id(-1),
-        gc_thread(std::thread([this]() { Worker(); })) {}
+        current_thread_id(-1) { SetWorkerCount(1); }
 
-    // この間隔ごとにGCを走らせる。
+    // queueが空の時に、この間隔ごとにqueueを確認する。
+    // (AddToGcQueue()されたらすぐに起こされるので、これは保険)
     const int kGCIntervalMs = 100;
 
+    // 1回(slice)に開放するNodeの数
+    static constexpr size_t kSliceNodes = 4096;
+
+    // 探索中に、1回(slice)開放するごとに休む時間[ms]
+    static constexpr int kYieldMs = 1;
+
     // GC対象に追加する。ここから辿れるNode,ChildNodeはすべて開放する。
     // また、Nodeは循環していないものとする。
     // また、node == nullptrなら何もせずにreturnする。
-    void AddToGcQueue(std::unique_ptr<Node> node) {
-        if (!node)
-            return;
+    void AddToGcQueue(NodePtr node);
 
-        std::lock_guard<std::mutex> lock(gc_mutex);
-        subtrees_to_gc.emplace_back(std::move(node));
-    }
-
-    ~NodeGarbageCollector() {
-        // stopフラグを変更して、GCスレッドが停止するのを待つ
-        stop.store(true);
-        gc_thread.join();
-    }
+    ~NodeGarbageCollector() { StopWorkers(); }
 
     // --- やねうら王独自拡張
 
+    // GCのworkerの数を設定する。"isready"の時に呼び出される。
+    // 探索中に呼び出してはならない。
+    void SetWorkerCount(size_t worker_count);
+
+    // 探索中であるかを設定する。探索中は、GCは探索スレッドに譲りながら開放する。
+    void SetSearching(bool b);
+
+    // GCの状況を文字列化して返す。("gc_stats"コマンド用)
+    std::string Stats();
+
     // GC用のスレッドのスレッドIDを設定する。
     // これは、WinProcGroup::bindThisThread()を呼び出す時のID。
     // worker thread自体は、やねうら王フレームワーク側(ThreadPoolクラス)で作成してもらうのではなく
@@ -301,61 +755,55 @@ class NodeGarbageCollector {
     void set_thread_id(size_t thread_id) { next_thread_id = (int) thread_id; }
 
    private:
-    // ガーベジ用のスレッドがkGCIntervalMs[ms]ごとに実行するガーベジ本体。
-    void GarbageCollect() {
-        while (!stop.load())
-        {
-
-            // Node will be released in destructor when mutex is not locked.
-            std::unique_ptr<Node> node_to_gc;
-            {
-                // Lock the mutex and move last subtree from subtrees_to_gc_ into
-                // node_to_gc.
-                std::lock_guard<std::mutex> lock(gc_mutex);
-                if (subtrees_to_gc.empty())
-                    return;
-                node_to_gc = std::move(subtrees_to_gc.back());
-                // node_to_gcにmoveしておけば、このスコープを抜けるときにまずgc_mutexがunlockされて、
-                // そのさらに一つ外のスコープでnode_to_gcのデストラクタが呼び出されて、
-                // unique_ptrなどで保持しているノードが数珠つなぎに開放される。LC0の手法。
-
-                subtrees_to_gc.pop_back();
-            }
-        }
-    }
-
     // ガーベジ用のスレッドが実行するworker
-    void Worker() {
-        // stop == trueになるまで、kGCIntervalMs[ms]ごとにGarbageCollect()を実行。
-        while (!stop.load())
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(kGCIntervalMs));
-            GarbageCollect();
+    void Worker(size_t worker_id);
 
-            // --- やねうら王独自拡張
+    // stackに積まれているNodeをkSliceNodes個まで開放する。
+    // 開放したNodeの子ノードはstackに積む。
+    void FreeSlice(std::vector<NodePtr>& stack);
 
-            // bindThisThreadして欲しいなら、それを行う。
-            if (current_thread_id != next_thread_id)
-            {
-                current_thread_id = next_thread_id.load();
-
-                //WinProcGroup::bindThisThread(current_thread_id);
-                // TODO : あとで binderどうにかする。
-            }
-        };
-    }
+    // 全workerを停止させる。
+    void StopWorkers();
 
     // subtrees_to_gc を変更する時のmutex
     mutable std::mutex gc_mutex;
 
-    // GC対象のTree。ここから数珠つなぎに開放していく。
-    // 一度にそんなにたくさん積まれないので、そこまで大きなコンテナにはならない。
-    std::vector<std::unique_ptr<Node>> subtrees_to_gc;
+    // subtrees_to_gcに追加された時や、探索が終了した時にworkerを起こす。
+    std::condition_variable gc_cv;
 
-    // gc_threadの停止フラグ。trueになったら、gc_threadはWorker()から抜けて終了する。
+    // GC対象のTree。ここから辿って開放していく。
+    // 開放途中の部分木の、まだ辿っていない子ノードもここに戻される。
+    std::vector<NodePtr> subtrees_to_gc;
+
+    // workerの停止フラグ。trueになったら、workerはWorker()から抜けて終了する。
     std::atomic<bool> stop{false};
+
+    // 探索中であるか。
+    std::atomic<bool> searching{false};
+
     // GC用のthread
-    std::thread gc_thread;
+    std::vector<std::thread> workers;
+
+    // workerの数。
+    // 📝 workerはworkersにemplace_back()している途中で起動するので、Worker()からworkers.size()を
+    //     読むとvectorの伸長と競合する。そこで、workerを起動する前にこちらに設定しておき、Worker()からはこちらを読む。
+    std::atomic<size_t> num_workers{0};
+
+    // --- 統計情報 ("gc_stats"コマンド用)
+
+    // 開放待ちのNode数の見積もり。(各部分木のrootのmove_countの合計)
+    std::atomic<s64> pending_nodes{0};
+
+    // 開放したNodeの数と、開放したメモリ[byte]
+    std::atomic<u64> freed_nodes{0};
+    std::atomic<u64> freed_bytes{0};
+
+    // workerが開放に費やした時間の合計[ns]
+    std::atomic<u64> busy_ns{0};
+
+    // 前回Stats()を呼び出した時刻と、その時のfreed_bytes。(直近の開放速度を求めるのに用いる)
+    TimePoint last_stats_time = 0;
+    u64       last_stats_bytes = 0;
 
     // --- やねうら王独自拡張
 
@@ -0,0 +1,308 @@
+﻿#include "NodeArena.h"
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <vector>
+
+#include "../../memory.h"
+#include "../../misc.h"
+
+namespace dlshogi {
+
+	std::atomic<size_t> NodeArena::reserved_bytes{0};
+
+#if defined(DLSHOGI_COMPACT_NODE)
+	std::atomic<size_t> NodeArena::node_block_size{0};
+	char*               NodeArena::node_chunks[size_t(1) << NodeArena::NODE_CHUNK_ID_BITS];
+	std::atomic<u32>    NodeArena::next_node_chunk_id{1};
+#endif
+
+	namespace {
+
+		using ChunkHeader = NodeArena::ChunkHeader;
+
+		// 個別に確保したchunkのサイズクラス
+		constexpr int    LARGE_CLASS       = -1;
+		constexpr size_t CHUNK_HEADER_SIZE = NodeArena::CHUNK_HEADER_SIZE;
+
+		static_assert(sizeof(ChunkHeader) <= CHUNK_HEADER_SIZE, "");
+
+		// size[byte] → サイズクラス
+		int size_to_class(size_t size) {
+			if (size <= 128)
+				return size == 0 ? 0 : int((size - 1) >> 4);
+
+			// 129 bytes以上は [2^e + 1, 2^(e+1)] を4等分する。
+			int e = 7;
+			while ((size_t(1) << (e + 1)) < size)
+				++e;
+			const size_t step = size_t(1) << (e - 2);
+			const int    k    = int((size - (size_t(1) << e) + step - 1) / step); // 1..4
+			return 8 + (e - 7) * 4 + (k - 1);
+		}
+
+		// サイズクラス → blockのサイズ[byte]
+		size_t class_to_size(int size_class) {
+			if (size_class < 8)
+				return size_t(size_class + 1) << 4;
+			const int e = 7 + (size_class - 8) / 4;
+			const int k = (size_class - 8) % 4 + 1;
+			return (size_t(1) << e) + size_t(k) * (size_t(1) << (e - 2));
+		}
+
+		// メモリが確保できなかった時は探索を続けられないので終了する。
+		void out_of_memory(size_t bytes) {
+			sync_cout << "info string Error! : Failed to allocate " << bytes << " bytes for Node." << sync_endl;
+			Tools::exit();
+		}
+
+		ChunkHeader* chunk_of(void* ptr) {
+			return reinterpret_cast<ChunkHeader*>(reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(NodeArena::CHUNK_SIZE - 1));
+		}
+
+		// 使われていないNodeArena
+		// 探索スレッドが終了した時に、そのスレッドのNodeArenaはここに戻され、次に生成されたスレッドが引き継ぐ。
+		// ⚠ NodeArenaは開放しない。(開放済みのNodeが終了時に残っていても問題がないように)
+		std::mutex               pool_mutex;
+		std::vector<NodeArena*>* idle_arenas = new std::vector<NodeArena*>();
+
+		// スレッドごとの状態
+		struct ThreadCache {
+
+			// このスレッドのNodeArena。Allocate()を呼び出すまではnullptr。
+			NodeArena* arena = nullptr;
+
+			// 他のスレッドのNodeArenaへの返却待ちのblock
+			struct Pending {
+				NodeArena*            owner = nullptr;
+				NodeArena::FreeBlock* head  = nullptr;
+				NodeArena::FreeBlock* tail  = nullptr;
+				size_t                count = 0;
+			};
+			static constexpr int    PENDING_NUM = 8;
+			static constexpr size_t FLUSH_COUNT = 256;
+			Pending pending[PENDING_NUM];
+
+			NodeArena* get_arena() {
+				if (!arena)
+				{
+					std::lock_guard<std::mutex> lk(pool_mutex);
+					if (idle_arenas->empty())
+						arena = new NodeArena();
+					else
+					{
+						arena = idle_arenas->back();
+						idle_arenas->pop_back();
+					}
+				}
+				return arena;
+			}
+
+			void flush(Pending& p) {
+				if (p.head)
+					p.owner->PushRemote(p.head, p.tail);
+				p = Pending();
+			}
+
+			void flush_all() {
+				for (auto& p : pending)
+					flush(p);
+			}
+
+			void push_remote(NodeArena* owner, NodeArena::FreeBlock* block) {
+				Pending* slot = nullptr;
+				for (auto& p : pending)
+					if (p.owner == owner) { slot = &p; break; }
+
+				if (!slot)
+				{
+					for (auto& p : pending)
+						if (!p.owner) { slot = &p; break; }
+
+					// 空きがなければ全部返却してから使う。
+					if (!slot)
+					{
+						flush_all();
+						slot = &pending[0];
+					}
+					slot->owner = owner;
+				}
+
+				block->next = slot->head;
+				if (!slot->head)
+					slot->tail = block;
+				slot->head = block;
+
+				if (++slot->count >= FLUSH_COUNT)
+					flush(*slot);
+			}
+
+			~ThreadCache() {
+				flush_all();
+				if (arena)
+				{
+					std::lock_guard<std::mutex> lk(pool_mutex);
+					idle_arenas->push_back(arena);
+				}
+			}
+		};
+
+		thread_local ThreadCache thread_cache;
+
+	} // namespace
+
+	// 現在のスレッドのNodeArenaからsize[byte]のメモリを確保する。
+	void* NodeArena::Allocate(size_t size)
+	{
+		NodeArena* arena = thread_cache.get_arena();
+
+		if (size <= MAX_SMALL_SIZE)
+			return arena->allocate_small(size_to_class(size));
+
+		// 大きなものはchunkを個別に確保する。
+		const size_t bytes = (CHUNK_HEADER_SIZE + size + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+		void*        mem   = std_aligned_alloc(CHUNK_SIZE, bytes);
+		if (!mem)
+			out_of_memory(bytes);
+		reserved_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+		auto* header       = static_cast<ChunkHeader*>(mem);
+		header->owner      = arena;
+		header->size_class = LARGE_CLASS;
+		header->chunk_id   = 0;
+		header->bytes      = bytes;
+		return static_cast<char*>(mem) + CHUNK_HEADER_SIZE;
+	}
+
+	// Allocate()で確保したメモリを開放する。
+	void NodeArena::Deallocate(void* ptr) noexcept
+	{
+		if (!ptr)
+			return;
+
+		ChunkHeader* header = chunk_of(ptr);
+		if (header->size_class == LARGE_CLASS)
+		{
+			// 個別に確保したchunkはすぐにOSに返す。
+			reserved_bytes.fetch_sub(header->bytes, std::memory_order_relaxed);
+			std_aligned_free(header);
+			return;
+		}
+
+		auto* block = static_cast<FreeBlock*>(ptr);
+		if (header->owner == thread_cache.arena)
+		{
+			// 自分のNodeArenaのblockなら、そのままfree listに戻す。
+			auto& head  = header->owner->free_list[header->size_class];
+			block->next = head;
+			head        = block;
+		}
+		else
+			thread_cache.push_remote(header->owner, block);
+	}
+
+#if defined(DLSHOGI_COMPACT_NODE)
+	// Node専用のpoolからNodeを1つ確保する。
+	void* NodeArena::AllocateNode(size_t size)
+	{
+		// 📝 最初の呼び出しでblockのサイズが決まる。(Nodeのサイズなので常に同じ値)
+		//     16 bytes境界にalignしないが、Nodeのalignmentは8 bytesなので問題ない。
+		if (!node_block_size.load(std::memory_order_relaxed))
+			node_block_size.store((size + 7) & ~size_t(7), std::memory_order_relaxed);
+
+		return thread_cache.get_arena()->allocate_small(NODE_CLASS);
+	}
+#endif
+
+	// 現在のスレッドで溜めている返却待ちのblockを返却する。
+	void NodeArena::FlushRemoteFrees() { thread_cache.flush_all(); }
+
+	// 他のスレッドから返却されたblockを受け取る。
+	void NodeArena::PushRemote(FreeBlock* head, FreeBlock* tail)
+	{
+		std::lock_guard<std::mutex> lk(remote_mutex);
+		tail->next  = remote_head;
+		remote_head = head;
+		has_remote.store(true, std::memory_order_release);
+	}
+
+	// 他のスレッドから返却されたblockを自分のfree listに移す。
+	void NodeArena::drain_remote()
+	{
+		FreeBlock* head;
+		{
+			std::lock_guard<std::mutex> lk(remote_mutex);
+			head        = remote_head;
+			remote_head = nullptr;
+			has_remote.store(false, std::memory_order_relaxed);
+		}
+
+		while (head)
+		{
+			FreeBlock* next = head->next;
+			auto&      list = free_list[chunk_of(head)->size_class];
+			head->next      = list;
+			list            = head;
+			head            = next;
+		}
+	}
+
+	// size_classのblockを1つ確保する。
+	void* NodeArena::allocate_small(int size_class)
+	{
+		// 1) 自分のfree list
+		// 2) 他のスレッドから返却されたblock
+		// 3) 切り出し中のchunk
+		// 4) 新しいchunk
+		// の順に調べる。
+
+		if (!free_list[size_class] && has_remote.load(std::memory_order_acquire))
+			drain_remote();
+
+		if (FreeBlock* block = free_list[size_class])
+		{
+			free_list[size_class] = block->next;
+			return block;
+		}
+
+#if defined(DLSHOGI_COMPACT_NODE)
+		const size_t block_size = size_class == NODE_CLASS ? node_block_size.load(std::memory_order_relaxed) : class_to_size(size_class);
+#else
+		const size_t block_size = class_to_size(size_class);
+#endif
+		if (size_t(end[size_class] - cur[size_class]) < block_size)
+		{
+			void* mem = std_aligned_alloc(CHUNK_SIZE, CHUNK_SIZE);
+			if (!mem)
+				out_of_memory(CHUNK_SIZE);
+			reserved_bytes.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
+
+			auto* header       = static_cast<ChunkHeader*>(mem);
+			header->owner      = this;
+			header->size_class = size_class;
+			header->chunk_id   = 0;
+			header->bytes      = CHUNK_SIZE;
+
+#if defined(DLSHOGI_COMPACT_NODE)
+			// Node専用のchunkなら通し番号を振って登録する。
+			if (size_class == NODE_CLASS)
+			{
+				const u32 chunk_id = next_node_chunk_id.fetch_add(1, std::memory_order_relaxed);
+				if (chunk_id >= (u32(1) << NODE_CHUNK_ID_BITS))
+					out_of_memory(CHUNK_SIZE);
+				header->chunk_id      = chunk_id;
+				node_chunks[chunk_id] = static_cast<char*>(mem);
+			}
+#endif
+
+			cur[size_class] = static_cast<char*>(mem) + CHUNK_HEADER_SIZE;
+			end[size_class] = static_cast<char*>(mem) + CHUNK_SIZE;
+		}
+
+		void* ptr = cur[size_class];
+		cur[size_class] += block_size;
+		return ptr;
+	}
+
+} // namespace dlshogi
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
@@ -0,0 +1,174 @@
+﻿#ifndef __NODE_ARENA_H_INCLUDED__
+#define __NODE_ARENA_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#include "../../types.h"
+
+namespace dlshogi {
+
+	using namespace YaneuraOu;
+
+	// Node , ChildNode[] , 子ノードへのポインタ配列 を確保するためのスレッドごとのメモリプール。
+	//
+	// 📝 探索スレッドは1手ごとに何百万ものNodeを確保するので、これをmalloc()(new)で行うと
+	//     複数スレッドからのmalloc()が競合する上に、NodeGarbageCollectorが1つずつfree()することになる。
+	//     そこで、スレッドごとにNodeArenaを持たせ、64KBのchunkからサイズクラスごとに切り出して用いる。
+	//
+	// 💡 chunkは、それを確保したスレッド(探索スレッド)が最初に書き込むので、first touchによって
+	//     そのスレッドのNUMAノードのメモリが割り当たる。
+	//
+	// 💡 確保したスレッドとは別のスレッド(GCスレッドなど)で開放されたblockは、そのスレッドで
+	//     ある程度溜めてから、所有者のNodeArenaにまとめて(mutexを1回lockするだけで)返却される。
+	//     所有者は自分のfree listが空になった時にそれをまとめて回収する。
+	//
+	// ⚠ chunkはプロセスの終了までOSに返却しない。開放されたblockは次の確保で再利用される。
+	//     (木の大きさはnode数の制限で抑えられているので、これで問題ない)
+	class NodeArena
+	{
+	public:
+		// chunkのサイズ[byte]。chunkはこのサイズでalignされている。
+		static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+		// サイズクラスで扱う最大サイズ[byte]。これより大きなものはchunkを個別に確保する。
+		static constexpr size_t MAX_SMALL_SIZE = 16 * 1024;
+
+		// サイズクラスの数
+		// 16〜128 bytesは16 bytes刻み、それ以降は2の累乗の間を4等分した刻み。
+		static constexpr int CLASS_NUM = 36;
+
+		// Node専用のサイズクラス。(DLSHOGI_COMPACT_NODEの時のみ用いる)
+		static constexpr int NODE_CLASS = CLASS_NUM;
+
+		// chunkの先頭に置くheader
+		// 📝 blockのアドレスの下位bitを落とせばchunkの先頭になるので、そこから所有者とサイズクラスがわかる。
+		struct ChunkHeader {
+			NodeArena* owner;
+			int        size_class; // -1なら個別に確保したchunk
+			u32        chunk_id;   // NODE_CLASSのchunkの通し番号
+			size_t     bytes;      // chunkのサイズ[byte]
+		};
+		static constexpr size_t CHUNK_HEADER_SIZE = 64;
+
+		// 現在のスレッドのNodeArenaからsize[byte]のメモリを確保する。16 bytes境界にalignされている。
+		static void* Allocate(size_t size);
+
+		// Allocate()で確保したメモリを開放する。どのスレッドから呼び出しても良い。
+		static void Deallocate(void* ptr) noexcept;
+
+		// 現在のスレッドで溜めている、他のスレッドのNodeArenaへの返却待ちのblockを返却する。
+		// NodeGarbageCollectorが部分木を1つ開放するごとに呼び出す。
+		static void FlushRemoteFrees();
+
+		// すべてのNodeArenaがOSから確保したメモリの合計[byte]
+		static size_t ReservedBytes() { return reserved_bytes.load(std::memory_order_relaxed); }
+
+		// 開放されたblock。free listを構成する。
+		struct FreeBlock { FreeBlock* next; };
+
+		// 他のスレッドから返却されたblockを受け取る。FlushRemoteFrees()の下請け。
+		void PushRemote(FreeBlock* head, FreeBlock* tail);
+
+#if defined(DLSHOGI_COMPACT_NODE)
+		// --- Node専用のpool
+
+		// 📝 Nodeは専用のサイズクラス(NODE_CLASS)のchunkから確保し、そのchunkには1から始まる通し番号を振って
+		//     node_chunksに登録しておく。これにより、Nodeを (chunk id , chunk内の何番目か) の
+		//     32bitのhandleで指せるようになる。(NodePtr)
+		//     chunkは開放しないので、登録したchunkはプロセスの終了まで有効である。
+
+		// chunk idのbit数。chunk内の番号は残りの bit で表す。
+		static constexpr int NODE_CHUNK_ID_BITS = 21;
+
+		// Node専用のpoolから、size[byte]のNodeを1つ確保する。sizeは常に同じ値であること。
+		static void* AllocateNode(size_t size);
+
+		// chunk id → chunkの先頭
+		static char* NodeChunk(u32 chunk_id) { return node_chunks[chunk_id]; }
+
+		// Nodeのアドレス → そのNodeのあるchunkのchunk id
+		static u32 NodeChunkId(const void* ptr) {
+			return reinterpret_cast<const ChunkHeader*>(reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(CHUNK_SIZE - 1))->chunk_id;
+		}
+#endif
+
+	private:
+		// 現在のスレッドのNodeArenaでsize_classのblockを1つ確保する。
+		void* allocate_small(int size_class);
+
+		// 他のスレッドから返却されたblockを自分のfree listに移す。
+		void drain_remote();
+
+		// サイズクラスごとのfree list
+		FreeBlock* free_list[CLASS_NUM + 1] = {};
+
+		// サイズクラスごとの、切り出し中のchunkの未使用領域 [cur, end)
+		char* cur[CLASS_NUM + 1] = {};
+		char* end[CLASS_NUM + 1] = {};
+
+		// 他のスレッドから返却されたblock(サイズクラスは混在している)
+		std::mutex remote_mutex;
+		FreeBlock* remote_head = nullptr;
+		std::atomic<bool> has_remote{false};
+
+		// 全NodeArenaで確保したchunkの合計[byte]
+		static std::atomic<size_t> reserved_bytes;
+
+#if defined(DLSHOGI_COMPACT_NODE)
+		// NODE_CLASSのblockのサイズ[byte]
+		static std::atomic<size_t> node_block_size;
+
+		// chunk id → chunkの先頭
+		static char* node_chunks[size_t(1) << NODE_CHUNK_ID_BITS];
+
+		// 次に割り当てるchunk id (0はnullptr用に欠番)
+		static std::atomic<u32> next_node_chunk_id;
+#endif
+	};
+
+	// NodeArenaで確保した配列を開放するdeleter
+	// 📝 配列の要素数は、配列の直前の16 bytesに格納してある。
+	template <typename T>
+	struct NodeArenaArrayDeleter {
+		void operator()(T* ptr) const noexcept {
+			if (!ptr)
+				return;
+			void* mem = reinterpret_cast<char*>(ptr) - 16;
+			for (size_t i = *static_cast<size_t*>(mem); i > 0; --i)
+				ptr[i - 1].~T();
+			NodeArena::Deallocate(mem);
+		}
+	};
+
+	// NodeArenaで確保した配列
+	template <typename T>
+	using NodeArenaArray = std::unique_ptr<T[], NodeArenaArrayDeleter<T>>;
+
+	// NodeArenaで要素数nの配列を確保して、各要素をdefault constructする。
+	template <typename T>
+	NodeArenaArray<T> MakeNodeArenaArray(size_t n) {
+		static_assert(alignof(T) <= 16, "NodeArena blocks are aligned to 16 bytes.");
+		void* mem = NodeArena::Allocate(16 + n * sizeof(T));
+		*static_cast<size_t*>(mem) = n;
+		T* ptr = reinterpret_cast<T*>(static_cast<char*>(mem) + 16);
+		for (size_t i = 0; i < n; ++i)
+			new (ptr + i) T();
+		return NodeArenaArray<T>(ptr);
+	}
+
+	// MakeNodeArenaArray()で確保した配列の要素数。ptr == nullptrなら0。
+	template <typename T>
+	size_t NodeArenaArraySize(const T* ptr) {
+		return ptr ? *reinterpret_cast<const size_t*>(reinterpret_cast<const char*>(ptr) - 16) : 0;
+	}
+
+} // namespace dlshogi
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
+#endif // ndef __NODE_ARENA_H_INCLUDED__
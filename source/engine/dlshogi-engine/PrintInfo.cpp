@@ -188,7 +188,7 @@ BestMovePonder get_best_move_multipv(const Node*          rootNode,
 			{
 				// 手数がいまのplyより小さいか？を調べる。
 				// 次のNodeが存在するかのチェックがまず必要。
-				if (rootNode->child_nodes.get() && rootNode->child_nodes[i])
+				if (rootNode->child_nodes && rootNode->child_nodes[i])
 				{
 					int mated_ply = rootNode->child_nodes[i]->mate_ply;
 					if (mated_ply)
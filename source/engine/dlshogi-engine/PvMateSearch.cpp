@@ -23,6 +23,15 @@ namespace dlshogi {
 		dl_searcher(dl_searcher)
 		/*,thread_id(thread_id)*/
 	{
+		// 置換表を共有する時は、それに対応したsolverにする。
+		// 他のスレッドが詰み/不詰を証明した局面は、その結論を用いて展開を省略できる。
+		hash_table = dl_searcher->mate_hash_table;
+		if (hash_table)
+		{
+			dfpn.ChangeSolverType(Mate::Dfpn::DfpnSolverType::Node48bitOrderingWithHash);
+			dfpn.set_hash_table(hash_table);
+		}
+
 		// 子ノードを展開するから、探索ノード数の8倍ぐらいのメモリを要する
 		dfpn.alloc_by_nodes_limit((size_t)(nodes * 8));
 		nodes_limit = nodes;
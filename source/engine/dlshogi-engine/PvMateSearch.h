@@ -23,13 +23,16 @@ namespace dlshogi {
 
 		PvMateSearcher(PvMateSearcher&& o) noexcept :
 			th(o.th), dfpn(std::move(o.dfpn)), dl_searcher(o.dl_searcher), nodes_limit(o.nodes_limit),
-			ready_th(o.ready_th), term_th(o.term_th)
+			hash_table(o.hash_table), ready_th(o.ready_th), term_th(o.term_th)
 		{} // 未使用
 		// ⇨　エンジンオプションの PV_Mate_Search_Threads を途中で変更しない限りは…。
 
 		// コンストラクタで渡されたnodesを返す。
 		int get_nodes_limit() const { return nodes_limit;  }
 
+		// 詰み探索で用いている置換表を返す。用いていなければnullptr。
+		Mate::MateHashTable* get_hash_table() const { return hash_table; }
+
 		// 詰み探索スレッドを開始する。
 		void Run();
 
@@ -68,6 +71,9 @@ namespace dlshogi {
 		// 1局面の詰探索のノード数の上限
 		int nodes_limit;
 
+		// 詰み探索で用いている置換表。(DlshogiSearcher::mate_hash_table)
+		Mate::MateHashTable* hash_table;
+
 		// 停止フラグ
 		std::atomic<bool> stop;
 
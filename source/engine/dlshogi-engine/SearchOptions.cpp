@@ -168,10 +168,31 @@ void SearchOptions::add_options(OptionsMap& options) {
           return std::nullopt;
       }));
 
+    // NNの推論結果をcacheするテーブルのサイズ[MB]。0ならcacheしない。
+    // 💡 同一局面への合流や、再利用しなかった部分木の局面を再度展開した時にNNの推論を省略できる。
+    //     1局面あたり256 bytesなので、256MBで約100万局面。
+    options.add(  //
+      "DNN_Cache", Option(256, 0, 1048576, [&](const Option& o) {
+          dnn_cache_mb = size_t(int(o));
+          return std::nullopt;
+      }));
+
     // PV lineの即詰みを調べるスレッドの数と1局面当たりの最大探索ノード数。
     options.add("PV_Mate_Search_Threads", Option(1, 0, 256));
     options.add("PV_Mate_Search_Nodes", Option(500000, 0, UINT32_MAX));
 
+    // 詰み探索の置換表のサイズ[MB]。0なら用いない。
+    // 💡 PV lineの詰み探索スレッド同士や、leaf nodeでの詰み探索とで、詰み/不詰を証明した局面を共有する。
+    options.add(  //
+      "Mate_Hash", Option(64, 0, 1048576, [&](const Option& o) {
+          mate_hash_mb = size_t(int(o));
+          return std::nullopt;
+      }));
+
+    // 前回の探索の不要になった部分木を開放するGCのスレッド数。"isready"の時に反映される。
+    // 💡 探索中は1スレッドだけが少しずつ開放するので、探索の邪魔にはならない。
+    options.add("GC_Threads", Option(1, 1, 64));
+
     // すべての合法手を生成するのか
     options.add(  //
       "GenerateAllLegalMoves", Option(false, [&](const Option& o) {
@@ -95,6 +95,15 @@ struct SearchOptions {
     // 0 = 呼び出さない。
     // エンジンオプションの"LeafDfpnNodesLimit"の値。
     int leaf_dfpn_nodes_limit = 40;
+
+    // NNの推論結果のcache(NNCache)のサイズ[MB]。0ならcacheしない。
+    // エンジンオプションの"DNN_Cache"の値。"isready"の時に反映される。
+    size_t dnn_cache_mb = 256;
+
+    // 詰み探索の置換表(Mate::MateHashTable)のサイズ[MB]。0なら用いない。
+    // PV lineの詰み探索スレッドとleaf nodeの詰み探索で共有する。
+    // エンジンオプションの"Mate_Hash"の値。"isready"の時に反映される。
+    size_t mate_hash_mb = 64;
 };
 
 } // namespace dlshogi
@@ -13,7 +13,10 @@
 #include "../../usi.h"
 #include "../../mate/mate.h"
 
+#include <chrono>
+#include <cstring>          // memcpy
 #include <limits>           // max<T>()
+#include <iomanip>
 #include <sstream>
 
 // 完全なログ出力をしてdlshogiと比較する時用。
@@ -93,7 +96,7 @@ MyLogger logger;
 
 using namespace YaneuraOu::Eval::dlshogi;
 
-#define LOCK_EXPAND grp->get_dlsearcher()->mutex_expand.lock();
+#define LOCK_EXPAND LockMutex(grp->get_dlsearcher()->mutex_expand, profile.expand_lock);
 #define UNLOCK_EXPAND grp->get_dlsearcher()->mutex_expand.unlock();
 
 namespace dlshogi
@@ -106,6 +109,11 @@ inline void atomic_fetch_add(std::atomic<T>* obj, T arg) {
 		;
 }
 
+// 計測用の現在時刻[ns]
+inline u64 profile_now_ns() {
+	return u64(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
 // Virtual Lossの加算
 inline void AddVirtualLoss(ChildNode* child, Node* current)
 {
@@ -143,15 +151,25 @@ inline void UpdateResult(ChildNode* child, float result, Node* current)
 //   new_thread                 : このインスタンスが確保するUctSearcherの数
 //   gpu_id                     : このインスタンスに紐付けられているGPU ID
 //   policy_value_batch_maxsize : このインスタンスが生成したスレッドがNNのforward()を呼び出す時のbatchsize
+//   pipeline_depth             : 各UctSearcherが持つbatchのバッファの数(2以上なら推論と探索を重ねる)
+//   server_latency_us          : 0以上ならInferenceServerを用いる。その時のbatchを待つ最大時間[us]
 void UctSearcherGroup::Initialize(const std::string& model_path, const std::string& model_architecture,
-                                  const int new_thread, const int gpu_id, const int policy_value_batch_maxsize)
+                                  const int new_thread, const int gpu_id, const int policy_value_batch_maxsize,
+                                  const int pipeline_depth, const int server_latency_us)
 {
+	// InferenceServerはnnからメモリを確保しているので、nnを作り直すかも知れない前に解体しておく。
+	inference_server.reset();
+
 	// gpu_idは呼び出しごとに変更される可能性はないと仮定してよい。
 	// (固定で確保しているので)
 	this->gpu_id = gpu_id;
 	const bool architecture_changed = this->model_architecture != model_architecture;
+	const bool pipeline_changed     = this->pipeline_depth != pipeline_depth;
+
+	// 推論slotは、各UctSearcherのbatchのバッファごとに一つ必要。
+	const int slot_count = new_thread * pipeline_depth;
 #if defined(TENSOR_RT)
-	const bool slot_capacity_changed = nn && nn->slot_capacity() < new_thread;
+	const bool slot_capacity_changed = nn && nn->slot_capacity() < slot_count;
 #else
 	constexpr bool slot_capacity_changed = false;
 #endif
@@ -169,32 +187,37 @@ void UctSearcherGroup::Initialize(const std::string& model_path, const std::stri
 		if (nn)
 			nn.reset();
 
-		nn = NN::build_nn(model_path, gpu_id, policy_value_batch_maxsize, new_thread);
+		nn = NN::build_nn(model_path, gpu_id, policy_value_batch_maxsize, slot_count);
 
 		// 次回、このmodel_pathかalloced_policy_value_batch_maxsizeに変更があれば、再度NNをbuildする。
 		this->model_path = model_path;
 		this->model_architecture = model_architecture;
 	}
-	nn->prepare_slots(new_thread);
+	nn->prepare_slots(slot_count);
 
 	// スレッド数に変更があるか、batchサイズが前回から変更があったならばUctSearcherのインスタンス自体を生成しなおす。
 	if (searchers.size() != (size_t)new_thread || architecture_changed
 	    || policy_value_batch_maxsize != this->policy_value_batch_maxsize
-	    || slot_capacity_changed)
+	    || slot_capacity_changed || pipeline_changed)
 	{
 		searchers.clear();
 		searchers.reserve(new_thread); // いまから追加する要素数はわかっているので事前に確保しておく。
 
 		for (int i = 0; i < new_thread; ++i)
-			searchers.emplace_back(this, i, policy_value_batch_maxsize);
+			searchers.emplace_back(this, i, policy_value_batch_maxsize, pipeline_depth);
 
 		this->policy_value_batch_maxsize = policy_value_batch_maxsize;
 		this->threads = new_thread;
+		this->pipeline_depth = pipeline_depth;
 	}
 
 	for (int i = 0; i < new_thread; ++i) {
 		searchers[i].DummyForward();
 	}
+
+	if (server_latency_us >= 0)
+		inference_server = std::make_unique<InferenceServer>(this, policy_value_batch_maxsize, server_latency_us,
+		                                                     new_thread * pipeline_depth);
 }
 
 // やねうら王では探索スレッドはThreadPoolが管理しているのでこれらは不要。
@@ -239,6 +262,276 @@ UCTSearcherGroup::Term()
 
 #endif
 
+// --------------------------------------------------------------------
+//  NNForwardWorker : batchの推論を探索スレッドとは別のスレッドで行う。
+// --------------------------------------------------------------------
+
+NNForwardWorker::NNForwardWorker(UctSearcherGroup* grp) :
+	grp(grp)
+{
+	th = std::thread([this]() { worker(); });
+}
+
+NNForwardWorker::~NNForwardWorker()
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		term = true;
+	}
+	cond.notify_all();
+	th.join();
+}
+
+// batchの推論を依頼する。
+void NNForwardWorker::submit(BatchBuffer* batch)
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		batch->forwarded = false;
+		queue.push_back(batch);
+	}
+	cond.notify_all();
+}
+
+// submit()したbatchの推論の完了を待つ。
+void NNForwardWorker::wait(BatchBuffer* batch)
+{
+	std::unique_lock<std::mutex> lk(mtx);
+	cond.wait(lk, [&] { return batch->forwarded; });
+}
+
+// workerスレッドのentry point
+void NNForwardWorker::worker()
+{
+	while (true)
+	{
+		BatchBuffer* batch;
+		{
+			std::unique_lock<std::mutex> lk(mtx);
+			cond.wait(lk, [&] { return term || !queue.empty(); });
+			// 💡 termになるのはUctSearcherの解体時で、その時に推論中のbatchは存在しない。
+			if (queue.empty())
+				break;
+			batch = queue.front();
+			queue.pop_front();
+		}
+
+		if (batch->size > 0)
+		{
+			// このスレッドとGPUとを紐付ける。
+			// 💡 "isready"でNNが作り直されることがあるので、毎回行う。
+			grp->set_device();
+			grp->nn_forward(batch->slot_id, batch->size, batch->packed_features1, batch->packed_features2,
+			                batch->features1, batch->features2, batch->y1, batch->y2);
+		}
+
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			batch->forwarded = true;
+		}
+		cond.notify_all();
+	}
+}
+
+// --------------------------------------------------------------------
+//  InferenceServer : 複数のUctSearcherのbatchを一つにまとめて推論する。
+// --------------------------------------------------------------------
+
+InferenceServer::InferenceServer(UctSearcherGroup* grp, int max_batch_size, int max_latency_us, int max_requests) :
+	grp(grp), max_batch_size(max_batch_size), max_latency_us(max_latency_us), max_requests(max_requests)
+{
+	packed_features1 = grp->gpu_memalloc<PType>(packed_input1_byte_count(max_batch_size));
+	packed_features2 = grp->gpu_memalloc<PType>(packed_input2_byte_count(max_batch_size));
+	features1        = grp->gpu_memalloc<NN_Input1>(input1_element_count(max_batch_size));
+	features2        = grp->gpu_memalloc<NN_Input2>(input2_element_count(max_batch_size));
+	y1               = grp->gpu_memalloc<NN_Output_Policy>(max_batch_size);
+	y2               = grp->gpu_memalloc<NN_Output_Value >(max_batch_size);
+
+	head = &stub;
+	tail = &stub;
+
+	th = std::thread([this]() { worker(); });
+}
+
+InferenceServer::~InferenceServer()
+{
+	term = true;
+	{
+		std::lock_guard<std::mutex> lk(idle_mtx);
+		idle_cond.notify_all();
+	}
+	th.join();
+
+	grp->gpu_memfree<PType           >(packed_features1);
+	grp->gpu_memfree<PType           >(packed_features2);
+	grp->gpu_memfree<NN_Input1       >(features1);
+	grp->gpu_memfree<NN_Input2       >(features2);
+	grp->gpu_memfree<NN_Output_Policy>(y1);
+	grp->gpu_memfree<NN_Output_Value >(y2);
+}
+
+// batchの推論を依頼する。(lock-free)
+void InferenceServer::submit(BatchBuffer* batch)
+{
+	batch->forwarded = false;
+
+	// MPSC queueにpushする。
+	auto* link = &batch->link;
+	link->next.store(nullptr, std::memory_order_relaxed);
+	// 💡 sleepingとの観測順序を保証するため、ここはseq_cstでexchangeする。
+	auto* prev = head.exchange(link);
+	prev->next.store(link, std::memory_order_release);
+
+	// サーバースレッドが眠っていたら起こす。
+	if (sleeping.load())
+	{
+		std::lock_guard<std::mutex> lk(idle_mtx);
+		idle_cond.notify_one();
+	}
+}
+
+// submit()したbatchの推論の完了を待つ。
+void InferenceServer::wait(BatchBuffer* batch)
+{
+	std::unique_lock<std::mutex> lk(done_mtx);
+	done_cond.wait(lk, [&] { return batch->forwarded; });
+}
+
+// MPSC queueから一つ取り出す。空(もしくはpushの途中)ならnullptr。
+BatchBuffer* InferenceServer::pop()
+{
+	auto* t    = tail;
+	auto* next = t->next.load(std::memory_order_acquire);
+
+	if (t == &stub)
+	{
+		if (next == nullptr)
+			return nullptr;
+		tail = next;
+		t    = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+
+	if (next)
+	{
+		tail = next;
+		return t->batch;
+	}
+
+	// 最後の一つを取り出す時は、stubを積みなおしてから取り出す。
+	if (t != head.load(std::memory_order_acquire))
+		return nullptr;
+
+	stub.next.store(nullptr, std::memory_order_relaxed);
+	auto* prev = head.exchange(&stub, std::memory_order_acq_rel);
+	prev->next.store(&stub, std::memory_order_release);
+
+	next = t->next.load(std::memory_order_acquire);
+	if (next)
+	{
+		tail = next;
+		return t->batch;
+	}
+	return nullptr;
+}
+
+// サーバースレッドのentry point
+void InferenceServer::worker()
+{
+	std::vector<BatchBuffer*> merged;
+	merged.reserve(max_requests);
+	int  merged_size = 0;
+	auto first_time  = std::chrono::steady_clock::now();
+
+	while (true)
+	{
+		BatchBuffer* batch = pop();
+		if (batch)
+		{
+			// 連結するとmax_batch_sizeを超えるなら、先にいま積んであるものを推論する。
+			if (merged_size + batch->size > max_batch_size)
+			{
+				dispatch(merged, merged_size);
+				merged_size = 0;
+			}
+
+			if (merged.empty())
+				first_time = std::chrono::steady_clock::now();
+			merged.push_back(batch);
+			merged_size += batch->size;
+
+			// batchが一杯になったか、すべてのbatchが揃った(これ以上待っても来ない)なら推論する。
+			if (merged_size >= max_batch_size || int(merged.size()) >= max_requests)
+			{
+				dispatch(merged, merged_size);
+				merged_size = 0;
+			}
+			continue;
+		}
+
+		if (!merged.empty())
+		{
+			// 最初のbatchを受け取ってからmax_latency_us経過したら、そこまでで推論する。
+			auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+			  std::chrono::steady_clock::now() - first_time);
+			if (elapsed.count() >= max_latency_us)
+			{
+				dispatch(merged, merged_size);
+				merged_size = 0;
+			}
+			else
+				std::this_thread::yield();
+			continue;
+		}
+
+		if (term)
+			break;
+
+		// queueが空なので、submit()されるまで眠る。
+		// 💡 sleepingをtrueにしてからqueueを再確認するので、submit()側とどちらかが必ず相手を観測する。
+		std::unique_lock<std::mutex> lk(idle_mtx);
+		sleeping = true;
+		if (head.load() == tail && tail->next.load() == nullptr && !term)
+			idle_cond.wait_for(lk, std::chrono::milliseconds(1));
+		sleeping = false;
+	}
+}
+
+// mergedのbatchを連結して推論し、結果を各batchに書き戻す。
+void InferenceServer::dispatch(std::vector<BatchBuffer*>& merged, int merged_size)
+{
+	if (merged_size > 0)
+	{
+		int index = 0;
+		for (auto* b : merged)
+		{
+			copy_packed_features(b->size, b->packed_features1, b->packed_features2, index,
+			                     packed_features1, packed_features2);
+			index += b->size;
+		}
+
+		grp->set_device();
+		grp->nn_forward(0, merged_size, packed_features1, packed_features2, features1, features2, y1, y2);
+
+		index = 0;
+		for (auto* b : merged)
+		{
+			std::memcpy(b->y1, y1 + index, sizeof(NN_Output_Policy) * b->size);
+			std::memcpy(b->y2, y2 + index, sizeof(NN_Output_Value ) * b->size);
+			index += b->size;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(done_mtx);
+		for (auto* b : merged)
+			b->forwarded = true;
+	}
+	done_cond.notify_all();
+
+	merged.clear();
+}
+
 // --------------------------------------------------------------------
 //  UCTSearcher : UctSearcherを行うスレッド一つを表現する。
 // --------------------------------------------------------------------
@@ -261,29 +554,30 @@ void UctSearcher::QueuingNode(const Position *pos, Node* node, float* value_win)
 	}*/
 
 	// 現在の局面に出現している特徴量を設定する。
-	// current_policy_value_batch_indexは、UctSearchThreadごとに持っているのでlock不要
+	// current_batchは、UctSearchThreadごとに持っているのでlock不要
 
-	make_input_features(*pos, current_policy_value_batch_index, packed_features1, packed_features2);
+	BatchBuffer& batch = *current_batch;
+	make_input_features(*pos, batch.size, batch.packed_features1, batch.packed_features2);
 
 	// 現在のNodeと手番を保存しておく。
-	policy_value_batch[current_policy_value_batch_index] = { node, pos->side_to_move() ,
+	batch.policy_value_batch[batch.size] = { node, pos->side_to_move() , pos->key() ,
 #if defined(USE_POLICY_BOOK)
 		pos->hash_key() ,
 #endif
 		value_win};
 
 #ifdef MAKE_BOOK
-	policy_value_book_key[current_policy_value_batch_index] = Book::bookKey(*pos);
+	batch.policy_value_book_key[batch.size] = Book::bookKey(*pos);
 #endif
 
-	current_policy_value_batch_index++;
+	batch.size++;
 	// これが、policy_value_batch_maxsize分だけ溜まったら、nn->forward()を呼び出す。
 }
 
 // leaf node用の詰め将棋ルーチンの初期化(alloc)を行う。
 // ※　SetLimits()が"go"に対してしか呼び出されていないからmax_moves_to_drawは未確定なので
 //     ここでそれを用いた設定をするわけにはいかない。
-void UctSearcher::InitMateSearcher(const SearchOptions& options)
+void UctSearcher::InitMateSearcher(const SearchOptions& options, Mate::MateHashTable* hash_table)
 {
 	// -- leaf nodeでdf-pn solverを用いる時はメモリの確保が必要
 
@@ -291,6 +585,13 @@ void UctSearcher::InitMateSearcher(const SearchOptions& options)
 	// でもマルチスレッドだとメモリアクセスが足を引っ張るようで50nodeぐらいでないと…。
 	// 50 nodeデフォルトでいいや。強さこれで5手詰めとほぼ変わらないし、nps 5%ほど速いので…。
 	// 10000/* nodes */ * 16 /* bytes */ * 10 /* 平均分岐数 */ / (1024 * 1024) = 1.525[MB] お、、おう…。1万nodeぐらいまでは1MBあればいけるか。
+
+	// 詰み探索の置換表を共有する時は、それに対応したsolverにする。
+	// PV lineの詰み探索スレッドが証明した局面にleaf nodeで到達した時に、その結論を用いることができる。
+	mate_solver.ChangeSolverType(hash_table ? Mate::Dfpn::DfpnSolverType::Node16bitOrderingWithHash
+											: Mate::Dfpn::DfpnSolverType::Node16bitOrdering);
+	if (hash_table)
+		mate_solver.set_hash_table(hash_table);
 	mate_solver.alloc(1);
 }
 
@@ -383,18 +684,22 @@ void UctSearcher::DummyForward()
 
 	// ダミー局面推論開始時間
 	TimePoint tpforwardbegin = now();
-	// ダミー局面設定
-	Position pos;
-	StateInfo si;
-	for (int i = 0; i < policy_value_batch_maxsize; ++i) {
-		pos.set(dummy_sfen((u32)i), &si);
-		make_input_features(pos, i, packed_features1, packed_features2);
-	}
 	// このスレッドとGPUとを紐付ける。
 	grp->set_device();
-	// 最大バッチサイズ(policy_value_batch_maxsize) と 最小バッチサイズ(1) でそれぞれ推論を実行しておく
-	grp->nn_forward(thread_id, policy_value_batch_maxsize, packed_features1, packed_features2, features1, features2, y1, y2);
-	grp->nn_forward(thread_id, 1, packed_features1, packed_features2, features1, features2, y1, y2);
+	// 💡 batchのバッファごとに推論slotが異なるので、それぞれで推論を実行しておく。
+	for (auto& b : batches)
+	{
+		// ダミー局面設定
+		Position pos;
+		StateInfo si;
+		for (int i = 0; i < policy_value_batch_maxsize; ++i) {
+			pos.set(dummy_sfen((u32)i), &si);
+			make_input_features(pos, i, b.packed_features1, b.packed_features2);
+		}
+		// 最大バッチサイズ(policy_value_batch_maxsize) と 最小バッチサイズ(1) でそれぞれ推論を実行しておく
+		grp->nn_forward(b.slot_id, policy_value_batch_maxsize, b.packed_features1, b.packed_features2, b.features1, b.features2, b.y1, b.y2);
+		grp->nn_forward(b.slot_id, 1, b.packed_features1, b.packed_features2, b.features1, b.features2, b.y1, b.y2);
+	}
 	// ダミー局面推論終了時間
 	TimePoint tpforwardend = now();
 
@@ -416,6 +721,32 @@ void UctSearcher::ParallelUctSearchStart(const Position& rootPos)
 	ParallelUctSearch(rootPos);
 }
 
+// NNCacheを調べて、hitしたならnodeの各子ノードのnnrateを設定して評価済みにする。
+bool UctSearcher::ProbeNNCache(const Position* pos, Node* node, float& value)
+{
+#if defined(USE_POLICY_BOOK) || defined(MAKE_BOOK)
+	// 定跡の遷移確率をpolicyに混ぜるので、cacheは用いない。
+	return false;
+#else
+	auto& nn_cache = grp->get_dlsearcher()->nn_cache;
+	if (!nn_cache.enabled())
+		return false;
+
+	const ChildNumType child_num = node->child_num;
+	ChildNode*         uct_child = node->child.get();
+
+	float policy[NNCache::MAX_CHILDREN];
+	if (!nn_cache.probe(pos->key(), uct_child, child_num, value, policy))
+		return false;
+
+	for (ChildNumType j = 0; j < child_num; j++)
+		uct_child[j].nnrate = policy[j];
+
+	node->SetEvaled();
+	return true;
+#endif
+}
+
 // UCTアルゴリズム(UctSearch())を反復的に実行する。
 // 探索用のすべてのスレッドが並列的にこの関数を実行をする。
 // この関数とUctSearch()、SelectMaxUcbChild()が探索部本体と言えると思う。
@@ -424,6 +755,10 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
     auto&            search_limits = ds->search_limits;
     auto             stop = [&]() { return ds->engine.threads.stop || search_limits.interruption; };
 
+    // "bench"コマンドで"mcts"が指定されている時は探索部の計測を行う。
+    profiling                 = ds->search_profiling;
+    const u64 search_start_ns = profiling ? profile_now_ns() : 0;
+
     // ↓ dlshogiのコードここから ↓
 
     Node* current_root = get_node_tree()->GetCurrentHead();
@@ -432,31 +767,54 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
     LOCK_EXPAND;
     if (!current_root->IsEvaled())
     {
-        current_policy_value_batch_index = 0;
+        current_batch       = &batches[0];
+        current_batch->size = 0;
         float value_win;  // EvalNode()した時に、ここにvalueが書き戻される。ダミーの変数。
         QueuingNode(&rootPos, current_root, &value_win);
-        EvalNode();
+        ForwardBatch(*current_batch);
+        EvalNode(*current_batch);
     }
     UNLOCK_EXPAND;
 
-    // 探索経路のバッチ
-    vector<NodeVisitor>      visitor_batch;
-    vector<NodeTrajectories> trajectories_batch_discarded;
-    visitor_batch.reserve(policy_value_batch_maxsize);
-    trajectories_batch_discarded.reserve(policy_value_batch_maxsize);
+    /*
+        📓 batchのpipeline化
+
+            batchesが2つ以上ある時(エンジンオプションの"DNN_Pipeline"が2以上の時)は、
+            あるbatchを推論に投げたら、その完了を待たずに次のbatchの探索(木の降下と入力特徴量の作成)を行う。
+            推論に投げているbatchの数がbatches.size()に達したら、最も古いbatchの推論の完了を待って、
+            その結果を反映(EvalNode + backup)してから、そのバッファを次のbatchに再利用する。
+
+            推論中のbatchのNodeはevaledになっていないので、次のbatchの探索でそこに到達した時はDISCARDEDになる。
+            これは複数スレッドで探索している時と同じ扱いである。
+    */
+
+    const size_t depth     = batches.size();
+    size_t       next      = 0;  // 次に探索に使うbatchのindex
+    size_t       in_flight = 0;  // 推論に投げていて、まだ結果を反映させていないbatchの数
+
+    // 推論を別スレッド(NNForwardWorkerかInferenceServer)で行うか。
+    const bool async = forward_worker || grp->get_inference_server();
+
+    // 1つのbatchに積む局面の最大数
+    const int batch_size = grp->search_batch_size();
 
     // 探索回数が閾値を超える, または探索が打ち切られたらループを抜ける
     while (!stop())
     {
+        BatchBuffer& batch                        = batches[next];
+        auto&        visitor_batch                = batch.visitor_batch;
+        auto&        trajectories_batch_discarded = batch.trajectories_batch_discarded;
+
         visitor_batch.clear();
         trajectories_batch_discarded.clear();
-        current_policy_value_batch_index = 0;
+        batch.size    = 0;
+        current_batch = &batch;
 
         // バッチサイズ分探索を繰り返す
         // stop()になったらなるべく早く終わりたいので終了判定のところに "&& !stop"を書いておく。
         // ※　VirtualLossを無くすなどして、stop()になったら直ちにリターンすべきだが、
         //    1回のbatch sizeはGPU側で0.1秒程度で完了できる量にすると思うので、普通のGPUでは誤差か。
-        for (int i = 0; i < policy_value_batch_maxsize && !stop(); i++)
+        for (int i = 0; i < batch_size && !stop(); i++)
         {
 
             // 盤面のコピー
@@ -470,6 +828,12 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
             visitor_batch.emplace_back();
             const float result = UctSearch(&pos, nullptr, current_root, visitor_batch.back());
 
+            if (profiling)
+            {
+                profile.playouts++;
+                profile.discarded += result == DISCARDED;
+            }
+
             if (result != DISCARDED)
             {
                 atomic_fetch_add(&search_limits.nodes_searched, (NodeCountType) 1);
@@ -490,47 +854,100 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
             }
         }
 
-        // 評価
-        EvalNode();
+        if (!async)
+        {
+            // 評価して結果を反映させる。
+            const u64 wait_start_ns = profiling ? profile_now_ns() : 0;
+            ForwardBatch(batch);
+            if (profiling)
+                profile.nn_wait_ns += profile_now_ns() - wait_start_ns;
+
+            CompleteBatch(batch);
+            continue;
+        }
 
-        // 破棄した探索経路のVirtual Lossを戻す
-        for (auto& trajectories : trajectories_batch_discarded)
+        // 推論を依頼して、その完了を待たずに次のbatchの探索に進む。
+        SubmitBatch(batch);
+        ++in_flight;
+        next = (next + 1) % depth;
+
+        // すべてのバッファが推論中なので、最も古いbatch(次に使うbatch)の完了を待って結果を反映させる。
+        if (in_flight == depth)
         {
-            for (auto it = trajectories.rbegin(); it != trajectories.rend(); ++it)
-            {
-                NodeTrajectory&    current_next = *it;
-                Node*              current      = current_next.node;
-                ChildNode*         uct_child    = current->child.get();
-                const ChildNumType next_index   = current_next.index;
+            const u64 wait_start_ns = profiling ? profile_now_ns() : 0;
+            WaitBatch(batches[next]);
+            if (profiling)
+                profile.nn_wait_ns += profile_now_ns() - wait_start_ns;
 
-                SubVirtualLoss(&uct_child[next_index], current);
-            }
+            CompleteBatch(batches[next]);
+            --in_flight;
         }
+    }
+
+    // 推論中のbatchの完了を待って、古い順に結果を反映させる。
+    // 💡 Virtual Lossが残ったままになるので、stop()であっても省略してはならない。
+    for (; in_flight > 0; --in_flight)
+    {
+        BatchBuffer& batch = batches[(next + depth - in_flight) % depth];
+        WaitBatch(batch);
+        CompleteBatch(batch);
+    }
+
+    if (profiling)
+        profile.search_ns += profile_now_ns() - search_start_ns;
+}
+
+// 推論済みのbatchについて、EvalNode()を呼び出したあと、
+// 破棄した探索経路のVirtual Lossを戻し、評価した探索経路をbackupする。
+void UctSearcher::CompleteBatch(BatchBuffer& batch)
+{
+    if (profiling && batch.size > 0)
+    {
+        profile.batches++;
+        profile.batch_positions += batch.size;
+        profile.batch_capacity  += grp->search_batch_size();
+    }
 
-        // バックアップ
-        // 通った経路(rootからleaf node)までのmove_countを加算するなどの処理。
-        // AlphaZeroの論文で、"Backup"と呼ばれている。
+    // 評価
+    EvalNode(batch);
 
-        // leaf nodeでの期待勝率(NNの返してきたvalue)。
-        // これをleaf nodeからrootに向かって、伝播していく。(Node::winに加算していく)
-        for (auto& visitor : visitor_batch)
+    // 破棄した探索経路のVirtual Lossを戻す
+    for (auto& trajectories : batch.trajectories_batch_discarded)
+    {
+        for (auto it = trajectories.rbegin(); it != trajectories.rend(); ++it)
         {
-            // leaf nodeの一つ上のnode用にvisitor.value_winから取り出す。
-            float result = 1.0f - visitor.value_win;
+            NodeTrajectory&    current_next = *it;
+            Node*              current      = current_next.node;
+            ChildNode*         uct_child    = current->child.get();
+            const ChildNumType next_index   = current_next.index;
 
-            auto& trajectories = visitor.trajectories;
-            for (auto it = trajectories.rbegin(); it != trajectories.rend(); ++it)
-            {
-                auto&              current_next = *it;
-                Node*              current      = current_next.node;
-                const ChildNumType next_index   = current_next.index;
-                ChildNode*         uct_child    = current->child.get();
+            SubVirtualLoss(&uct_child[next_index], current);
+        }
+    }
 
-                UpdateResult(&uct_child[next_index], result, current);
+    // バックアップ
+    // 通った経路(rootからleaf node)までのmove_countを加算するなどの処理。
+    // AlphaZeroの論文で、"Backup"と呼ばれている。
 
-                // Value Networkの返した期待勝率を手番ごとに反転させて伝播する。
-                result = 1.0f - result;
-            }
+    // leaf nodeでの期待勝率(NNの返してきたvalue)。
+    // これをleaf nodeからrootに向かって、伝播していく。(Node::winに加算していく)
+    for (auto& visitor : batch.visitor_batch)
+    {
+        // leaf nodeの一つ上のnode用にvisitor.value_winから取り出す。
+        float result = 1.0f - visitor.value_win;
+
+        auto& trajectories = visitor.trajectories;
+        for (auto it = trajectories.rbegin(); it != trajectories.rend(); ++it)
+        {
+            auto&              current_next = *it;
+            Node*              current      = current_next.node;
+            const ChildNumType next_index   = current_next.index;
+            ChildNode*         uct_child    = current->child.get();
+
+            UpdateResult(&uct_child[next_index], result, current);
+
+            // Value Networkの返した期待勝率を手番ごとに反転させて伝播する。
+            result = 1.0f - result;
         }
     }
 }
@@ -544,7 +961,8 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
 //
 // 返し値 : currentの局面の期待勝率を返すが、以下の特殊な定数を取ることがある。
 //   QUEUING      : 評価関数を呼び出した。(呼び出しはqueuingされていて、完了はしていない)
-//   DISCARDED    : 他のスレッドがすでにこのnodeの評価関数の呼び出しをしたあとであったので、何もせずにリターンしたことを示す。
+//   DISCARDED    : 他のスレッドがすでにこのnodeの評価関数の呼び出しをしたあとであったか、
+//                  他のスレッドが展開中であったので、何もせずにリターンしたことを示す。
 //
 float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, NodeVisitor& visitor)
 {
@@ -568,16 +986,30 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 	// ここまでの手順
 	auto& trajectories = visitor.trajectories;
 
-	// 現在見ているノードをロック
-	// これは、このNode(current)の展開(child[i].node = new Node(); ... )を行う時にLockすることになっている。
-	auto& mutex = ds->get_node_mutex(pos);
-	mutex.lock();
+	// 📝 dlshogiでは、ここで局面ごとのmutexをlockして、子ノードの選択と展開を行っていたが、やねうら王ではlockしない。
+	//     子ノードの選択とVirtual Lossの加算はatomicな変数に対して行い、
+	//     child_nodesの初期化と子ノードの作成だけをExpandStateのCASで1スレッドに限る。(ExpandStateのコメントを参照)
+	//     CASに負けたスレッドは待たずにDISCARDEDを返して、このプレイアウトをやり直す。
 
 	// 子ノードへのポインタ配列が初期化されていない場合、初期化する
-	if (!current->child_nodes) current->InitChildNodes();
+	// 他のスレッドが初期化中なら、まだVirtual Lossを加算していないので、そのままDISCARDEDを返す。
+	if (!current->EnsureChildNodes())
+	{
+		profile.expand.lost++;
+		return DISCARDED;
+	}
 
 	// 子ノードのなかからUCB値最大の手を求める
-	const ChildNumType next_index = SelectMaxUcbChild(parent, current);
+	ChildNumType next_index;
+	if (profiling)
+	{
+		const u64 select_start_ns = profile_now_ns();
+		next_index = SelectMaxUcbChild(parent, current);
+		profile.select_ns += profile_now_ns() - select_start_ns;
+		profile.select_calls++;
+	}
+	else
+		next_index = SelectMaxUcbChild(parent, current);
 
 #if defined(LOG_PRINT)
 	logger.print("do_move = " + to_usi_string(uct_child[next_index].move));
@@ -594,26 +1026,27 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 
 	// ノードの展開の確認
 	// この子ノードがまだ展開されていないなら、この子ノードを展開する。
-	if (!current->child_nodes[next_index]) {
-		// ノードの作成
-		Node* child_node = current->CreateChildNode(next_index);
-		//cerr << "value evaluated " << result << " " << v << " " << *value_result << endl;
-
-		// ノードを展開したので、もうcurrentは書き換えないからunlockして良い。
-
-		// 現在見ているノードのロックを解除
-		mutex.unlock();
-		// →　CreateChildNode()で新しく作られたNodeは、evaledがfalseのままになっているので
-		// 　　他の探索スレッドがここに到達した場合、DISCARDする。
-		//     この新しく作られたNodeは、EvalNode()のなかで最後にevaled = trueに変更される。
-
-		// 経路を記録
+	// 新しく作成した時はchild_nodeに、作成済みであった時(DAGモードで既存のNodeを共有した場合も)はnext_nodeにそのNodeが入る。
+	// ⚠ child_nodes[next_index]は、他のスレッドが書き換えるかも知れないので、IsExpanded()を確認してから読むこと。
+	Node*           child_node = nullptr;
+	Node*           next_node  = nullptr;
+	RepetitionState rep        = REPETITION_NONE;
+	if (uct_child[next_index].IsExpanded())
+		next_node = current->child_nodes[next_index].get();
+
+	else if (!uct_child[next_index].TryBeginExpand())
+	{
+		// 他のスレッドがこの子ノードを作成中なので、DISCARDEDにする。
+		// 加算したVirtual Lossはバッチ完了までそのままにする。(評価中のNodeに到達した時と同じ扱い)
 		trajectories.emplace_back(current, next_index);
+		profile.expand.lost++;
+		return DISCARDED;
+	}
 
+	else
+	{
 		// 千日手チェック
 
-		RepetitionState rep;
-
 		// この局面の手数が最大手数を超えているなら千日手扱いにする。
 
 		// この局面で詰んでいる可能性がある。その時はmatedのスコアを返すべき。
@@ -630,7 +1063,46 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 		if (options.max_moves_to_draw < pos->game_ply())
 			rep = pos->is_mated() ? REPETITION_LOSE /* 負け扱い */ : REPETITION_DRAW;
 		else
+		{
+#if defined(DLSHOGI_DAG)
+			int found_ply;
+			rep = pos->is_repetition(16, found_ply);
+
+			// 千日手が見つかったので、found_ply手前の局面からcurrentまでの間にあるNodeは、
+			// そこに至る経路によって結果が変わる。これらは以降、共有しない。(NodeTableのコメントを参照)
+			// 💡 found_ply手前の局面より前にあるNodeは、千日手の手順を部分木に含むので、経路には依存しない。
+			// 💡 最大手数による引き分けは、keyに手数を含めているので経路に依存しない。
+			if (rep != REPETITION_NONE)
+			{
+				// currentとその祖先のうち、found_ply - 1 個が該当する。
+				profile.expand.path_dependent += current->SetPathDependent();
+				const size_t n = std::min(trajectories.size(), size_t(std::max(found_ply - 2, 0)));
+				for (size_t i = trajectories.size() - n; i < trajectories.size(); ++i)
+					profile.expand.path_dependent += trajectories[i].node->SetPathDependent();
+			}
+#else
 			rep = pos->is_repetition(16);
+#endif
+		}
+
+#if defined(DLSHOGI_DAG)
+		// 千日手絡みの局面は、そこに至る経路によって結果が変わるので共有しない。
+		const Key dag_key = rep == REPETITION_NONE ? NodeTable::KeyOf(*pos) : 0;
+		child_node        = current->ExpandChildNode(next_index, profile.expand, dag_key);
+		if (!child_node)
+			next_node = current->child_nodes[next_index].get();
+#else
+		child_node = current->ExpandChildNode(next_index, profile.expand);
+#endif
+	}
+
+	if (child_node) {
+		// →　ExpandChildNode()で新しく作られたNodeは、evaledがfalseのままになっているので
+		// 　　他の探索スレッドがここに到達した場合、DISCARDする。
+		//     この新しく作られたNodeは、EvalNode()のなかで最後にevaled = trueに変更される。
+
+		// 経路を記録
+		trajectories.emplace_back(current, next_index);
 
 		switch (rep)
 		{
@@ -706,6 +1178,12 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 						uct_child[next_index].SetLose();
 						result = 1.0f;
 					}
+					else if (ProbeNNCache(pos, child_node, result))
+					{
+						// NNCacheにhitしたので、NNの推論を待たずにこのnodeの評価は完了している。
+						// 反転して値を返すため、1から引き算する。
+						result = 1.0f - result;
+					}
 					else
 					{
 						// ノードをキューに追加
@@ -729,14 +1207,9 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 
 	}
 	else {
-		// 現在見ているノードのロックを解除
-		mutex.unlock();
-
 		// 経路を記録
 		trajectories.emplace_back(current, next_index);
 
-		Node* next_node = current->child_nodes[next_index].get();
-
 		// policy計算中のため破棄する(他のスレッドが同じノードを先に展開した場合)
 		if (!next_node->IsEvaled())
 			return DISCARDED;
@@ -787,7 +1260,9 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 //  currentノードがすべて勝ちなら、親ノードは負けなので、parent->SetLose()を呼び出す。
 ChildNumType UctSearcher::SelectMaxUcbChild(ChildNode* parent, Node* current)
 {
-	// nodeはlockされているので、atomicは不要なはず。
+	// 📝 lockせずに呼び出すので、他のスレッドが同時にmove_count、win等を更新しうる。これらはatomicのまま読む。
+	//     他のスレッドと同じ子を選ぶことはありうるが、子ノードを作成するのはそのうちの1スレッドだけである。
+	//     (呼び出し元のUctSearch()を参照)
 
 	auto ds = grp->get_dlsearcher();
 	auto& options = ds->search_options;
@@ -915,43 +1390,93 @@ ChildNumType UctSearcher::SelectMaxUcbChild(ChildNode* parent, Node* current)
 	} else {
 
 		// for FPU reduction
-		atomic_fetch_add(&current->visited_nnrate, uct_child[max_child].nnrate);
+		atomic_fetch_add(&current->visited_nnrate, (float) uct_child[max_child].nnrate);
 	}
 
 	return max_child;
 }
 
-// 評価関数を呼び出す。
 // batchに積まれていた入力特徴量をまとめてGPUに投げて、結果を得る。
-void UctSearcher::EvalNode() {
-    // 何もデータが積まれていないならこのあとforwardを呼び出してはならないので帰る。
-    if (current_policy_value_batch_index == 0)
+void UctSearcher::ForwardBatch(BatchBuffer& batch) {
+    // 何もデータが積まれていないならforwardを呼び出してはならない。
+    if (batch.size == 0)
+        return;
+
+    // InferenceServerを用いている時は、推論はすべてサーバーのスレッドで行う。
+    if (grp->get_inference_server())
+    {
+        SubmitBatch(batch);
+        WaitBatch(batch);
+        return;
+    }
+
+    // predict
+    // batch.sizeの数だけまとめて局面を評価する
+    grp->nn_forward(batch.slot_id, batch.size, batch.packed_features1, batch.packed_features2,
+                    batch.features1, batch.features2, batch.y1, batch.y2);
+}
+
+// mutexをlockする。計測中なら、待たされた回数と時間をlock_profileに加算する。
+void UctSearcher::LockMutex(std::mutex& mutex, LockProfile& lock_profile) {
+    if (!profiling)
+    {
+        mutex.lock();
+        return;
+    }
+
+    lock_profile.acquisitions++;
+    if (mutex.try_lock())
+        return;
+
+    const u64 wait_start_ns = profile_now_ns();
+    mutex.lock();
+    lock_profile.contended++;
+    lock_profile.wait_ns += profile_now_ns() - wait_start_ns;
+}
+
+// batchの推論を依頼する。(InferenceServerかNNForwardWorkerに)
+void UctSearcher::SubmitBatch(BatchBuffer& batch) {
+    if (auto server = grp->get_inference_server())
+        server->submit(&batch);
+    else
+        forward_worker->submit(&batch);
+}
+
+// SubmitBatch()したbatchの推論の完了を待つ。
+void UctSearcher::WaitBatch(BatchBuffer& batch) {
+    if (auto server = grp->get_inference_server())
+        server->wait(&batch);
+    else
+        forward_worker->wait(&batch);
+}
+
+// 評価関数を呼び出した結果を反映させる。
+// ForwardBatch()(またはNNForwardWorker)で推論済みのbatchの結果を、batchに積まれていた各Nodeに書き戻す。
+void UctSearcher::EvalNode(BatchBuffer& batch) {
+    // 何もデータが積まれていないなら帰る。
+    if (batch.size == 0)
         return;
 
     // batchに積まれているデータの個数
-    const int policy_value_batch_size = current_policy_value_batch_index;
+    const int policy_value_batch_size = batch.size;
     auto      ds                      = grp->get_dlsearcher();
+    auto      policy_value_batch      = batch.policy_value_batch;
 
 #if defined(LOG_PRINT)
     // 入力特徴量
     std::stringstream ss;
     for (size_t i = 0; i < input1_element_count(1); ++i)
-        ss << features1[i] << ",";
+        ss << batch.features1[i] << ",";
     ss << endl << "Input2" << endl;
     for (size_t i = 0; i < input2_element_count(1); ++i)
-        ss << features2[i] << ",";
+        ss << batch.features2[i] << ",";
     logger.print(ss.str());
 #endif
 
-    // predict
-    // policy_value_batch_sizeの数だけまとめて局面を評価する
-    grp->nn_forward(thread_id, policy_value_batch_size, packed_features1, packed_features2, features1,
-                    features2, y1, y2);
-
-    //cout << *y2 << endl;
+    //cout << *batch.y2 << endl;
 
-    const NN_Output_Policy* logits = y1;
-    const NN_Output_Value*  value  = y2;
+    const NN_Output_Policy* logits = batch.y1;
+    const NN_Output_Value*  value  = batch.y2;
 
     for (int i = 0; i < policy_value_batch_size; i++, logits++, value++)
     {
@@ -1003,6 +1528,13 @@ void UctSearcher::EvalNode() {
         // Boltzmann distribution
         softmax_temperature_with_normalize(legal_move_probabilities);
 
+#if !(defined(USE_POLICY_BOOK) || defined(MAKE_BOOK))
+        // 次に同じ局面に到達した時にNNを呼び出さずに済むように記録しておく。
+        // 📝 ProbeNNCache()と同じく、定跡の遷移確率をpolicyに混ぜる時はcacheを用いない。
+        ds->nn_cache.store(policy_value_batch[i].cache_key, uct_child, child_num, *value,
+                           legal_move_probabilities.data());
+#endif
+
 #if !defined(USE_POLICY_BOOK)
         for (ChildNumType j = 0; j < child_num; j++)
         {
@@ -1088,7 +1620,7 @@ void UctSearcher::EvalNode() {
 #ifdef MAKE_BOOK
         // 定跡作成時は、事前確率に定跡の遷移確率も使用する
         constexpr float alpha = 0.5f;
-        const Key&      key   = policy_value_book_key[i];
+        const Key&      key   = batch.policy_value_book_key[i];
         const auto      itr   = bookMap.find(key);
         if (itr != bookMap.end())
         {
@@ -1116,6 +1648,64 @@ void UctSearcher::EvalNode() {
 }
 
 
+// -----------------------------------------------------------------------------
+//  探索部の計測結果
+// -----------------------------------------------------------------------------
+
+void SearchProfile::add(const SearchProfile& o) {
+	playouts        += o.playouts;
+	discarded       += o.discarded;
+	batches         += o.batches;
+	batch_positions += o.batch_positions;
+	batch_capacity  += o.batch_capacity;
+	select_calls    += o.select_calls;
+	select_ns       += o.select_ns;
+	nn_wait_ns      += o.nn_wait_ns;
+	search_ns       += o.search_ns;
+	expand_lock.add(o.expand_lock);
+	expand.add(o.expand);
+}
+
+std::string SearchProfile::to_string(size_t searchers) const {
+	auto ratio = [](u64 a, u64 b) { return b ? 100.0 * double(a) / double(b) : 0.0; };
+
+	// search_nsは全UctSearcherの合計なので、UctSearcherの数で割ったものを経過時間とみなす。
+	const double elapsed_sec = searchers ? double(search_ns) / searchers / 1e9 : 0.0;
+
+	auto lock_string = [&](const char* name, const LockProfile& lp) {
+		std::ostringstream os;
+		os << std::fixed << std::setprecision(2)
+		   << name << " : acquisitions = " << lp.acquisitions
+		   << " , contended = " << lp.contended << " (" << ratio(lp.contended, lp.acquisitions) << "%)"
+		   << " , wait = " << double(lp.wait_ns) / 1e6 << "[ms]";
+		return os.str();
+	};
+
+	std::ostringstream os;
+	os << std::fixed << std::setprecision(2)
+	   << "searchers          : " << searchers << std::endl
+	   << "playouts           : " << playouts
+	   << " (discarded " << ratio(discarded, playouts) << "%)" << std::endl
+	   << "playouts/s         : " << (elapsed_sec > 0 ? double(playouts) / elapsed_sec : 0.0) << std::endl
+	   << "batches            : " << batches
+	   << " , positions/batch = " << (batches ? double(batch_positions) / batches : 0.0)
+	   << " , fill ratio = " << ratio(batch_positions, batch_capacity) << "%" << std::endl
+	   << "SelectMaxUcbChild  : calls = " << select_calls
+	   << " , " << (select_calls ? double(select_ns) / select_calls : 0.0) << "[ns/call]"
+	   << " (" << ratio(select_ns, search_ns) << "% of search)" << std::endl
+	   << "NN wait            : " << double(nn_wait_ns) / 1e6 << "[ms]"
+	   << " (" << ratio(nn_wait_ns, search_ns) << "% of search)" << std::endl
+	   << lock_string("mutex_expand      ", expand_lock) << std::endl
+	   << "node expansion     : expansions = " << expand.expansions
+	   << " , lost races = " << expand.lost
+#if defined(DLSHOGI_DAG)
+	   << " , transpositions = " << expand.transpositions
+	   << " , path-dependent = " << expand.path_dependent
+#endif
+	   ;
+	return os.str();
+}
+
 // 訪問回数が最大の子ノードを選択
 unsigned int select_max_child_node(const Node* uct_node)
 {
@@ -6,6 +6,12 @@
 #include "../../position.h"
 #include "../../mate/mate.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
 #include "Node.h"
 #include "PvMateSearch.h"
 
@@ -20,6 +26,7 @@ using namespace YaneuraOu::Eval::dlshogi;
 
 class UctSearcher;
 class DlshogiSearcher;
+class InferenceServer;
 struct SearchOptions;
 
 // UctSearcher(探索用スレッド)をGPU一つ利用する分ずつひとまとめにしたもの。
@@ -37,8 +44,11 @@ public:
 	//   new_thread                 : このインスタンスが確保するUctSearcherの数
 	//   gpu_id                     : このインスタンスに紐付けられているGPU ID
 	//   policy_value_batch_maxsize : このインスタンスが生成したスレッドがNNのforward()を呼び出す時のbatchsize
+	//   pipeline_depth             : 各UctSearcherが持つbatchのバッファの数(2以上なら推論と探索を重ねる)
+	//   server_latency_us          : 0以上ならInferenceServerを用いる。その時のbatchを待つ最大時間[us]
 	void Initialize(const std::string& model_path, const std::string& model_architecture,
-	                const int new_thread, const int gpu_id, const int policy_value_batch_maxsize);
+	                const int new_thread, const int gpu_id, const int policy_value_batch_maxsize,
+	                const int pipeline_depth, const int server_latency_us);
 
 	// ニューラルネットのforward() (順方向の伝播 = 推論)を呼び出す。
 	void nn_forward(const int slot_id, const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2)
@@ -47,7 +57,8 @@ public:
 		// 入力特徴量を展開する。GPU側で展開する場合は不要。
 		extract_input_features(batch_size, p1, p2, x1, x2);
 #endif
-#if defined(TENSOR_RT)
+#if defined(TENSOR_RT) || defined(NN_CPU)
+		// NN_CPUのforward()はreentrantなので、各スレッドが同時に推論して良い。
 		nn->forward(slot_id, batch_size, p1, p2, x1, x2, y1, y2);
 #else
 		mutex_gpu.lock();
@@ -87,6 +98,16 @@ public:
 	// 保持しているn番目のUctSearcherを返す。
 	UctSearcher* get_uct_searcher(int n) { return &searchers[n]; }
 
+	// InferenceServerを用いている時はそれを返す。用いていなければnullptr。
+	InferenceServer* get_inference_server() const { return inference_server.get(); }
+
+	// 各UctSearcherが1つのbatchに積む局面の最大数
+	// 💡 InferenceServerを用いる時は、各スレッドのbatchをまとめてDNN_Batch_Sizeになるようにする。
+	int search_batch_size() const {
+		return inference_server ? std::max(1, policy_value_batch_maxsize / std::max(1, int(threads)))
+		                        : policy_value_batch_maxsize;
+	}
+
 private:
 
 	// dlshogiではglobalだった変数
@@ -111,6 +132,10 @@ private:
 	// Initialize()で引数として渡される。
 	int policy_value_batch_maxsize;
 
+	// 各UctSearcherが持つbatchのバッファの数
+	// Initialize()で引数として渡される。
+	int pipeline_depth = 1;
+
 	// ↑のnnにアクセスする時のmutex
 	std::mutex mutex_gpu;
 
@@ -122,6 +147,10 @@ private:
 
 	// nnが保持している入力特徴量仕様。
 	std::string model_architecture;
+
+	// 複数のUctSearcherのbatchをまとめて推論するサーバー
+	// 💡 nnからメモリを確保しているので、nnより先に解体されるように最後に宣言しておく。
+	std::unique_ptr<InferenceServer> inference_server;
 };
 
 // leaf nodeまでに辿ったNodeを記録しておく構造体。
@@ -137,6 +166,38 @@ struct NodeTrajectory {
 // ※　dlshogiではtrajectories_t
 typedef std::vector<NodeTrajectory> NodeTrajectories;
 
+// mutexのlockの計測結果
+struct LockProfile {
+	u64 acquisitions = 0; // lockした回数
+	u64 contended    = 0; // そのうち、他のスレッドがlockしていて待たされた回数
+	u64 wait_ns      = 0; // 待たされた時間の合計[ns]
+
+	void add(const LockProfile& o) { acquisitions += o.acquisitions; contended += o.contended; wait_ns += o.wait_ns; }
+};
+
+// 探索部(木の降下、展開、backup)の計測結果。"bench"コマンドで"mcts"を指定した時に集計する。
+// 💡 各UctSearcherが自分のスレッドからだけ書き込むのでatomicにはしていない。
+struct SearchProfile {
+	u64 playouts        = 0; // UctSearch()でrootから降下した回数
+	u64 discarded       = 0; // そのうち、評価中か展開中のNodeに到達してDISCARDEDになった回数
+	u64 batches         = 0; // 推論したbatchの数
+	u64 batch_positions = 0; // 推論した局面数の合計
+	u64 batch_capacity  = 0; // batchに積める局面数の合計 (batch_positions / batch_capacityがbatchの充填率)
+	u64 select_calls    = 0; // SelectMaxUcbChild()の呼び出し回数
+	u64 select_ns       = 0; // SelectMaxUcbChild()に要した時間の合計[ns]
+	u64 nn_wait_ns      = 0; // 推論の完了を待っていた時間の合計[ns]
+	u64 search_ns       = 0; // ParallelUctSearch()の時間の合計[ns]
+
+	LockProfile expand_lock; // DlshogiSearcher::mutex_expand
+
+	ExpandProfile expand;    // Nodeの展開(ExpandStateのCAS)
+
+	void add(const SearchProfile& o);
+
+	// 集計結果を文字列化する。searchers : 集計したUctSearcherの数
+	std::string to_string(size_t searchers) const;
+};
+
 // 訪問したNodeに対してEvalNodeが完了した時に辿るための構造体。
 // ※　dlshogiではvisitor_t
 struct NodeVisitor {
@@ -161,6 +222,7 @@ struct NodeVisitor {
 struct BatchElement {
 	Node*	node;       // どのNodeに対するEvalNode()なのか。
 	Color	color;      // その時の手番
+	Key64	cache_key;  // NNCacheに書き込む時に用いる、この局面のhash key(Position::key())
 
 #if defined(USE_POLICY_BOOK)
 	HASH_KEY key;       // この局面のhash key
@@ -170,12 +232,149 @@ struct BatchElement {
 	float* value_win; // leaf nodeでのvalue_winの値(これを辿ってきたNodeに対して符号を反転させながら伝播させていく)
 };
 
+// NNに一度に投げる1 batch分の入出力バッファと、そのbatchの探索経路。
+// 🌈 "DNN_Pipeline"が2以上の時は、UctSearcherはこれを複数持ち、あるbatchを推論している間に
+//     次のbatchの探索(木の降下と入力特徴量の作成)を行う。
+struct BatchBuffer {
+	// これらは、policy_value_batch_maxsize分、事前に確保されている。
+	PType*            packed_features1 = nullptr;
+	PType*            packed_features2 = nullptr;
+	NN_Input1*        features1        = nullptr;
+	NN_Input2*        features2        = nullptr;
+	NN_Output_Policy* y1               = nullptr;
+	NN_Output_Value*  y2               = nullptr;
+
+	// EvalNode()ごとにどのNodeとColorから呼び出されたのかを記録しておく配列
+	// NNから返し値がもらえた時に、ここに記録されているNodeについて、その情報を更新する。
+	BatchElement* policy_value_batch = nullptr;
+
+#ifdef MAKE_BOOK
+	Key* policy_value_book_key = nullptr;
+#endif
+
+	// features1[],features2[],policy_value_batch[],policy_value_book_key[],の次に使用するindex。
+	// (このbatchに積まれている局面の数)
+	int size = 0;
+
+	// このbatchを推論する時のslot_id。(TensorRTのように複数の推論slotを使える実装用)
+	int slot_id = 0;
+
+	// 評価待ちの探索経路
+	std::vector<NodeVisitor> visitor_batch;
+
+	// 破棄した探索経路(推論完了後にVirtual Lossを戻す)
+	std::vector<NodeTrajectories> trajectories_batch_discarded;
+
+	// NNForwardWorker(InferenceServer)による推論が完了したか。NNForwardWorker::mtx(InferenceServer::done_mtx)で保護されている。
+	bool forwarded = true;
+
+	// InferenceServerのMPSC queueで用いるlink
+	// 💡 std::atomicはcopyできないので、copyしても中身は引き継がないようにしておく。
+	struct QueueLink {
+		std::atomic<QueueLink*> next  = nullptr;
+		BatchBuffer*            batch = nullptr;
+
+		QueueLink() = default;
+		QueueLink(const QueueLink&) {}
+		QueueLink& operator=(const QueueLink&) { return *this; }
+	} link;
+};
+
+// batchの推論(UctSearcherGroup::nn_forward())を探索スレッドとは別のスレッドで行うworker
+// "DNN_Pipeline"が2以上の時に、UctSearcherごとに一つ生成される。
+class NNForwardWorker
+{
+public:
+	NNForwardWorker(UctSearcherGroup* grp);
+	~NNForwardWorker();
+
+	// batchの推論を依頼する。
+	void submit(BatchBuffer* batch);
+
+	// submit()したbatchの推論の完了を待つ。
+	void wait(BatchBuffer* batch);
+
+private:
+	// workerスレッドのentry point
+	void worker();
+
+	UctSearcherGroup*         grp;
+	std::thread               th;
+	std::mutex                mtx;
+	std::condition_variable   cond;
+	std::deque<BatchBuffer*>  queue;
+	bool                      term = false;
+};
+
+// 複数のUctSearcherのbatchを一つにまとめて推論するサーバー
+// エンジンオプションの"DNN_Server"がtrueの時に、UctSearcherGroup(GPU)ごとに一つ生成される。
+//
+// 📝 各探索スレッドはbatchをlock-freeなMPSC queueに積む。サーバーのスレッドはそれを取り出して
+//     DNN_Batch_Sizeまで連結し、batchが一杯になるか、すべての探索スレッドのbatchが揃うか、
+//     最初のbatchを受け取ってからmax_latency_us経過したら推論して、結果を各batchに書き戻す。
+//     これにより、UCT_Threadsの数とDNN_Batch_Sizeとを独立に設定できる。
+class InferenceServer
+{
+public:
+	//   max_batch_size : 一度に推論する局面の最大数(NNを構築した時のbatch size)
+	//   max_latency_us : 最初のbatchを受け取ってから推論を開始するまでの最大待ち時間[us]
+	//   max_requests   : 同時に積まれうるbatchの最大数(探索スレッド数 × DNN_Pipeline)
+	InferenceServer(UctSearcherGroup* grp, int max_batch_size, int max_latency_us, int max_requests);
+	~InferenceServer();
+
+	// batchの推論を依頼する。(lock-free)
+	void submit(BatchBuffer* batch);
+
+	// submit()したbatchの推論の完了を待つ。
+	void wait(BatchBuffer* batch);
+
+private:
+	// サーバースレッドのentry point
+	void worker();
+
+	// MPSC queueから一つ取り出す。サーバースレッドからのみ呼び出す。空ならnullptr。
+	BatchBuffer* pop();
+
+	// mergedのbatchを連結して推論し、結果を各batchに書き戻す。
+	void dispatch(std::vector<BatchBuffer*>& merged, int merged_size);
+
+	UctSearcherGroup* grp;
+	int               max_batch_size;
+	int               max_latency_us;
+	int               max_requests;
+
+	// 連結したbatchの入出力バッファ。max_batch_size分確保されている。
+	PType*            packed_features1;
+	PType*            packed_features2;
+	NN_Input1*        features1;
+	NN_Input2*        features2;
+	NN_Output_Policy* y1;
+	NN_Output_Value*  y2;
+
+	// --- MPSC queue (Dmitry Vyukovのintrusive MPSC queue)
+	std::atomic<BatchBuffer::QueueLink*> head;
+	BatchBuffer::QueueLink*              tail;
+	BatchBuffer::QueueLink               stub;
+
+	// サーバースレッドが眠っているか。眠っている時だけsubmit()でidle_condをnotifyする。
+	std::atomic<bool>       sleeping = false;
+	std::mutex              idle_mtx;
+	std::condition_variable idle_cond;
+
+	// 推論完了の通知用
+	std::mutex              done_mtx;
+	std::condition_variable done_cond;
+
+	std::atomic<bool>       term = false;
+	std::thread             th;
+};
+
 // UCT探索を行う、それぞれのスレッドを表現する。
 // UctSearcherGroupは、このインスタンスを集めたもの。1つのGPUに対してUctSearcherGroupのインスタンスが1つ割り当たる。
 class UctSearcher
 {
 public:
-	UctSearcher(UctSearcherGroup* grp, const int thread_id, const int policy_value_batch_maxsize) :
+	UctSearcher(UctSearcherGroup* grp, const int thread_id, const int policy_value_batch_maxsize, const int pipeline_depth) :
 		grp(grp),
 		thread_id(thread_id),
 		// やねうら王では、スレッドはこのクラスが保有しないので、スレッドhandle不要。
@@ -191,18 +390,34 @@ public:
 		// 推論(NN::forward())のためのメモリを動的に確保する。
 		// GPUを利用する場合は、GPU側のメモリを確保しなければならないので、alloc()は抽象化されている。
 
-		packed_features1 = grp->gpu_memalloc<PType>(packed_input1_byte_count(policy_value_batch_maxsize));
-		packed_features2 = grp->gpu_memalloc<PType>(packed_input2_byte_count(policy_value_batch_maxsize));
-		features1 = grp->gpu_memalloc<NN_Input1>(input1_element_count(policy_value_batch_maxsize));
-		features2 = grp->gpu_memalloc<NN_Input2>(input2_element_count(policy_value_batch_maxsize));
-		y1        = grp->gpu_memalloc<NN_Output_Policy>(policy_value_batch_maxsize);
-		y2        = grp->gpu_memalloc<NN_Output_Value >(policy_value_batch_maxsize);
+		batches.resize(pipeline_depth);
+		for (int i = 0; i < pipeline_depth; ++i)
+		{
+			auto& b = batches[i];
+			b.packed_features1 = grp->gpu_memalloc<PType>(packed_input1_byte_count(policy_value_batch_maxsize));
+			b.packed_features2 = grp->gpu_memalloc<PType>(packed_input2_byte_count(policy_value_batch_maxsize));
+			b.features1 = grp->gpu_memalloc<NN_Input1>(input1_element_count(policy_value_batch_maxsize));
+			b.features2 = grp->gpu_memalloc<NN_Input2>(input2_element_count(policy_value_batch_maxsize));
+			b.y1        = grp->gpu_memalloc<NN_Output_Policy>(policy_value_batch_maxsize);
+			b.y2        = grp->gpu_memalloc<NN_Output_Value >(policy_value_batch_maxsize);
 
-		policy_value_batch = new BatchElement[policy_value_batch_maxsize];
+			b.policy_value_batch = new BatchElement[policy_value_batch_maxsize];
 
 #ifdef MAKE_BOOK
-		policy_value_book_key = new Key[policy_value_batch_maxsize];
+			b.policy_value_book_key = new Key[policy_value_batch_maxsize];
 #endif
+			// 推論slotはスレッドごとにpipeline_depth個ずつ割り当てる。
+			b.slot_id = thread_id * pipeline_depth + i;
+
+			b.visitor_batch.reserve(policy_value_batch_maxsize);
+			b.trajectories_batch_discarded.reserve(policy_value_batch_maxsize);
+			b.link.batch = &b;
+		}
+		current_batch = &batches[0];
+
+		// 2つ以上のbatchを交互に使う時は、推論を別スレッドで行う。
+		if (pipeline_depth >= 2)
+			forward_worker = std::make_unique<NNForwardWorker>(grp);
 	}
 
 	// move counstructor
@@ -210,32 +425,36 @@ public:
 		grp(o.grp),
 		thread_id(o.thread_id),
 		mt(std::move(o.mt)),
-		packed_features1(o.packed_features1),packed_features2(o.packed_features2),
-		features1(o.features1),features2(o.features2),y1(o.y1),y2(o.y2),
+		policy_value_batch_maxsize(o.policy_value_batch_maxsize),
+		batches(std::move(o.batches)),
+		current_batch(batches.empty() ? nullptr : &batches[0]),
+		forward_worker(std::move(o.forward_worker)),
 		mate_solver(std::move(o.mate_solver))
 	{
-		o.packed_features1 = nullptr;
-		o.packed_features2 = nullptr;
-		o.features1 = nullptr;
-		o.features2 = nullptr;
-		o.y1 = nullptr;
-		o.y2 = nullptr;
-		policy_value_batch = nullptr;
+		o.batches.clear();
+		o.current_batch = nullptr;
 	}
 
 	~UctSearcher() {
-		if (features1) // move counstructorによって解体後でないことをチェック
+		// 推論中のbatchがあるかも知れないので先にworkerを終了させる。
+		forward_worker.reset();
+
+		// move counstructorによって解体後なら、batchesは空になっている。
+		for (auto& b : batches)
 		{
-			grp->gpu_memfree<PType           >(packed_features1);
-			grp->gpu_memfree<PType           >(packed_features2);
-			grp->gpu_memfree<NN_Input1       >(features1);
-			grp->gpu_memfree<NN_Input2       >(features2);
-			grp->gpu_memfree<NN_Output_Policy>(y1);
-			grp->gpu_memfree<NN_Output_Value >(y2);
-
-			delete[] policy_value_batch;
-		}
+			grp->gpu_memfree<PType           >(b.packed_features1);
+			grp->gpu_memfree<PType           >(b.packed_features2);
+			grp->gpu_memfree<NN_Input1       >(b.features1);
+			grp->gpu_memfree<NN_Input2       >(b.features2);
+			grp->gpu_memfree<NN_Output_Policy>(b.y1);
+			grp->gpu_memfree<NN_Output_Value >(b.y2);
+
+			delete[] b.policy_value_batch;
+#ifdef MAKE_BOOK
+			delete[] b.policy_value_book_key;
+#endif
 		}
+	}
 
 	// -- やねうら王ではこのクラスはスレッド生成～解体に関与しない。
 
@@ -249,7 +468,8 @@ public:
 
 	// leaf node用の詰め将棋ルーチンの初期化(alloc)を行う。"isready"に対して行う。
 	// ※　SetLimits()が"go"に対してしか呼び出されていないからmax_moves_to_drawは未確定なのでここで設定するわけにはいかない。
-	void InitMateSearcher(const SearchOptions& options);
+	// hash_table : 共有する詰み探索の置換表。用いないならnullptr。
+	void InitMateSearcher(const SearchOptions& options, Mate::MateHashTable* hash_table);
 
 	// "go"に対して探索を開始する時に呼び出す。
 	// "go"に対してしかmax_moves_to_drawは未確定なので、それが確定してから呼び出す。
@@ -259,6 +479,10 @@ public:
 	// policy_value_batch_maxsize と同数のダミーデータを作成し、推論を行う。
 	void DummyForward();
 
+	// 探索部の計測結果
+	const SearchProfile& get_profile() const { return profile; }
+	void reset_profile() { profile = SearchProfile(); }
+
 private:
 	//  並列処理で呼び出す関数
 	//  UCTアルゴリズムを反復する
@@ -286,8 +510,37 @@ private:
 	// Evaluateを呼び出すリスト(queue)に追加する。
 	void QueuingNode(const Position* pos, Node* node, float* value_win);
 
-	// ノードを評価
-	void EvalNode();
+	// NNCacheを調べて、hitしたならnodeの各子ノードのnnrateを設定して評価済みにする。
+	//   pos   : nodeに対応する局面
+	//   node  : ExpandNode()済みのnode
+	//   value : [Out] hitした時にNNのvalueが返る。
+	// 返し値 : hitしたならtrue(このときQueuingNode()は不要)
+	bool ProbeNNCache(const Position* pos, Node* node, float& value);
+
+	// batchを推論する。(推論が完了するまでreturnしない)
+	void ForwardBatch(BatchBuffer& batch);
+
+	// batchの推論を依頼する。(InferenceServerかNNForwardWorkerに)
+	void SubmitBatch(BatchBuffer& batch);
+
+	// SubmitBatch()したbatchの推論の完了を待つ。
+	void WaitBatch(BatchBuffer& batch);
+
+	// 推論済みのbatchの結果を各Nodeに反映させる。
+	void EvalNode(BatchBuffer& batch);
+
+	// 推論済みのbatchについて、EvalNode()を呼び出したあと、
+	// 破棄した探索経路のVirtual Lossを戻し、評価した探索経路をbackupする。
+	void CompleteBatch(BatchBuffer& batch);
+
+	// mutexをlockする。計測中(profiling == true)なら、待たされた回数と時間をlock_profileに加算する。
+	void LockMutex(std::mutex& mutex, LockProfile& lock_profile);
+
+	// 計測中であるか。ParallelUctSearch()の開始時にDlshogiSearcher::search_profilingの値がcopyされる。
+	bool profiling = false;
+
+	// 探索部の計測結果
+	SearchProfile profile;
 
 	// 自分の所属するグループ
 	UctSearcherGroup* grp;
@@ -312,26 +565,14 @@ private:
 	// コンストラクタで渡された、このスレッドが扱う、NNへのbatchの個数。
 	int policy_value_batch_maxsize;
 
-	// これは、policy_value_batch_maxsize分、事前に確保されている。
-	Eval::dlshogi::PType* packed_features1;
-	Eval::dlshogi::PType* packed_features2;
-	Eval::dlshogi::NN_Input1* features1;
-	Eval::dlshogi::NN_Input2* features2;
+	// NNに投げるbatchのバッファ。"DNN_Pipeline"の数だけ確保されている。
+	std::vector<BatchBuffer> batches;
 
-	Eval::dlshogi::NN_Output_Policy* y1;
-	Eval::dlshogi::NN_Output_Value * y2;
-
-	// EvalNode()ごとにどのNodeとColorから呼び出されたのかを記録しておく配列
-	// NNから返し値がもらえた時に、ここに記録されているNodeについて、その情報を更新する。
-	BatchElement* policy_value_batch;
-
-#ifdef MAKE_BOOK
-	Key* policy_value_book_key;
-#endif
+	// QueuingNode()で局面を積んでいくbatch
+	BatchBuffer* current_batch;
 
-	// features1[],features2[],policy_value_batch[],policy_value_book_key[],の次に使用するindexを示している。
-	// batch分溜まったら、まとめてGPUに投げてEvalする。
-	int current_policy_value_batch_index;
+	// batchesが2つ以上の時に推論を行うworker
+	std::unique_ptr<NNForwardWorker> forward_worker;
 
 	// NodeTreeを取得
 	NodeTree* get_node_tree() const;
@@ -39,7 +39,8 @@ void DlshogiSearcher::add_options(OptionsMap& options) {
 // "isready"に対して呼び出される。
 // スレッドの生成ついでに、詰将棋探索系の初期化もここで行う。
 void DlshogiSearcher::InitGPU(const std::string& model_path, const std::string& model_architecture,
-                              std::vector<int> thread_settings, int policy_value_batch_maxsize)
+                              std::vector<int> thread_settings, int policy_value_batch_maxsize, int pipeline_depth,
+                              int server_latency_us)
 {
 	// ----------------------
 	// 必要なスレッド数の算出
@@ -109,10 +110,21 @@ void DlshogiSearcher::InitGPU(const std::string& model_path, const std::string&
 	for (size_t i = 0; i < search_groups_size ; i++)
 		if (thread_settings[i] > 0)
 			search_groups[i].Initialize(model_path, model_architecture,
-			                            thread_settings[i],/* gpu_id = */int(i), policy_value_batch_maxsize);
+			                            thread_settings[i],/* gpu_id = */int(i), policy_value_batch_maxsize, pipeline_depth,
+			                            server_latency_us);
 
 	sync_cout << "info string All model files have been loaded. " << time.elapsed() << "ms." << sync_endl;
 
+	// NNの推論結果のcacheの確保
+	// 💡 modelやSoftmax_Temperatureが変更されているかも知れないので、"isready"ごとにclearする。
+	nn_cache.resize(search_options.dnn_cache_mb);
+	nn_cache.clear();
+
+	// 詰み探索の置換表
+	mate_hash.resize(search_options.mate_hash_mb);
+	mate_hash.clear(engine.threads);
+	mate_hash_table = search_options.mate_hash_mb ? &mate_hash : nullptr;
+
 	// ----------------------
 	// 探索スレッドとUctSearcherの紐付け
 	// ----------------------
@@ -136,7 +148,7 @@ void DlshogiSearcher::InitGPU(const std::string& model_path, const std::string&
 
 	// leaf nodeでの詰み探索用のMateSolverの初期化
 	for (auto& uct_searcher : thread_id_to_uct_searcher)
-		uct_searcher->InitMateSearcher(search_options);
+		uct_searcher->InitMateSearcher(search_options, mate_hash_table);
 
 #if defined(USE_POLICY_BOOK)
 	policy_book.read_book();
@@ -144,6 +156,24 @@ void DlshogiSearcher::InitGPU(const std::string& model_path, const std::string&
 
 }
 
+// 全UctSearcherの計測結果をクリアする。
+void DlshogiSearcher::ResetSearchProfile()
+{
+	for (auto& uct_searcher : thread_id_to_uct_searcher)
+		uct_searcher->reset_profile();
+}
+
+// 全UctSearcherの計測結果を集計して文字列化したものを返す。
+std::string DlshogiSearcher::SearchProfileReport() const
+{
+	SearchProfile total;
+	for (auto& uct_searcher : thread_id_to_uct_searcher)
+		total.add(uct_searcher->get_profile());
+
+	// 探索木のメモリ使用量も併せて出力する。
+	return total.to_string(thread_id_to_uct_searcher.size()) + "\n" + MeasureTree(tree->GetGameRoot()).to_string();
+}
+
 // 探索スレッドの終了(main thread以外)
 void DlshogiSearcher::TeminateThreads()
 {
@@ -202,9 +232,10 @@ void DlshogiSearcher::SetDrawValue(const int value_black, const int value_white)
 // nodes   : 1局面で詰探索する最大ノード数。
 void DlshogiSearcher::SetPvMateSearch(const int threads, /*const int depth,*/ const int nodes)
 {
-	// 現在生成されているthread数とnodesがぴったり一致するなら、生成しなおす必要はない。
+	// 現在生成されているthread数とnodesと置換表がぴったり一致するなら、生成しなおす必要はない。
 	if (threads == int(pv_mate_searchers.size()) &&
-		(threads == 0 || pv_mate_searchers[0].get_nodes_limit() == nodes))
+		(threads == 0 || (pv_mate_searchers[0].get_nodes_limit() == nodes
+						  && pv_mate_searchers[0].get_hash_table() == mate_hash_table)))
 		return; 
 
 	// 個数が異なるので生成しなおす。
@@ -449,6 +480,9 @@ Move DlshogiSearcher::UctSearchGenmove(Position&                pos,
     // 探索スレッドの開始
     //StartThreads();
 
+	// 探索中は、GCに探索スレッドとCPUを取り合わないようにしてもらう。
+	gc->SetSearching(true);
+
 	// main以外のthreadを開始する
 	engine.threads.start_searching();
 	// 💡 FukauraOuWorker::start_searching()が呼び出され、FukauraOuWorker::parallel_search()から、
@@ -471,6 +505,8 @@ Move DlshogiSearcher::UctSearchGenmove(Position&                pos,
     // 探索スレッドの終了(とすべてのスレッドの終了の待機)
     TeminateThreads();
 
+    gc->SetSearching(false);
+
     // PVの詰み探索スレッド終了待機
     for (auto& searcher : pv_mate_searchers)
         searcher.Join();
@@ -489,6 +525,15 @@ SEARCH_SKIP:
 
         // 探索の情報を出力(探索回数, 勝敗, 思考時間, 勝率, 探索速度)
         UctPrint::PrintPlayoutInformation(current_root, &search_limits, finish_time, pre_simulated);
+
+        // NNCacheのhit率
+        if (nn_cache.enabled())
+        {
+            const u64 probes = nn_cache.get_probes();
+            const u64 hits   = nn_cache.get_hits();
+            sync_cout << "NN Cache Hits      :  " << hits << " / " << probes << " ("
+                      << (probes ? hits * 100 / probes : 0) << "%)" << sync_endl;
+        }
     }
 
 	if (search_skipped)
@@ -599,7 +644,7 @@ void pv_key(Position& pos, Node* node, int ply, Key64 keys[]) {
         keys[ply] = 0;
     else
     {
-        if (node->child_nodes.get() == nullptr)
+        if (!node->child_nodes)
             return;
         // child nodesが展開されていない。
 
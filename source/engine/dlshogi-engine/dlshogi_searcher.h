@@ -12,6 +12,7 @@
 #include "dlshogi_types.h"
 #include "SearchOptions.h"
 #include "PvMateSearch.h"
+#include "NNCache.h"
 
 // dlshogiの探索部で構造体化・クラス化されていないものを集めたもの。
 
@@ -101,34 +102,6 @@ namespace dlshogi {
 	};
 
 
-	// ノードのlock用。
-	// 子ノードの構造体にstd::mutex(sizeof(std::mutex)==80)を持たせると子ノードがメモリを消費しすぎるので
-	// 局面のhash keyからindexを計算して、↓の配列の要素を使う。
-
-	class MutexPool
-	{
-	public:
-		static const uint64_t MUTEX_NUM = 65536; // must be 2^n
-		static_assert((MUTEX_NUM & (MUTEX_NUM - 1)) == 0);
-
-		// ある局面に対応するmutexを返す。
-		std::mutex& get_mutex(const Position* pos)
-		{
-			return get_mutex(pos->key());
-		}
-
-	private:
-		// ある局面のHASH_KEY(Position::key()にて取得できる)に対応するmutexを返す。
-		// →　これ外から呼び出して使わなくていいっぽいのでとりまprivateにしておく。
-		std::mutex& get_mutex(const Key key)
-		{
-			return mutexes[key & (MUTEX_NUM - 1)];
-		}
-
-	private:
-		std::mutex mutexes[MUTEX_NUM];
-	};
-
 	// UCT探索部
 	// ※　dlshogiでは、この部分、class化されていない。
 	class DlshogiSearcher
@@ -146,8 +119,11 @@ namespace dlshogi {
 		// model_path         : 読み込むmodel path
 		// model_architecture : 読み込むmodelの入力特徴量仕様
 		// thread_settings    : 各GPU用のスレッド数
+		// pipeline_depth     : 各スレッドが持つbatchのバッファの数
+		// server_latency_us  : 0以上なら推論サーバーを用いる。その時のbatchを待つ最大時間[us]
         void InitGPU(const std::string& model_path, const std::string& model_architecture,
-                     std::vector<int> thread_settings, int policy_value_batch_maxsize);
+                     std::vector<int> thread_settings, int policy_value_batch_maxsize, int pipeline_depth,
+                     int server_latency_us);
 
 		// 対局開始時に呼び出されるハンドラ
 		void NewGame();
@@ -252,6 +228,42 @@ namespace dlshogi {
 		// 定跡の指し手を選択するモジュール
 		Book::BookMoveSelector book;
 
+		// NNの推論結果のcache
+		// UctSearcher::EvalNode()で書き込み、UctSearcher::UctSearch()でNodeを展開した時に調べる。
+		NNCache nn_cache;
+
+		// 詰み探索の置換表
+		// PV lineの詰み探索(PvMateSearcher)とleaf nodeの詰み探索(UctSearcher::mate_solver)のすべてで共有する。
+		// 📝 あるスレッドが詰み/不詰を証明した局面は、他のスレッドではその結論を用いて展開を省略できる。
+		//     entryごとにCAS lockがあるので、複数スレッドから同時に読み書きして良い。
+		Mate::MateHashTable mate_hash;
+
+		// 詰み探索で用いる置換表。mate_hashを用いない時(エンジンオプションの"Mate_Hash"が0の時)はnullptr。
+		// "isready"の時に設定される。
+		Mate::MateHashTable* mate_hash_table = nullptr;
+
+		// 探索部の計測をするか。"bench"コマンドで"mcts"を指定した時にtrueになる。
+		// UctSearcher::ParallelUctSearch()の開始時に参照される。
+		bool search_profiling = false;
+
+		// GCのworkerの数を設定する。"isready"の時に呼び出される。
+		void SetGarbageCollector(int threads) { gc->SetWorkerCount(size_t(threads)); }
+
+		// GCの状況を文字列化して返す。("gc_stats"コマンド用)
+		std::string GarbageCollectorStats() { return gc->Stats(); }
+
+		// 全UctSearcherの計測結果をクリアする。
+		void ResetSearchProfile();
+
+		// 全UctSearcherの計測結果を集計して文字列化したものを返す。
+		std::string SearchProfileReport() const;
+
+		// 前回のInitGPU()で確保したUctSearcherの数(全GPUの合計)
+		size_t UctSearcherCount() const { return thread_id_to_uct_searcher.size(); }
+
+		// 前回のInitGPU()で用いた各GPUのスレッド設定
+		const std::vector<int>& ThreadSettings() const { return last_thread_settings; }
+
 		//  探索停止の確認
 		// SearchInterruptionCheckerから呼び出される。
 		void InterruptionCheck(const Position& rootPos);
@@ -260,11 +272,6 @@ namespace dlshogi {
 		// SearchInterruptionCheckerから呼び出される。
 		void OutputPvCheck();
 
-		// 子ノードで使うstd::mutexを返す。
-		//   pos : 子ノードの局面になっていること。
-		// Nodeのchildrenの書き換えの時などにこれをlockすることになっている。
-		std::mutex& get_node_mutex(const Position* pos) { return node_mutexes.get_mutex(pos); }
-		//std::mutex& get_child_node_mutex(const HASH_KEY posKey) { return child_node_mutexes.get_mutex(posKey); }
 
 		// 探索開始局面。これはこの局面の探索中には消失しないのでglobalに参照して良い。
 		Position pos_root;
@@ -324,9 +331,6 @@ namespace dlshogi {
 		// 前回のInitGPU時のthread_settings
         std::vector<int>          last_thread_settings;
 
-		// ノードのlockに使うmutex
-		MutexPool node_mutexes;
-
 		// PV lineの詰探索用
 		std::vector<PvMateSearcher> pv_mate_searchers;
 	};
@@ -108,6 +108,14 @@ void SearchOptions::add_options(OptionsMap& options) {
                     enteringKingRule = to_entering_king_rule(o);
                     return std::nullopt;
                 }));
+
+#if defined(USE_SEARCH_STATS)
+    // 反復深化の1回ごとに探索の統計情報を"info string"で出力する。
+    options.add("SearchStatsInfo", Option(false, [&](const Option& o) {
+                    search_stats_info = o;
+                    return std::nullopt;
+                }));
+#endif
 }
 
 
@@ -142,6 +150,24 @@ void YaneuraOuEngine::add_options() {
             set_tt_size(o);
             return std::nullopt;
         }));
+
+	// ContinuationHistoryとCapturePieceToHistoryを共有する範囲。"isready"の時に反映される。
+	//   thread : スレッドごとに持つ。(従来通り)
+	//   numa   : 同じNUMAノードのスレッド間で共有する。
+	//   global : 全スレッドで共有する。
+	// 💡 スレッド数が多い時に、cacheの節約とhistoryの学習の速さを狙って共有する。
+	//     どれが良いかはスレッド数や持ち時間によるので、計測して決めること。
+    options.add("SharedHistoryScope", Option(std::vector<std::string>{"thread", "numa", "global"}, "thread"));
+
+	// 置換表を同じPCで動いている他のエンジンのプロセスと共有するか。
+	// 💡 同じ実行ファイルで、USI_Hashが同じプロセス同士で共有される。
+	//     共有している置換表は"isready"でクリアされない。
+	//     置換表の世代カウンターも共有されるので、どのプロセスが探索を開始しても全プロセスのentryが1世代古くなる。
+    options.add(  //
+        "SharedHash", Option(false, [this](const Option&) {
+            set_tt_size(options["USI_Hash"]);
+            return std::nullopt;
+        }));
 #endif
 
 	// その局面での上位N個の候補手を調べる機能
@@ -316,6 +342,16 @@ void YaneuraOuEngine::resize_threads() {
 
     // 📌 スレッド数のリサイズ
 
+    // Workerが参照しているMoveHistoriesを開放する前に、Workerを解体しておく。
+    threads.set(numaContext.get_numa_config(), {options, threads, tt, sharedHists /*, networks*/ },
+                updateContext, 0, [](SharedState&, const ThreadIds&) { return LargePagePtr<Worker>(); });
+
+    const std::string scope(options["SharedHistoryScope"]);
+    historyShareScope = scope == "numa"   ? HistoryShareScope::NumaNode
+                      : scope == "global" ? HistoryShareScope::Global
+                                          : HistoryShareScope::Thread;
+    moveHists.clear();
+
     auto worker_factory = [&](SharedState& sharedState, const ThreadIds& ids)
 	{
 
@@ -342,10 +378,38 @@ void YaneuraOuEngine::resize_threads() {
     threads.ensure_network_replicated();
 }
 
+// idsのWorkerが用いるMoveHistoriesを返す。なければ確保する。
+MoveHistories& YaneuraOuEngine::acquire_move_histories(const ThreadIds& ids, size_t& shareIdx, size_t& shareCount) {
+    size_t key;
+    switch (historyShareScope)
+    {
+    case HistoryShareScope::NumaNode :
+        key        = ids.numaAccessToken.get_numa_index();
+        shareIdx   = ids.numaThreadIdx;
+        shareCount = ids.numaTotal;
+        break;
+    case HistoryShareScope::Global :
+        key        = 0;
+        shareIdx   = ids.threadIdx;
+        shareCount = size_t(options["Threads"]);
+        break;
+    default :
+        key        = ids.threadIdx;
+        shareIdx   = 0;
+        shareCount = 1;
+        break;
+    }
+
+    auto& p = moveHists[key];
+    if (!p)
+        p = make_unique_large_page<MoveHistories>();
+    return *p;
+}
+
 // 置換表の割り当て
 void YaneuraOuEngine::set_tt_size(size_t mb){
 	wait_for_search_finished();
-	tt.resize(mb, threads);
+	tt.resize(mb, threads, options["SharedHash"]);
 }
 
 // 置換表の使用率を返す。
@@ -355,6 +419,56 @@ int YaneuraOuEngine::get_hashfull(int maxAge) const
 	return tt.hashfull(maxAge);
 }
 
+// USI拡張コマンド "tt_save filename" の実体。
+bool YaneuraOuEngine::tt_save(const std::string& filename, std::string& message) {
+	if (filename.empty())
+	{
+		message = "usage: tt_save filename";
+		return false;
+	}
+
+	// 探索中に書き出すと内容が一貫しないので、探索の終了を待つ。
+	wait_for_search_finished();
+
+	auto result = tt.save(filename);
+	message = "tt_save " + filename + " : " + result.to_string();
+	return result.is_ok();
+}
+
+// USI拡張コマンド "tt_load filename" の実体。
+bool YaneuraOuEngine::tt_load(const std::string& filename, std::string& message) {
+	if (filename.empty())
+	{
+		message = "usage: tt_load filename";
+		return false;
+	}
+
+	wait_for_search_finished();
+
+	auto result = tt.load(filename);
+	message = "tt_load " + filename + " : " + result.to_string();
+	return result.is_ok();
+}
+
+// "bench"コマンドの制限の種類に"tt_latency"を指定した時の処理の実体。
+bool YaneuraOuEngine::tt_latency_bench(uint64_t probes, std::string& message) {
+	wait_for_search_finished();
+	message = tt.numa_latency_bench(threads, probes);
+	return true;
+}
+
+// "stats"コマンドの実体。
+bool YaneuraOuEngine::search_stats(std::string& message) {
+#if defined(USE_SEARCH_STATS)
+	wait_for_search_finished();
+	message = SearchStats::to_string(lastSearchStats);
+	return true;
+#else
+	message = "stats : search statistics are not compiled in. (build with USE_SEARCH_STATS)";
+	return false;
+#endif
+}
+
 namespace {
 
 constexpr size_t QSEARCH_PSV_CHUNK_RECORDS = 65536;
@@ -873,6 +987,9 @@ Search::YaneuraOuWorker::YaneuraOuWorker(SharedState& sharedState,
     sharedHistory(sharedState.sharedHistories.at(ids.numaAccessToken.get_numa_index())),
 	// 残りは基底classであるSearch::Workerのほうでunpackする。
 	Search::Worker(sharedState, ids),
+	moveHistories(engine.acquire_move_histories(ids, historyShareIdx, historyShareCount)),
+	captureHistory(moveHistories.captureHistory),
+	continuationHistory(moveHistories.continuationHistory),
 	engine(engine),
 	manager(engine.manager)
 {
@@ -942,6 +1059,11 @@ void Search::YaneuraOuWorker::start_searching() {
     // 前回のgoで得たPVは今回の探索では使えないので、各Workerの探索開始時に破棄する。
     lastIterationPV.clear();
 
+#if defined(USE_SEARCH_STATS)
+    // 評価関数の内部からもこのWorkerのcounterで数えられるようにする。
+    SearchStats::current = &stats;
+#endif
+
     // Non-main threads go directly to iterative_deepening()
     // メインスレッド以外は直接 iterative_deepening() へ進む
 
@@ -1198,6 +1320,11 @@ SKIP_SEARCH:
 
     threads.wait_for_search_finished();
 
+#if defined(USE_SEARCH_STATS)
+    // 全スレッドの探索の統計情報を集計しておく。("stats"コマンド用)
+    engine.lastSearchStats = threads.search_stats();
+#endif
+
 // 💡 やねうら王では、npmsecをサポートしない。
 #if STOCKFISH
     // When playing in 'nodes as time' mode, subtract the searched nodes from
@@ -1838,6 +1965,14 @@ bool Search::YaneuraOuWorker::iterative_deepening() {
             lastIterationPV = rootMoves[0].pv;
         }
 
+#if defined(USE_SEARCH_STATS)
+        // 反復深化の1回ごとに探索の統計情報を出力する。
+        // 💡 他のスレッドは探索中なので、その時点までの値である。
+        if (mainThread && !threads.stop && search_options.search_stats_info)
+            sync_cout << "info string stats depth " << rootDepth << ' '
+                      << SearchStats::to_short_string(threads.search_stats()) << sync_endl;
+#endif
+
         // A mated-in/TB-loss score from an aborted search cannot be trusted: the loss
         // could be delayed or refuted upon exploring the remaining root-moves.
         // Thus here we roll back to the score from the previous iteration.
@@ -2125,7 +2260,10 @@ void YaneuraOuWorker::clear() {
 
 	// TODO : あとで調整する。pawnHistory.fill(-1238@);も。
 	mainHistory.fill(mainHistoryDefault);
-    captureHistory.fill(-678);
+
+    // 💡 captureHistoryとcontinuationHistoryを他のスレッドと共有している時は、共有しているスレッドで分担してクリアする。
+    if (historyShareIdx == 0)
+        captureHistory.fill(-678);
 
     // Each thread is responsible for clearing their part of shared history
     sharedHistory.correctionHistory.clear_range(0, numaThreadIdx, numaTotal);
@@ -2143,11 +2281,13 @@ void YaneuraOuWorker::clear() {
     //     あまり意味がないが、無駄ではないらしい。
     //     cf. Tweak history initialization : https://github.com/official-stockfish/Stockfish/commit/7d44b43b3ceb2eebc756709432a0e291f885a1d2
 
+	size_t k = 0;
 	for (bool inCheck : {false, true})
         for (StatsType c : {NoCaptures, Captures})
             for (auto& to : continuationHistory[inCheck][c])
                 for (auto& h : to)
-                    h.fill(-523);
+                    if (k++ % historyShareCount == historyShareIdx)
+                        h.fill(-523);
 
 	// reductions tableの初期化(これはWorkerごとが持つように変更された)
     for (size_t i = 1; i < reductions.size(); ++i)
@@ -2157,6 +2297,8 @@ void YaneuraOuWorker::clear() {
 
 #if defined(EVAL_SFNN)
     refreshTable.clear(networks[numaAccessToken]);
+#elif defined(EVAL_NNUE)
+    refreshTable.clear();
 #endif
 }
 
@@ -2245,6 +2387,8 @@ Value YaneuraOuWorker::search(Position& pos, Stack* ss, Value alpha, Value beta,
 
     depth = std::min(depth, MAX_PLY - 1);
 
+    SEARCH_STATS_INC(stats, SearchNodes);
+
 	// 📝 次の指し手で引き分けに持ち込めてかつ、betaが引き分けのスコアより低いなら
     //     早期枝刈りが実施できる。
     // 🤔 将棋だとあまり千日手が起こらないので効果がなさげ。採用しない。
@@ -2607,6 +2751,10 @@ Value YaneuraOuWorker::search(Position& pos, Stack* ss, Value alpha, Value beta,
 
 	ss->ttHit    = ttHit;
 
+    SEARCH_STATS_INC(stats, TTProbe);
+    if (ttHit)
+        SEARCH_STATS_INC(stats, TTHit);
+
 	/*
 		📝
 			置換表の指し手
@@ -2778,6 +2926,7 @@ Value YaneuraOuWorker::search(Position& pos, Stack* ss, Value alpha, Value beta,
                 return ttData.value;
         }
 #else
+        SEARCH_STATS_INC(stats, TTCutoff);
         return ttData.value;
 #endif        
     }
@@ -2887,8 +3036,11 @@ Value YaneuraOuWorker::search(Position& pos, Stack* ss, Value alpha, Value beta,
         {
             move = Mate::mate_1ply(pos);
 
+            SEARCH_STATS_INC(stats, Mate1plyCall);
             if (move != Move::none())
             {
+                SEARCH_STATS_INC(stats, Mate1plyHit);
+
                 /*
 					🤔 1手詰めスコアなので確実にvalue > alphaなはず。
 					    1手詰めは次のnodeで詰むという解釈
@@ -3249,6 +3401,7 @@ Value YaneuraOuWorker::search(Position& pos, Stack* ss, Value alpha, Value beta,
 
         do_null_move(pos, st);
 
+        SEARCH_STATS_INC(stats, NullMoveTry);
         Value nullValue = -search<NonPV>(pos, ss + 1, -beta, -beta + 1, depth - R, false);
 
         undo_null_move(pos);
@@ -3286,9 +3439,13 @@ Value YaneuraOuWorker::search(Position& pos, Stack* ss, Value alpha, Value beta,
                 return nullValue;
         }
 #else
+        {
+            SEARCH_STATS_INC(stats, NullMoveCutoff);
+
             // null move pruningの検証探索は、パス (null move) した方が有利になる局面での誤った枝刈り防止のために存在するが、
             // 将棋ではそのようなことはチェスよりはるかに少ないため不要。
             return nullValue;
+        }
 #endif
     }
 
@@ -3972,6 +4129,8 @@ moves_loop:  // When in check, search starts here
             value         = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, d, true);
             ss->reduction = 0;
 
+            SEARCH_STATS_INC(stats, LmrSearch);
+
             // Do a full-depth search when reduced LMR search fails high
             // 深さを減らした LMR 探索がfail highを出した場合は、full depth(元の探索深さ)で探索を行う
 
@@ -3991,7 +4150,10 @@ moves_loop:  // When in check, search starts here
                 newDepth += doDeeperSearch - doShallowerSearch;
 
                 if (newDepth > d)
+                {
+                    SEARCH_STATS_INC(stats, LmrResearch);
                     value = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, newDepth, !cutNode);
+                }
 
                 // Post LMR continuation history updates
                 // LMR後のcontinuation historyの更新
@@ -4527,6 +4689,8 @@ Value Search::YaneuraOuWorker::qsearch(Position& pos, Stack* ss, Value alpha, Va
     ss->inCheck                 = pos.checkers();
     moveCount                   = 0;
 
+    SEARCH_STATS_INC(stats, QSearchNodes);
+
 #if defined(USE_CLASSIC_EVAL) && defined(USE_LAZY_EVALUATE)
     bool evaluated = false;
     auto evaluate  = [&](Position& pos) {
@@ -4637,6 +4801,11 @@ Value Search::YaneuraOuWorker::qsearch(Position& pos, Stack* ss, Value alpha, Va
     // 保存されたデータのさらなる処理が必要です
 
     ss->ttHit   = ttHit;
+
+    SEARCH_STATS_INC(stats, TTProbe);
+    if (ttHit)
+        SEARCH_STATS_INC(stats, TTHit);
+
     ttData.move = ttHit ? ttData.move : Move::none();
 
     ttData.value =
@@ -4755,8 +4924,10 @@ Value Search::YaneuraOuWorker::qsearch(Position& pos, Stack* ss, Value alpha, Va
 
                 // 1手詰めなのでこの次のnodeで(指し手がなくなって)詰むという解釈
                 move = Mate::mate_1ply(pos);
+                SEARCH_STATS_INC(stats, Mate1plyCall);
                 if (move != Move::none())
                 {
+                    SEARCH_STATS_INC(stats, Mate1plyHit);
                     bestValue = mate_in(ss->ply + 1);
 
                     if (true)
@@ -5169,12 +5340,16 @@ TimePoint Search::Worker::elapsed_time() const { return main_manager()->tm.elaps
 
 Value Search::YaneuraOuWorker::evaluate(const Position& pos) {
 
+    SEARCH_STATS_INC(stats, EvaluateCall);
+
 #if defined(EVAL_SFNN)
 	// 最新のStockfishのコード
 
     return Eval::evaluate(networks[numaAccessToken], pos, accumulatorStack, refreshTable,
                           optimism[pos.side_to_move()]);
 
+#elif defined(EVAL_NNUE)
+	return Eval::evaluate(pos, &refreshTable);
 #else
 	return Eval::evaluate(pos);
 #endif
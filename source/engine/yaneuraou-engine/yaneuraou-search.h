@@ -11,6 +11,10 @@
 #include "../../tt.h"
 #include "../../score.h"
 
+#if defined(EVAL_NNUE)
+#include "../../eval/nnue/nnue_feature_transformer.h"
+#endif
+
 namespace YaneuraOu {
 
 namespace Search {
@@ -30,6 +34,9 @@ struct SearchOptions
         enteringKingRule         = EKR_27_POINT;
         lastPvInfoTime           = 0;
         computed_pv_interval     = 0;
+#if defined(USE_SEARCH_STATS)
+        search_stats_info        = false;
+#endif
     }
 
     // この構造体メンバーに対応するエンジンオプションを生やす
@@ -61,6 +68,12 @@ struct SearchOptions
     // 📝 options["EnteringKingRule"]の値。
     EnteringKingRule enteringKingRule;
 
+#if defined(USE_SEARCH_STATS)
+    // 反復深化の1回ごとに探索の統計情報を"info string"で出力するか。
+    // 📝 options["SearchStatsInfo"]の設定値。
+    bool search_stats_info;
+#endif
+
     // 📌 ここ以降は、SearchManagerで用いるメンバ変数 📌
 
     // 前回のPV出力した時刻。PVが詰まるのを抑制するためのもの。
@@ -364,6 +377,19 @@ class YaneuraOuEngine: public Engine {
 
     // 🌈 やねうら王独自 🌈
 
+    // Workerが用いるContinuationHistoryとCapturePieceToHistoryの実体。
+    // 💡 "SharedHistoryScope"に応じて、スレッドごと、NUMAノードごと、全体で1つのいずれかで確保する。
+    //     keyは、それぞれthreadIdx、NUMAノードのindex、0。resize_threads()で作り直す。
+    std::map<size_t, LargePagePtr<MoveHistories>> moveHists;
+
+    // moveHistsを確保する範囲。resize_threads()の時にエンジンオプションの"SharedHistoryScope"から設定する。
+    HistoryShareScope historyShareScope = HistoryShareScope::Thread;
+
+    // idsのWorkerが用いるMoveHistoriesを返す。なければ確保する。
+    // shareIdx, shareCount : それを共有しているスレッドのうち何番目か、何スレッドで共有しているか。
+    // 📝 Workerの生成時に、そのWorkerのスレッドから呼び出されるので、NUMAノードのメモリが割り当たる。
+    MoveHistories& acquire_move_histories(const ThreadIds& ids, size_t& shareIdx, size_t& shareCount);
+
     // 思考エンジンの追加オプションを設定する。
     virtual void add_options() override;
 
@@ -389,6 +415,16 @@ class YaneuraOuEngine: public Engine {
                              size_t             workerCount,
                              std::string&       message) override;
 
+    // USI拡張コマンド "tt_save", "tt_load" の実体。
+    virtual bool tt_save(const std::string& filename, std::string& message) override;
+    virtual bool tt_load(const std::string& filename, std::string& message) override;
+
+    // "bench"コマンドの制限の種類に"tt_latency"を指定した時の処理の実体。
+    virtual bool tt_latency_bench(uint64_t probes, std::string& message) override;
+
+    // "stats"コマンドの実体。直前の探索の統計情報を返す。
+    virtual bool search_stats(std::string& message) override;
+
 	// 現在の局面の評価値の詳細を出力する。
     virtual void trace_eval() const override;
 
@@ -407,6 +443,11 @@ class YaneuraOuEngine: public Engine {
 
     // Stockfishとの互換性のために用意。
     Search::SearchManager* main_manager() { return &manager; }
+
+#if defined(USE_SEARCH_STATS)
+    // 直前の探索の統計情報。探索の終了時にメインスレッドが全スレッドのものを集計して格納する。
+    SearchStats::Totals lastSearchStats;
+#endif
 };
 
 // やねうら王の探索Worker
@@ -447,13 +488,21 @@ class YaneuraOuWorker: public Worker {
     ButterflyHistory mainHistory;
     LowPlyHistory    lowPlyHistory;
 
-    CapturePieceToHistory captureHistory;
+    // captureHistoryとcontinuationHistoryの実体。(YaneuraOuEngine::moveHistsにある)
+    // 💡 エンジンオプションの"SharedHistoryScope"に応じて、他のスレッドと共有していることがある。
+    MoveHistories& moveHistories;
+
+    // moveHistoriesを共有しているスレッドのうち何番目か、何スレッドで共有しているか。clear()の分担に用いる。
+    size_t historyShareIdx, historyShareCount;
+
+    CapturePieceToHistory& captureHistory;
 
     // コア数が多いか、長い持ち時間においては、ContinuationHistoryもスレッドごとに確保したほうが良いらしい。
     // cf. https://github.com/official-stockfish/Stockfish/commit/5c58d1f5cb4871595c07e6c2f6931780b5ac05b5
     // 添字の[2][2]は、[inCheck(王手がかかっているか)][capture_stage]
     // →　この改造、レーティングがほぼ上がっていない。悪い改造のような気がする。
-    ContinuationHistory continuationHistory[2][2];
+    // 🌈 やねうら王では、"SharedHistoryScope"でNUMAノードごとや全体での共有も選べるようにした。
+    ContinuationHistory (&continuationHistory)[2][2];
     CorrectionHistory<Continuation> continuationCorrectionHistory;
 
     TTMoveHistory    ttMoveHistory;
@@ -626,6 +675,10 @@ class YaneuraOuWorker: public Worker {
     Eval::NNUE::AccumulatorStack  accumulatorStack;
 	// NNUE評価関数の差分計算用
     Eval::NNUE::AccumulatorCaches refreshTable;
+#elif defined(EVAL_NNUE)
+	// 🌈 NNUE評価関数の全計算(refresh)を、玉の升ごとのcacheからの差分計算で済ませるためのもの。
+	//     Worker::clear()でclearする。
+    Eval::NNUE::AccumulatorCache refreshTable;
 #endif
 
 #if STOCKFISH
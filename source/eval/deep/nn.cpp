@@ -9,7 +9,10 @@
 	#include "nn_tensorrt.h"
 #elif defined (COREML)
     #include "nn_coreml.h"
+#elif defined (NN_CPU)
+	#include "nn_cpu.h"
 #endif
+#include "nn_mock.h"
 
 #include "../../misc.h"
 
@@ -30,6 +33,8 @@ namespace Eval::dlshogi {
 		checkCudaErrors(cudaHostAlloc(&ptr, size, cudaHostAllocPortable));
 #elif defined (COREML)
 		ptr = (void*)new u8[size];
+#elif defined (NN_CPU)
+		ptr = (void*)new u8[size];
 #endif
 		return ptr;
 	}
@@ -44,6 +49,8 @@ namespace Eval::dlshogi {
 		checkCudaErrors(cudaFreeHost(ptr));
 #elif defined (COREML)
 		delete[] (u8*)ptr;
+#elif defined (NN_CPU)
+		delete[] (u8*)ptr;
 #endif
 	}
 	
@@ -55,6 +62,8 @@ namespace Eval::dlshogi {
 		return NNTensorRT::get_device_count();
 #elif defined (COREML)
 		return NNCoreML::get_device_count();
+#elif defined (NN_CPU)
+		return NNCpu::get_device_count();
 #endif
 	}
 
@@ -79,8 +88,16 @@ namespace Eval::dlshogi {
 
 		nn = std::make_unique<NNCoreML>();
 
+#elif defined (NN_CPU)
+
+		nn = std::make_unique<NNCpu>();
+
 #endif
 
+		// "mock"で始まるモデル名なら、推論を行わない擬似的なNNを用いる。
+		if (NNMock::is_mock_model(model_path))
+			nn = std::make_unique<NNMock>();
+
 		const auto& spec = input_feature_spec();
 		sync_cout << "info string Start loading the model file, path = " << model_path
 		          << ", gpu_id = " << gpu_id
@@ -0,0 +1,1263 @@
+﻿#include "nn_cpu.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP) && defined(NN_CPU)
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+#if defined(USE_AVX2) || defined(USE_AVX512)
+#include <immintrin.h>
+#endif
+
+#include "../../usi.h"
+#include "../../misc.h"
+
+using namespace std;
+
+namespace YaneuraOu {
+using namespace Tools;
+
+namespace Eval::dlshogi {
+
+namespace {
+
+	// --------------------
+	//  SIMD演算
+	// --------------------
+
+	// floatのSIMDレジスタ1本分を表現する。
+	// 📝 AVX2の時はFMAが使えるとは限らない(TARGET_CPUがAVX2のときは-march=corei7-avx)ので、
+	//     __FMA__が定義されていなければ乗算と加算に分ける。
+	struct VecF
+	{
+#if defined(USE_AVX512)
+		static constexpr int width = 16;
+		__m512 v;
+		static VecF zero()                  { return { _mm512_setzero_ps() }; }
+		static VecF set1(float x)           { return { _mm512_set1_ps(x) }; }
+		static VecF load(const float* p)    { return { _mm512_loadu_ps(p) }; }
+		void store(float* p) const          { _mm512_storeu_ps(p, v); }
+		// a * b + c
+		static VecF fmadd(VecF a, VecF b, VecF c) { return { _mm512_fmadd_ps(a.v, b.v, c.v) }; }
+		float sum() const                   { return _mm512_reduce_add_ps(v); }
+#elif defined(USE_AVX2)
+		static constexpr int width = 8;
+		__m256 v;
+		static VecF zero()                  { return { _mm256_setzero_ps() }; }
+		static VecF set1(float x)           { return { _mm256_set1_ps(x) }; }
+		static VecF load(const float* p)    { return { _mm256_loadu_ps(p) }; }
+		void store(float* p) const          { _mm256_storeu_ps(p, v); }
+#if defined(__FMA__)
+		static VecF fmadd(VecF a, VecF b, VecF c) { return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+#else
+		static VecF fmadd(VecF a, VecF b, VecF c) { return { _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v) }; }
+#endif
+		float sum() const {
+			__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+			s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+			s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+			return _mm_cvtss_f32(s);
+		}
+#else
+		// SIMDなし。4要素の配列にしておけばコンパイラがそれなりにvector化してくれる。
+		static constexpr int width = 4;
+		float v[4];
+		static VecF zero()                  { return { { 0, 0, 0, 0 } }; }
+		static VecF set1(float x)           { return { { x, x, x, x } }; }
+		static VecF load(const float* p)    { return { { p[0], p[1], p[2], p[3] } }; }
+		void store(float* p) const          { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+		static VecF fmadd(VecF a, VecF b, VecF c) {
+			VecF r;
+			for (int i = 0; i < 4; ++i)
+				r.v[i] = a.v[i] * b.v[i] + c.v[i];
+			return r;
+		}
+		float sum() const                   { return (v[0] + v[1]) + (v[2] + v[3]); }
+#endif
+	};
+
+	// GEMMのmicro kernelのサイズ。
+	// 行方向にGEMM_MR行、列方向にGEMM_NR列を一度に計算する。
+	// 累算用のレジスタ(GEMM_MR × 2本)が、SIMDレジスタの本数に収まるように決めてある。
+#if defined(USE_AVX512)
+	constexpr int GEMM_MR = 8;
+#elif defined(USE_AVX2)
+	constexpr int GEMM_MR = 6;
+#else
+	constexpr int GEMM_MR = 4;
+#endif
+	constexpr int GEMM_NR = VecF::width * 2;
+
+	// GEMMのcache blocking。Bの[GEMM_KC][GEMM_NC]がL2に収まる程度にする。
+	constexpr int GEMM_KC = 256;
+	constexpr int GEMM_NC = GEMM_NR * 8;
+
+	// C[ROWS][GEMM_NR] (+)= A[ROWS][kc] × B[kc][GEMM_NR]
+	// first == trueなら、Cをbiasで初期化してから累算する。
+	template <int ROWS>
+	void gemm_kernel(int kc, const float* a, int lda, const float* b, int ldb, float* c, int ldc, bool first, const float* bias)
+	{
+		VecF acc[ROWS][2];
+		for (int i = 0; i < ROWS; ++i)
+		{
+			if (first)
+				acc[i][0] = acc[i][1] = VecF::set1(bias[i]);
+			else {
+				acc[i][0] = VecF::load(c + i * ldc);
+				acc[i][1] = VecF::load(c + i * ldc + VecF::width);
+			}
+		}
+
+		for (int k = 0; k < kc; ++k)
+		{
+			const VecF b0 = VecF::load(b + k * ldb);
+			const VecF b1 = VecF::load(b + k * ldb + VecF::width);
+			for (int i = 0; i < ROWS; ++i)
+			{
+				const VecF ai = VecF::set1(a[i * lda + k]);
+				acc[i][0] = VecF::fmadd(ai, b0, acc[i][0]);
+				acc[i][1] = VecF::fmadd(ai, b1, acc[i][1]);
+			}
+		}
+
+		for (int i = 0; i < ROWS; ++i)
+		{
+			acc[i][0].store(c + i * ldc);
+			acc[i][1].store(c + i * ldc + VecF::width);
+		}
+	}
+
+	// 行数がGEMM_MRに満たない端数の行もあるので、行数に応じたkernelを呼び出す。
+	template <int ROWS = GEMM_MR>
+	void gemm_kernel_rows(int rows, int kc, const float* a, int lda, const float* b, int ldb, float* c, int ldc, bool first, const float* bias)
+	{
+		if constexpr (ROWS > 1)
+			if (rows < ROWS)
+				return gemm_kernel_rows<ROWS - 1>(rows, kc, a, lda, b, ldb, c, ldc, first, bias);
+		gemm_kernel<ROWS>(kc, a, lda, b, ldb, c, ldc, first, bias);
+	}
+
+	// C[M][N] = A[M][K] × B[K][N] + bias[M]
+	// NはGEMM_NRの倍数であること。(呼び出し側でpaddingしておく)
+	void sgemm(int M, int N, int K, const float* a, const float* b, float* c, const float* bias)
+	{
+		for (int n0 = 0; n0 < N; n0 += GEMM_NC)
+		{
+			const int nc = std::min(GEMM_NC, N - n0);
+			for (int k0 = 0; k0 < K; k0 += GEMM_KC)
+			{
+				const int kc = std::min(GEMM_KC, K - k0);
+				for (int m0 = 0; m0 < M; m0 += GEMM_MR)
+				{
+					const int mr = std::min(GEMM_MR, M - m0);
+					for (int n = n0; n < n0 + nc; n += GEMM_NR)
+						gemm_kernel_rows(mr, kc, a + (size_t)m0 * K + k0, K, b + (size_t)k0 * N + n, N,
+						                 c + (size_t)m0 * N + n, N, k0 == 0, bias + m0);
+				}
+			}
+		}
+	}
+
+	// 内積
+	float dot(const float* a, const float* b, int n)
+	{
+		VecF acc0 = VecF::zero(), acc1 = VecF::zero();
+		int i = 0;
+		for (; i + VecF::width * 2 <= n; i += VecF::width * 2)
+		{
+			acc0 = VecF::fmadd(VecF::load(a + i), VecF::load(b + i), acc0);
+			acc1 = VecF::fmadd(VecF::load(a + i + VecF::width), VecF::load(b + i + VecF::width), acc1);
+		}
+		float sum = acc0.sum() + acc1.sum();
+		for (; i < n; ++i)
+			sum += a[i] * b[i];
+		return sum;
+	}
+
+	// forward()で使う作業用のバッファ。探索スレッドごとに持つ。
+	thread_local std::vector<float> im2col_buffer;
+	thread_local std::vector<float> gemm_buffer;
+
+	// 2次元の畳み込み。stride = 1 , dilation = 1 , group = 1 のみ。
+	//   x : [batch][Cin][h][w]
+	//   y : [batch][Cout][oh][ow]
+	// im2colで[Cin*kh*kw][batch*oh*ow]の行列にしてから重みとのGEMMに帰着させる。
+	void conv2d(const NNCpu::Op& op, const float* x, int batch, int h, int w, float* y)
+	{
+		const int kh = op.kernel_h, kw = op.kernel_w;
+		const int oh = h + op.pad_h * 2 - kh + 1;
+		const int ow = w + op.pad_w * 2 - kw + 1;
+		const int cin = op.in_channels, cout = op.out_channels;
+		const int K = cin * kh * kw;
+		const int ohw = oh * ow;
+		const int N  = batch * ohw;
+		const int NP = (N + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+
+		auto& col = im2col_buffer;
+		col.resize((size_t)K * NP);
+
+		for (int ci = 0; ci < cin; ++ci)
+			for (int ky = 0; ky < kh; ++ky)
+				for (int kx = 0; kx < kw; ++kx)
+				{
+					float* row = &col[(size_t)((ci * kh + ky) * kw + kx) * NP];
+					for (int b = 0; b < batch; ++b)
+					{
+						const float* src = x + ((size_t)b * cin + ci) * h * w;
+						float* dst = row + b * ohw;
+						for (int oy = 0; oy < oh; ++oy)
+						{
+							const int iy = oy + ky - op.pad_h;
+							for (int ox = 0; ox < ow; ++ox)
+							{
+								const int ix = ox + kx - op.pad_w;
+								dst[oy * ow + ox] = (0 <= iy && iy < h && 0 <= ix && ix < w) ? src[iy * w + ix] : 0.0f;
+							}
+						}
+					}
+					std::fill(row + N, row + NP, 0.0f);
+				}
+
+		auto& out = gemm_buffer;
+		out.resize((size_t)cout * NP);
+		sgemm(cout, NP, K, op.weight.data(), col.data(), out.data(), op.bias.data());
+
+		// [Cout][batch*oh*ow] → [batch][Cout][oh*ow]
+		for (int co = 0; co < cout; ++co)
+			for (int b = 0; b < batch; ++b)
+				std::memcpy(y + ((size_t)b * cout + co) * ohw, &out[(size_t)co * NP + b * ohw], sizeof(float) * ohw);
+	}
+
+	// --------------------
+	//  ONNX(protobuf)の読み込み
+	// --------------------
+
+	// protobufのwire formatを読むためのclass。
+	// ONNXのモデルファイルはprotobufでシリアライズされているので、必要なfieldだけ自前で読む。
+	struct ProtoReader
+	{
+		const u8* p;
+		const u8* end;
+		bool error = false;
+
+		ProtoReader(const u8* p_, size_t size) : p(p_), end(p_ + size) {}
+
+		bool eof() const { return error || p >= end; }
+
+		u64 varint()
+		{
+			u64 r = 0;
+			for (int shift = 0; shift < 64 && p < end; shift += 7)
+			{
+				const u8 b = *p++;
+				r |= u64(b & 0x7f) << shift;
+				if (!(b & 0x80))
+					return r;
+			}
+			error = true;
+			return 0;
+		}
+
+		// 次のfieldのtagを読む。
+		bool next(u32& field, u32& wire)
+		{
+			if (eof())
+				return false;
+			const u64 key = varint();
+			field = u32(key >> 3);
+			wire  = u32(key & 7);
+			return !error;
+		}
+
+		// length-delimitedなfieldの中身
+		ProtoReader bytes()
+		{
+			const u64 size = varint();
+			if (error || size > u64(end - p))
+			{
+				error = true;
+				return ProtoReader(end, 0);
+			}
+			ProtoReader r(p, size_t(size));
+			p += size;
+			return r;
+		}
+
+		std::string str()
+		{
+			auto r = bytes();
+			return std::string((const char*)r.p, r.end - r.p);
+		}
+
+		u32 fixed32()
+		{
+			if (end - p < 4) { error = true; return 0; }
+			u32 r;
+			std::memcpy(&r, p, 4);
+			p += 4;
+			return r;
+		}
+
+		float f32()
+		{
+			const u32 u = fixed32();
+			float f;
+			std::memcpy(&f, &u, 4);
+			return f;
+		}
+
+		void skip(u32 wire)
+		{
+			switch (wire)
+			{
+			case 0: varint(); break;
+			case 1: if (end - p < 8) error = true; else p += 8; break;
+			case 2: bytes(); break;
+			case 5: fixed32(); break;
+			default: error = true; break;
+			}
+		}
+
+		// repeated int64 (packedでもそうでなくとも)
+		void ints(u32 wire, std::vector<s64>& v)
+		{
+			if (wire == 2)
+			{
+				auto r = bytes();
+				while (!r.eof())
+					v.push_back(s64(r.varint()));
+				error |= r.error;
+			}
+			else
+				v.push_back(s64(varint()));
+		}
+
+		// repeated float (packedでもそうでなくとも)
+		void floats(u32 wire, std::vector<float>& v)
+		{
+			if (wire == 2)
+			{
+				auto r = bytes();
+				while (!r.eof())
+					v.push_back(r.f32());
+				error |= r.error;
+			}
+			else
+				v.push_back(f32());
+		}
+	};
+
+	// IEEE 754 半精度 → 単精度
+	float half_to_float(u16 h)
+	{
+		const u32 sign = u32(h & 0x8000) << 16;
+		const u32 exp  = (h >> 10) & 0x1f;
+		u32 mant = h & 0x3ff;
+		u32 bits;
+		if (exp == 0)
+		{
+			if (mant == 0)
+				bits = sign;
+			else {
+				// 非正規化数
+				int e = -1;
+				do { ++e; mant <<= 1; } while (!(mant & 0x400));
+				bits = sign | u32(127 - 15 - e) << 23 | (mant & 0x3ff) << 13;
+			}
+		}
+		else if (exp == 0x1f)
+			bits = sign | 0x7f800000 | mant << 13;
+		else
+			bits = sign | (exp + 127 - 15) << 23 | mant << 13;
+
+		float f;
+		std::memcpy(&f, &bits, 4);
+		return f;
+	}
+
+	// ONNXのTensorProto::DataType
+	enum OnnxDataType { ONNX_FLOAT = 1, ONNX_INT32 = 6, ONNX_INT64 = 7, ONNX_FLOAT16 = 10, ONNX_DOUBLE = 11, ONNX_BFLOAT16 = 16 };
+
+	// TensorProtoを読み込んで定数にする。
+	bool read_tensor(ProtoReader r, std::string& name, NNCpu::Constant& c)
+	{
+		int data_type = 0;
+		std::vector<float> float_data;
+		std::vector<s64> int_data;
+		ProtoReader raw(nullptr, 0);
+		bool external = false;
+
+		u32 field, wire;
+		while (r.next(field, wire))
+		{
+			switch (field)
+			{
+			case 1:  r.ints(wire, c.dims); break;
+			case 2:  data_type = int(r.varint()); break;
+			case 4:  r.floats(wire, float_data); break;
+			case 5:  // int32_data (FLOAT16もここに入る)
+			case 7:  r.ints(wire, int_data); break;
+			case 8:  name = r.str(); break;
+			case 9:  raw = r.bytes(); break;
+			case 13: external = true; r.skip(wire); break;
+			default: r.skip(wire); break;
+			}
+		}
+		if (r.error)
+			return false;
+
+		if (external)
+		{
+			sync_cout << "info string Error! : NNCpu : external data is not supported , tensor = " << name << sync_endl;
+			return false;
+		}
+
+		const size_t raw_size = raw.end - raw.p;
+		auto raw_at = [&](size_t i, size_t bytes) { u64 v = 0; std::memcpy(&v, raw.p + i * bytes, bytes); return v; };
+
+		switch (data_type)
+		{
+		case ONNX_FLOAT:
+			if (raw_size)
+			{
+				c.data.resize(raw_size / 4);
+				std::memcpy(c.data.data(), raw.p, c.data.size() * 4);
+			}
+			else
+				c.data = std::move(float_data);
+			break;
+
+		case ONNX_DOUBLE:
+			for (size_t i = 0; i < raw_size / 8; ++i)
+			{
+				const u64 v = raw_at(i, 8);
+				double d;
+				std::memcpy(&d, &v, 8);
+				c.data.push_back(float(d));
+			}
+			break;
+
+		case ONNX_FLOAT16:
+			if (raw_size)
+				for (size_t i = 0; i < raw_size / 2; ++i)
+					c.data.push_back(half_to_float(u16(raw_at(i, 2))));
+			else
+				for (auto v : int_data)
+					c.data.push_back(half_to_float(u16(v)));
+			break;
+
+		case ONNX_BFLOAT16:
+		{
+			auto bf16 = [](u32 v) { float f; v <<= 16; std::memcpy(&f, &v, 4); return f; };
+			if (raw_size)
+				for (size_t i = 0; i < raw_size / 2; ++i)
+					c.data.push_back(bf16(u32(raw_at(i, 2))));
+			else
+				for (auto v : int_data)
+					c.data.push_back(bf16(u32(v)));
+			break;
+		}
+
+		case ONNX_INT32:
+		case ONNX_INT64:
+		{
+			const size_t bytes = data_type == ONNX_INT32 ? 4 : 8;
+			if (raw_size)
+				for (size_t i = 0; i < raw_size / bytes; ++i)
+					c.ints.push_back(bytes == 4 ? s64(s32(u32(raw_at(i, 4)))) : s64(raw_at(i, 8)));
+			else
+				c.ints = std::move(int_data);
+			for (auto v : c.ints)
+				c.data.push_back(float(v));
+			break;
+		}
+
+		default:
+			sync_cout << "info string Error! : NNCpu : unsupported data type = " << data_type << " , tensor = " << name << sync_endl;
+			return false;
+		}
+		return true;
+	}
+
+	// NodeProtoのattribute
+	struct OnnxAttribute
+	{
+		std::string name;
+		float f = 0;
+		s64 i = 0;
+		std::vector<s64> ints;
+		std::vector<float> floats;
+		bool has_tensor = false;
+		NNCpu::Constant t;
+	};
+
+	// NodeProto
+	struct OnnxNode
+	{
+		std::vector<std::string> inputs, outputs;
+		std::string op_type;
+		std::vector<OnnxAttribute> attributes;
+
+		const OnnxAttribute* attribute(const std::string& name) const
+		{
+			for (auto& a : attributes)
+				if (a.name == name)
+					return &a;
+			return nullptr;
+		}
+		s64 attr_i(const std::string& name, s64 def) const { auto a = attribute(name); return a ? a->i : def; }
+		float attr_f(const std::string& name, float def) const { auto a = attribute(name); return a ? a->f : def; }
+		std::vector<s64> attr_ints(const std::string& name) const { auto a = attribute(name); return a ? a->ints : std::vector<s64>(); }
+	};
+
+	bool read_node(ProtoReader r, OnnxNode& node)
+	{
+		u32 field, wire;
+		while (r.next(field, wire))
+		{
+			switch (field)
+			{
+			case 1: node.inputs.push_back(r.str()); break;
+			case 2: node.outputs.push_back(r.str()); break;
+			case 4: node.op_type = r.str(); break;
+			case 5:
+			{
+				OnnxAttribute a;
+				auto ar = r.bytes();
+				u32 f2, w2;
+				while (ar.next(f2, w2))
+				{
+					switch (f2)
+					{
+					case 1: a.name = ar.str(); break;
+					case 2: a.f = ar.f32(); break;
+					case 3: a.i = s64(ar.varint()); break;
+					case 5:
+					{
+						std::string tensor_name;
+						a.has_tensor = read_tensor(ar.bytes(), tensor_name, a.t);
+						if (!a.has_tensor)
+							return false;
+						break;
+					}
+					case 7: ar.floats(w2, a.floats); break;
+					case 8: ar.ints(w2, a.ints); break;
+					default: ar.skip(w2); break;
+					}
+				}
+				if (ar.error)
+					return false;
+				node.attributes.emplace_back(std::move(a));
+				break;
+			}
+			default: r.skip(wire); break;
+			}
+		}
+		return !r.error;
+	}
+
+	// ValueInfoProtoの名前
+	std::string read_value_info_name(ProtoReader r)
+	{
+		std::string name;
+		u32 field, wire;
+		while (r.next(field, wire))
+			if (field == 1)
+				name = r.str();
+			else
+				r.skip(wire);
+		return name;
+	}
+
+	// --------------------
+	//  forward()時のtensor
+	// --------------------
+
+	struct Tensor
+	{
+		std::vector<s64> dims;
+
+		// 実体。定数や入力の場合は空で、dataは外部のメモリを指す。
+		std::vector<float> storage;
+		const float* data = nullptr;
+
+		size_t size() const
+		{
+			size_t n = 1;
+			for (auto d : dims)
+				n *= size_t(d);
+			return n;
+		}
+
+		// dimsに従ってstorageを確保し、書き込み先を返す。
+		float* alloc(const std::vector<s64>& dims_)
+		{
+			dims = dims_;
+			storage.resize(size());
+			data = storage.data();
+			return storage.data();
+		}
+
+		void release()
+		{
+			std::vector<float>().swap(storage);
+			data = nullptr;
+		}
+	};
+
+	// 二項演算。numpyと同じbroadcastを行う。
+	template <typename F>
+	bool broadcast_binary(const Tensor& a, const Tensor& b, Tensor& out, F f)
+	{
+		const size_t rank = std::max(a.dims.size(), b.dims.size());
+		std::vector<s64> da(rank, 1), db(rank, 1), dims(rank);
+		std::copy(a.dims.begin(), a.dims.end(), da.begin() + (rank - a.dims.size()));
+		std::copy(b.dims.begin(), b.dims.end(), db.begin() + (rank - b.dims.size()));
+		for (size_t i = 0; i < rank; ++i)
+		{
+			if (da[i] != db[i] && da[i] != 1 && db[i] != 1)
+				return false;
+			dims[i] = std::max(da[i], db[i]);
+		}
+
+		float* y = out.alloc(dims);
+		const float* pa = a.data;
+		const float* pb = b.data;
+		const size_t n = out.size(), na = a.size(), nb = b.size();
+
+		if (na == n && nb == n)
+			for (size_t i = 0; i < n; ++i) y[i] = f(pa[i], pb[i]);
+		else if (nb == 1)
+			for (size_t i = 0; i < n; ++i) y[i] = f(pa[i], pb[0]);
+		else if (na == 1)
+			for (size_t i = 0; i < n; ++i) y[i] = f(pa[0], pb[i]);
+		else
+		{
+			// 一般のbroadcast。最内の次元ごとに処理する。
+			std::vector<size_t> sa(rank), sb(rank);
+			size_t ta = 1, tb = 1;
+			for (size_t i = rank; i-- > 0;)
+			{
+				sa[i] = da[i] == 1 ? 0 : ta; ta *= size_t(da[i]);
+				sb[i] = db[i] == 1 ? 0 : tb; tb *= size_t(db[i]);
+			}
+			const size_t inner = size_t(dims[rank - 1]);
+			std::vector<s64> idx(rank, 0);
+			for (size_t i = 0; i < n; i += inner)
+			{
+				size_t oa = 0, ob = 0;
+				for (size_t d = 0; d + 1 < rank; ++d)
+					oa += size_t(idx[d]) * sa[d], ob += size_t(idx[d]) * sb[d];
+				for (size_t j = 0; j < inner; ++j)
+					y[i + j] = f(pa[oa + j * sa[rank - 1]], pb[ob + j * sb[rank - 1]]);
+				for (size_t d = rank - 1; d-- > 0;)
+				{
+					if (++idx[d] < dims[d])
+						break;
+					idx[d] = 0;
+				}
+			}
+		}
+		return true;
+	}
+
+} // namespace
+
+	// 値(tensor)の名前から、その値のindexを返す。なければ新規に割り当てる。
+	int NNCpu::value_id(const std::string& name)
+	{
+		for (size_t i = 0; i < value_names.size(); ++i)
+			if (value_names[i] == name)
+				return int(i);
+		value_names.push_back(name);
+		constant_index.push_back(-1);
+		return int(value_names.size() - 1);
+	}
+
+	// モデルファイル(ONNX)を読み込んで、実行するopの列を構築する。
+	bool NNCpu::build_graph(const u8* data, size_t size)
+	{
+		value_names.clear();
+		constant_index.clear();
+		constants.clear();
+		ops.clear();
+
+		// ModelProto.graph
+		ProtoReader model(data, size);
+		ProtoReader graph(nullptr, 0);
+		u32 field, wire;
+		while (model.next(field, wire))
+			if (field == 7)
+				graph = model.bytes();
+			else
+				model.skip(wire);
+		if (model.error || graph.eof())
+		{
+			sync_cout << "info string Error! : NNCpu : not an ONNX model file." << sync_endl;
+			return false;
+		}
+
+		std::vector<OnnxNode> nodes;
+		std::vector<std::string> graph_inputs, graph_outputs;
+
+		auto add_constant = [&](const std::string& name, NNCpu::Constant&& c) {
+			const int id = value_id(name);
+			constant_index[id] = int(constants.size());
+			constants.emplace_back(std::move(c));
+		};
+
+		while (graph.next(field, wire))
+		{
+			switch (field)
+			{
+			case 1:
+			{
+				OnnxNode node;
+				if (!read_node(graph.bytes(), node))
+					return false;
+				nodes.emplace_back(std::move(node));
+				break;
+			}
+			case 5:
+			{
+				std::string name;
+				NNCpu::Constant c;
+				if (!read_tensor(graph.bytes(), name, c))
+					return false;
+				add_constant(name, std::move(c));
+				break;
+			}
+			case 11: graph_inputs.push_back(read_value_info_name(graph.bytes())); break;
+			case 12: graph_outputs.push_back(read_value_info_name(graph.bytes())); break;
+			default: graph.skip(wire); break;
+			}
+		}
+		if (graph.error)
+		{
+			sync_cout << "info string Error! : NNCpu : broken ONNX graph." << sync_endl;
+			return false;
+		}
+
+		auto constant_of = [&](const std::string& name) -> const NNCpu::Constant* {
+			const int id = value_id(name);
+			return constant_index[id] >= 0 ? &constants[constant_index[id]] : nullptr;
+		};
+		auto error = [&](const OnnxNode& node, const std::string& message) {
+			sync_cout << "info string Error! : NNCpu : " << message << " , op = " << node.op_type << sync_endl;
+			return false;
+		};
+
+		// ONNXのnodeは実行順(topological order)に並んでいるので、そのままopにしていく。
+		for (auto& node : nodes)
+		{
+			if (node.outputs.empty() || (node.inputs.empty() && node.op_type != "Constant"))
+				return error(node, "wrong number of inputs or outputs");
+
+			const auto& t = node.op_type;
+			Op op;
+			op.output = value_id(node.outputs[0]);
+
+			if (t == "Constant")
+			{
+				NNCpu::Constant c;
+				if (auto a = node.attribute("value"); a && a->has_tensor)
+					c = a->t;
+				else if (auto a = node.attribute("value_float"))
+					c.data.push_back(a->f);
+				else if (auto a = node.attribute("value_floats"))
+				{
+					c.data = a->floats;
+					c.dims.push_back(s64(c.data.size()));
+				}
+				else if (auto a = node.attribute("value_int"))
+				{
+					c.ints.push_back(a->i);
+					c.data.push_back(float(a->i));
+				}
+				else if (auto a = node.attribute("value_ints"))
+				{
+					c.ints = a->ints;
+					for (auto v : c.ints)
+						c.data.push_back(float(v));
+					c.dims.push_back(s64(c.ints.size()));
+				}
+				else
+					return error(node, "unsupported constant");
+				add_constant(node.outputs[0], std::move(c));
+				continue;
+			}
+			else if (t == "Conv")
+			{
+				auto w = node.inputs.size() >= 2 ? constant_of(node.inputs[1]) : nullptr;
+				if (!w || w->dims.size() != 4)
+					return error(node, "the weight must be a 4D constant");
+
+				for (auto v : node.attr_ints("strides"))
+					if (v != 1) return error(node, "strides must be 1");
+				for (auto v : node.attr_ints("dilations"))
+					if (v != 1) return error(node, "dilations must be 1");
+				if (node.attr_i("group", 1) != 1)
+					return error(node, "group must be 1");
+
+				op.type         = OpType::Conv;
+				op.out_channels = int(w->dims[0]);
+				op.in_channels  = int(w->dims[1]);
+				op.kernel_h     = int(w->dims[2]);
+				op.kernel_w     = int(w->dims[3]);
+
+				auto pads = node.attr_ints("pads");
+				if (pads.size() == 4)
+				{
+					if (pads[0] != pads[2] || pads[1] != pads[3])
+						return error(node, "asymmetric pads are not supported");
+					op.pad_h = int(pads[0]);
+					op.pad_w = int(pads[1]);
+				}
+				else if (auto a = node.attribute("auto_pad"); a)
+					return error(node, "auto_pad is not supported");
+
+				op.weight = w->data;
+				op.bias.assign(op.out_channels, 0.0f);
+				if (node.inputs.size() >= 3 && !node.inputs[2].empty())
+				{
+					auto b = constant_of(node.inputs[2]);
+					if (!b || b->data.size() != size_t(op.out_channels))
+						return error(node, "the bias must be a constant");
+					op.bias = b->data;
+				}
+				op.inputs.push_back(value_id(node.inputs[0]));
+			}
+			else if (t == "BatchNormalization")
+			{
+				if (node.inputs.size() < 5)
+					return error(node, "wrong number of inputs");
+				const NNCpu::Constant* p[4];
+				for (int i = 0; i < 4; ++i)
+					if (!(p[i] = constant_of(node.inputs[i + 1])))
+						return error(node, "the parameters must be constants");
+
+				// y = (x - mean) / sqrt(var + eps) * scale + B を y = x * weight + bias にしておく。
+				const float eps = node.attr_f("epsilon", 1e-5f);
+				const size_t channels = p[0]->data.size();
+				op.type = OpType::BatchNorm;
+				op.out_channels = int(channels);
+				for (size_t c = 0; c < channels; ++c)
+				{
+					const float s = p[0]->data[c] / std::sqrt(p[3]->data[c] + eps);
+					op.weight.push_back(s);
+					op.bias.push_back(p[1]->data[c] - p[2]->data[c] * s);
+				}
+				op.inputs.push_back(value_id(node.inputs[0]));
+			}
+			else if (t == "Relu" || t == "Sigmoid" || t == "Tanh" || t == "Identity" || t == "Cast" || t == "Dropout")
+			{
+				// Castは全部floatで計算しているので何もしなくて良い。
+				op.type = t == "Relu" ? OpType::Relu : t == "Sigmoid" ? OpType::Sigmoid : t == "Tanh" ? OpType::Tanh : OpType::Identity;
+				op.inputs.push_back(value_id(node.inputs[0]));
+			}
+			else if (t == "Add" || t == "Sub" || t == "Mul" || t == "Div")
+			{
+				if (node.inputs.size() != 2)
+					return error(node, "wrong number of inputs");
+				op.type = t == "Add" ? OpType::Add : t == "Sub" ? OpType::Sub : t == "Mul" ? OpType::Mul : OpType::Div;
+				op.inputs.push_back(value_id(node.inputs[0]));
+				op.inputs.push_back(value_id(node.inputs[1]));
+			}
+			else if (t == "Gemm" || t == "MatMul")
+			{
+				// 重みは[N][K]に転置して持つ。
+				auto b = node.inputs.size() >= 2 ? constant_of(node.inputs[1]) : nullptr;
+				if (!b || b->dims.size() != 2)
+					return error(node, "the second input must be a 2D constant");
+				const bool gemm = t == "Gemm";
+				if (gemm && node.attr_i("transA", 0))
+					return error(node, "transA is not supported");
+
+				const bool trans_b = gemm && node.attr_i("transB", 0);
+				const float alpha  = gemm ? node.attr_f("alpha", 1.0f) : 1.0f;
+				const float beta   = gemm ? node.attr_f("beta" , 1.0f) : 1.0f;
+				const int K = int(trans_b ? b->dims[1] : b->dims[0]);
+				const int N = int(trans_b ? b->dims[0] : b->dims[1]);
+
+				op.type = OpType::Gemm;
+				op.in_channels  = K;
+				op.out_channels = N;
+				op.weight.resize(size_t(N) * K);
+				for (int n = 0; n < N; ++n)
+					for (int k = 0; k < K; ++k)
+						op.weight[size_t(n) * K + k] = alpha * (trans_b ? b->data[size_t(n) * K + k] : b->data[size_t(k) * N + n]);
+
+				op.bias.assign(N, 0.0f);
+				if (gemm && node.inputs.size() >= 3 && !node.inputs[2].empty())
+				{
+					auto c = constant_of(node.inputs[2]);
+					if (!c || (c->data.size() != 1 && c->data.size() != size_t(N)))
+						return error(node, "the bias must be a constant of size 1 or N");
+					for (int n = 0; n < N; ++n)
+						op.bias[n] = beta * c->data[c->data.size() == 1 ? 0 : n];
+				}
+				op.inputs.push_back(value_id(node.inputs[0]));
+			}
+			else if (t == "Flatten")
+			{
+				op.type = OpType::Flatten;
+				op.axis = int(node.attr_i("axis", 1));
+				op.inputs.push_back(value_id(node.inputs[0]));
+			}
+			else if (t == "Reshape")
+			{
+				auto shape = node.inputs.size() >= 2 ? constant_of(node.inputs[1]) : nullptr;
+				if (!shape)
+					return error(node, "the shape must be a constant");
+				op.type = OpType::Reshape;
+				op.shape = shape->ints;
+				op.inputs.push_back(value_id(node.inputs[0]));
+			}
+			else
+				return error(node, "unsupported op");
+
+			for (auto id : op.inputs)
+				if (value_names[id].empty())
+					return error(node, "empty input");
+			ops.emplace_back(std::move(op));
+		}
+
+		// モデルの入出力。dlshogiのモデルは"input1","input2","output_policy","output_value"という名前になっている。
+		// 名前が異なる場合は、定数でない入力と出力を順番に割り当てる。
+		{
+			std::vector<int> inputs;
+			for (auto& name : graph_inputs)
+				if (!constant_of(name))
+					inputs.push_back(value_id(name));
+			std::vector<int> outputs;
+			for (auto& name : graph_outputs)
+				outputs.push_back(value_id(name));
+
+			if (inputs.size() != 2 || outputs.size() != 2)
+			{
+				sync_cout << "info string Error! : NNCpu : the model must have 2 inputs and 2 outputs." << sync_endl;
+				return false;
+			}
+			const char* input_names[]  = { "input1", "input2" };
+			const char* output_names[] = { "output_policy", "output_value" };
+			for (int i = 0; i < 2; ++i)
+			{
+				auto find = [&](const std::vector<int>& ids, const char* name) {
+					for (auto id : ids)
+						if (value_names[id] == name)
+							return id;
+					return -1;
+				};
+				input_ids[i]  = find(inputs , input_names[i] ) != -1 ? find(inputs , input_names[i] ) : inputs[i];
+				output_ids[i] = find(outputs, output_names[i]) != -1 ? find(outputs, output_names[i]) : outputs[i];
+			}
+		}
+
+		// 各値の参照回数
+		auto count_uses = [&]() {
+			std::vector<int> uses(value_names.size(), 0);
+			for (auto& op : ops)
+				for (auto id : op.inputs)
+					uses[id]++;
+			for (auto id : output_ids)
+				uses[id]++;
+			return uses;
+		};
+
+		// 最適化その1 : Conv → BatchNormalization を一つのConvにする。
+		{
+			auto uses = count_uses();
+			std::vector<Op> folded;
+			for (auto& op : ops)
+			{
+				if (op.type == OpType::BatchNorm && !folded.empty())
+				{
+					auto& conv = folded.back();
+					if (conv.type == OpType::Conv && conv.output == op.inputs[0] && uses[conv.output] == 1
+						&& conv.out_channels == op.out_channels)
+					{
+						const size_t k = conv.weight.size() / conv.out_channels;
+						for (int c = 0; c < conv.out_channels; ++c)
+						{
+							for (size_t i = 0; i < k; ++i)
+								conv.weight[c * k + i] *= op.weight[c];
+							conv.bias[c] = conv.bias[c] * op.weight[c] + op.bias[c];
+						}
+						conv.output = op.output;
+						continue;
+					}
+				}
+				folded.emplace_back(std::move(op));
+			}
+			ops = std::move(folded);
+		}
+
+		// 最適化その2 : x * Sigmoid(x) (Swish) を一つのopにする。
+		{
+			auto uses = count_uses();
+			std::vector<Op> fused;
+			std::vector<bool> removed(ops.size(), false);
+			for (size_t i = 0; i < ops.size(); ++i)
+			{
+				if (removed[i])
+					continue;
+				auto& op = ops[i];
+				if (op.type == OpType::Sigmoid && uses[op.output] == 1)
+				{
+					const int x = op.inputs[0], s = op.output;
+					for (size_t j = i + 1; j < ops.size(); ++j)
+					{
+						auto& mul = ops[j];
+						if (mul.type == OpType::Mul
+							&& ((mul.inputs[0] == x && mul.inputs[1] == s) || (mul.inputs[0] == s && mul.inputs[1] == x)))
+						{
+							op.type   = OpType::Swish;
+							op.output = mul.output;
+							removed[j] = true;
+							break;
+						}
+					}
+				}
+				fused.emplace_back(std::move(op));
+			}
+			ops = std::move(fused);
+		}
+
+		// 各値を最後に参照するop
+		last_use.assign(value_names.size(), -1);
+		for (size_t i = 0; i < ops.size(); ++i)
+			for (auto id : ops[i].inputs)
+				last_use[id] = int(i);
+		for (auto id : output_ids)
+			last_use[id] = int(ops.size());
+
+		return true;
+	}
+
+	// モデルファイルの読み込み。
+	Result NNCpu::load(const std::string& model_path , int gpu_id , int batch_size)
+	{
+		(void)gpu_id; (void)batch_size;
+
+		std::unique_ptr<u8[]> model;
+		size_t model_size = 0;
+		auto result = SystemIO::ReadFileToMemory(model_path, [&](size_t size) {
+			model = make_unique<u8[]>(size); model_size = size; return model.get();
+		});
+		if (result.is_not_ok())
+			return result;
+
+		if (!build_graph(model.get(), model_size))
+			return ResultCode::FileMismatch;
+
+		// ModelArchitectureとモデルの入出力が一致しているかを、1局面だけ推論して確認しておく。
+		{
+			const auto& spec = input_feature_spec();
+			std::vector<float> x1(input1_element_count(1)), x2(input2_element_count(1));
+			std::vector<float> y1(MAX_MOVE_LABEL_NUM * (size_t)SQ_NB, -1.0f);
+			float y2 = -1.0f;
+			if (!run(1, x1.data(), x2.data(), y1.data(), &y2))
+			{
+				sync_cout << "info string Error! : NNCpu : the model does not match ModelArchitecture = " << spec.architecture << sync_endl;
+				return ResultCode::FileMismatch;
+			}
+		}
+
+		sync_cout << "info string NNCpu : " << ops.size() << " ops , SIMD width = " << VecF::width << sync_endl;
+		return ResultCode::Ok;
+	}
+
+	// グラフを実行する。出力のshapeが合わなかった場合などはfalseが返る。
+	bool NNCpu::run(const int batch_size, const float* x1, const float* x2, float* y1, float* y2) const
+	{
+		const auto& spec = input_feature_spec();
+
+		std::vector<Tensor> values(value_names.size());
+		for (size_t i = 0; i < values.size(); ++i)
+			if (constant_index[i] >= 0)
+			{
+				auto& c = constants[constant_index[i]];
+				values[i].dims = c.dims;
+				values[i].data = c.data.data();
+			}
+
+		values[input_ids[0]].dims = { batch_size, s64(spec.features1_channels), 9, 9 };
+		values[input_ids[0]].data = x1;
+		values[input_ids[1]].dims = { batch_size, s64(spec.features2_channels), 9, 9 };
+		values[input_ids[1]].data = x2;
+
+		auto fail = [&](const Op& op, const std::string& message) {
+			sync_cout << "info string Error! : NNCpu : " << message << " , output = " << value_names[op.output] << sync_endl;
+			return false;
+		};
+
+		for (size_t i = 0; i < ops.size(); ++i)
+		{
+			const auto& op = ops[i];
+			const Tensor& x = values[op.inputs[0]];
+			Tensor& out = values[op.output];
+			if (!x.data)
+				return fail(op, "the input is not computed");
+			const size_t n = x.size();
+
+			switch (op.type)
+			{
+			case OpType::Conv:
+			{
+				if (x.dims.size() != 4 || x.dims[1] != op.in_channels)
+					return fail(op, "input channels mismatch");
+				const int h = int(x.dims[2]), w = int(x.dims[3]);
+				float* y = out.alloc({ x.dims[0], op.out_channels, h + op.pad_h * 2 - op.kernel_h + 1, w + op.pad_w * 2 - op.kernel_w + 1 });
+				conv2d(op, x.data, int(x.dims[0]), h, w, y);
+				break;
+			}
+
+			case OpType::BatchNorm:
+			{
+				if (x.dims.size() < 2 || x.dims[1] != op.out_channels)
+					return fail(op, "channels mismatch");
+				float* y = out.alloc(x.dims);
+				const size_t channels = size_t(op.out_channels);
+				const size_t inner = n / size_t(x.dims[0]) / channels;
+				for (size_t j = 0; j < n; ++j)
+				{
+					const size_t c = (j / inner) % channels;
+					y[j] = x.data[j] * op.weight[c] + op.bias[c];
+				}
+				break;
+			}
+
+			case OpType::Relu:
+			{
+				float* y = out.alloc(x.dims);
+				for (size_t j = 0; j < n; ++j) y[j] = std::max(x.data[j], 0.0f);
+				break;
+			}
+			case OpType::Sigmoid:
+			{
+				float* y = out.alloc(x.dims);
+				for (size_t j = 0; j < n; ++j) y[j] = 1.0f / (1.0f + std::exp(-x.data[j]));
+				break;
+			}
+			case OpType::Swish:
+			{
+				float* y = out.alloc(x.dims);
+				for (size_t j = 0; j < n; ++j) y[j] = x.data[j] / (1.0f + std::exp(-x.data[j]));
+				break;
+			}
+			case OpType::Tanh:
+			{
+				float* y = out.alloc(x.dims);
+				for (size_t j = 0; j < n; ++j) y[j] = std::tanh(x.data[j]);
+				break;
+			}
+
+			case OpType::Add:
+			case OpType::Sub:
+			case OpType::Mul:
+			case OpType::Div:
+			{
+				const Tensor& x2 = values[op.inputs[1]];
+				if (!x2.data)
+					return fail(op, "the input is not computed");
+				bool ok;
+				switch (op.type)
+				{
+				case OpType::Add: ok = broadcast_binary(x, x2, out, [](float a, float b) { return a + b; }); break;
+				case OpType::Sub: ok = broadcast_binary(x, x2, out, [](float a, float b) { return a - b; }); break;
+				case OpType::Mul: ok = broadcast_binary(x, x2, out, [](float a, float b) { return a * b; }); break;
+				default:          ok = broadcast_binary(x, x2, out, [](float a, float b) { return a / b; }); break;
+				}
+				if (!ok)
+					return fail(op, "shapes cannot be broadcast");
+				break;
+			}
+
+			case OpType::Gemm:
+			{
+				const size_t K = size_t(op.in_channels);
+				if (x.dims.empty() || n % K != 0 || size_t(x.dims.back()) != K)
+					return fail(op, "input size mismatch");
+				const size_t M = n / K;
+				std::vector<s64> dims(x.dims.begin(), x.dims.end() - 1);
+				dims.push_back(op.out_channels);
+				float* y = out.alloc(dims);
+				for (size_t m = 0; m < M; ++m)
+					for (int o = 0; o < op.out_channels; ++o)
+						y[m * op.out_channels + o] = dot(x.data + m * K, &op.weight[o * K], int(K)) + op.bias[o];
+				break;
+			}
+
+			case OpType::Flatten:
+			case OpType::Reshape:
+			{
+				std::vector<s64> dims;
+				if (op.type == OpType::Flatten)
+				{
+					s64 outer = 1;
+					for (int d = 0; d < op.axis && d < int(x.dims.size()); ++d)
+						outer *= x.dims[d];
+					dims = { outer, s64(n) / std::max(outer, s64(1)) };
+				}
+				else
+				{
+					s64 known = 1;
+					int infer = -1;
+					for (size_t d = 0; d < op.shape.size(); ++d)
+					{
+						s64 v = op.shape[d] == 0 && d < x.dims.size() ? x.dims[d] : op.shape[d];
+						if (v == -1)
+							infer = int(d);
+						else
+							known *= v;
+						dims.push_back(v);
+					}
+					if (infer >= 0)
+						dims[infer] = known ? s64(n) / known : 0;
+				}
+				float* y = out.alloc(dims);
+				if (out.size() != n)
+					return fail(op, "reshape size mismatch");
+				std::memcpy(y, x.data, sizeof(float) * n);
+				break;
+			}
+
+			case OpType::Identity:
+			{
+				float* y = out.alloc(x.dims);
+				std::memcpy(y, x.data, sizeof(float) * n);
+				break;
+			}
+			}
+
+			// もう参照されない値は開放しておく。
+			for (auto id : op.inputs)
+				if (last_use[id] == int(i) && constant_index[id] < 0)
+					values[id].release();
+		}
+
+		const Tensor& policy = values[output_ids[0]];
+		const Tensor& value  = values[output_ids[1]];
+		if (!policy.data || !value.data
+			|| policy.size() != (size_t)batch_size * MAX_MOVE_LABEL_NUM * (size_t)SQ_NB
+			|| value.size() != (size_t)batch_size)
+			return false;
+
+		std::memcpy(y1, policy.data, sizeof(float) * policy.size());
+		std::memcpy(y2, value.data , sizeof(float) * value.size());
+		return true;
+	}
+
+	// NNによる推論
+	void NNCpu::forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2)
+	{
+		(void)p1; (void)p2;
+		run(batch_size, (const float*)x1, (const float*)x2, (float*)y1, (float*)y2);
+	}
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(YANEURAOU_ENGINE_DEEP) && defined(NN_CPU)
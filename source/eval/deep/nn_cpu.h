@@ -0,0 +1,113 @@
+﻿#ifndef __NN_CPU_H_INCLUDED__
+#define __NN_CPU_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+#if defined(NN_CPU)
+
+// 外部ライブラリ(ONNX Runtime等)を用いずに、CPUだけで推論する場合。
+//
+// ONNX形式のモデルファイルを自前で読み込み、そのグラフを順番に実行する。
+// Conv , BatchNormalization , Gemm 等、dlshogiのResNetをexportした時に出てくるopだけに対応している。
+// Convの直後のBatchNormalizationはload時にConvの重みに畳み込んでおく。
+//
+// 💡 forward()はreentrantなので、各探索スレッドがmutexなしで同時に呼び出せる。
+//     CPUのコア数だけUCT_Threadsを設定すると、各スレッドが1コアずつ使って推論する。
+
+#include <vector>
+#include <string>
+
+#include "nn.h"
+#include "nn_types.h"
+
+namespace YaneuraOu {
+namespace Eval::dlshogi {
+
+	// 外部ライブラリなしのCPU推論用
+	class NNCpu : public NN
+	{
+	public:
+		// モデルファイルの読み込み。
+		virtual Tools::Result load(const std::string& model_path , int gpu_id , int batch_size);
+
+		// NNによる推論
+		virtual void forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2);
+
+		// 使用可能なデバイス数を取得する。
+		// CPUなので常に1。
+		static int get_device_count() { return 1; }
+
+		// 対応しているopの種類
+		enum class OpType
+		{
+			Conv, BatchNorm, Relu, Sigmoid, Swish, Tanh,
+			Add, Sub, Mul, Div, Gemm, Reshape, Flatten, Identity,
+		};
+
+		// load()で読み込んだグラフの1要素(op)
+		struct Op
+		{
+			OpType type;
+
+			// 入力の値のindex。
+			std::vector<int> inputs;
+
+			// 出力の値のindex。
+			int output;
+
+			// Conv : 重みは[out_channels][in_channels * kernel_h * kernel_w]
+			// Gemm : 重みは[out_channels][in_channels] (転置済み。alphaも掛けてある)
+			// BatchNorm : channelごとのscale。biasはchannelごとのshift。
+			std::vector<float> weight;
+			std::vector<float> bias;
+			int out_channels = 0, in_channels = 0;
+			int kernel_h = 1, kernel_w = 1, pad_h = 0, pad_w = 0;
+
+			// Reshape : 変形後のshape(0はそのまま、-1は残り全部)
+			// Flatten : axis
+			std::vector<s64> shape;
+			int axis = 1;
+		};
+
+		// グラフ上の定数(initializer)
+		struct Constant
+		{
+			std::vector<s64> dims;
+			std::vector<float> data;
+			std::vector<s64> ints; // Reshapeのshape等、整数で扱いたい定数用。
+		};
+
+	private:
+		// 定数とopの構築。load()の下請け。
+		bool build_graph(const u8* data, size_t size);
+
+		// グラフを実行する。出力のshapeが合わなかった場合などはfalseが返る。
+		bool run(const int batch_size, const float* x1, const float* x2, float* y1, float* y2) const;
+
+		// 値(tensor)の名前から、その値のindexを返す。なければ新規に割り当てる。
+		int value_id(const std::string& name);
+
+		// 値の名前 → index
+		std::vector<std::string> value_names;
+
+		// 定数のindex。定数でない値は-1。value_names と同じ要素数。
+		std::vector<int> constant_index;
+		std::vector<Constant> constants;
+
+		// 実行順に並んだop
+		std::vector<Op> ops;
+
+		// 入力(input1,input2)と出力(output_policy,output_value)の値のindex
+		int input_ids[2]  = { -1, -1 };
+		int output_ids[2] = { -1, -1 };
+
+		// 各値を最後に参照するopのindex。forward()で不要になった値を開放するのに用いる。
+		std::vector<int> last_use;
+	};
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(NN_CPU)
+#endif // defined(YANEURAOU_ENGINE_DEEP)
+#endif // ndef __NN_CPU_H_INCLUDED__
@@ -0,0 +1,99 @@
+﻿#include "nn_mock.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "../../misc.h"
+
+namespace YaneuraOu {
+using namespace Tools;
+
+namespace Eval::dlshogi {
+
+	// model_pathのファイル名部分が"mock"で始まるならtrue。
+	bool NNMock::is_mock_model(const std::string& model_path)
+	{
+		const auto pos  = model_path.find_last_of("/\\");
+		const auto name = pos == std::string::npos ? model_path : model_path.substr(pos + 1);
+		return name.compare(0, 4, "mock") == 0;
+	}
+
+	// モデル名の解析。"mock[:base_us[:per_position_us]]"
+	Tools::Result NNMock::load(const std::string& model_path, int gpu_id, int batch_size)
+	{
+		(void)gpu_id; (void)batch_size;
+
+		const auto pos  = model_path.find_last_of("/\\");
+		const auto name = pos == std::string::npos ? model_path : model_path.substr(pos + 1);
+
+		const char* p = name.c_str() + 4; // "mock"の直後
+		if (*p == ':')
+		{
+			char* end;
+			base_us = std::max(s64(0), s64(std::strtol(p + 1, &end, 10)));
+			p = end;
+			if (*p == ':')
+			{
+				per_position_us = std::max(s64(0), s64(std::strtol(p + 1, &end, 10)));
+				p = end;
+			}
+		}
+		if (*p != '\0')
+		{
+			sync_cout << "Error! : mock model name must be \"mock[:base_us[:per_position_us]]\" , name = " << name << sync_endl;
+			return ResultCode::FileMismatch;
+		}
+
+		sync_cout << "info string mock NN , base = " << base_us << "[us] , per position = " << per_position_us << "[us]" << sync_endl;
+		return ResultCode::Ok;
+	}
+
+	// 擬似的な推論
+	void NNMock::forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2)
+	{
+		(void)x1; (void)x2;
+
+		const auto&  spec  = input_feature_spec();
+		const size_t bits1 = size_t(spec.features1_channels) * size_t(SQ_NB);
+		const size_t bits2 = size_t(spec.features2_channels);
+
+		// packされた特徴量のbit列[offset, offset + bits)をhashに混ぜる。
+		auto mix_bits = [](u64 h, const PType* packed, size_t offset, size_t bits) {
+			for (size_t i = offset; i < offset + bits; ++i)
+				if ((packed[i >> 3] >> (i & 7)) & 1)
+					h = (h ^ i) * 0x9E3779B97F4A7C15ULL;
+			return h;
+		};
+
+		// 局面のhash値から擬似乱数列を作る。(xorshift64*)
+		auto next = [](u64& s) {
+			s ^= s >> 12; s ^= s << 25; s ^= s >> 27;
+			return s * 0x2545F4914F6CDD1DULL;
+		};
+		// [0,1)の一様乱数
+		auto uniform = [&](u64& s) { return float(next(s) >> 40) * (1.0f / float(1 << 24)); };
+
+		for (int i = 0; i < batch_size; ++i)
+		{
+			u64 h = 0xcbf29ce484222325ULL;
+			h = mix_bits(h, p1, bits1 * i, bits1);
+			h = mix_bits(h, p2, bits2 * i, bits2);
+			u64 s = h | 1;
+
+			for (auto& logit : y1[i])
+				logit = to_dtype(uniform(s) * 4.0f - 2.0f);
+			y2[i] = to_dtype(0.3f + 0.4f * uniform(s));
+		}
+
+		const s64 us = base_us + per_position_us * batch_size;
+		if (us > 0)
+			std::this_thread::sleep_for(std::chrono::microseconds(us));
+	}
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
@@ -0,0 +1,58 @@
+﻿#ifndef __NN_MOCK_H_INCLUDED__
+#define __NN_MOCK_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+// 推論を行わずに、それらしい値を返すだけの擬似的なNN。
+//
+// GPUやモデルファイルなしで、探索部(木の降下、展開、backup、batchの充填)の性能を計測するために用いる。
+// DNN_Modelに"mock"で始まる名前を指定するとこれが使われる。書式は以下の通り。
+//
+//   mock[:base_us[:per_position_us]]
+//
+//   base_us         : 1回のforward()にかかる時間[us]。省略時は1000。
+//   per_position_us : batchの局面1つあたりに追加でかかる時間[us]。省略時は0。
+//
+//   例) "mock:2000:10" なら、batch_size = 128で 2000 + 10 * 128 = 3280[us]かかる。
+//
+// 📝 policyとvalueは局面の入力特徴量のhash値から決まるので、同じ局面に対しては常に同じ値を返す。
+//     (探索の再現性が保たれるので、探索部の変更前後で比較しやすい)
+//
+// 💡 推論は各backendのforward()と同じ経路(UctSearcherGroup::nn_forward())で呼び出されるので、
+//     TensorRT等、GPUのあるeditionではmutexによる排他も含めて計測される。
+
+#include <string>
+
+#include "nn.h"
+#include "nn_types.h"
+
+namespace YaneuraOu {
+namespace Eval::dlshogi {
+
+	// 擬似的なNN
+	class NNMock : public NN
+	{
+	public:
+		// モデル名の解析。ファイルは読み込まない。
+		virtual Tools::Result load(const std::string& model_path, int gpu_id, int batch_size);
+
+		// 擬似的な推論。policyとvalueを書き込んで、指定された時間だけsleepする。
+		virtual void forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2);
+
+		// model_pathのファイル名部分が"mock"で始まるならtrue。
+		static bool is_mock_model(const std::string& model_path);
+
+	private:
+		// 1回のforward()にかかる時間[us]
+		s64 base_us = 1000;
+
+		// batchの局面1つあたりに追加でかかる時間[us]
+		s64 per_position_us = 0;
+	};
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
+#endif // ndef __NN_MOCK_H_INCLUDED__
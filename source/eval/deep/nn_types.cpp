@@ -534,6 +534,42 @@ void extract_input_features(int        batch_size,
     }
 }
 
+// make_input_features()で生成したbatch_size局面分の入力特徴量を、
+// 別のバッファのdst_index番目の局面以降に複写する。
+void copy_packed_features(int          batch_size,
+                          const PType* src_features1,
+                          const PType* src_features2,
+                          int          dst_index,
+                          PType*       dst_features1,
+                          PType*       dst_features2) {
+    const auto& spec = input_feature_spec();
+
+    // 📝 packされた特徴量は局面ごとにbyte境界に揃っていないので、bit単位で複写する。
+    //     複写先がbyte境界に揃っている時だけ、byte単位でまとめて複写する。
+    auto copy_bits = [](const PType* src, PType* dst, size_t dst_bit, size_t bits) {
+        size_t i = 0;
+        if ((dst_bit & 7) == 0)
+        {
+            std::memcpy(dst + (dst_bit >> 3), src, bits >> 3);
+            i = bits & ~size_t(7);
+        }
+        for (; i < bits; ++i)
+        {
+            const size_t d    = dst_bit + i;
+            const PType  mask = PType(1 << (d & 7));
+            if ((src[i >> 3] >> (i & 7)) & 1)
+                dst[d >> 3] |= mask;
+            else
+                dst[d >> 3] &= PType(~mask);
+        }
+    };
+
+    const size_t bits1 = size_t(spec.features1_channels) * size_t(SQ_NB);
+    const size_t bits2 = size_t(spec.features2_channels);
+    copy_bits(src_features1, dst_features1, bits1 * dst_index, bits1 * batch_size);
+    copy_bits(src_features2, dst_features2, bits2 * dst_index, bits2 * batch_size);
+}
+
 // MoveLabel配列を事前に初期化する。
 // "isready"に対して呼び出される。
 void init_move_label() {
@@ -192,6 +192,11 @@ namespace Eval::dlshogi {
 	// 入力特徴量を展開する。GPU側で展開する場合は不要。
 	void extract_input_features(int batch_size, PType* packed_features1, PType* packed_features2, NN_Input1* features1, NN_Input2* features2);
 
+	// make_input_features()で生成したbatch_size局面分の入力特徴量を、
+	// 別のバッファのdst_index番目の局面以降に複写する。(複数のbatchを一つにまとめて推論する時に用いる)
+	void copy_packed_features(int batch_size, const PType* src_features1, const PType* src_features2,
+	                          int dst_index, PType* dst_features1, PType* dst_features2);
+
 	// 指し手に対して、Policy Networkの返してくる配列のindexを返す。
 	int make_move_label(Move move, Color color);
 
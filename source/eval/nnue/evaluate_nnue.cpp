@@ -299,7 +299,8 @@ namespace {
 #endif
 
     // 評価値を計算する
-    static Value ComputeScore(const Position& pos, bool refresh = false) {
+    // cache : 全計算が必要になった時に用いるAccumulatorCache。nullptrなら用いない。
+    static Value ComputeScore(const Position& pos, bool refresh = false, AccumulatorCache* cache = nullptr) {
         auto& accumulator = pos.state()->accumulator;
         if (!refresh && accumulator.computed_score) {
             return accumulator.score;
@@ -307,7 +308,7 @@ namespace {
 
         alignas(kCacheLineSize) TransformedFeatureType
             transformed_features[FeatureTransformer::kBufferSize];
-        networks().feature_transformer.Transform(pos, transformed_features, refresh);
+        networks().feature_transformer.Transform(pos, transformed_features, refresh, cache);
         alignas(kCacheLineSize) char buffer[Network::kBufferSize];
 #if defined(SFNNwoPSQT)
         const auto bucket = stack_index_for_nnue(pos);
@@ -467,6 +468,11 @@ Value compute_eval(const Position& pos) {
 
 // 評価関数
 Value evaluate(const Position& pos) {
+    return evaluate(pos, nullptr);
+}
+
+// 評価関数(AccumulatorCacheを用いる版)
+Value evaluate(const Position& pos, NNUE::AccumulatorCache* cache) {
     const auto& accumulator = pos.state()->accumulator;
     if (accumulator.computed_score) {
         return accumulator.score;
@@ -477,7 +483,7 @@ Value evaluate(const Position& pos) {
     // eval hashへの照会をskipする。
     if (!GlobalOptions.use_eval_hash) {
         ASSERT_LV5(pos.state()->materialValue == Eval::material(pos));
-        return NNUE::ComputeScore(pos);
+        return NNUE::ComputeScore(pos, false, cache);
     }
 #endif
 
@@ -492,7 +498,7 @@ Value evaluate(const Position& pos) {
     }
 #endif
 
-    Value score = NNUE::ComputeScore(pos);
+    Value score = NNUE::ComputeScore(pos, false, cache);
 #if defined(USE_EVAL_HASH)
     // せっかく計算したのでevaluate hash tableに保存しておく。
     entry.key = key;
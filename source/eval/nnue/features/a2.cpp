@@ -32,9 +32,8 @@ void A2::AppendActiveIndices(
 
 // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
 void A2::AppendChangedIndices(
-    const Position& pos, Color perspective,
+    const Position& pos, const DirtyPiece& dp, Color perspective,
     IndexList* removed, IndexList* added) {
-  const auto& dp = pos.state()->dirtyPiece;
   for (int i = 0; i < dp.dirty_num; ++i) {
     removed->push_back(MapToA2Index(static_cast<BonaPiece>(
         dp.changed_piece[i].old_piece.from[perspective])));
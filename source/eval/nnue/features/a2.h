@@ -24,10 +24,13 @@ class A2 {
   static constexpr IndexType kMaxActiveDimensions = PIECE_NUMBER_NB;
   static constexpr TriggerEvent kRefreshTrigger = TriggerEvent::kNone;
 
+  // 差分がDirtyPieceと玉の位置だけから求まるので、2手以上前の局面から差分計算できる
+  static constexpr bool kMultiPlyUpdatable = true;
+
   static void AppendActiveIndices(const Position& pos, Color perspective,
                                   IndexList* active);
 
-  static void AppendChangedIndices(const Position& pos, Color perspective,
+  static void AppendChangedIndices(const Position& pos, const DirtyPiece& dp, Color perspective,
                                    IndexList* removed, IndexList* added);
 };
 
@@ -88,38 +88,58 @@ class FeatureSetBase {
     if (dp.dirty_num == 0) return;
 
     for (const auto perspective : COLOR) {
-      reset[perspective] = false;
-      switch (trigger) {
-        case TriggerEvent::kNone:
-          break;
-        case TriggerEvent::kFriendKingMoved:
-          reset[perspective] =
-              dp.pieceNo[0] == PIECE_NUMBER_KING + perspective;
-          break;
-        case TriggerEvent::kEnemyKingMoved:
-          reset[perspective] =
-              dp.pieceNo[0] == PIECE_NUMBER_KING + ~perspective;
-          break;
-        case TriggerEvent::kAnyKingMoved:
-          reset[perspective] = dp.pieceNo[0] >= PIECE_NUMBER_KING;
-          break;
-        case TriggerEvent::kAnyPieceMoved:
-          reset[perspective] = true;
-          break;
-        default:
-          ASSERT_LV5(false);
-          break;
-      }
+      reset[perspective] = IsRefreshRequired(dp, trigger, perspective);
       if (reset[perspective]) {
         Derived::CollectActiveIndices(
             pos, trigger, perspective, &added[perspective]);
       } else {
         Derived::CollectChangedIndices(
-            pos, trigger, perspective,
+            pos, dp, trigger, perspective,
             &removed[perspective], &added[perspective]);
       }
     }
   }
+
+  // 特徴量のうち、perspective側で値が1であるインデックスのリストを取得する
+  template <typename IndexListType>
+  static void AppendActiveIndices(
+      const Position& pos, TriggerEvent trigger, Color perspective, IndexListType* active) {
+    Derived::CollectActiveIndices(pos, trigger, perspective, active);
+  }
+
+  // 特徴量のうち、dpによってperspective側で値が変化したインデックスのリストを取得する
+  // 💡 dpはposより前の局面のDirtyPieceであっても良い(2手以上前の局面からの差分計算用)が、
+  //     その場合、kMultiPlyUpdatableがtrueである特徴量セットでなければならない。
+  //     いずれの場合も、dpの指し手でtriggerによる全計算が必要になってはならない。
+  template <typename IndexListType>
+  static void AppendChangedIndices(
+      const Position& pos, const DirtyPiece& dp, TriggerEvent trigger, Color perspective,
+      IndexListType* removed, IndexListType* added) {
+    ASSERT_LV5(!IsRefreshRequired(dp, trigger, perspective));
+    Derived::CollectChangedIndices(pos, dp, trigger, perspective, removed, added);
+  }
+
+  // dpの指し手によって、perspective側のtriggerに関する全計算が必要になるか
+  static bool IsRefreshRequired(
+      const DirtyPiece& dp, TriggerEvent trigger, Color perspective) {
+    if (dp.dirty_num == 0) return false;
+
+    switch (trigger) {
+      case TriggerEvent::kNone:
+        return false;
+      case TriggerEvent::kFriendKingMoved:
+        return dp.pieceNo[0] == PIECE_NUMBER_KING + perspective;
+      case TriggerEvent::kEnemyKingMoved:
+        return dp.pieceNo[0] == PIECE_NUMBER_KING + ~perspective;
+      case TriggerEvent::kAnyKingMoved:
+        return dp.pieceNo[0] >= PIECE_NUMBER_KING;
+      case TriggerEvent::kAnyPieceMoved:
+        return true;
+      default:
+        ASSERT_LV5(false);
+        return false;
+    }
+  }
 };
 
 // Class template that represents the feature set
@@ -143,6 +163,9 @@ class FeatureSet<FirstFeatureType, RemainingFeatureTypes...> :
   // 特徴量のうち、同時に値が1となるインデックスの数の最大値
   static constexpr IndexType kMaxActiveDimensions =
       Head::kMaxActiveDimensions + Tail::kMaxActiveDimensions;
+  // 差分がDirtyPieceと玉の位置だけから求まり、2手以上前の局面から差分計算できるか
+  static constexpr bool kMultiPlyUpdatable =
+      Head::kMultiPlyUpdatable && Tail::kMultiPlyUpdatable;
   // 差分計算の代わりに全計算を行うタイミングのリスト
   using SortedTriggerSet = typename InsertToSet<TriggerEvent,
       typename Tail::SortedTriggerSet, Head::kRefreshTrigger>::Result;
@@ -172,13 +195,13 @@ class FeatureSet<FirstFeatureType, RemainingFeatureTypes...> :
   // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
   template <typename IndexListType>
   static void CollectChangedIndices(
-      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const Position& pos, const DirtyPiece& dp, const TriggerEvent trigger, const Color perspective,
       IndexListType* const removed, IndexListType* const added) {
-    Tail::CollectChangedIndices(pos, trigger, perspective, removed, added);
+    Tail::CollectChangedIndices(pos, dp, trigger, perspective, removed, added);
     if (Head::kRefreshTrigger == trigger) {
       const auto start_removed = removed->size();
       const auto start_added = added->size();
-      Head::AppendChangedIndices(pos, perspective, removed, added);
+      Head::AppendChangedIndices(pos, dp, perspective, removed, added);
       for (auto i = start_removed; i < removed->size(); ++i) {
         (*removed)[i] += Tail::kDimensions;
       }
@@ -211,6 +234,9 @@ class FeatureSet<FeatureType> : public FeatureSetBase<FeatureSet<FeatureType>> {
   static constexpr IndexType kMaxActiveDimensions =
       FeatureType::kMaxActiveDimensions;
 
+  // 差分がDirtyPieceと玉の位置だけから求まり、2手以上前の局面から差分計算できるか
+  static constexpr bool kMultiPlyUpdatable = FeatureType::kMultiPlyUpdatable;
+
   // Trigger for full calculation instead of difference calculation
   // 差分計算の代わりに全計算を行うタイミングのリスト
   using SortedTriggerSet =
@@ -234,10 +260,10 @@ class FeatureSet<FeatureType> : public FeatureSetBase<FeatureSet<FeatureType>> {
 
   // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
   static void CollectChangedIndices(
-      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const Position& pos, const DirtyPiece& dp, const TriggerEvent trigger, const Color perspective,
       IndexList* const removed, IndexList* const added) {
     if (FeatureType::kRefreshTrigger == trigger) {
-      FeatureType::AppendChangedIndices(pos, perspective, removed, added);
+      FeatureType::AppendChangedIndices(pos, dp, perspective, removed, added);
     }
   }
 
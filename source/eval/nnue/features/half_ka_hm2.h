@@ -34,12 +34,15 @@ namespace Eval::NNUE::Features {
 			(AssociatedKing == Side::kFriend) ?
 			TriggerEvent::kFriendKingMoved : TriggerEvent::kEnemyKingMoved;
 
+		// 差分がDirtyPieceと玉の位置だけから求まるので、2手以上前の局面から差分計算できる
+		static constexpr bool kMultiPlyUpdatable = true;
+
 		// 特徴量のうち、値が1であるインデックスのリストを取得する
 		static void AppendActiveIndices(const Position& pos, Color perspective,
 			IndexList* active);
 
 		// 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
-		static void AppendChangedIndices(const Position& pos, Color perspective,
+		static void AppendChangedIndices(const Position& pos, const DirtyPiece& dp, Color perspective,
 			IndexList* removed, IndexList* added);
 
 		// 玉の位置とBonaPieceから特徴量のインデックスを求める
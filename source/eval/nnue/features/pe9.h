@@ -29,12 +29,15 @@ class PE9 {
   // 差分計算の代わりに全計算を行うタイミング
   static constexpr TriggerEvent kRefreshTrigger = TriggerEvent::kNone;
 
+  // 差分が利きなど盤面の状態に依存するので、2手以上前の局面からの差分計算はできない
+  static constexpr bool kMultiPlyUpdatable = false;
+
   // 特徴量のうち、値が1であるインデックスのリストを取得する
   static void AppendActiveIndices(const Position& pos, Color perspective,
                                   IndexList* active);
 
   // 特徴量のうち、一手前から値が変化したインデックスのリストを取得する
-  static void AppendChangedIndices(const Position& pos, Color perspective,
+  static void AppendChangedIndices(const Position& pos, const DirtyPiece& dp, Color perspective,
                                    IndexList* removed, IndexList* added);
 
   // BonaPieceと利き数から特徴量のインデックスを求める
@@ -19,7 +19,8 @@ struct alignas(64) Accumulator {
   std::int16_t
       accumulation[2][kRefreshTriggers.size()][kTransformedFeatureDimensions];
   Value score = VALUE_ZERO;
-  bool computed_accumulation = false;
+  // accumulationが計算済みであるか。perspectiveごとに別々に計算される。
+  bool computed_accumulation[2] = {false, false};
   bool computed_score = false;
 };
 
@@ -15,6 +15,7 @@
 #include "nnue_common.h"
 #include "nnue_architecture.h"
 #include "features/index_list.h"
+#include "../../search_stats.h"
 
 #include <algorithm>  // std::clamp
 #include <cstring>  // std::memset()
@@ -122,6 +123,36 @@ static constexpr IndexType kNumRegs = 16;
 
 constexpr IndexType MaxChunkSize = 16;
 
+// Accumulator cache (a.k.a. "Finny table")
+// 玉の升ごとに、最後にその升で計算したaccumulatorと、その時のactiveな特徴量を保持しておくcache。
+// 玉が移動してrefresh_accumulator()が必要になった時に、biasから全計算する代わりに
+// 同じ玉の升で最後に計算したaccumulatorからの差分計算で済ませる。
+// 💡 探索スレッド(Worker)ごとに1つ持つ。評価関数を読み込み直したらclear()すること。
+struct AccumulatorCache {
+
+	struct alignas(kCacheLineSize) Entry {
+		std::int16_t accumulation[kTransformedFeatureDimensions];
+
+		// accumulationに足し込まれている特徴量のindex(昇順に並んでいる)
+		Features::IndexList active_indices;
+
+		// このentryが有効であるか。falseならbias(or 0)から計算し直す。
+		bool valid;
+	};
+
+	// 全entryを無効化する。
+	void clear() {
+		for (auto& per_trigger : entries)
+			for (auto& per_color : per_trigger)
+				for (auto& entry : per_color)
+					entry.valid = false;
+	}
+
+	// entries[trigger][perspective][玉の升]
+	// 💡 玉がいない局面(詰将棋など)では玉の升がSQ_NBになるので、SQ_NB_PLUS1だけ確保しておく。
+	Entry entries[kRefreshTriggers.size()][COLOR_NB][SQ_NB_PLUS1];
+};
+
 // Input feature converter
 // 入力特徴量変換器
 class FeatureTransformer {
@@ -203,24 +234,30 @@ class FeatureTransformer {
 
 	// Proceed with the difference calculation if possible
 	// 可能なら差分計算を進める
+	// 💡 差分計算できるperspectiveだけ計算して、全計算が必要なperspectiveは未計算のまま残す。
+	//     残したperspectiveは、評価値が必要になった時(Transform())に計算される。
+	//     両方のperspectiveが計算済みになったならtrueを返す。
 	bool UpdateAccumulatorIfPossible(const Position& pos) const {
-		const auto now = pos.state();
-		if (now->accumulator.computed_accumulation) {
-			return true;
-		}
-		const auto prev = now->previous;
-		if (prev && prev->accumulator.computed_accumulation) {
-			update_accumulator(pos);
-			return true;
-		}
-		return false;
+		bool computed = true;
+		for (Color perspective : {BLACK, WHITE})
+			computed &= update_accumulator_if_possible(pos, perspective);
+		return computed;
 	}
 
 	// Convert input features
 	// 入力特徴量を変換する
-	void Transform(const Position& pos, OutputType* output, bool refresh) const {
-		if (refresh || !UpdateAccumulatorIfPossible(pos)) {
-			refresh_accumulator(pos);
+	// cache : nullptrでなければ、全計算の代わりにAccumulatorCacheからの差分計算を行う。
+	void Transform(const Position& pos, OutputType* output, bool refresh, AccumulatorCache* cache = nullptr) const {
+		// 手番側から順に、未計算のperspectiveだけを計算する。
+		for (Color perspective : {pos.side_to_move(), ~pos.side_to_move()}) {
+			if (refresh)
+				refresh_accumulator(pos, perspective);
+			else if (!update_accumulator_if_possible(pos, perspective)) {
+				if (cache)
+					refresh_accumulator_with_cache(pos, perspective, *cache);
+				else
+					refresh_accumulator(pos, perspective);
+			}
 		}
 		const auto& accumulation = pos.state()->accumulator.accumulation;
 
@@ -492,116 +529,195 @@ class FeatureTransformer {
 			b[i] = read ? b[i] * 2 : b[i] / 2;
 	}
 
-	// Calculate cumulative value without using difference calculation
-	// 差分計算を用いずに累積値を計算する
-	void refresh_accumulator(const Position& pos) const {
-		auto& accumulator = pos.state()->accumulator;
-		for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
-			Features::IndexList active_indices[2];
-			RawFeatures::AppendActiveIndices(pos, kRefreshTriggers[i], active_indices);
-			for (Color perspective : {BLACK, WHITE}) {
+	// accumulationをtrigger iの初期値(i == 0ならbias、それ以外は0)にする
+	void reset_accumulation(BiasType* accumulation, IndexType i) const {
+		if (i == 0) {
+			std::memcpy(accumulation, biases_, kHalfDimensions * sizeof(BiasType));
+		} else {
+			std::memset(accumulation, 0, kHalfDimensions * sizeof(BiasType));
+		}
+	}
+
+	// accumulationに特徴量indexの重みを足す
+	void add_weights(BiasType* accumulation, IndexType index) const {
+		const IndexType offset = kHalfDimensions * index;
 #if defined(VECTOR)
-				if (i == 0) {
-					std::memcpy(accumulator.accumulation[perspective][i], biases_, kHalfDimensions * sizeof(BiasType));
-				} else {
-					std::memset(accumulator.accumulation[perspective][i], 0, kHalfDimensions * sizeof(BiasType));
-				}
-				for (const auto index : active_indices[perspective]) {
-					const IndexType offset = kHalfDimensions * index;
-					auto accumulation      = reinterpret_cast<vec_t*>(&accumulator.accumulation[perspective][i][0]);
-					auto column            = reinterpret_cast<const vec_t*>(&weights_[offset]);
-					constexpr IndexType kNumChunks = kHalfDimensions / (sizeof(vec_t) / sizeof(BiasType));
-					for (IndexType j = 0; j < kNumChunks; ++j) {
-						accumulation[j] = vec_add_16(accumulation[j], column[j]);
-					}
-				}
+		constexpr IndexType kNumChunks = kHalfDimensions / (sizeof(vec_t) / sizeof(BiasType));
+		auto acc    = reinterpret_cast<vec_t*>(accumulation);
+		auto column = reinterpret_cast<const vec_t*>(&weights_[offset]);
+		for (IndexType j = 0; j < kNumChunks; ++j) {
+			acc[j] = vec_add_16(acc[j], column[j]);
+		}
 #else
-				if (i == 0) {
-					std::memcpy(accumulator.accumulation[perspective][i], biases_, kHalfDimensions * sizeof(BiasType));
-				} else {
-					std::memset(accumulator.accumulation[perspective][i], 0, kHalfDimensions * sizeof(BiasType));
-				}
-				for (const auto index : active_indices[perspective]) {
-					const IndexType offset = kHalfDimensions * index;
+		for (IndexType j = 0; j < kHalfDimensions; ++j) {
+			accumulation[j] += weights_[offset + j];
+		}
+#endif
+	}
 
-					for (IndexType j = 0; j < kHalfDimensions; ++j) {
-						accumulator.accumulation[perspective][i][j] += weights_[offset + j];
-					}
-				}
+	// accumulationから特徴量indexの重みを引く
+	void sub_weights(BiasType* accumulation, IndexType index) const {
+		const IndexType offset = kHalfDimensions * index;
+#if defined(VECTOR)
+		constexpr IndexType kNumChunks = kHalfDimensions / (sizeof(vec_t) / sizeof(BiasType));
+		auto acc    = reinterpret_cast<vec_t*>(accumulation);
+		auto column = reinterpret_cast<const vec_t*>(&weights_[offset]);
+		for (IndexType j = 0; j < kNumChunks; ++j) {
+			acc[j] = vec_sub_16(acc[j], column[j]);
+		}
+#else
+		for (IndexType j = 0; j < kHalfDimensions; ++j) {
+			accumulation[j] -= weights_[offset + j];
+		}
 #endif
+	}
+
+	// Calculate cumulative value without using difference calculation
+	// 差分計算を用いずに、perspective側の累積値を計算する
+	void refresh_accumulator(const Position& pos, Color perspective) const {
+		SEARCH_STATS_INC_CURRENT(AccumulatorRefresh);
+		auto& accumulator = pos.state()->accumulator;
+		for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+			Features::IndexList active_indices;
+			RawFeatures::AppendActiveIndices(pos, kRefreshTriggers[i], perspective, &active_indices);
+			auto accumulation = accumulator.accumulation[perspective][i];
+			reset_accumulation(accumulation, i);
+			for (const auto index : active_indices) {
+				add_weights(accumulation, index);
 			}
 		}
 
-		accumulator.computed_accumulation = true;
+		accumulator.computed_accumulation[perspective] = true;
 		// Stockfishでは fc27d15(2020-09-07) にcomputed_scoreが排除されているので確認
 		accumulator.computed_score = false;
 	}
 
+	// Calculate cumulative value from the accumulator cache
+	// AccumulatorCacheに保存されている、同じ玉の升の時のaccumulatorからの差分計算でperspective側の累積値を計算する
+	void refresh_accumulator_with_cache(const Position& pos, Color perspective, AccumulatorCache& cache) const {
+		SEARCH_STATS_INC_CURRENT(AccumulatorRefresh);
+		auto& accumulator = pos.state()->accumulator;
+		for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+			Features::IndexList active;
+			RawFeatures::AppendActiveIndices(pos, kRefreshTriggers[i], perspective, &active);
+
+			// 敵玉に関する特徴量なら敵玉の升、それ以外は自玉の升をkeyとする。
+			// 📝 keyはcacheのhit率に影響するだけで、計算結果の正しさには影響しない。
+			const Color  king_color = kRefreshTriggers[i] == Features::TriggerEvent::kEnemyKingMoved ? ~perspective : perspective;
+			const Square king_sq    = pos.square<KING>(king_color);
+			ASSERT_LV3(is_ok_plus1(king_sq));
+			auto&        entry      = cache.entries[i][perspective][king_sq];
+
+			std::sort(active.begin(), active.end());
+
+			if (!entry.valid) {
+				reset_accumulation(entry.accumulation, i);
+				entry.active_indices.resize(0);
+				entry.valid = true;
+			}
+
+			// entry.active_indicesとactiveはどちらも昇順なので、mergeの要領で差分を求める。
+			const auto& cached = entry.active_indices;
+			std::size_t a = 0, b = 0;
+			while (a < cached.size() && b < active.size()) {
+				if (cached[a] < active[b])
+					sub_weights(entry.accumulation, cached[a++]);
+				else if (active[b] < cached[a])
+					add_weights(entry.accumulation, active[b++]);
+				else
+					++a, ++b;
+			}
+			while (a < cached.size())
+				sub_weights(entry.accumulation, cached[a++]);
+			while (b < active.size())
+				add_weights(entry.accumulation, active[b++]);
+
+			entry.active_indices = active;
+			std::memcpy(accumulator.accumulation[perspective][i], entry.accumulation,
+			            kHalfDimensions * sizeof(BiasType));
+		}
+
+		accumulator.computed_accumulation[perspective] = true;
+		accumulator.computed_score = false;
+	}
+
 	// Calculate cumulative value using difference calculation
-	// 差分計算を用いて累積値を計算する
-	void update_accumulator(const Position& pos) const {
-		const auto prev_accumulator = pos.state()->previous->accumulator;
-		auto&      accumulator      = pos.state()->accumulator;
+	// 差分計算を用いてperspective側の累積値を計算する
+	// base : 差分計算の起点とする、perspective側のaccumulatorが計算済みの局面。
+	//        pos.state()->previousでなければ、その間の局面のDirtyPieceも順番に適用する。
+	void update_accumulator(const Position& pos, Color perspective, const StateInfo* base) const {
+		const auto& prev_accumulator = base->accumulator;
+		auto&       accumulator      = pos.state()->accumulator;
 		for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
-			Features::IndexList removed_indices[2], added_indices[2];
-			bool                reset[2];
-			RawFeatures::AppendChangedIndices(pos, kRefreshTriggers[i], removed_indices, added_indices, reset);
-			for (Color perspective : {BLACK, WHITE}) {
-#if defined(VECTOR)
-				constexpr IndexType kNumChunks = kHalfDimensions / (sizeof(vec_t) / sizeof(BiasType));
-				auto accumulation              = reinterpret_cast<vec_t*>(&accumulator.accumulation[perspective][i][0]);
-#endif
-				if (reset[perspective]) {
-					if (i == 0) {
-						std::memcpy(accumulator.accumulation[perspective][i], biases_,
-						            kHalfDimensions * sizeof(BiasType));
-					} else {
-						std::memset(accumulator.accumulation[perspective][i], 0, kHalfDimensions * sizeof(BiasType));
-					}
-				} else {
-					// Difference calculation for the feature amount changed from 1 to 0
-					// 1から0に変化した特徴量に関する差分計算
-					std::memcpy(accumulator.accumulation[perspective][i], prev_accumulator.accumulation[perspective][i],
-					            kHalfDimensions * sizeof(BiasType));
-					for (const auto index : removed_indices[perspective]) {
-						const IndexType offset = kHalfDimensions * index;
-#if defined(VECTOR)
-						auto column = reinterpret_cast<const vec_t*>(&weights_[offset]);
-						for (IndexType j = 0; j < kNumChunks; ++j) {
-							accumulation[j] = vec_sub_16(accumulation[j], column[j]);
-						}
-#else
-						for (IndexType j = 0; j < kHalfDimensions; ++j) {
-							accumulator.accumulation[perspective][i][j] -= weights_[offset + j];
-						}
-#endif
-					}
+			auto accumulation = accumulator.accumulation[perspective][i];
+			std::memcpy(accumulation, prev_accumulator.accumulation[perspective][i],
+			            kHalfDimensions * sizeof(BiasType));
+
+			for (auto st = pos.state(); st != base; st = st->previous) {
+				Features::IndexList removed_indices, added_indices;
+				RawFeatures::AppendChangedIndices(pos, st->dirtyPiece, kRefreshTriggers[i], perspective,
+				                                  &removed_indices, &added_indices);
+
+				// Difference calculation for the feature amount changed from 1 to 0
+				// 1から0に変化した特徴量に関する差分計算
+				for (const auto index : removed_indices) {
+					sub_weights(accumulation, index);
 				}
-				{
-					// Difference calculation for features that changed from 0 to 1
-					// 0から1に変化した特徴量に関する差分計算
-					for (const auto index : added_indices[perspective]) {
-						const IndexType offset = kHalfDimensions * index;
-#if defined(VECTOR)
-						auto column = reinterpret_cast<const vec_t*>(&weights_[offset]);
-						for (IndexType j = 0; j < kNumChunks; ++j) {
-							accumulation[j] = vec_add_16(accumulation[j], column[j]);
-						}
-#else
-						for (IndexType j = 0; j < kHalfDimensions; ++j) {
-							accumulator.accumulation[perspective][i][j] += weights_[offset + j];
-						}
-#endif
-					}
+
+				// Difference calculation for features that changed from 0 to 1
+				// 0から1に変化した特徴量に関する差分計算
+				for (const auto index : added_indices) {
+					add_weights(accumulation, index);
 				}
 			}
 		}
 
-		accumulator.computed_accumulation = true;
+		accumulator.computed_accumulation[perspective] = true;
 		// Stockfishでは fc27d15(2020-09-07) にcomputed_scoreが排除されているので確認
 		accumulator.computed_score = false;
 	}
 
+	// perspective側について、可能なら差分計算を進める。
+	// 全計算が必要ならfalseを返す。
+	bool update_accumulator_if_possible(const Position& pos, Color perspective) const {
+		if (pos.state()->accumulator.computed_accumulation[perspective]) {
+			return true;
+		}
+		if (const auto base = find_updatable_ancestor(pos, perspective)) {
+			update_accumulator(pos, perspective, base);
+			return true;
+		}
+		return false;
+	}
+
+	// 遡って、perspective側の差分計算の起点にできる(accumulatorが計算済みの)局面を探す。
+	// 見つからないか、全計算が必要か、差分計算のほうが全計算より高くつきそうならnullptrを返す。
+	// 🌈 直前の局面が未計算(null move、枝刈りなどでevaluate()されなかった)でも、
+	//     さらに遡った局面が計算済みであれば、そこからの差分計算のほうが全計算より安いことが多い。
+	static const StateInfo* find_updatable_ancestor(const Position& pos, Color perspective) {
+		// 全計算のコストは、おおよそactiveな特徴量の数に比例する。
+		// 差分計算のコストは、途中の局面で変化した駒の数×2(removedとadded)に比例する。
+		int budget = int(RawFeatures::kMaxActiveDimensions);
+		for (auto st = pos.state(); st->previous != nullptr; st = st->previous) {
+			const auto& dp = st->dirtyPiece;
+			for (const auto trigger : kRefreshTriggers)
+				if (RawFeatures::IsRefreshRequired(dp, trigger, perspective))
+					return nullptr;
+
+			budget -= 2 * dp.dirty_num;
+			if (budget < 0)
+				return nullptr;
+
+			if (st->previous->accumulator.computed_accumulation[perspective])
+				return st->previous;
+
+			// 差分が盤面の状態に依存する特徴量では、1手前からしか差分計算できない。
+			if constexpr (!RawFeatures::kMultiPlyUpdatable)
+				return nullptr;
+		}
+		return nullptr;
+	}
+
 	// parameter type
 	// パラメータの型
 
@@ -52,6 +52,15 @@ namespace Eval {
 	// 評価関数本体
 	Value evaluate(const Position& pos);
 
+#if defined(EVAL_NNUE)
+	namespace NNUE { struct AccumulatorCache; }
+
+	// 評価関数本体(NNUE用)
+	// 💡 全計算が必要になった時に、探索スレッドごとに持たせたAccumulatorCacheからの差分計算で済ませる。
+	//     cacheがnullptrならevaluate(pos)と同じ。
+	Value evaluate(const Position& pos, NNUE::AccumulatorCache* cache);
+#endif
+
 #if defined(EVAL_KPPT) || defined(EVAL_KPP_KKPT)
 	// 評価関数パラメーターのチェックサムを返す。
 	u64 calc_check_sum();
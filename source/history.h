@@ -241,12 +241,18 @@ using LowPlyHistory = Stats<std::int16_t, 7183, LOW_PLY_HISTORY_SIZE, UINT_16_HI
 // CapturePieceToHistory is addressed by a move's [piece][to][captured piece type]
 // CapturePieceToHistoryは、指し手の [piece][to][captured piece type]で示される。
 
-using CapturePieceToHistory = Stats<std::int16_t, 10692, PIECE_NB, SQUARE_NB, PIECE_TYPE_NB>;
+// 📝 スレッド間で共有できるように(エンジンオプションの"SharedHistoryScope")、atomic版にしてある。
+//     更新はrelaxedなload/storeなので、共有していなければ普通の配列と同じ速度で動く。
+//     共有している時に他のスレッドと同時に更新すると片方の更新が失われることがあるが、historyなので問題ない。
+
+using CapturePieceToHistory = AtomicStats<std::int16_t, 10692, PIECE_NB, SQUARE_NB, PIECE_TYPE_NB>;
 
 // PieceToHistory is like ButterflyHistory but is addressed by a move's [piece][to]
 // PieceToHistoryは、ButterflyHistoryに似たものだが、指し手の[piece][to]で示される。
 
-using PieceToHistory = Stats<std::int16_t, 30000, PIECE_NB, SQUARE_NB>;
+// 📝 CapturePieceToHistoryと同じ理由でatomic版にしてある。
+
+using PieceToHistory = AtomicStats<std::int16_t, 30000, PIECE_NB, SQUARE_NB>;
 
 // ContinuationHistory is the combined history of a given pair of moves, usually
 // the current one given a previous one. The nested history table is based on
@@ -404,6 +410,25 @@ struct SharedHistories {
     size_t sizeMinus1, pawnHistSizeMinus1;
 };
 
+// 🌈 やねうら王独自拡張
+
+// ContinuationHistoryとCapturePieceToHistoryをどの範囲のスレッドで共有するか。
+// エンジンオプションの"SharedHistoryScope"の値。
+enum class HistoryShareScope {
+    Thread,    // 共有しない(スレッドごとに持つ)
+    NumaNode,  // 同じNUMAノードのスレッド間で共有する
+    Global,    // 全スレッドで共有する
+};
+
+// ContinuationHistoryとCapturePieceToHistoryをまとめたもの。
+// 📝 スレッド数が多い時にスレッドごとに持つと、CPUのcacheを圧迫する上に各スレッドの学習が遅い。
+//     そこで、HistoryShareScopeに応じて、複数のスレッドでこれを1つ共有する。
+//     それぞれStatsEntryがatomicなので、複数スレッドから同時に更新して良い。
+struct MoveHistories {
+    ContinuationHistory   continuationHistory[2][2];
+    CapturePieceToHistory captureHistory;
+};
+
 
 } // namespace YaneuraOu
 
@@ -310,7 +310,8 @@ void MateHashEntry::unlock() { mutex = false; }
 // 与えられたboard_keyを持つMateHashEntryの先頭アドレスを返す。
 // (現状、1つしか該当するエントリーはない)
 MateHashEntry* MateHashTable::first_entry(const Key board_key, Color side_to_move) const {
-    uint64_t index = mul_hi64((u64) board_key >> 1, entryCount);
+    // 先後の2つのentryを組にしているので、組の数はentryCount / 2。
+    uint64_t index = mul_hi64((u64) board_key >> 1, entryCount >> 1);
     return &table[(index << 1) | side_to_move];
 }
 
@@ -320,7 +321,8 @@ void MateHashTable::resize(size_t mbSize) {
 
     if (entryCount != size)
     {
-        table      = new MateHashEntry[size];
+        delete[] table;
+        table      = size ? new MateHashEntry[size] : nullptr;
         entryCount = size;
 
         //clear();
@@ -330,7 +332,8 @@ void MateHashTable::resize(size_t mbSize) {
 
 // 置換表のエントリーの全クリア
 void MateHashTable::clear(ThreadPool& threads) {
-    Tools::memclear(threads, "MateHash", table, entryCount * sizeof(MateHashEntry));
+    if (table)
+        Tools::memclear(threads, "MateHash", table, entryCount * sizeof(MateHashEntry));
 }
 
 
@@ -117,15 +117,18 @@ namespace Mate {
 	private:
 		u16 move16;
 		u8  move8;
-		// その時の手番側の手駒(手駒の優越判定に用いる)
-		u32 hand;
 
 		// このentryのlock用
 		// cluster->entries[0].mutexがlockされてたら、entries[1]側もlockされていると解釈する。
+		// 📝 handの前に置かないとpaddingが入って32byteになってしまう。
 		std::atomic<bool> mutex;
 
+		// その時の手番側の手駒(手駒の優越判定に用いる)
+		u32 hand;
+
 		// 以上、16byte
 	};
+	static_assert(sizeof(MateHashEntry) == 16, "MateHashEntry must be 16 bytes.");
 
 	// 詰み探索で用いる置換表本体
 	//
@@ -152,6 +155,8 @@ namespace Mate {
 		// 連続対局の時はクリアしなくともいいような気はするが…。
 		void clear(ThreadPool& threads);
 
+		~MateHashTable() { delete[] table; }
+
 	private:
 		// 置換表の先頭アドレス
 		MateHashEntry* table = nullptr;
@@ -11,6 +11,13 @@
     #include <sys/mman.h>
 #endif
 
+#if !defined(_WIN32)
+    #include <fcntl.h>     // open()
+    #include <sys/mman.h>  // mmap()
+    #include <sys/stat.h>  // fstat()
+    #include <unistd.h>    // close()
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) \
   || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) \
   || defined(__e2k__)
@@ -207,4 +214,135 @@ void aligned_large_pages_free(void* mem) { std_aligned_free(mem); }
 
 #endif
 
+#if !STOCKFISH
+
+// 🌈 やねうら王独自
+// ファイル全体をメモリにmapする。
+// read_only == falseならcopy-on-write、trueなら読み込み専用でmapする。
+
+#if defined(_WIN32)
+
+static void* map_file(const std::string& path, size_t& size, bool read_only) {
+
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(hFile);
+        return nullptr;
+    }
+
+    // PAGE_WRITECOPY + FILE_MAP_COPY でcopy-on-writeになる。
+    HANDLE hMap = CreateFileMappingA(hFile, nullptr, read_only ? PAGE_READONLY : PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(hFile);
+    if (!hMap)
+        return nullptr;
+
+    void* mem = MapViewOfFile(hMap, read_only ? FILE_MAP_READ : FILE_MAP_COPY, 0, 0, 0);
+
+    // 📝 viewが生きている間はmapping objectも解放されないので、ここでhandleを閉じて良い。
+    CloseHandle(hMap);
+    if (!mem)
+        return nullptr;
+
+    size = size_t(fileSize.QuadPart);
+    return mem;
+}
+
+void* map_file_read_write(const std::string& path, size_t size) {
+
+    if (size == 0)
+        return nullptr;
+
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    // mapping objectのサイズを指定すると、ファイルはそのサイズまで拡張される。
+    const uint64_t size64 = uint64_t(size);
+    HANDLE hMap = CreateFileMappingA(hFile, nullptr, PAGE_READWRITE, DWORD(size64 >> 32), DWORD(size64), nullptr);
+    CloseHandle(hFile);
+    if (!hMap)
+        return nullptr;
+
+    void* mem = MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    CloseHandle(hMap);
+    return mem;
+}
+
+void unmap_file(const void* mem, [[maybe_unused]] size_t size) {
+    if (mem)
+        UnmapViewOfFile(mem);
+}
+
+#else
+
+static void* map_file(const std::string& path, size_t& size, bool read_only) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    // MAP_PRIVATEなので、PROT_WRITEでもファイルには書き戻されない。
+    void* mem = read_only ? mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0)
+                          : mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    // 📝 mapしたあとはfdを閉じて良い。
+    close(fd);
+    if (mem == MAP_FAILED)
+        return nullptr;
+
+    size = size_t(st.st_size);
+    return mem;
+}
+
+void* map_file_read_write(const std::string& path, size_t size) {
+
+    if (size == 0)
+        return nullptr;
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return nullptr;
+
+    // 📝 ftruncate()で伸ばした部分はsparseなので、書き込むまでディスクは消費しない。
+    if (ftruncate(fd, off_t(size)) == -1)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return nullptr;
+
+    return mem;
+}
+
+void unmap_file(const void* mem, size_t size) {
+    if (mem)
+        munmap(const_cast<void*>(mem), size);
+}
+
+#endif
+
+void* map_file_private(const std::string& path, size_t& size) { return map_file(path, size, false); }
+
+const void* map_file_read_only(const std::string& path, size_t& size) { return map_file(path, size, true); }
+
+#endif // !STOCKFISH
+
 } // namespace YaneuraOu
@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <memory>
 #include <new>
+#include <string>
 #include <type_traits>
 #include <utility>
 
@@ -65,6 +66,35 @@ void  aligned_large_pages_free(void* mem);
 // 現環境でlarge pagesが使えるか判定して返す。
 bool has_large_pages();
 
+#if !STOCKFISH
+// 🌈 やねうら王独自
+// ファイル全体をcopy-on-writeでメモリにmapする。
+// 書き込みはこのプロセス内でのみ有効で、ファイルには反映されない。
+// ページはアクセスされた時に初めて読み込まれるので、巨大なファイルでもすぐに使い始められる。
+// 💡 pathはそのままopenされる。(起動フォルダ相対にはならない)
+// size : mapしたサイズ(== ファイルサイズ)が返る。
+// 失敗した時はnullptrを返す。
+void* map_file_private(const std::string& path, size_t& size);
+
+// ファイル全体を読み込み専用でメモリにmapする。
+// 同じファイルをmapした他のプロセスとは、OSのpage cacheを共有する。
+// 💡 pathはそのままopenされる。(起動フォルダ相対にはならない)
+// size : mapしたサイズ(== ファイルサイズ)が返る。
+// 失敗した時はnullptrを返す。
+const void* map_file_read_only(const std::string& path, size_t& size);
+
+// pathにsizeバイトのファイルを作成して(すでにあれば作り直す)、読み書き可能でメモリにmapする。
+// 書き込んだ内容はファイルに反映される。OSはこのメモリを必要に応じてファイルに書き出して
+// 物理メモリから追い出せるので、物理メモリより大きな作業領域として使える。
+// 💡 pathはそのままopenされる。(起動フォルダ相対にはならない)
+//     ファイルはunmapしても削除されないので、不要なら呼び出し側で削除すること。
+// 失敗した時はnullptrを返す。
+void* map_file_read_write(const std::string& path, size_t size);
+
+// map_file_private(), map_file_read_only(), map_file_read_write()でmapしたメモリを解放する。mem == nullptrならnop。
+void unmap_file(const void* mem, size_t size);
+#endif
+
 // Frees memory which was placed there with placement new.
 // Works for both single objects and arrays of unknown bound.
 
@@ -672,20 +672,15 @@ namespace Tools {
 			sync_cout << "info string " + string(name_) + " : Start clearing with " << threadCount << " threads , size =  " << size / (1024 * 1024) << "[MB]" << sync_endl;
 
 		// マルチスレッドで並列化してクリアする。
+		// 💡 それぞれのスレッドがhash tableの各パートをゼロ初期化する。
+		//     スレッドはNUMAノードにbindされているので、同じNUMAノードのスレッドが連続した領域を担当するようにする。
+
+		const auto parts = split_by_numa_node(threads, size);
 
 		for (size_t i = 0; i < threadCount; ++i)
 		{
-			threads.run_on_thread(i, [table, size, threadCount, i]() {
-				// それぞれのスレッドがhash tableの各パートをゼロ初期化する。
-				// start  : このスレッドによるゼロクリア開始位置
-				// stride : 各スレッドのゼロクリアするサイズ
-				// len    : このスレッドによるゼロクリアするサイズ。
-				//          strideと等しいが、最後のスレッドだけは端数を考慮し、
-				//			size - start のサイズだけクリアする必要がある。
-				const size_t stride = size / threadCount,
-				start = stride * i,
-				len = (i != threadCount - 1) ? stride : size - start;
-
+			const auto [start, len] = parts[i];
+			threads.run_on_thread(i, [table, start = start, len = len]() {
 				memset((uint8_t*)table + start, 0, len);
 			});
 		}
@@ -705,6 +700,51 @@ namespace Tools {
 
 	}
 
+	std::vector<std::pair<size_t, size_t>> split_by_numa_node(const ThreadPool& threads, size_t size)
+	{
+		const size_t threadCount = threads.num_threads();
+
+		// スレッドがすべて同じNUMAノードにあるなら(NUMAでない環境を含む)、従来通り単純に等分する。
+		// 📝 最後のスレッドだけは端数を考慮し、size - start のサイズを担当する。
+		bool single_node = true;
+		for (size_t i = 1; i < threadCount; ++i)
+			single_node &= threads.get_bound_numa_node(i) == threads.get_bound_numa_node(0);
+
+		if (single_node)
+		{
+			std::vector<std::pair<size_t, size_t>> parts(threadCount);
+			const size_t stride = size / threadCount;
+			for (size_t i = 0; i < threadCount; ++i)
+			{
+				const size_t start = stride * i;
+				parts[i] = { start, (i != threadCount - 1) ? stride : size - start };
+			}
+			return parts;
+		}
+
+		// 同じNUMAノードのスレッドが隣り合うように並べる。(ノード内ではスレッド番号順)
+		std::vector<size_t> order(threadCount);
+		for (size_t i = 0; i < threadCount; ++i)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return threads.get_bound_numa_node(a) < threads.get_bound_numa_node(b);
+		});
+
+		// k番目の境界。2MB(large pageのサイズ)の倍数にalignする。最後の境界だけはsize。
+		constexpr size_t alignment = 2 * 1024 * 1024;
+		auto boundary = [&](size_t k) {
+			return k == threadCount ? size : size_t(u64(size) * k / threadCount) / alignment * alignment;
+		};
+
+		std::vector<std::pair<size_t, size_t>> parts(threadCount);
+		for (size_t k = 0; k < threadCount; ++k)
+		{
+			const size_t start = boundary(k);
+			parts[order[k]] = { start, boundary(k + 1) - start };
+		}
+		return parts;
+	}
+
 	// 途中での終了処理のためのwrapper
 	// コンソールの出力が完了するのを待ちたいので3秒待ってから::exit(EXIT_FAILURE)する。
 	void exit()
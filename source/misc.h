@@ -614,8 +614,18 @@ namespace Tools
 	// nameは"Hash" , "eHash"などクリアしたいものの名前を書く。
 	// メモリクリアの途中経過が出力されるときにその名前(引数nameで渡している)が出力される。
 	// name == nullptrのとき、途中経過は表示しない。
+	// 📝 同じNUMAノードに属するスレッドが連続した領域をクリアするので(split_by_numa_node()を見よ)、
+	//     first touchの原則により、各NUMAノードの実メモリにはテーブルの連続した一部分ずつが割り当てられる。
 	void memclear(YaneuraOu::ThreadPool& threads, const char* name, void* table, size_t size);
 
+	// size[byte]の領域を、threadsの各スレッドが担当する部分に分割する。
+	// 同じNUMAノードに属するスレッドには連続した領域が割り当てられ、NUMAノードごとの領域の大きさは
+	// そのノードのスレッド数に比例する。
+	// 各部分の境界は、large pageがNUMAノードを跨がないように2MBの倍数にalignされる。
+	// 💡 全スレッドが同じNUMAノードにある時(NUMAでない環境を含む)は、従来通りスレッド番号順に等分するだけである。
+	// 返し値[i] : i番目のスレッドの担当する領域の{開始位置, サイズ}
+	std::vector<std::pair<size_t, size_t>> split_by_numa_node(const YaneuraOu::ThreadPool& threads, size_t size);
+
 	// insertion sort
 	// 昇順に並び替える。学習時のコードで使いたい時があるので用意してある。
 	template <typename T >
@@ -2,12 +2,16 @@
 #define PERFT_H_INCLUDED
 
 //#include <cstdint>
+#include <atomic>
+#include <vector>
 
 #include "movegen.h"
 #include "position.h"
 #include "types.h"
 #include "usi.h"
 #include "misc.h"
+#include "memory.h"
+#include "thread.h"
 
 namespace YaneuraOu::Benchmark {
 
@@ -50,10 +54,96 @@ uint64_t perft(Position& pos, Depth depth) {
     return nodes;
 }
 
+#if !STOCKFISH
+
+// 🌈 やねうら王独自拡張
+//     将棋は合流(transposition)が多いので、部分木のnode数を置換表に記録しておき、
+//     同じ局面・同じ残り深さの部分木は数えなおさないようにする。
+//     また、rootの指し手をThreadPoolの各スレッドに割り振って並列に数えあげる。
+
+// perft用の置換表のサイズ[MB]の既定値
+// 📝 通常は"USI_Hash"の値だけ確保する。これは"USI_Hash"のoptionがないエンジンの時に用いる。
+constexpr size_t PERFT_HASH_MB = 256;
+
+// perft用の置換表
+// 📝 lockはせず、keyにdataをxorしたものを格納しておく。(lockless hashing)
+//     他のスレッドと同時に書き込まれて壊れたentryは、keyが一致しなくなるので単にmiss扱いになる。
+struct PerftHashTable {
+
+	struct Entry {
+		std::atomic<u64> key_xor_data;
+		std::atomic<u64> data; // 上位56bitがnode数、下位8bitが残り深さ
+	};
+
+	PerftHashTable(size_t mb) :
+		entry_count(mb * 1024 * 1024 / sizeof(Entry)),
+		table(make_unique_large_page<Entry[]>(entry_count)) {}
+
+	// 局面のkeyと残り深さからentryのkeyを求める。
+	static u64 make_key(Key key, Depth depth) { return u64(key) ^ (u64(depth) * 0x9e3779b97f4a7c15ULL); }
+
+	// 置換表を調べる。hitしたらnodesにnode数を格納してtrueを返す。
+	bool probe(u64 key, Depth depth, uint64_t& nodes) const {
+		const Entry& e = entry(key);
+		const u64 data = e.data.load(std::memory_order_relaxed);
+		if ((e.key_xor_data.load(std::memory_order_relaxed) ^ data) != key || Depth(data & 0xff) != depth)
+			return false;
+		nodes = data >> 8;
+		return true;
+	}
+
+	// 置換表に書き込む。常に上書きする。
+	void store(u64 key, Depth depth, uint64_t nodes) {
+		Entry& e = entry(key);
+		const u64 data = (nodes << 8) | u64(depth);
+		e.data.store(data, std::memory_order_relaxed);
+		e.key_xor_data.store(key ^ data, std::memory_order_relaxed);
+	}
+
+private:
+	Entry& entry(u64 key) const { return table[mul_hi64(key, entry_count)]; }
+
+	size_t              entry_count;
+	LargePagePtr<Entry[]> table;
+};
+
+// 置換表を用いるperft。root以外で用いる。
+// hits : 置換表にhitした回数が加算される。
+inline uint64_t perft(Position& pos, Depth depth, PerftHashTable& tt, uint64_t& hits) {
+
+	// 残り深さ2以下は、置換表を調べるより生成したほうが速い。
+	// 📝 perft<false>()は残り深さ2以上でしか呼び出せない。
+	if (depth <= 2)
+		return depth == 1 ? uint64_t(MoveList<LEGAL_ALL>(pos).size()) : perft<false>(pos, depth);
+
+	const u64 key = PerftHashTable::make_key(pos.key(), depth);
+	uint64_t  nodes;
+	if (tt.probe(key, depth, nodes))
+	{
+		++hits;
+		return nodes;
+	}
+
+	StateInfo st;
+	nodes = 0;
+	for (const auto& m : MoveList<LEGAL_ALL>(pos))
+	{
+		pos.do_move(m, st);
+		nodes += perft(pos, depth - 1, tt, hits);
+		pos.undo_move(m);
+	}
+
+	tt.store(key, depth, nodes);
+	return nodes;
+}
+
+#endif
+
 #if STOCKFISH
 inline uint64_t perft(const std::string& fen, Depth depth , bool isChess960) {
 #else
-inline uint64_t perft(const std::string& fen, Depth depth /*, bool isChess960 */) {
+// hash_mb : perft用の置換表のサイズ[MB]
+inline uint64_t perft(const std::string& fen, Depth depth , ThreadPool& threads , size_t hash_mb /*, bool isChess960 */) {
 
 	ElapsedTimer time;
     time.reset();
@@ -68,10 +158,76 @@ inline uint64_t perft(const std::string& fen, Depth depth /*, bool isChess960 */
 #else
     p.set(fen, &st);
 
+	// 残り深さ1以下なら並列化するまでもない。
+	// また、"isready"前などでスレッドが1つもないなら、従来通りこのスレッドで数える。
+	const size_t thread_num = threads.num_threads();
+	if (depth <= 1 || thread_num == 0)
+	{
+		auto nodes = perft<true>(p, depth);
+		auto elapsed = time.elapsed() + 1;
+
+		sync_cout << "Elapsed Time = " << elapsed << " [ms]" << sync_endl;
+		sync_cout << 1000 * nodes / elapsed << " NPS" << sync_endl;
+
+		return nodes;
+	}
+
+	// rootの指し手ごとの結果
+	struct RootResult {
+		Move     move;
+		uint64_t nodes   = 0;
+		TimePoint elapsed = 0;
+	};
+	std::vector<RootResult> results;
+	for (const auto& m : MoveList<LEGAL_ALL>(p))
+		results.push_back({ Move(m) });
+
+	PerftHashTable tt(hash_mb);
+
+	// 各スレッドは、まだ誰も数えていないrootの指し手を1つずつ取って数える。
+	// 💡 指し手によって部分木の大きさが大きく異なるので、静的に割り振るより負荷が均等になる。
+	std::atomic<size_t> next_move{0};
+	std::atomic<uint64_t> total_hits{0};
+
+	for (size_t i = 0; i < thread_num; ++i)
+		threads.run_on_thread(i, [&]() {
+			Position  pos;
+			StateInfo root_st, st;
+			pos.set(fen, &root_st);
+
+			uint64_t hits = 0;
+			for (size_t j; (j = next_move.fetch_add(1, std::memory_order_relaxed)) < results.size(); )
+			{
+				auto& r = results[j];
+				ElapsedTimer move_time;
+				move_time.reset();
+
+				pos.do_move(r.move, st);
+				r.nodes = perft(pos, depth - 1, tt, hits);
+				pos.undo_move(r.move);
+
+				r.elapsed = move_time.elapsed();
+			}
+			total_hits += hits;
+		});
+
+	for (size_t i = 0; i < thread_num; ++i)
+		threads.wait_on_thread(i);
+
+	// 🌈 rootの指し手ごとに、node数に加えて、それを数えるのに要した時間とNPSも出力する。
+	//     (置換表があるので、後から数えた指し手ほど他の指し手の部分木を再利用できて速くなる)
+	uint64_t nodes = 0;
+	for (const auto& r : results)
+	{
+		nodes += r.nodes;
+		sync_cout << USIEngine::move(r.move) << ": " << r.nodes
+				  << " , " << r.elapsed << " [ms] , " << 1000 * r.nodes / (r.elapsed + 1) << " NPS" << sync_endl;
+	}
+
 	// 🌈 やねうら王では、NPS(leaf nodeの数/elapsed)と計測に要した時間も出力する。
-	auto nodes = perft<true>(p, depth);
     auto elapsed = time.elapsed() + 1; // ゼロ割防止のために +1
 
+	sync_cout << "Threads = " << thread_num << " , Perft Hash = " << hash_mb << " [MB] , hits = " << total_hits << sync_endl;
 	sync_cout << "Elapsed Time = " << elapsed << " [ms]" << sync_endl;
     sync_cout << 1000 * nodes / elapsed << " NPS" << sync_endl;
 
@@ -1731,7 +1731,8 @@ void Position::do_move_impl(Move m, StateInfo& newSt, bool givesCheck, const T*
     st->sum.p[0][0] = VALUE_NOT_EVALUATED;
 #endif
 #if defined(EVAL_NNUE)
-    st->accumulator.computed_accumulation = false;
+    st->accumulator.computed_accumulation[BLACK] = false;
+    st->accumulator.computed_accumulation[WHITE] = false;
     st->accumulator.computed_score        = false;
 #endif
 
@@ -2462,6 +2463,10 @@ void Position::do_null_move(StateInfo& newSt, const T& tt) {
 #if defined(USE_CLASSIC_EVAL) && defined(EVAL_NNUE)
     // NNUEの場合、KPPT型と違って、手番が違う場合、計算なしに済ますわけにはいかない。
     st->accumulator.computed_score = false;
+
+    // 直前の局面のDirtyPieceがコピーされているので、駒が動いていないことにしておく。
+    // 📝 2手以上前の局面からaccumulatorを差分計算する時に、これを二重に適用しないようにするため。
+    st->dirtyPiece.dirty_num = 0;
 #endif
 
 	// このタイミングでアドレスが確定するのでprefetchしたほうが良い。(かも)
@@ -789,7 +789,7 @@ public:
     RepetitionState is_repetition(int ply = 16) const;
 
     // is_repetition()の、千日手が見つかった時に、現局面から何手遡ったかを返すバージョン。
-    // REPETITION_NONEではない時は、found_plyにその値が返ってくる。	// ※　定跡生成の時にしか使わない。
+    // REPETITION_NONEではない時は、found_plyにその値が返ってくる。	// ※　定跡生成とdlshogiのDAGモードで使う。
     RepetitionState is_repetition(int ply, int& found_ply) const;
 
 #if !defined(ENABLE_QUICK_DRAW)
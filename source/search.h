@@ -14,6 +14,7 @@
 #include "numa.h"
 #include "position.h"
 #include "score.h"
+#include "search_stats.h"
 //#include "syzygy/tbprobe.h"
 //#include "timeman.h"
 #include "timeman.h"
@@ -516,6 +517,11 @@ protected:
     // bestMoveChanges : bestMoveが反復深化のなかで変化した回数。📝 派生classのほうで。
     std::atomic<uint64_t> nodes /*, tbHits, bestMoveChanges*/;
 
+#if defined(USE_SEARCH_STATS)
+	// 探索の統計情報。探索部が(自分で)カウントする。"stats"コマンド用。
+	SearchStats::Counters stats;
+#endif
+
 	// 📝 派生class側で。
 #if STOCKFISH
     int selDepth, nmpMinPly;
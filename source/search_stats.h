@@ -0,0 +1,143 @@
+﻿#ifndef SEARCH_STATS_H_INCLUDED
+#define SEARCH_STATS_H_INCLUDED
+
+#include "config.h"
+
+// 探索部の統計情報(USE_SEARCH_STATSがdefineされている時のみ集計する)
+//
+// 📝 探索スレッドごとにcounterを持たせて、自分のcounterだけをインクリメントする。
+//     counterはcache lineの境界にalignしてあるので、他のスレッドのcounterとfalse sharingは起きない。
+//     集計は探索の終了時に、メインスレッドが全スレッドのcounterを足し合わせて行う。
+//
+// 💡 USE_SEARCH_STATSがdefineされていない時は、SEARCH_STATS_INC()などのマクロは空になり、
+//     集計のためのコードは一切生成されない。そのため、探索部のコードに書いたままにしておいて良い。
+
+#if defined(USE_SEARCH_STATS)
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace YaneuraOu::SearchStats {
+
+// 集計する項目
+enum Counter : int {
+	SearchNodes,         // search()の呼び出し回数(qsearch()に移行したものは除く)
+	QSearchNodes,        // qsearch()の呼び出し回数
+	TTProbe,             // search() , qsearch()での置換表のprobe回数
+	TTHit,               // そのうち、置換表にhitした回数
+	TTCutoff,            // search()での置換表の値による枝刈りの回数
+	NullMoveTry,         // null moveを試した回数
+	NullMoveCutoff,      // null moveでbeta cutした回数
+	LmrSearch,           // LMR(深さを減らした探索)の回数
+	LmrResearch,         // LMRがfail highして、元の深さで再探索した回数
+	EvaluateCall,        // evaluate()の呼び出し回数
+	AccumulatorRefresh,  // NNUEのaccumulatorを差分計算できずにrefreshした回数(手番ごとに数える)
+	Mate1plyCall,        // mate_1ply()の呼び出し回数
+	Mate1plyHit,         // そのうち、1手詰めが見つかった回数
+	COUNTER_NB
+};
+
+// 全スレッドのcounterを足し合わせたもの
+struct Totals {
+	std::array<uint64_t, COUNTER_NB> v{};
+
+	uint64_t operator[](Counter c) const { return v[c]; }
+};
+
+// 探索スレッドごとのcounter
+// 💡 alignas(64)なので、sizeofも64の倍数になり、後続のメンバーとcache lineを共有しない。
+struct alignas(64) Counters {
+
+	Counters() { clear(); }
+
+	// counterを1増やす。
+	// 💡 自分のスレッドしか書き込まないので、lock命令を伴うfetch_add()は用いない。
+	void inc(Counter c) {
+		auto& a = v[c];
+		a.store(a.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	void clear() {
+		for (auto& a : v)
+			a.store(0, std::memory_order_relaxed);
+	}
+
+	// totalsにこのcounterの値を足し込む。
+	void add_to(Totals& totals) const {
+		for (int i = 0; i < COUNTER_NB; ++i)
+			totals.v[i] += v[i].load(std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> v[COUNTER_NB];
+};
+
+// 現在のスレッドのcounter。探索スレッドが探索開始時に自分のcounterを設定する。
+// 💡 評価関数の内部など、Workerを参照できないところから数えるのに用いる。
+//     探索スレッド以外ではnullptrのままなので数えない。
+inline thread_local Counters* current = nullptr;
+
+// 割合を[%]で返す。
+inline double percent(uint64_t a, uint64_t b) { return b ? 100.0 * a / b : 0.0; }
+
+// 集計結果を"stats"コマンド用に複数行の文字列にする。
+inline std::string to_string(const Totals& t) {
+	std::ostringstream ss;
+	ss << std::fixed << std::setprecision(2);
+
+	const uint64_t nodes = t[SearchNodes] + t[QSearchNodes];
+	ss << "search nodes    : " << t[SearchNodes] << '\n'
+	   << "qsearch nodes   : " << t[QSearchNodes] << " (" << percent(t[QSearchNodes], nodes) << "% of all nodes)\n"
+	   << "tt              : probes = " << t[TTProbe]
+	   << " , hits = " << t[TTHit] << " (" << percent(t[TTHit], t[TTProbe]) << "%)"
+	   << " , cutoffs = " << t[TTCutoff] << " (" << percent(t[TTCutoff], t[SearchNodes]) << "% of search nodes)\n"
+	   << "null move       : tries = " << t[NullMoveTry]
+	   << " , cutoffs = " << t[NullMoveCutoff] << " (" << percent(t[NullMoveCutoff], t[NullMoveTry]) << "%)\n"
+	   << "lmr             : searches = " << t[LmrSearch]
+	   << " , re-searches = " << t[LmrResearch] << " (" << percent(t[LmrResearch], t[LmrSearch]) << "%)\n"
+	   << "evaluate        : calls = " << t[EvaluateCall]
+	   << " , accumulator refreshes = " << t[AccumulatorRefresh] << " (" << percent(t[AccumulatorRefresh], t[EvaluateCall]) << "% of calls)\n"
+	   << "mate_1ply       : calls = " << t[Mate1plyCall]
+	   << " , hits = " << t[Mate1plyHit] << " (" << percent(t[Mate1plyHit], t[Mate1plyCall]) << "%)";
+	return ss.str();
+}
+
+// 集計結果を反復深化ごとの"info string"用に1行の文字列にする。
+inline std::string to_short_string(const Totals& t) {
+	std::ostringstream ss;
+	ss << std::fixed << std::setprecision(1);
+
+	ss << "qsearch " << percent(t[QSearchNodes], t[SearchNodes] + t[QSearchNodes]) << "%"
+	   << " tthit " << percent(t[TTHit], t[TTProbe]) << "%"
+	   << " ttcut " << percent(t[TTCutoff], t[SearchNodes]) << "%"
+	   << " nullcut " << percent(t[NullMoveCutoff], t[NullMoveTry]) << "%"
+	   << " lmr_re " << percent(t[LmrResearch], t[LmrSearch]) << "%"
+	   << " eval " << t[EvaluateCall]
+	   << " refresh " << t[AccumulatorRefresh]
+	   << " mate1ply " << t[Mate1plyHit] << "/" << t[Mate1plyCall];
+	return ss.str();
+}
+
+} // namespace YaneuraOu::SearchStats
+
+// countersのcounterを1増やす。
+#define SEARCH_STATS_INC(counters, counter) (counters).inc(YaneuraOu::SearchStats::counter)
+
+// 現在のスレッドのcounterを1増やす。(探索スレッド以外では何もしない)
+#define SEARCH_STATS_INC_CURRENT(counter)                                             \
+	do {                                                                              \
+		if (auto* search_stats_ = YaneuraOu::SearchStats::current)                    \
+			search_stats_->inc(YaneuraOu::SearchStats::counter);                      \
+	} while (false)
+
+#else
+
+#define SEARCH_STATS_INC(counters, counter) ((void)0)
+#define SEARCH_STATS_INC_CURRENT(counter) ((void)0)
+
+#endif // defined(USE_SEARCH_STATS)
+
+#endif // #ifndef SEARCH_STATS_H_INCLUDED
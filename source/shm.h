@@ -614,6 +614,162 @@ struct SystemWideSharedConstant {
     std::variant<std::monostate, SharedMemoryBackend<T>, SharedMemoryBackendFallback<T>> backend;
 };
 
+#if !STOCKFISH
+
+// 🌈 やねうら王独自
+// システム全体で共有される、書き込み可能なメモリ領域。
+// 同じnameとsizeで確保したプロセス同士は、同じ領域を共有する。
+// 📝 SystemWideSharedConstantとは異なり、中身は実行時にサイズが決まるbyte列であり、
+//     各プロセスから書き換えられる。(置換表を複数プロセスで共有するために用いる)
+//     新規に作成された領域はゼロクリアされている。
+//     共有メモリが使えない環境では確保に失敗する(is_valid() == falseになる)ので、
+//     呼び出し側でプロセスローカルなメモリにfallbackすること。
+class SystemWideSharedBuffer {
+   public:
+    SystemWideSharedBuffer() = default;
+
+    SystemWideSharedBuffer(const std::string& name, size_t size) {
+        // 実行ファイルが異なれば、構造の異なるデータであるかも知れないので共有しない。
+        char buf[1024];
+        std::snprintf(buf, sizeof(buf), "Local\\yo_%s$%zu$%zu", name.c_str(), size,
+                      std::size_t(hash_string(getExecutablePathHash())));
+        std::string shm_name = buf;
+
+    #if defined(_WIN32)
+        initialize_windows(shm_name, size);
+    #elif defined(__linux__) && !defined(__ANDROID__)
+        // POSIX shared memory names must start with a slash
+        char hash_buf[64];
+        std::snprintf(hash_buf, sizeof(hash_buf), "/yo_%016" PRIx64, hash_string(shm_name));
+        shm1.emplace(hash_buf, size);
+        if (!shm1->open(0))
+        {
+            shm1.reset();
+            error_message = "Failed to open shared memory";
+        }
+    #else
+        error_message = "Shared memory not supported by the OS.";
+    #endif
+    }
+
+    ~SystemWideSharedBuffer() { cleanup(); }
+
+    SystemWideSharedBuffer(const SystemWideSharedBuffer&)            = delete;
+    SystemWideSharedBuffer& operator=(const SystemWideSharedBuffer&) = delete;
+
+    SystemWideSharedBuffer(SystemWideSharedBuffer&& other) noexcept { *this = std::move(other); }
+
+    SystemWideSharedBuffer& operator=(SystemWideSharedBuffer&& other) noexcept {
+        if (this != &other)
+        {
+            cleanup();
+    #if defined(_WIN32)
+            pMap     = other.pMap;
+            hMapFile = other.hMapFile;
+            reused   = other.reused;
+
+            other.pMap     = nullptr;
+            other.hMapFile = 0;
+    #elif defined(__linux__) && !defined(__ANDROID__)
+            shm1 = std::move(other.shm1);
+            other.shm1.reset();
+    #endif
+            error_message = std::move(other.error_message);
+        }
+        return *this;
+    }
+
+    // 共有メモリの先頭。確保に失敗していればnullptr。
+    void* get() const {
+    #if defined(_WIN32)
+        return pMap;
+    #elif defined(__linux__) && !defined(__ANDROID__)
+        return shm1 ? static_cast<void*>(shm1->data()) : nullptr;
+    #else
+        return nullptr;
+    #endif
+    }
+
+    bool is_valid() const { return get() != nullptr; }
+
+    // 他のプロセスがすでに作成していた領域を開いたのか。
+    // 💡 trueなら、他のプロセスが書き込んだ内容が入っているので、ゼロクリアしてはならない。
+    bool reused_existing() const {
+    #if defined(_WIN32)
+        return pMap && reused;
+    #elif defined(__linux__) && !defined(__ANDROID__)
+        return shm1 && shm1->reused_existing();
+    #else
+        return false;
+    #endif
+    }
+
+    std::optional<std::string> get_error_message() const {
+        if (is_valid())
+            return std::nullopt;
+        return error_message.empty() ? "Not initialized" : error_message;
+    }
+
+   private:
+    #if defined(_WIN32)
+    void initialize_windows(const std::string& shm_name, size_t size) {
+        #if defined(_WIN64)
+        const DWORD size_low  = DWORD(size & 0xFFFFFFFFu);
+        const DWORD size_high = DWORD(size >> 32u);
+        #else
+        const DWORD size_low  = DWORD(size);
+        const DWORD size_high = 0;
+        #endif
+
+        // 📝 名前付きのfile mappingはkernelが参照カウントを持っているので、
+        //     最後のプロセスが閉じた時に自動的に解放される。
+        hMapFile = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, size_high,
+                                      size_low, shm_name.c_str());
+        if (!hMapFile)
+        {
+            error_message = "Failed to create file mapping: " + GetLastErrorAsString(GetLastError());
+            return;
+        }
+        reused = GetLastError() == ERROR_ALREADY_EXISTS;
+
+        pMap = MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (!pMap)
+        {
+            error_message = "Failed to map view: " + GetLastErrorAsString(GetLastError());
+            cleanup();
+        }
+    }
+    #endif
+
+    void cleanup() {
+    #if defined(_WIN32)
+        if (pMap)
+        {
+            UnmapViewOfFile(pMap);
+            pMap = nullptr;
+        }
+        if (hMapFile)
+        {
+            CloseHandle(hMapFile);
+            hMapFile = 0;
+        }
+    #elif defined(__linux__) && !defined(__ANDROID__)
+        shm1.reset();
+    #endif
+    }
+
+    #if defined(_WIN32)
+    void*  pMap     = nullptr;
+    HANDLE hMapFile = 0;
+    bool   reused   = false;
+    #elif defined(__linux__) && !defined(__ANDROID__)
+    std::optional<shm::SharedMemory<char>> shm1;
+    #endif
+    std::string error_message;
+};
+
+#endif  // !STOCKFISH
+
 
 }  // namespace YaneuraOu
 
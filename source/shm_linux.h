@@ -176,6 +176,9 @@ class SharedMemory: public detail::SharedMemoryBase {
     std::string        sentinel_path_;
 #if !STOCKFISH
     bool               reused_existing_ = false;
+
+    // 🌈 データ部のサイズ。通常はsizeof(T)。
+    size_t             data_size_       = sizeof(T);
 #endif
 
     static constexpr size_t calculate_total_size() noexcept {
@@ -196,6 +199,19 @@ class SharedMemory: public detail::SharedMemoryBase {
         total_size_(calculate_total_size()),
         sentinel_base_(make_sentinel_base(name)) {}
 
+#if !STOCKFISH
+    // 🌈 やねうら王独自
+    // データ部としてsizeof(T)ではなくdata_size[byte]を確保する。
+    // 置換表のような、実行時にサイズが決まる書き込み可能な領域を共有するために用いる。
+    // 📝 新規に作成された領域はゼロクリアされている。(ftruncate()の仕様)
+    SharedMemory(const std::string& name, size_t data_size) noexcept :
+        name_(name),
+        sentinel_base_(make_sentinel_base(name)),
+        data_size_(align_header_offset(data_size)) {
+        total_size_ = data_size_ + sizeof(detail::ShmHeader);
+    }
+#endif
+
     ~SharedMemory() noexcept override {
         detail::SharedMemoryRegistry::unregister_instance(this);
         close();
@@ -215,7 +231,8 @@ class SharedMemory: public detail::SharedMemoryBase {
         sentinel_path_(std::move(other.sentinel_path_))
 #if !STOCKFISH
         ,
-        reused_existing_(other.reused_existing_)
+        reused_existing_(other.reused_existing_),
+        data_size_(other.data_size_)
 #endif
     {
 
@@ -240,6 +257,7 @@ class SharedMemory: public detail::SharedMemoryBase {
             sentinel_path_ = std::move(other.sentinel_path_);
 #if !STOCKFISH
             reused_existing_ = other.reused_existing_;
+            data_size_       = other.data_size_;
 #endif
 
             detail::SharedMemoryRegistry::unregister_instance(&other);
@@ -403,6 +421,9 @@ class SharedMemory: public detail::SharedMemoryBase {
 
 #if !STOCKFISH
     [[nodiscard]] bool reused_existing() const noexcept { return is_open() && reused_existing_; }
+
+    // 🌈 書き込み可能なデータ部の先頭。
+    [[nodiscard]] T* data() const noexcept { return data_ptr_; }
 #endif
 
     [[nodiscard]] uint32_t ref_count() const noexcept {
@@ -416,6 +437,18 @@ class SharedMemory: public detail::SharedMemoryBase {
     static void cleanup_all_instances() noexcept { detail::SharedMemoryRegistry::cleanup_all(); }
 
    private:
+#if !STOCKFISH
+    // ShmHeaderをデータ部の直後に置くので、その位置をShmHeaderのalignmentに揃える。
+    static size_t align_header_offset(size_t size) noexcept {
+        constexpr size_t align = alignof(detail::ShmHeader);
+        return (size + align - 1) / align * align;
+    }
+
+    size_t header_offset() const noexcept { return data_size_; }
+#else
+    static constexpr size_t header_offset() noexcept { return sizeof(T); }
+#endif
+
     void reset() noexcept {
         fd_         = -1;
         mapped_ptr_ = nullptr;
@@ -632,7 +665,7 @@ class SharedMemory: public detail::SharedMemoryBase {
 
         data_ptr_ = static_cast<T*>(mapped_ptr_);
         header_ptr_ =
-          reinterpret_cast<detail::ShmHeader*>(static_cast<char*>(mapped_ptr_) + sizeof(T));
+          reinterpret_cast<detail::ShmHeader*>(static_cast<char*>(mapped_ptr_) + header_offset());
 
         new (header_ptr_) detail::ShmHeader{};
         new (data_ptr_) T{initial_value};
@@ -665,7 +698,7 @@ class SharedMemory: public detail::SharedMemoryBase {
 
         data_ptr_   = static_cast<T*>(mapped_ptr_);
         header_ptr_ = std::launder(
-          reinterpret_cast<detail::ShmHeader*>(static_cast<char*>(mapped_ptr_) + sizeof(T)));
+          reinterpret_cast<detail::ShmHeader*>(static_cast<char*>(mapped_ptr_) + header_offset()));
 
         if (!header_ptr_->initialized.load(std::memory_order_acquire)
             || header_ptr_->magic != detail::ShmHeader::SHM_MAGIC)
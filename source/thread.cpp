@@ -166,6 +166,15 @@ void Thread::idle_loop() {
 //Search::SearchManager* ThreadPool::main_manager() { return main_thread()->worker->main_manager(); }
 
 uint64_t ThreadPool::nodes_searched() const { return accumulate(&Search::Worker::nodes); }
+
+#if defined(USE_SEARCH_STATS)
+SearchStats::Totals ThreadPool::search_stats() const {
+    SearchStats::Totals totals;
+    for (auto&& th : threads)
+        th->worker->stats.add_to(totals);
+    return totals;
+}
+#endif
 //uint64_t ThreadPool::tb_hits() const { return accumulate(&Search::Worker::tbHits); }
 
 static size_t next_power_of_two(uint64_t count) { return count > 1 ? (2ULL << msb(count - 1)) : 1; }
@@ -503,6 +512,9 @@ void ThreadPool::start_thinking(const OptionsMap&  options,
 
             th->worker->limits = limits;
             th->worker->nodes  = 0;
+#if defined(USE_SEARCH_STATS)
+            th->worker->stats.clear();
+#endif
 #endif
 
 			// 📝 tbHits、tbConfigは将棋では使わない。
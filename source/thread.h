@@ -269,6 +269,11 @@ public:
     // 　dlshogi::nodes_visited()を呼び出すこと。
     uint64_t nodes_searched() const;
 
+#if defined(USE_SEARCH_STATS)
+	// 今回、goコマンド以降の全スレッドの探索の統計情報を足し合わせたもの
+	SearchStats::Totals search_stats() const;
+#endif
+
 #if STOCKFISH
 	// 💡 tablebaseにhitした回数。将棋では使わない。
 	uint64_t               tb_hits() const;
@@ -289,6 +294,11 @@ public:
 
 	std::vector<size_t> get_bound_thread_count_by_numa_node() const;
 
+	// 🌈 threadIdのスレッドがbindされているNUMAノード。bindされていなければ0。
+	NumaIndex get_bound_numa_node(size_t threadId) const {
+		return threadId < boundThreadToNumaNode.size() ? boundThreadToNumaNode[threadId] : 0;
+	}
+
 	// 評価関数パラメーターがいま実行しているNUMAに配置されているようにする。
 	void ensure_network_replicated();
 
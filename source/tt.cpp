@@ -1,10 +1,16 @@
 ﻿#include "tt.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <vector>
 //#include <thread>
 //#include <vector>
 
@@ -249,6 +255,17 @@ struct Cluster {
 // static_assert(sizeof(Cluster) == 32, "Suboptimal Cluster size");
 static_assert((sizeof(Cluster) % 32) == 0, "Unexpected Cluster size");
 
+// 共有メモリ上の置換表の先頭に置くヘッダー。(SharedHash用)
+// 💡 後ろに続くtableがcache line境界から始まるように、TT_SHARED_HEADER_SIZEまでpaddingする。
+struct TTSharedHeader {
+	// 共有している全プロセスで共通の世代カウンター。
+	// 📝 新規に作成された共有メモリはゼロクリアされているので、0から始まる。
+	std::atomic<uint8_t> generation8;
+};
+static constexpr size_t TT_SHARED_HEADER_SIZE = 64;
+static_assert(sizeof(TTSharedHeader) <= TT_SHARED_HEADER_SIZE);
+static_assert(std::atomic<uint8_t>::is_always_lock_free, "the shared generation counter must be lock-free.");
+
 // Sets the size of the transposition table,
 // measured in megabytes. Transposition table consists
 // of clusters and each cluster consists of ClusterSize number of TTEntry.
@@ -257,7 +274,7 @@ static_assert((sizeof(Cluster) % 32) == 0, "Unexpected Cluster size");
 // トランスポジションテーブルはクラスターで構成されており、
 // 各クラスターはClusterSize個のTTEntryで構成されます。
 
-void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
+void TranspositionTable::resize(size_t mbSize, ThreadPool& threads, bool shared) {
 #if STOCKFISH
     aligned_large_pages_free(table);
 
@@ -280,12 +297,34 @@ void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
 	// Stockfishのコード、問答無用で確保しなおしてゼロクリアしているが、
 	// ゼロクリアの時間も馬鹿にならないのであまり良いとは言い難い。
 
-	if (newClusterCount == clusterCount)
+	if (newClusterCount == clusterCount && shared == sharedRequested)
 		return;
 
-	aligned_large_pages_free(table);
+	free_table();
+
+	clusterCount    = newClusterCount;
+	sharedRequested = shared;
 
-	clusterCount = newClusterCount;
+	if (shared)
+	{
+		// 📝 Clusterの構造が異なれば共有できないので、それを決める値を名前に含めておく。
+		//     サイズはSystemWideSharedBufferの側で名前に含まれる。
+		const std::string name = "tt_" + std::to_string(TT_CLUSTER_SIZE) + "_" + std::to_string(HASH_KEY_BITS);
+
+		// 📝 共有メモリの先頭に世代カウンター(TTSharedHeader)を置き、その後ろにtableを置く。
+		sharedTable = SystemWideSharedBuffer(name, TT_SHARED_HEADER_SIZE + clusterCount * sizeof(Cluster));
+		if (sharedTable.is_valid())
+		{
+			auto* mem        = static_cast<u8*>(sharedTable.get());
+			sharedGeneration = &reinterpret_cast<TTSharedHeader*>(mem)->generation8;
+			table            = reinterpret_cast<Cluster*>(mem + TT_SHARED_HEADER_SIZE);
+			sync_cout << "info string Shared hash " << (sharedTable.reused_existing() ? "attached." : "created.") << sync_endl;
+			return;
+		}
+
+		sync_cout << "info string Failed to allocate shared hash : " << sharedTable.get_error_message().value_or("")
+			<< " , local memory is used instead." << sync_endl;
+	}
 #endif
 
 	// tableはCacheLineSizeでalignされたメモリに配置したいので、CacheLineSize-1だけ余分に確保する。
@@ -325,6 +364,12 @@ void TranspositionTable::clear(ThreadPool& threads) {
 
 	generation8 = 0;
 
+	// 共有メモリ上の置換表は、他のプロセスが探索に使っているのでクリアしない。
+	// 世代カウンターも他のプロセスと共有しているので、リセットしない。
+	// 📝 新規に作成された共有メモリはゼロクリアされている。
+	if (sharedTable.is_valid())
+		return;
+
 	// Stockfishのコード
 #if 0
 	const size_t threadCount = threads.num_threads();
@@ -361,17 +406,26 @@ void TranspositionTable::clear(ThreadPool& threads) {
 // maxAgeより若いエントリのみをカウントします。
 
 int TranspositionTable::hashfull(int maxAge) const {
+	const uint8_t generation = current_generation();
 	int cnt = 0;
 	for (int i = 0; i < 1000; ++i)
 		for (int j = 0; j < ClusterSize; ++j)
 			cnt += table[i].entry[j].is_occupied()
-			&& table[i].entry[j].relative_age(generation8) <= maxAge;
+			&& table[i].entry[j].relative_age(generation) <= maxAge;
 
 	return cnt / ClusterSize;
 }
 
 void TranspositionTable::new_search() {
 
+	if (sharedGeneration)
+	{
+		// 📝 共有している他のプロセスと同時に加算しても失われないようにfetch_add()で加算する。
+		//     GENERATION_MASKでwrap aroundさせるのは読み出す側(current_generation())で行う。
+		sharedGeneration->fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
 	++generation8;
 
 	// Don't overflow into the other bits of TTEntry::genBound8
@@ -380,7 +434,12 @@ void TranspositionTable::new_search() {
 }
 
 
-uint8_t TranspositionTable::generation() const { return generation8; }
+uint8_t TranspositionTable::generation() const { return current_generation(); }
+
+uint8_t TranspositionTable::current_generation() const {
+	return sharedGeneration ? uint8_t(sharedGeneration->load(std::memory_order_relaxed) & GENERATION_MASK)
+	                        : generation8;
+}
 
 // Looks up the current position in the transposition table.
 // It returns true if the key is found (which may be a collision), and has non-null data.
@@ -435,10 +494,11 @@ std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key, cons
 	// Find an entry to be replaced according to the replacement strategy
 	// 置換戦略に従って、置き換えるエントリを見つけます
 
+	const uint8_t generation = current_generation();
 	TTEntry* replace = tte;
 	for (int i = 1; i < ClusterSize; ++i)
-		if (replace->depth8 - 8 * replace->relative_age(generation8)
-			> tte[i].depth8 - 8 * tte[i].relative_age(generation8))
+		if (replace->depth8 - 8 * replace->relative_age(generation)
+			> tte[i].depth8 - 8 * tte[i].relative_age(generation))
 			replace = &tte[i];
 
 	return { false,
@@ -486,6 +546,230 @@ TTEntry* TranspositionTable::first_entry(const Key& key_, Color side_to_move) co
 #endif
 }
 
+// ----------------------------------
+//		NUMAノード間のlatencyの計測
+// ----------------------------------
+
+std::string TranspositionTable::numa_latency_bench(ThreadPool& threads, uint64_t probes) const {
+
+	const size_t size  = clusterCount * sizeof(Cluster);
+	const auto   parts = Tools::split_by_numa_node(threads, size);
+
+	// 各NUMAノードに割り当てられている領域と、そのノードで計測に用いるスレッド。
+	// 📝 split_by_numa_node()は同じノードのスレッドに連続した領域を割り当てるので、
+	//     ノードごとの領域は、そのノードのスレッドの担当する領域を合わせたものになる。
+	struct NodeInfo {
+		size_t begin = SIZE_MAX, end = 0;
+		size_t threadId = SIZE_MAX;
+	};
+	std::vector<NodeInfo> nodes;
+	for (size_t i = 0; i < threads.num_threads(); ++i)
+	{
+		const NumaIndex n = threads.get_bound_numa_node(i);
+		if (nodes.size() <= n)
+			nodes.resize(n + 1);
+		auto& node    = nodes[n];
+		node.threadId = std::min(node.threadId, i);
+		if (parts[i].second)
+		{
+			node.begin = std::min(node.begin, parts[i].first);
+			node.end   = std::max(node.end, parts[i].first + parts[i].second);
+		}
+	}
+
+	// latency[m][n] : NUMAノードmのスレッドから、NUMAノードnの領域へのアクセス1回あたりの時間[ns]
+	std::vector<std::vector<double>> latency(nodes.size(), std::vector<double>(nodes.size(), 0));
+
+	for (size_t m = 0; m < nodes.size(); ++m)
+	{
+		if (nodes[m].threadId == SIZE_MAX)
+			continue;
+
+		threads.run_on_thread(nodes[m].threadId, [&, m]() {
+			for (size_t n = 0; n < nodes.size(); ++n)
+			{
+				if (nodes[n].begin >= nodes[n].end)
+					continue;
+
+				const u8*    base  = reinterpret_cast<const u8*>(table) + nodes[n].begin;
+				const size_t lines = (nodes[n].end - nodes[n].begin) / 64;
+
+				// 読み出した値を次のアドレスの計算に混ぜることで、アクセス同士に依存関係を作り、
+				// CPUがアクセスを並列に発行できないようにする。
+				u64        x     = 0x9E3779B97F4A7C15ULL + n;
+				const auto start = std::chrono::steady_clock::now();
+				for (u64 i = 0; i < probes; ++i)
+				{
+					x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+					x += *reinterpret_cast<const volatile u8*>(base + mul_hi64(x, lines) * 64);
+				}
+				const auto elapsed = std::chrono::steady_clock::now() - start;
+
+				latency[m][n] =
+				  double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / std::max(probes, u64(1));
+			}
+		});
+		threads.wait_on_thread(nodes[m].threadId);
+	}
+
+	std::ostringstream ss;
+	ss << "TT probe latency [ns] , size = " << size / (1024 * 1024) << "[MB] , probes = " << probes;
+	for (size_t m = 0; m < nodes.size(); ++m)
+	{
+		if (nodes[m].threadId == SIZE_MAX)
+			continue;
+
+		ss << "\nfrom node " << m << " :";
+		for (size_t n = 0; n < nodes.size(); ++n)
+			if (nodes[n].begin < nodes[n].end)
+				ss << " node " << n << (m == n ? "(local) = " : "(remote) = ") << std::fixed
+				   << std::setprecision(1) << latency[m][n];
+	}
+	return ss.str();
+}
+
+// ----------------------------------
+//		置換表の保存と読み込み
+// ----------------------------------
+
+// 置換表ファイルのヘッダー。
+// 📝 置換表の構造が異なるビルドで読み込めてしまわないように、構造を決める値を記録しておく。
+struct TTFileHeader {
+	char     magic[8];       // TT_FILE_MAGIC
+	uint64_t clusterCount;   // Clusterの数
+	uint32_t clusterSize;    // TT_CLUSTER_SIZE
+	uint32_t hashKeyBits;    // HASH_KEY_BITS
+	uint32_t sizeofCluster;  // sizeof(Cluster)
+	uint8_t  generation8;    // 保存した時の世代カウンター
+};
+
+static constexpr char TT_FILE_MAGIC[8] = {'Y', 'O', 'T', 'T', '0', '0', '0', '1'};
+
+// ファイル上でヘッダーが占めるサイズ。
+// 💡 mapした時にtableがpage境界(= cache line境界)から始まるように、ヘッダーはpage sizeまでpaddingして書き出す。
+static constexpr size_t TT_FILE_HEADER_SIZE = 4096;
+static_assert(sizeof(TTFileHeader) <= TT_FILE_HEADER_SIZE);
+
+void TranspositionTable::free_table() {
+	if (sharedTable.is_valid())
+	{
+		// 📝 最後のプロセスが手放した時に共有メモリは解放される。
+		sharedTable      = SystemWideSharedBuffer();
+		sharedGeneration = nullptr;
+	}
+	else if (mappedMem)
+	{
+		unmap_file(mappedMem, mappedSize);
+		mappedMem  = nullptr;
+		mappedSize = 0;
+	}
+	else
+		aligned_large_pages_free(table);
+
+	table = nullptr;
+}
+
+Tools::Result TranspositionTable::save(const std::string& filename) const {
+
+	if (!table)
+		return Tools::Result(Tools::ResultCode::MemoryAllocationError);
+
+	// 📝 一時ファイルに書き出してからrenameする。
+	//     load()でmapしている元のファイルに上書きすると、mapしている内容が壊れるため。
+	const std::string tmp_filename = filename + ".tmp";
+	const std::string path         = Path::Combine(Directory::GetBinaryFolder(), filename);
+	const std::string tmp_path     = Path::Combine(Directory::GetBinaryFolder(), tmp_filename);
+
+	// 一時ファイルに書き出す。
+	// 💡 writerはこのlambdaを抜ける時にcloseされるので、失敗した時でもその後に一時ファイルを削除できる。
+	auto write_tmp = [&]() -> Tools::Result {
+		SystemIO::BinaryWriter writer;
+		if (writer.Open(tmp_filename).is_not_ok())
+			return Tools::Result(Tools::ResultCode::FileOpenError);
+
+		char header_buf[TT_FILE_HEADER_SIZE] = {};
+		TTFileHeader header;
+		std::memcpy(header.magic, TT_FILE_MAGIC, sizeof(header.magic));
+		header.clusterCount  = clusterCount;
+		header.clusterSize   = TT_CLUSTER_SIZE;
+		header.hashKeyBits   = HASH_KEY_BITS;
+		header.sizeofCluster = sizeof(Cluster);
+		header.generation8   = current_generation();
+		std::memcpy(header_buf, &header, sizeof(header));
+
+		if (writer.Write(header_buf, sizeof(header_buf)).is_not_ok())
+			return Tools::Result(Tools::ResultCode::FileWriteError);
+
+		// BinaryWriter::Write()は2GB制限があるので分割して書き出す。
+		constexpr size_t chunk = size_t(1) << 30;
+		const size_t     size  = clusterCount * sizeof(Cluster);
+		for (size_t pos = 0; pos < size; pos += chunk)
+			if (writer.Write(reinterpret_cast<u8*>(table) + pos, std::min(chunk, size - pos)).is_not_ok())
+				return Tools::Result(Tools::ResultCode::FileWriteError);
+
+		return writer.Close().is_ok() ? Tools::Result::Ok()
+		                              : Tools::Result(Tools::ResultCode::FileCloseError);
+	};
+
+	// ⚠ 書き出しに失敗した時は、中途半端な一時ファイルを残さないように削除しておく。
+	if (auto result = write_tmp(); result.is_not_ok())
+	{
+		std::remove(tmp_path.c_str());
+		return result;
+	}
+
+#if defined(_WIN32)
+	// Windowsのrename()は既存のファイルを置き換えないので先に消しておく。
+	std::remove(path.c_str());
+#endif
+	if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+	{
+		std::remove(tmp_path.c_str());
+		return Tools::Result(Tools::ResultCode::FileWriteError);
+	}
+
+	return Tools::Result::Ok();
+}
+
+Tools::Result TranspositionTable::load(const std::string& filename) {
+
+	const std::string path = Path::Combine(Directory::GetBinaryFolder(), filename);
+
+	size_t size = 0;
+	void*  mem  = map_file_private(path, size);
+	if (!mem)
+		return Tools::Result(Tools::ResultCode::FileOpenError);
+
+	TTFileHeader header;
+	if (size < TT_FILE_HEADER_SIZE)
+	{
+		unmap_file(mem, size);
+		return Tools::Result(Tools::ResultCode::FileMismatch);
+	}
+	std::memcpy(&header, mem, sizeof(header));
+
+	// 構造が異なる置換表のファイルであるか、ファイルが壊れている。
+	if (std::memcmp(header.magic, TT_FILE_MAGIC, sizeof(header.magic)) != 0
+		|| header.clusterSize != TT_CLUSTER_SIZE || header.hashKeyBits != HASH_KEY_BITS
+		|| header.sizeofCluster != sizeof(Cluster) || (header.clusterCount & 1) != 0
+		|| header.generation8 > GENERATION_MASK
+		|| size != TT_FILE_HEADER_SIZE + header.clusterCount * sizeof(Cluster))
+	{
+		unmap_file(mem, size);
+		return Tools::Result(Tools::ResultCode::FileMismatch);
+	}
+
+	free_table();
+
+	mappedMem    = mem;
+	mappedSize   = size;
+	table        = reinterpret_cast<Cluster*>(static_cast<u8*>(mem) + TT_FILE_HEADER_SIZE);
+	clusterCount = size_t(header.clusterCount);
+	generation8  = header.generation8;
+
+	return Tools::Result::Ok();
+}
+
 // ----------------------------------
 //			UnitTest
 // ----------------------------------
@@ -532,6 +816,24 @@ void TranspositionTable::UnitTest(Test::UnitTester& unittest, IEngine& engine)
 			}
 			unittest.test("write & probe", ok);
 		}
+
+		auto section3 = unittest.section("save() & load()");
+		{
+			const std::string filename = "tt_unittest.bin";
+			bool ok = tt.save(filename).is_ok();
+
+			TranspositionTable tt2;
+			ok &= tt2.load(filename).is_ok();
+			if (ok)
+			{
+				auto [ttHit1, ttData1, ttWriter1] = tt.probe(posKey, pos);
+				auto [ttHit2, ttData2, ttWriter2] = tt2.probe(posKey, pos);
+				ok &= ttHit2 && ttData1.value == ttData2.value && ttData1.move == ttData2.move
+					&& tt.generation() == tt2.generation();
+			}
+			std::remove(Path::Combine(Directory::GetBinaryFolder(), filename).c_str());
+			unittest.test("save & load", ok);
+		}
 	}
 }
 
@@ -7,6 +7,9 @@
 #include "misc.h"
 #include "memory.h"
 #include "thread.h"
+#include "shm.h"
+
+#include <atomic>
 
 namespace YaneuraOu {
 
@@ -106,12 +109,14 @@ typedef uint64_t TTE_KEY_TYPE;
 class TranspositionTable {
 
 public:
-	~TranspositionTable() { aligned_large_pages_free(table); }
+	~TranspositionTable() { free_table(); }
 
 	// Set TT size in MiB
 	// 置換表のサイズを変更する。mbSize == 確保するメモリサイズ。[MiB]単位。
+	// 🌈 shared == trueなら、同じ実行ファイル・同じサイズで確保した他のプロセスと共有する置換表を確保する。
+	//     (共有メモリが使えなければ、通常のメモリにfallbackする)
 
-	void resize(size_t mbSize,ThreadPool& threads);  // Set TT size in MiB
+	void resize(size_t mbSize,ThreadPool& threads, bool shared = false);  // Set TT size in MiB
 
 	// Re-initialize memory, multithreaded
 	// メモリを再初期化、マルチスレッド対応
@@ -186,11 +191,34 @@ public:
 	TTEntry* first_entry(const Key& key, Color side_to_move) const;
 #endif
 
+	// 🌈 やねうら王独自拡張
+	// 置換表の内容をファイルに保存する。
+	// 📝 置換表のClusterの配列をそのまま書き出す。ファイルの先頭にはTTFileHeaderがある。
+	Tools::Result save(const std::string& filename) const;
+
+	// 🌈 やねうら王独自拡張
+	// save()で保存したファイルを置換表として読み込む。
+	// 📝 ファイルはcopy-on-writeでmapされるので、巨大な置換表でもすぐに使い始められる。
+	//     探索中の書き込みはファイルには反映されない。
+	// ⚠ 置換表のサイズはファイルに記録されているサイズになる。
+	//    また、このあと"isready"が来るとclear()されるので、"isready"のあとに読み込むこと。
+	Tools::Result load(const std::string& filename);
+
+	// 🌈 やねうら王独自拡張
+	// NUMAノード間の置換表のアクセスのlatencyを計測して、結果を文字列で返す。
+	// 各NUMAノードのスレッドから、clear()によって各NUMAノードに割り当てられた領域に対して
+	// probes回の依存関係のあるランダムアクセスを行い、1回あたりの時間[ns]を計る。
+	// 📝 USIの"bench"コマンドで limitType == "tt_latency" とした時に呼び出される。
+	std::string numa_latency_bench(ThreadPool& threads, uint64_t probes) const;
+
 	static void UnitTest(Test::UnitTester& unittest, IEngine& engine);
 
 private:
 	friend struct TTEntry;
 
+	// tableを解放する。load()でmapしたものであればunmapする。
+	void free_table();
+
 	// この置換表が保持しているクラスター数。
 	// Stockfishはresize()ごとに毎回新しく置換表を確保するが、やねうら王では
 	// そこは端折りたいので、毎回は確保しない。そのため前回サイズがここに格納されていないと
@@ -203,7 +231,29 @@ private:
 	Cluster* table = nullptr;
 
 	// ⇨ 世代カウンター。new_search()のごとに1ずつ加算する。TTEntry::save()で用いる。
+	// ⚠ 共有メモリ上の置換表を用いている時は、こちらではなくsharedGenerationを用いる。
 	uint8_t generation8 = 0;
+
+	// 共有メモリ上の置換表を用いている時は、共有メモリの先頭に置いた世代カウンター。そうでなければnullptr。
+	// 📝 プロセスごとに世代カウンターを持つと、世代の異なるプロセスが書いたentryの古さを誤って判定して
+	//     まだ新しいentryを置き換えてしまう。そこで、共有している全プロセスで1つの世代カウンターを用いる。
+	//     どのプロセスがnew_search()しても世代が進むので、entryの古さは全プロセスの探索回数で測ることになる。
+	std::atomic<uint8_t>* sharedGeneration = nullptr;
+
+	// 現在の世代。(共有メモリ上の置換表を用いているなら、その世代カウンターの値)
+	uint8_t current_generation() const;
+
+	// resize()で共有メモリ上の置換表が要求されたか。
+	bool sharedRequested = false;
+
+	// 共有メモリ上に置換表を確保している時は、その共有メモリ。
+	// 📝 このときtableはsharedTable.get()を指している。
+	SystemWideSharedBuffer sharedTable;
+
+	// load()でファイルをmapしている時は、mapしたメモリの先頭とそのサイズ。
+	// 📝 tableはmappedMemからヘッダーの分だけ進めたところを指している。
+	void*  mappedMem  = nullptr;
+	size_t mappedSize = 0;
 };
 
 } // namespace YaneuraOu
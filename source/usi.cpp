@@ -1,6 +1,7 @@
 ﻿#include <cstdlib>
 #include <sstream>
 #include <queue>
+#include <iomanip>
 
 #include "types.h"
 #include "usi.h"
@@ -331,6 +332,12 @@ bool USIEngine::usi_cmdexec(const std::string& cmd) {
     else if (token == BenchmarkCommand)
         benchmark(is);
 
+#if !STOCKFISH
+    // Lazy SMPのスレッド数に対するスケーリングの計測
+    else if (token == "bench_scaling")
+        bench_scaling(is);
+#endif
+
     // 現在の局面を視覚的に表示する。
     else if (token == "d")
         sync_cout << engine.visualize() << sync_endl;
@@ -408,6 +415,34 @@ bool USIEngine::usi_cmdexec(const std::string& cmd) {
     else if (token == "qsearch_psv")
         qsearch_psv(is);
 
+    // 置換表をファイルに保存する/ファイルから読み込む。
+    else if (token == "tt_save")
+        tt_save(is);
+    else if (token == "tt_load")
+        tt_load(is);
+
+    // 探索木のGCの状況を出力する。(ふかうら王のみ)
+    else if (token == "gc_stats")
+    {
+        std::string message;
+        engine.gc_stats(message);
+
+        std::istringstream lines(message);
+        for (std::string line; std::getline(lines, line);)
+            sync_cout << "info string " << line << sync_endl;
+    }
+
+    // 直前の探索の統計情報を出力する。(USE_SEARCH_STATSをdefineしてビルドした時のみ)
+    else if (token == "stats")
+    {
+        std::string message;
+        engine.search_stats(message);
+
+        std::istringstream lines(message);
+        for (std::string line; std::getline(lines, line);)
+            sync_cout << "info string " << line << sync_endl;
+    }
+
 #if defined(ENABLE_MAKEBOOK_CMD)
 	// 定跡コマンド
 	else if (token == "makebook")
@@ -666,6 +701,21 @@ void USIEngine::go(std::istringstream& is)
 // "bench"コマンドの応答部。
 void USIEngine::bench(std::istream& args) {
 
+#if !STOCKFISH
+    // 🌈 "bench json ..."なら、結果をJSONで出力する。
+    {
+        const auto  start = args.tellg();
+        std::string sub;
+        if (args >> sub && sub == "json")
+        {
+            bench_json(args);
+            return;
+        }
+        args.clear();
+        args.seekg(start);
+    }
+#endif
+
     std::string token;
     uint64_t    num, nodes = 0, cnt = 1;
     uint64_t    nodesSearched = 0;
@@ -735,6 +785,26 @@ void USIEngine::bench(std::istream& args) {
 
 			elapsed = now();
         }
+#if !STOCKFISH
+		// 置換表のNUMAノード間のlatencyの計測。("bench"の制限の種類に"tt_latency"を指定した時)
+        else if (token == "tt_latency")
+        {
+            uint64_t    probes = 0;
+            std::string message;
+            is >> probes;
+            engine.tt_latency_bench(probes, message);
+            std::cerr << message << std::endl;
+        }
+		// 探索部の計測の開始と終了。("bench"の制限の種類に"mcts"を指定した時)
+        else if (token == "mcts_bench")
+        {
+            std::string sub, message;
+            is >> sub;
+            const bool start = sub == "start";
+            if (!engine.mcts_bench(start, message) || !start)
+                std::cerr << message << std::endl;
+        }
+#endif
     }
 
     elapsed = now() - elapsed + 1;  // Ensure positivity to avoid a 'divide by zero'
@@ -757,6 +827,357 @@ void USIEngine::bench(std::istream& args) {
 #endif
 }
 
+#if !STOCKFISH
+// "bench json"コマンドの応答部。
+// 引数は"bench"と同じで、その後ろに繰り返し回数を指定する。(省略時5回)
+// 例) bench json 1024 1 16 default depth 10
+//
+// 💡 読み筋は出力せずに、結果をまとめてJSONで標準出力に出力する。(進捗は標準エラー出力に出力する)
+//     同じ局面集を繰り返し探索して、NPSなどの平均と95%信頼区間を求めるので、
+//     2つのbinaryの結果を比較すれば、差が計測誤差の範囲内かどうかがわかる。
+//
+// ⚠ "phases_ms"はコマンド単位の計測で、探索前の"ucinewgame"と"position"の処理時間のみ。
+//     探索自体の時間は"time_ms"であり、探索内部の処理ごとの時間は計測していない。
+//     USE_SEARCH_STATSをdefineしてbuildした時は、探索内部の内訳として"search_stats"に
+//     局面ごとのSearchStatsのcounter(qsearchのnode数、evaluate()の呼び出し回数など)を出力する。
+void USIEngine::bench_json(std::istream& args) {
+
+    // USIEngine::isready()を呼び出してやらかないと"engine_options.txt"などの読み込みが行われない。
+    isready();
+
+    std::vector<std::string> list = Benchmark::setup_bench(engine.sfen(), args);
+
+    int repeat;
+    if (!(args >> repeat) || repeat < 1)
+        repeat = 5;
+
+    // 探索以外の計測はJSONにできないので対象外。
+    for (const auto& cmd : list)
+        if (cmd.find("go perft") == 0 || cmd == "eval" || cmd.find("tt_latency") == 0
+            || cmd.find("mcts_bench") == 0)
+        {
+            std::cerr << "Error! : bench json supports depth, nodes and movetime only." << std::endl;
+            return;
+        }
+
+    // 1局面の探索結果
+    struct PositionResult {
+        std::string           sfen;
+        uint64_t              nodes    = 0;
+        TimePoint             searchMs = 0;
+        TimePoint             clearMs  = 0; // 直前の"ucinewgame"(search_clear)に要した時間
+        TimePoint             setupMs  = 0; // "position"コマンドの処理に要した時間
+        int                   depth    = 0;
+        int                   selDepth = 0;
+        int                   hashfull = 0;
+        std::vector<TimePoint> timeToDepth; // [depth - 1]がその深さを最後に出力した時の経過時間[ms]
+#if defined(USE_SEARCH_STATS)
+        SearchStats::Totals   stats;        // この局面の探索中の全スレッドのcounterの合計
+#endif
+    };
+
+    PositionResult current;
+
+    engine.set_on_update_full([&](const Engine::InfoFull& i) {
+        if (i.multiPV != 1)
+            return;
+        current.nodes    = i.nodes;
+        current.depth    = i.depth;
+        current.selDepth = i.selDepth;
+        if (i.depth >= 1)
+        {
+            if (current.timeToDepth.size() < size_t(i.depth))
+                current.timeToDepth.resize(size_t(i.depth), -1);
+            current.timeToDepth[size_t(i.depth) - 1] = TimePoint(i.timeMs);
+        }
+    });
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_bestmove([](const auto&, const auto&) {});
+    engine.set_on_update_string([](const auto&) {});
+
+    std::vector<std::vector<PositionResult>> runs(repeat);
+    std::string                              goCommand;
+
+    const size_t num = count_if(list.begin(), list.end(), [](const std::string& s) { return s.find("go ") == 0; });
+
+    for (int r = 0; r < repeat; ++r)
+    {
+        TimePoint clearMs = 0, setupMs = 0;
+        size_t    cnt     = 1;
+
+        for (const auto& cmd : list)
+        {
+            std::istringstream is(cmd);
+            std::string        token;
+            is >> std::skipws >> token;
+
+            if (token == "go")
+            {
+                std::cerr << "\rRun " << r + 1 << '/' << repeat << " , Position " << cnt++ << '/' << num << std::flush;
+
+                goCommand = cmd;
+                current   = PositionResult();
+                current.sfen    = engine.sfen();
+                current.clearMs = clearMs;
+                current.setupMs = setupMs;
+                clearMs = setupMs = 0;
+
+                Search::LimitsType limits = parse_limits(is);
+                limits.disablePvInterval  = true;
+
+                TimePoint start = now();
+                engine.go(limits);
+                engine.wait_for_search_finished();
+                current.searchMs = now() - start;
+                current.hashfull = engine.get_hashfull();
+#if defined(USE_SEARCH_STATS)
+                // 📝 counterは探索開始時にclearされるので、この局面の探索だけの値になる。
+                current.stats = engine.get_threads().search_stats();
+#endif
+
+                runs[r].push_back(current);
+            }
+            else if (token == "setoption")
+                setoption(is);
+            else if (token == "position")
+            {
+                TimePoint start = now();
+                position(is);
+                setupMs += now() - start;
+            }
+            else if (token == "ucinewgame")
+            {
+                TimePoint start = now();
+                engine.search_clear();
+                clearMs += now() - start;
+            }
+        }
+    }
+    std::cerr << std::endl;
+
+    init_search_update_listeners();
+
+    // --- JSONの出力
+
+    auto json_string = [](const std::string& s) {
+        std::string out = "\"";
+        for (char c : s)
+        {
+            if (c == '\n')
+                out += "\\n";
+            else if (c == '"' || c == '\\')
+                out += std::string("\\") + c;
+            else if (c != '\r')
+                out += c;
+        }
+        return out + "\"";
+    };
+
+    auto json_stats = [](const std::vector<double>& samples) {
+        const auto         st = Benchmark::sample_stats(samples);
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(2) << "{\"n\": " << st.n << ", \"mean\": " << st.mean
+           << ", \"stddev\": " << st.stddev << ", \"ci95\": " << st.ci95 << ", \"min\": " << st.min
+           << ", \"max\": " << st.max << "}";
+        return ss.str();
+    };
+
+    auto nps = [](uint64_t nodes, TimePoint ms) { return 1000 * nodes / uint64_t(std::max<TimePoint>(ms, 1)); };
+
+    std::ostringstream js;
+    std::vector<double> runNps, runTime, runNodes;
+
+    js << "{\n  \"engine\": " << json_string(engine_version_info())
+       << ",\n  \"compiler\": " << json_string(compiler_info())
+       << ",\n  \"go\": " << json_string(goCommand)
+       << ",\n  \"repeat\": " << repeat
+       << ",\n  \"runs\": [";
+
+    for (int r = 0; r < repeat; ++r)
+    {
+        uint64_t  nodes = 0;
+        TimePoint time  = 0;
+
+        js << (r ? "," : "") << "\n    {\"positions\": [";
+        for (size_t i = 0; i < runs[r].size(); ++i)
+        {
+            const auto& p = runs[r][i];
+            nodes += p.nodes;
+            time += p.searchMs;
+
+            js << (i ? "," : "") << "\n      {\"sfen\": " << json_string(p.sfen) << ", \"nodes\": " << p.nodes
+               << ", \"time_ms\": " << p.searchMs << ", \"nps\": " << nps(p.nodes, p.searchMs)
+               << ", \"depth\": " << p.depth << ", \"seldepth\": " << p.selDepth
+               << ", \"hashfull\": " << p.hashfull << ", \"time_to_depth_ms\": [";
+            for (size_t d = 0; d < p.timeToDepth.size(); ++d)
+                js << (d ? ", " : "") << p.timeToDepth[d];
+            js << "], \"phases_ms\": {\"clear\": " << p.clearMs << ", \"position\": " << p.setupMs << "}";
+#if defined(USE_SEARCH_STATS)
+            {
+                using namespace SearchStats;
+                const auto& t = p.stats;
+                js << ", \"search_stats\": {\"search_nodes\": " << t[SearchNodes]
+                   << ", \"qsearch_nodes\": " << t[QSearchNodes] << ", \"tt_probes\": " << t[TTProbe]
+                   << ", \"tt_hits\": " << t[TTHit] << ", \"tt_cutoffs\": " << t[TTCutoff]
+                   << ", \"evaluate_calls\": " << t[EvaluateCall]
+                   << ", \"accumulator_refreshes\": " << t[AccumulatorRefresh]
+                   << ", \"mate1ply_calls\": " << t[Mate1plyCall] << "}";
+            }
+#endif
+            js << "}";
+        }
+        js << "],\n     \"nodes\": " << nodes << ", \"time_ms\": " << time << ", \"nps\": " << nps(nodes, time)
+           << "}";
+
+        runNps.push_back(double(nps(nodes, time)));
+        runTime.push_back(double(time));
+        runNodes.push_back(double(nodes));
+    }
+
+    js << "\n  ],\n  \"summary\": {\n    \"nps\": " << json_stats(runNps)
+       << ",\n    \"time_ms\": " << json_stats(runTime) << ",\n    \"nodes\": " << json_stats(runNodes)
+       << "\n  }\n}";
+
+    sync_cout << js.str() << sync_endl;
+}
+#endif
+
+#if !STOCKFISH
+// "bench_scaling"コマンドの応答部。
+// bench_scaling [maxThreads] [depth] [ttSize]
+//
+// 1,2,4,...,maxThreadsスレッドで、setup_benchmark()と同じ局面を固定深さで探索して、
+// 1スレッドに対する time-to-depthのspeedup、NPSの倍率、探索node数の増加(search overhead)と、
+// 置換表のhit率の増加から見積もった、他のスレッドと重複して探索したnodeの割合を出力する。
+//
+// 📝 重複の見積もり : 置換表は全スレッドで共有しているので、他のスレッドが既に探索したnodeに
+//     到達すると置換表にhitする。そこで、1スレッドの時からのhit率(hit数/node数)の増加分を、
+//     他のスレッドと重複して探索したnodeの割合とみなす。あくまで目安である。
+//     置換表のhit数は、USE_SEARCH_STATSの統計情報(SearchStats::TTHit)から得るので、
+//     USE_SEARCH_STATSを定義していない時は、hit率と重複の割合は"-"と出力する。
+//
+// ⚠ "Threads"と"USI_Hash"は、終了時に元の値に戻す。
+void USIEngine::bench_scaling(std::istream& args) {
+
+    // USIEngine::isready()を呼び出してやらかないと"engine_options.txt"などの読み込みが行われない。
+    isready();
+
+    Benchmark::ScalingSetup setup = Benchmark::setup_scaling(args);
+
+    engine.set_on_update_full([](const auto&) {});
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_bestmove([](const auto&, const auto&) {});
+    engine.set_on_update_string([](const auto&) {});
+
+    // 変更する前の値。終了時に戻す。
+    const int64_t saved_threads = engine.get_options()["Threads"];
+    const int64_t saved_hash    = engine.get_options()["USI_Hash"];
+
+    auto ss = std::istringstream("name USI_Hash value " + std::to_string(setup.ttSize));
+    setoption(ss);
+
+    // 1つのスレッド数での計測結果
+    struct Result {
+        size_t    threads;
+        TimePoint time   = 0;
+        uint64_t  nodes  = 0;
+        uint64_t  ttHits = 0;
+    };
+    std::vector<Result> results;
+
+    const size_t num = count_if(setup.commands.begin(), setup.commands.end(),
+                                [](const std::string& s) { return s.find("go ") == 0; });
+
+    for (size_t threads : setup.threads)
+    {
+        ss = std::istringstream("name Threads value " + std::to_string(threads));
+        setoption(ss);
+
+        Result r;
+        r.threads  = threads;
+        size_t cnt = 1;
+
+        for (const auto& cmd : setup.commands)
+        {
+            std::istringstream is(cmd);
+            std::string        token;
+            is >> std::skipws >> token;
+
+            if (token == "go")
+            {
+                std::cerr << "\rThreads " << threads << " , Position " << cnt++ << '/' << num << std::flush;
+
+                Search::LimitsType limits = parse_limits(is);
+                limits.disablePvInterval  = true;
+
+                TimePoint start = now();
+                engine.go(limits);
+                engine.wait_for_search_finished();
+                r.time += now() - start;
+
+                r.nodes += engine.get_threads().nodes_searched();
+#if defined(USE_SEARCH_STATS)
+                r.ttHits += engine.get_threads().search_stats()[SearchStats::TTHit];
+#endif
+            }
+            else if (token == "position")
+                position(is);
+            else if (token == "ucinewgame")
+                engine.search_clear();
+        }
+        results.push_back(r);
+    }
+    std::cerr << std::endl;
+
+    init_search_update_listeners();
+
+    ss = std::istringstream("name Threads value " + std::to_string(saved_threads));
+    setoption(ss);
+    ss = std::istringstream("name USI_Hash value " + std::to_string(saved_hash));
+    setoption(ss);
+
+    // --- 結果の出力
+
+    const Result& base = results.front();
+    auto          nps  = [](const Result& r) { return 1000.0 * double(r.nodes) / double(std::max<TimePoint>(r.time, 1)); };
+#if defined(USE_SEARCH_STATS)
+    auto          hit_rate = [](const Result& r) { return r.nodes ? double(r.ttHits) / double(r.nodes) : 0.0; };
+#endif
+
+    std::cerr << "==========================="
+              << "\nDepth                      : " << setup.depth
+              << "\nPositions                  : " << num
+              << "\nTT size [MiB]              : " << setup.ttSize
+              << "\n\n"
+              << " Threads  Time[ms]  Speedup  Efficiency         Nodes        NPS  NPS scale  TT hit  Overhead  Duplicated\n";
+
+    for (const auto& r : results)
+    {
+        const double speedup   = double(std::max<TimePoint>(base.time, 1)) / double(std::max<TimePoint>(r.time, 1));
+        const double overhead  = base.nodes ? double(r.nodes) / double(base.nodes) - 1.0 : 0.0;
+
+        std::cerr << std::fixed << std::setprecision(2)                                    //
+                  << std::setw(8) << r.threads << std::setw(10) << r.time                  //
+                  << std::setw(9) << speedup << std::setw(12) << speedup / double(r.threads)  //
+                  << std::setw(14) << r.nodes << std::setw(11) << uint64_t(nps(r))       //
+                  << std::setw(11) << nps(r) / std::max(nps(base), 1.0);
+#if defined(USE_SEARCH_STATS)
+        const double duplicate = std::max(0.0, hit_rate(r) - hit_rate(base));
+        std::cerr << std::setw(7) << 100.0 * hit_rate(r) << '%'                           //
+                  << std::setw(9) << 100.0 * overhead << '%'                              //
+                  << std::setw(11) << 100.0 * duplicate << '%' << '\n';
+#else
+        std::cerr << std::setw(8) << '-'                                                  //
+                  << std::setw(9) << 100.0 * overhead << '%'                              //
+                  << std::setw(12) << '-' << '\n';
+#endif
+    }
+    std::cerr << std::defaultfloat << std::flush;
+}
+#endif
+
 void USIEngine::benchmark(std::istream& args) {
 
 	// Probably not very important for a test this long, but include for completeness and sanity.
@@ -1410,6 +1831,39 @@ void USIEngine::qsearch_psv(std::istringstream& is) {
         sync_cout << "info string qsearch_psv failed" << sync_endl;
 }
 
+// USI拡張コマンド "tt_save" のhandler。
+// "tt_save filename" で置換表の内容をfilenameに保存する。
+void USIEngine::tt_save(std::istringstream& is) {
+    std::string filename;
+    is >> filename;
+
+    std::string message;
+    const bool  ok = engine.tt_save(filename, message);
+
+    if (!message.empty())
+        sync_cout << "info string " << message << sync_endl;
+
+    if (!ok)
+        sync_cout << "info string tt_save failed" << sync_endl;
+}
+
+// USI拡張コマンド "tt_load" のhandler。
+// "tt_load filename" でtt_saveで保存した置換表を読み込む。
+// ⚠ "isready"で置換表はクリアされるので、"isready"のあとに送ること。
+void USIEngine::tt_load(std::istringstream& is) {
+    std::string filename;
+    is >> filename;
+
+    std::string message;
+    const bool  ok = engine.tt_load(filename, message);
+
+    if (!message.empty())
+        sync_cout << "info string " << message << sync_endl;
+
+    if (!ok)
+        sync_cout << "info string tt_load failed" << sync_endl;
+}
+
 // "unittest"コマンドのhandler
 void USIEngine::unittest(std::istringstream& is) { Test::UnitTest(is, engine); }
 
@@ -177,9 +177,13 @@ private:
 	// 🌈 やねうら王独自拡張 🌈
 
 	void isready();
+    void bench_json(std::istream& args);
+    void bench_scaling(std::istream& args);
     void moves();
     void getoption(std::istringstream& is);
     void qsearch_psv(std::istringstream& is);
+    void tt_save(std::istringstream& is);
+    void tt_load(std::istringstream& is);
     void unittest(std::istringstream& is);
 #endif
 